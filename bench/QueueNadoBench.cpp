@@ -0,0 +1,647 @@
+/*
+ * QueueNadoBench, the benchmark suite. Separate from UnitTestRunner so the
+ * numbers are measured, not asserted against a hard coded speed.
+ *
+ * Every combination of the scenario lists given on the command line is run
+ * and written out as JSON, one object per scenario:
+ *
+ *    ./QueueNadoBench --transports=inproc,ipc --patterns=push-pull --sizes=16,4096 \
+ *       --hwms=100,1000 --threads=1,4 --out=results.json
+ *
+ * Latency is taken from a timestamp the sender writes at the front of every
+ * message. It is one way for push-pull, pub-sub and kraken, and the round
+ * trip for req-rep and dealer.
+ */
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <czmq.h>
+#include <g3log/logworker.hpp>
+#include <g3log/g3log.hpp>
+#include <g3log/std2_make_unique.hpp>
+#include <g3sinks/LogRotate.h>
+
+#include "Alien.h"
+#include "BoomStick.h"
+#include "ContextPool.h"
+#include "Crowbar.h"
+#include "Harpoon.h"
+#include "Headcrab.h"
+#include "Kraken.h"
+#include "LatencyHistogram.h"
+#include "Rifle.h"
+#include "Shotgun.h"
+#include "Vampire.h"
+
+#define QN_STRINGIZE_VALUE(x) #x
+#define QN_STRINGIZE(x) QN_STRINGIZE_VALUE(x)
+#ifdef QUEUENADO_VERSION
+#define QN_VERSION QN_STRINGIZE(QUEUENADO_VERSION)
+#else
+#define QN_VERSION "unknown"
+#endif
+
+namespace {
+   const size_t kStampSize = 16;
+   const int kReceiveTimeoutMs = 100;
+   const int kIdleTimeoutMs = 1000;
+   const size_t kDealerWindow = 100;
+
+   struct Options {
+      std::vector<std::string> transports{"inproc", "ipc", "tcp"};
+      std::vector<std::string> patterns{"push-pull", "pub-sub", "req-rep", "dealer", "kraken"};
+      std::vector<size_t> sizes{16, 1024, 65536};
+      std::vector<int> hwms{1000};
+      std::vector<size_t> threads{1};
+      size_t messages = 100000;
+      size_t roundTrips = 10000;
+      int port = 27000;
+      std::string out;
+   };
+
+   struct Scenario {
+      std::string transport;
+      std::string pattern;
+      size_t size;
+      int hwm;
+      size_t threads;
+      std::string location;
+   };
+
+   struct Result {
+      Result() : expected(0), received(0), seconds(0) {
+      }
+      size_t expected;
+      size_t received;
+      double seconds;
+      LatencyHistogram::Snapshot latency;
+   };
+
+   uint64_t Now() {
+      return LatencyHistogram::Now();
+   }
+
+   /**
+    * A message of size bytes starting with the send time in hex, text only
+    * so it survives the endpoints that pass C strings. A stamp of 0 is a
+    * warm up message.
+    */
+   std::string MakePayload(const size_t size, const uint64_t stamp) {
+      char hex[kStampSize + 1];
+      snprintf(hex, sizeof (hex), "%016llx", static_cast<unsigned long long> (stamp));
+      std::string payload(hex, kStampSize);
+      payload.resize(std::max(size, kStampSize), 'q');
+      return payload;
+   }
+
+   uint64_t ReadStamp(const char* data, const size_t size) {
+      if (size < kStampSize) {
+         return 0;
+      }
+      return strtoull(std::string(data, kStampSize).c_str(), NULL, 16);
+   }
+
+   void RecordLatency(LatencyHistogram& latency, const char* data, const size_t size) {
+      const uint64_t stamp = ReadStamp(data, size);
+      const uint64_t now = Now();
+      if (stamp != 0 && now > stamp) {
+         latency.Record(now - stamp);
+      }
+   }
+
+   /**
+    * Keeps the time the last message of a scenario arrived, from any thread.
+    */
+   class LastArrival {
+   public:
+      LastArrival() : mNs(0) {
+      }
+
+      void Arrived() {
+         const uint64_t now = Now();
+         uint64_t last = mNs.load(std::memory_order_relaxed);
+         while (now > last && !mNs.compare_exchange_weak(last, now, std::memory_order_relaxed)) {
+         }
+      }
+
+      uint64_t Get() const {
+         return mNs.load();
+      }
+
+   private:
+      std::atomic<uint64_t> mNs;
+   };
+
+   void Finish(Result& result, const uint64_t start, const LastArrival& last, const LatencyHistogram& latency) {
+      const uint64_t end = std::max(last.Get(), start);
+      result.seconds = (end - start) / 1e9;
+      result.latency = latency.GetSnapshot();
+   }
+
+   zctx_t* SharedContext(const Scenario& scenario) {
+      return ("inproc" == scenario.transport) ? ContextPool::Instance().GetContext() : NULL;
+   }
+
+   /**
+    * One Rifle pushing to threads Vampires.
+    */
+   Result RunPushPull(const Scenario& scenario, const Options& options) {
+      Result result;
+      result.expected = options.messages;
+      zctx_t* context = SharedContext(scenario);
+      std::unique_ptr<Rifle> rifle(context ? new Rifle(scenario.location, context) : new Rifle(scenario.location));
+      rifle->SetHighWater(scenario.hwm);
+      if (!rifle->Aim()) {
+         LOG(WARNING) << "Could not aim at " << scenario.location;
+         return result;
+      }
+      LatencyHistogram latency;
+      LastArrival last;
+      std::atomic<size_t> received(0);
+      std::atomic<size_t> ready(0);
+      std::atomic<bool> sent(false);
+      std::vector<std::thread> vampires;
+      for (size_t i = 0; i < scenario.threads; ++i) {
+         vampires.emplace_back([&]() {
+            std::unique_ptr<Vampire> vampire(context ? new Vampire(scenario.location, context) : new Vampire(scenario.location));
+            vampire->SetHighWater(scenario.hwm);
+            const bool prepared = vampire->PrepareToBeShot();
+            ready.fetch_add(1);
+            if (!prepared) {
+               return;
+            }
+            std::string wound;
+            auto idleSince = std::chrono::steady_clock::now();
+            while (received.load(std::memory_order_relaxed) < options.messages) {
+               if (vampire->GetShot(wound, kReceiveTimeoutMs)) {
+                  RecordLatency(latency, wound.data(), wound.size());
+                  received.fetch_add(1, std::memory_order_relaxed);
+                  last.Arrived();
+                  idleSince = std::chrono::steady_clock::now();
+               } else if (sent.load() && std::chrono::steady_clock::now() - idleSince > std::chrono::milliseconds(kIdleTimeoutMs)) {
+                  break;
+               }
+            }
+         });
+      }
+      while (ready.load() < scenario.threads) {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      // let every Vampire connect, or PUSH sends them all to the first one
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      const uint64_t start = Now();
+      for (size_t i = 0; i < options.messages; ++i) {
+         if (!rifle->Fire(MakePayload(scenario.size, Now()))) {
+            LOG(WARNING) << "Fire timed out after " << i << " messages";
+            break;
+         }
+      }
+      sent.store(true);
+      for (auto& vampire : vampires) {
+         vampire.join();
+      }
+      result.received = received.load();
+      Finish(result, start, last, latency);
+      return result;
+   }
+
+   /**
+    * One Shotgun publishing to threads Aliens, every Alien should get every
+    * message. Slow Aliens lose messages at the Shotgun's high water mark.
+    */
+   Result RunPubSub(const Scenario& scenario, const Options& options) {
+      Result result;
+      result.expected = options.messages * scenario.threads;
+      zctx_t* context = SharedContext(scenario);
+      std::unique_ptr<Shotgun> shotgun(context ? new Shotgun(context) : new Shotgun());
+      shotgun->Aim(scenario.location);
+      LatencyHistogram latency;
+      LastArrival last;
+      std::atomic<size_t> received(0);
+      std::atomic<size_t> ready(0);
+      std::atomic<bool> sent(false);
+      std::vector<std::thread> aliens;
+      for (size_t i = 0; i < scenario.threads; ++i) {
+         aliens.emplace_back([&]() {
+            std::unique_ptr<Alien> alien(context ? new Alien(context) : new Alien());
+            alien->PrepareToBeShot(scenario.location);
+            std::vector<std::string> bullets;
+            bool warm = false;
+            size_t mine = 0;
+            auto idleSince = std::chrono::steady_clock::now();
+            while (mine < options.messages) {
+               alien->GetShot(kReceiveTimeoutMs, bullets);
+               if (bullets.empty()) {
+                  if (sent.load() && std::chrono::steady_clock::now() - idleSince > std::chrono::milliseconds(kIdleTimeoutMs)) {
+                     break;
+                  }
+                  continue;
+               }
+               idleSince = std::chrono::steady_clock::now();
+               const std::string& bullet = bullets.back();
+               if (0 == ReadStamp(bullet.data(), bullet.size())) {
+                  if (!warm) {
+                     warm = true;
+                     ready.fetch_add(1);
+                  }
+                  continue;
+               }
+               RecordLatency(latency, bullet.data(), bullet.size());
+               received.fetch_add(1, std::memory_order_relaxed);
+               last.Arrived();
+               ++mine;
+            }
+            if (!warm) {
+               ready.fetch_add(1);
+            }
+         });
+      }
+      // subscriptions take a moment to reach the publisher
+      const std::string warmUp = MakePayload(scenario.size, 0);
+      while (ready.load() < scenario.threads) {
+         shotgun->Fire(warmUp);
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      const uint64_t start = Now();
+      for (size_t i = 0; i < options.messages; ++i) {
+         shotgun->Fire(MakePayload(scenario.size, Now()));
+      }
+      sent.store(true);
+      for (auto& alien : aliens) {
+         alien.join();
+      }
+      result.received = received.load();
+      Finish(result, start, last, latency);
+      return result;
+   }
+
+   /**
+    * threads Crowbars swinging at one Headcrab that sends every hit back.
+    */
+   Result RunReqRep(const Scenario& scenario, const Options& options) {
+      Result result;
+      const size_t perClient = options.roundTrips / scenario.threads;
+      result.expected = perClient * scenario.threads;
+      zctx_t* context = SharedContext(scenario);
+      std::unique_ptr<Headcrab> headcrab(context ? new Headcrab(scenario.location, context) : new Headcrab(scenario.location));
+      // Crowbars join the Headcrab's context
+      if (!headcrab->ComeToLife()) {
+         LOG(WARNING) << "Headcrab could not bind " << scenario.location;
+         return result;
+      }
+      std::atomic<bool> done(false);
+      std::thread server([&]() {
+         std::string hit;
+         while (!done.load()) {
+            if (headcrab->GetHitWait(hit, kReceiveTimeoutMs)) {
+               headcrab->SendSplatter(hit);
+            }
+         }
+      });
+      LatencyHistogram latency;
+      LastArrival last;
+      std::atomic<size_t> received(0);
+      const uint64_t start = Now();
+      std::vector<std::thread> clients;
+      for (size_t i = 0; i < scenario.threads; ++i) {
+         clients.emplace_back([&]() {
+            Crowbar crowbar(*headcrab);
+            if (!crowbar.Wield()) {
+               return;
+            }
+            std::string splat;
+            for (size_t n = 0; n < perClient; ++n) {
+               const std::string hit = MakePayload(scenario.size, Now());
+               // a REQ socket that lost its reply can't be used again
+               if (!crowbar.Swing(hit) || !crowbar.WaitForKill(splat, kIdleTimeoutMs)) {
+                  break;
+               }
+               RecordLatency(latency, splat.data(), splat.size());
+               received.fetch_add(1, std::memory_order_relaxed);
+               last.Arrived();
+            }
+         });
+      }
+      for (auto& client : clients) {
+         client.join();
+      }
+      done.store(true);
+      server.join();
+      result.received = received.load();
+      Finish(result, start, last, latency);
+      return result;
+   }
+
+   /**
+    * threads BoomSticks, each keeping up to kDealerWindow requests in flight
+    * to a ROUTER that sends every request back.
+    */
+   Result RunDealer(const Scenario& scenario, const Options& options) {
+      Result result;
+      const size_t perClient = options.roundTrips / scenario.threads;
+      result.expected = perClient * scenario.threads;
+      zctx_t* context = SharedContext(scenario);
+      zctx_t* serverContext = context ? zctx_shadow(context) : zctx_new();
+      void* router = zsocket_new(serverContext, ZMQ_ROUTER);
+      zsocket_set_sndhwm(router, scenario.hwm);
+      zsocket_set_rcvhwm(router, scenario.hwm);
+      if (zsocket_bind(router, scenario.location.c_str()) < 0) {
+         LOG(WARNING) << "Router could not bind " << scenario.location;
+         zctx_destroy(&serverContext);
+         return result;
+      }
+      std::atomic<bool> done(false);
+      std::thread server([&]() {
+         while (!done.load()) {
+            if (zsocket_poll(router, kReceiveTimeoutMs)) {
+               zmsg_t* message = zmsg_recv(router);
+               if (message) {
+                  zmsg_send(&message, router);
+               }
+            }
+         }
+      });
+      LatencyHistogram latency;
+      LastArrival last;
+      std::atomic<size_t> received(0);
+      const uint64_t start = Now();
+      std::vector<std::thread> clients;
+      for (size_t i = 0; i < scenario.threads; ++i) {
+         clients.emplace_back([&]() {
+            std::unique_ptr<BoomStick> stick(context ? new BoomStick(scenario.location, context) : new BoomStick(scenario.location));
+            stick->SetSendHWM(scenario.hwm);
+            stick->SetRecvHWM(scenario.hwm);
+            if (!stick->Initialize()) {
+               return;
+            }
+            std::vector<std::string> uuids;
+            std::string reply;
+            size_t sent = 0;
+            while (sent < perClient) {
+               uuids.clear();
+               while (uuids.size() < kDealerWindow && sent < perClient) {
+                  uuids.push_back(stick->GetUuid());
+                  if (!stick->SendAsync(uuids.back(), MakePayload(scenario.size, Now()))) {
+                     uuids.pop_back();
+                     break;
+                  }
+                  ++sent;
+               }
+               if (uuids.empty()) {
+                  return;
+               }
+               for (const auto& uuid : uuids) {
+                  if (stick->GetAsyncReply(uuid, kIdleTimeoutMs, reply)) {
+                     RecordLatency(latency, reply.data(), reply.size());
+                     received.fetch_add(1, std::memory_order_relaxed);
+                     last.Arrived();
+                  }
+               }
+            }
+         });
+      }
+      for (auto& client : clients) {
+         client.join();
+      }
+      done.store(true);
+      server.join();
+      zctx_destroy(&serverContext);
+      result.received = received.load();
+      Finish(result, start, last, latency);
+      return result;
+   }
+
+   /**
+    * A Kraken streaming chunks to a Harpoon, one chunk per request.
+    */
+   Result RunKraken(const Scenario& scenario, const Options& options) {
+      Result result;
+      result.expected = options.roundTrips;
+      zctx_t* context = SharedContext(scenario);
+      Kraken kraken(context);
+      kraken.MaxWaitInMs(kIdleTimeoutMs);
+      if (Kraken::Spear::IMPALED != kraken.SetLocation(scenario.location)) {
+         LOG(WARNING) << "Kraken could not bind " << scenario.location;
+         return result;
+      }
+      LatencyHistogram latency;
+      LastArrival last;
+      std::atomic<size_t> received(0);
+      std::thread harpooner([&]() {
+         Harpoon harpoon(context);
+         harpoon.MaxWaitInMs(kIdleTimeoutMs);
+         if (Harpoon::Spear::IMPALED != harpoon.Aim(scenario.location)) {
+            return;
+         }
+         std::vector<uint8_t> chunk;
+         while (Harpoon::Battling::CONTINUE == harpoon.Heave(chunk)) {
+            RecordLatency(latency, reinterpret_cast<const char*> (chunk.data()), chunk.size());
+            received.fetch_add(1, std::memory_order_relaxed);
+            last.Arrived();
+         }
+      });
+      const uint64_t start = Now();
+      for (size_t i = 0; i < options.roundTrips; ++i) {
+         const std::string payload = MakePayload(scenario.size, Now());
+         if (Kraken::Battling::CONTINUE != kraken.SendTidalWave(Kraken::Chunks(payload.begin(), payload.end()))) {
+            break;
+         }
+      }
+      kraken.FinalBreach();
+      harpooner.join();
+      result.received = received.load();
+      Finish(result, start, last, latency);
+      return result;
+   }
+
+   std::string Location(const std::string& transport, const int port, const size_t index) {
+      if ("inproc" == transport) {
+         return "inproc://QueueNadoBench" + std::to_string(index);
+      } else if ("ipc" == transport) {
+         return "ipc:///tmp/QueueNadoBench" + std::to_string(getpid()) + "_" + std::to_string(index) + ".ipc";
+      }
+      return "tcp://127.0.0.1:" + std::to_string(port + index);
+   }
+
+   std::string ToJson(const Scenario& scenario, const Result& result) {
+      const double seconds = std::max(result.seconds, 1e-9);
+      const double rate = result.received / seconds;
+      std::ostringstream json;
+      json << "{\"transport\": \"" << scenario.transport << "\""
+              << ", \"pattern\": \"" << scenario.pattern << "\""
+              << ", \"size\": " << scenario.size
+              << ", \"hwm\": " << scenario.hwm
+              << ", \"threads\": " << scenario.threads
+              << ", \"expected\": " << result.expected
+              << ", \"received\": " << result.received
+              << ", \"seconds\": " << result.seconds
+              << ", \"msgs_per_sec\": " << static_cast<uint64_t> (rate)
+              << ", \"mb_per_sec\": " << rate * std::max(scenario.size, kStampSize) / (1024 * 1024)
+              << ", \"latency_us\": {\"p50\": " << result.latency.Percentile(50) / 1000.0
+              << ", \"p90\": " << result.latency.Percentile(90) / 1000.0
+              << ", \"p99\": " << result.latency.Percentile(99) / 1000.0
+              << ", \"p99.9\": " << result.latency.Percentile(99.9) / 1000.0
+              << ", \"max\": " << result.latency.max / 1000.0
+              << ", \"mean\": " << result.latency.Mean() / 1000.0 << "}}";
+      return json.str();
+   }
+
+   std::vector<std::string> Split(const std::string& list) {
+      std::vector<std::string> items;
+      std::stringstream stream(list);
+      std::string item;
+      while (std::getline(stream, item, ',')) {
+         if (!item.empty()) {
+            items.push_back(item);
+         }
+      }
+      return items;
+   }
+
+   template <typename Number>
+   std::vector<Number> SplitNumbers(const std::string& list) {
+      std::vector<Number> numbers;
+      for (const auto& item : Split(list)) {
+         numbers.push_back(static_cast<Number> (std::stoll(item)));
+      }
+      return numbers;
+   }
+
+   void Usage() {
+      std::cerr << "QueueNadoBench [options]\n"
+              << "  --transports=inproc,ipc,tcp\n"
+              << "  --patterns=push-pull,pub-sub,req-rep,dealer,kraken\n"
+              << "  --sizes=16,1024,65536      message sizes in bytes, at least 16\n"
+              << "  --hwms=1000                high water marks, for push-pull and dealer\n"
+              << "  --threads=1                receivers for push-pull and pub-sub, clients for req-rep and dealer\n"
+              << "  --messages=100000          messages for push-pull and pub-sub\n"
+              << "  --roundtrips=10000         requests for req-rep and dealer, chunks for kraken\n"
+              << "  --port=27000               first tcp port\n"
+              << "  --out=results.json         default is stdout\n";
+   }
+
+   bool Parse(int argc, char* argv[], Options& options) {
+      for (int i = 1; i < argc; ++i) {
+         const std::string argument(argv[i]);
+         const size_t equals = argument.find('=');
+         if (0 != argument.compare(0, 2, "--") || std::string::npos == equals) {
+            return false;
+         }
+         const std::string key = argument.substr(2, equals - 2);
+         const std::string value = argument.substr(equals + 1);
+         if ("transports" == key) {
+            options.transports = Split(value);
+         } else if ("patterns" == key) {
+            options.patterns = Split(value);
+         } else if ("sizes" == key) {
+            options.sizes = SplitNumbers<size_t>(value);
+         } else if ("hwms" == key) {
+            options.hwms = SplitNumbers<int>(value);
+         } else if ("threads" == key) {
+            options.threads = SplitNumbers<size_t>(value);
+         } else if ("messages" == key) {
+            options.messages = std::stoull(value);
+         } else if ("roundtrips" == key) {
+            options.roundTrips = std::stoull(value);
+         } else if ("port" == key) {
+            options.port = std::stoi(value);
+         } else if ("out" == key) {
+            options.out = value;
+         } else {
+            return false;
+         }
+      }
+      return !options.hwms.empty() && !options.threads.empty();
+   }
+}
+
+int main(int argc, char* argv[]) {
+   Options options;
+   try {
+      if (!Parse(argc, argv, options)) {
+         Usage();
+         return 1;
+      }
+   } catch (const std::exception&) {
+      Usage();
+      return 1;
+   }
+   auto logger = g3::LogWorker::createLogWorker();
+   logger->addSink(std2::make_unique<LogRotate>("QueueNadoBench", "/tmp/"), &LogRotate::save);
+   g3::initializeLogging(logger.get());
+
+   const std::map<std::string, std::function<Result(const Scenario&, const Options&)>> runners = {
+      {"push-pull", RunPushPull},
+      {"pub-sub", RunPubSub},
+      {"req-rep", RunReqRep},
+      {"dealer", RunDealer},
+      {"kraken", RunKraken}
+   };
+   // the high water mark can only be set on these
+   const std::vector<std::string> hwmPatterns = {"push-pull", "dealer"};
+
+   std::vector<std::string> results;
+   size_t index = 0;
+   for (const auto& transport : options.transports) {
+      for (const auto& pattern : options.patterns) {
+         auto runner = runners.find(pattern);
+         if (runners.end() == runner) {
+            std::cerr << "Unknown pattern " << pattern << std::endl;
+            return 1;
+         }
+         const bool sweepHwm = (hwmPatterns.end() != std::find(hwmPatterns.begin(), hwmPatterns.end(), pattern));
+         const std::vector<int> hwms = sweepHwm ? options.hwms : std::vector<int>{0};
+         const std::vector<size_t> threads = ("kraken" == pattern) ? std::vector<size_t>{1} : options.threads;
+         for (const size_t size : options.sizes) {
+            for (const int hwm : hwms) {
+               for (const size_t count : threads) {
+                  Scenario scenario{transport, pattern, std::max(size, kStampSize), hwm, std::max(count, size_t(1)),
+                     Location(transport, options.port, index++)};
+                  std::cerr << transport << " " << pattern << " size " << scenario.size << " hwm " << hwm
+                          << " threads " << scenario.threads << std::flush;
+                  Result result;
+                  try {
+                     result = runner->second(scenario, options);
+                  } catch (const std::string& error) {
+                     // Shotgun and Alien throw when they can't bind or connect
+                     LOG(WARNING) << scenario.location << ": " << error;
+                  }
+                  std::cerr << ": " << result.received << "/" << result.expected << " in "
+                          << result.seconds << "s" << std::endl;
+                  results.push_back(ToJson(scenario, result));
+               }
+            }
+         }
+      }
+   }
+
+   std::ostringstream json;
+   json << "{\"version\": \"" << QN_VERSION << "\", \"results\": [\n";
+   for (size_t i = 0; i < results.size(); ++i) {
+      json << "  " << results[i] << ((i + 1 < results.size()) ? ",\n" : "\n");
+   }
+   json << "]}\n";
+   if (options.out.empty()) {
+      std::cout << json.str();
+   } else {
+      std::ofstream file(options.out);
+      file << json.str();
+      if (!file) {
+         std::cerr << "Could not write " << options.out << std::endl;
+         return 1;
+      }
+   }
+   return 0;
+}
@@ -8,13 +8,25 @@
 /**
  * Alien is a ZeroMQ Sub socket.
  */
-Alien::Alien() {
+Alien::Alien() : mStats("Alien", EndpointStats::Role::Subscriber) {
    mCtx = zctx_new();
    CHECK(mCtx);
    mBody = zsocket_new(mCtx, ZMQ_SUB);
    CHECK(mBody);
 }
 
+/**
+ * Alien on a shared context, see ContextPool.
+ * @param context
+ *   A working context, it is shadowed and never destroyed by the Alien
+ */
+Alien::Alien(zctx_t* context) : mStats("Alien", EndpointStats::Role::Subscriber) {
+   mCtx = zctx_shadow(context);
+   CHECK(mCtx);
+   mBody = zsocket_new(mCtx, ZMQ_SUB);
+   CHECK(mBody);
+}
+
 /**
  * Setup the location to receive messages.
  * @param location
@@ -31,6 +43,7 @@ void Alien::PrepareToBeShot(const std::string& location) {
       LOG(WARNING) << "connect socket rc == " << rc;
       throw std::string("Failed to connect to socket");
    }
+   mStats.SetLocation(location);
 }
 
 /**
@@ -60,36 +73,80 @@ void Alien::GetShot(const unsigned int timeout, std::vector<std::string>& bullet
       return;
    }
 
+   LatencyTimer wait(mLatency ? &mLatency->receiveWait : NULL);
    if (zsocket_poll(mBody, timeout)) {
       zmsg_t* msg = zmsg_recv(mBody);
+      if (msg && zmsg_size(msg) >= 3) {
+         // a Shotgun with stats on ends the message with a timestamp frame
+         zframe_t* last = zmsg_last(msg);
+         uint64_t sent = 0;
+         if (LatencyStats::ReadStamp(zframe_data(last), zframe_size(last), sent)) {
+            if (mLatency) {
+               mLatency->RecordStamp(zframe_data(last), zframe_size(last));
+            }
+            zmsg_remove(msg, last);
+            zframe_destroy(&last);
+         }
+      }
       if (msg && zmsg_size(msg) >= 2) {
+         wait.Stop();
          zframe_t* data = zmsg_pop(msg);
          if (data) {
             //remove the first frame
             zframe_destroy(&data);
          }
          int msgSize = zmsg_size(msg);
+         size_t bytes = 0;
          for (int i = 0; i < msgSize; i++) {
             data = zmsg_pop(msg);
             if (data) {
                std::string bullet;
                bullet.assign(reinterpret_cast<char*> (zframe_data(data)), zframe_size(data));
                bullets.push_back(bullet);
+               bytes += bullet.size();
                zframe_destroy(&data);
             }
          }
+         mStats.Received(bytes);
       } else {
          if (msg) {
             LOG(WARNING) << "Got Invalid bullet of size: " << zmsg_size(msg);
+            mStats.Malformed();
          }
       }
       if (msg) {
          zmsg_destroy(&msg);
       }
+   } else {
+      mStats.ReceiveTimeout();
    }
 
 }
 
+/**
+ * Record how long GetShot waits for a message, and the end to end latency
+ * of messages from Shotguns that stamp them.
+ */
+void Alien::EnableLatencyStats() {
+   if (!mLatency) {
+      mLatency.reset(new LatencyStats);
+   }
+}
+
+/**
+ * @return the latency stats, NULL unless they were enabled
+ */
+const LatencyStats* Alien::GetLatencyStats() const {
+   return mLatency.get();
+}
+
+/**
+ * @return what was received and how often GetShot timed out
+ */
+EndpointStats::Counters Alien::Stats() const {
+   return mStats.Get();
+}
+
 /**
  * Destroy the body and context of the alien.
  */
@@ -4,17 +4,26 @@
 #include <stdlib.h>
 #include <vector>
 #include <string>
+#include <memory>
+#include "LatencyHistogram.h"
+#include "EndpointStats.h"
 struct _zctx_t;
 typedef struct _zctx_t zctx_t;
 class Alien {
 public:
    Alien();
+   explicit Alien(zctx_t* context);
    void PrepareToBeShot(const std::string& location);
    std::vector<std::string> GetShot();
    void GetShot(const unsigned int timeout, std::vector<std::string>& bullets);
+   void EnableLatencyStats();
+   const LatencyStats* GetLatencyStats() const;
+   EndpointStats::Counters Stats() const;
    virtual ~Alien();
     
 private:
    void *mBody;
    zctx_t *mCtx;
+   std::unique_ptr<LatencyStats> mLatency;
+   EndpointStats mStats;
 };
\ No newline at end of file
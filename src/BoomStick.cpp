@@ -15,15 +15,16 @@
 #include "QueueNadoMacros.h"
 #include "BoomStick.h"
 namespace {
+   // how long the future from SendAsync waits, like Send
+   const unsigned int kFutureWaitMs = 30000;
 
-   void ShrinkToFit(std::map<std::string, std::string>& map) {
-      std::map<std::string, std::string>(map).swap(map);
-   }
-
-   void ShrinkToFit(std::map<std::string, time_t>& map) {
-      std::map<std::string, time_t>(map).swap(map);
-   }
-
+   struct Outcome {
+      Outcome() : done(false), success(false) {
+      }
+      bool done;
+      bool success;
+      std::string reply;
+   };
 }
 
 /**
@@ -32,10 +33,23 @@ namespace {
  *   The binding is stored, but Initialize must be used to connect to it.
  */
 BoomStick::BoomStick(const std::string& binding) : mLastGCTime(time(NULL)),
-mBinding(binding), mChamber(nullptr), mCtx(nullptr), mRan(), m_uuidGen(mRan),
+mBinding(binding), mChamber(nullptr), mCtx(nullptr), mSharedCtx(nullptr), mRan(), m_uuidGen(mRan),
 mSendHWM(1000), mRecvHWM(1000), mPendingAlertSize(500), mUnreadAlertSize(500),
-mUnreadAlert(false), mPendingAlert(false), mUtilizedThread(0) {
+mUnreadAlert(false), mPendingAlert(false), mUtilizedThread(0), mCompactIds(false), mIdSalt(0), mIdCount(0),
+mWindow(0), mWindowWaitMs(0), mStats("BoomStick", EndpointStats::Role::Requester) {
+   mStats.SetLocation(binding);
    mRan.seed(boost::uuids::detail::seed_rng()());
+   mIdSalt = (static_cast<uint64_t> (mRan()) << 32) | mRan();
+}
+
+/**
+ * Construct with a ZMQ socket binding on a shared context, see ContextPool
+ * @param binding
+ * @param context
+ *   A working context, it is shadowed and never destroyed by the BoomStick
+ */
+BoomStick::BoomStick(const std::string& binding, zctx_t* context) : BoomStick(binding) {
+   mSharedCtx = context;
 }
 
 /**
@@ -43,19 +57,24 @@ mUnreadAlert(false), mPendingAlert(false), mUtilizedThread(0) {
  *   This destroys the context and any associated sockets
  */
 BoomStick::~BoomStick() {
+   if (mSelf) {
+      *mSelf = nullptr;
+   }
    if (mCtx != nullptr) {
       zctx_destroy(&mCtx);
    }
-   if (!mPendingReplies.empty()) {
-      LOG(WARNING) << "Pending replies never emptied " << mPendingReplies.size();
-      for (auto reply : mPendingReplies) {
-         LOG(WARNING) << reply.first;
-      }
-   }
-   if (!mUnreadReplies.empty()) {
-      LOG(WARNING) << "mUnreadReplies replies never emptied " << mUnreadReplies.size();
-      for (auto reply : mUnreadReplies) {
-         LOG(WARNING) << reply.first;
+   if (!mRequests.empty()) {
+      LOG(WARNING) << "Pending replies never emptied " << mRequests.size()
+              << ", unread replies " << mRequests.replies();
+      mRequests.ForEach([](const RequestId& id, bool hasReply) {
+         LOG(WARNING) << id.ToString() << (hasReply ? " unread" : "");
+      });
+      // everything is due this far ahead
+      std::vector<ReplyCallback> waiting;
+      size_t unread = 0;
+      mRequests.Expire(std::time(NULL) + 5 * MINUTES_TO_SECONDS + 1, unread, &waiting);
+      for (auto& onReply : waiting) {
+         onReply(false, "BoomStick destroyed");
       }
    }
 }
@@ -77,6 +96,7 @@ void BoomStick::Swap(BoomStick& other) {
    mBinding = other.mBinding;
    mChamber = other.mChamber;
    mCtx = other.mCtx;
+   mSharedCtx = other.mSharedCtx;
    mLastGCTime = other.mLastGCTime;
    mRan = other.mRan;
    m_uuidGen = other.m_uuidGen;
@@ -87,6 +107,22 @@ void BoomStick::Swap(BoomStick& other) {
    mUnreadAlert = other.mUnreadAlert;
    mPendingAlert = other.mPendingAlert;
    mUtilizedThread = other.mUtilizedThread;
+   mCompactIds = other.mCompactIds;
+   mIdSalt = other.mIdSalt;
+   mIdCount = other.mIdCount;
+   mWindow = other.mWindow;
+   mWindowWaitMs = other.mWindowWaitMs;
+   mLatency.swap(other.mLatency);
+   // futures follow the socket they are waiting on
+   mSelf.swap(other.mSelf);
+   if (mSelf) {
+      *mSelf = this;
+   }
+   if (other.mSelf) {
+      *other.mSelf = &other;
+   }
+   mRequests.swap(other.mRequests);
+   mStats.Swap(other.mStats);
    
    //   other.mBinding.clear();  Allow it to be initialized again
    other.mPendingAlertSize = 0;
@@ -114,12 +150,43 @@ void BoomStick::SetRecvHWM(const int hwm) {
    mRecvHWM = hwm;
 }
 
+/**
+ * Limit how many requests can wait on a reply at once. A request takes a
+ * credit from the window when it is sent and gives it back when its reply
+ * is read off the socket, even if the reply then waits in the cache. With
+ * the window full a send either fails at once, WindowFull tells why, or
+ * reads replies off the socket till one frees a credit.
+ * @param requests
+ *   The window size, 0 for no limit
+ * @param msToWait
+ *   How long a send waits for a credit, 0 fails at once
+ */
+void BoomStick::SetWindow(const size_t requests, const unsigned int msToWait) {
+   mWindow = requests;
+   mWindowWaitMs = msToWait;
+   mStats.SetWindow(requests);
+}
+
+/**
+ * @return how many requests were sent and have no reply yet
+ */
+size_t BoomStick::InFlight() const {
+   return mRequests.size() - mRequests.replies();
+}
+
+/**
+ * @return true when the window has no credit for another send
+ */
+bool BoomStick::WindowFull() const {
+   return mWindow > 0 && InFlight() >= mWindow;
+}
+
 /**
  * Move constructor
  * @param other
  *   A BoomStick that is presumably setup already
  */
-BoomStick::BoomStick(BoomStick&& other) {
+BoomStick::BoomStick(BoomStick&& other) : mStats("BoomStick", EndpointStats::Role::Requester) {
    Swap(other);
 }
 
@@ -141,11 +208,14 @@ BoomStick& BoomStick::operator=(BoomStick&& other) {
 }
 
 /**
- * Get a brand new ZMQ context
+ * Get a brand new ZMQ context, a shadow of the shared context if there is one
  * @return 
  *   A pointer to the context
  */
 zctx_t* BoomStick::GetNewContext() {
+   if (nullptr != mSharedCtx) {
+      return zctx_shadow(mSharedCtx);
+   }
    zctx_t* context = zctx_new();
    return context;
 }
@@ -173,6 +243,26 @@ std::string BoomStick::GetUuid() {
    return ss.str();
 }
 
+/**
+ * An id for SendAsync that needs no formatting, this BoomStick's random
+ * salt and a count of the ids it has handed out.
+ * @return
+ */
+RequestId BoomStick::NextRequestId() {
+   return RequestId(mIdSalt, ++mIdCount);
+}
+
+/**
+ * In compact mode every id goes out as a raw 16 byte frame, string ids
+ * included, and Send uses NextRequestId instead of formatting a uuid. The
+ * peer must echo the id frame as it is, which a ROUTER does. Set it before
+ * sending, replies to requests sent in the other mode are not matched.
+ * @param compact
+ */
+void BoomStick::SetCompactIds(const bool compact) {
+   mCompactIds = compact;
+}
+
 /**
  * Connect the given socket to the given binding
  * @param socket
@@ -203,6 +293,7 @@ void BoomStick::SetBinding(const std::string& binding) {
       mChamber = nullptr;
    }
    mBinding = binding;
+   mStats.SetLocation(binding);
 }
 
 /**
@@ -243,7 +334,7 @@ bool BoomStick::Initialize() {
  * @return 
  */
 bool BoomStick::FindPendingUuid(const std::string& uuid) const {
-   return mPendingReplies.find(uuid) != mPendingReplies.end();
+   return mRequests.Contains(RequestId::FromString(uuid));
 }
 
 /**
@@ -252,7 +343,7 @@ bool BoomStick::FindPendingUuid(const std::string& uuid) const {
  * @return 
  */
 bool BoomStick::FindUnreadUuid(const std::string& uuid) const {
-   return mUnreadReplies.find(uuid) != mUnreadReplies.end();
+   return mRequests.HasReply(RequestId::FromString(uuid));
 }
 
 /**
@@ -264,18 +355,27 @@ bool BoomStick::FindUnreadUuid(const std::string& uuid) const {
  *   The reply received
  */
 std::string BoomStick::Send(const std::string& command) {
-   const std::string uuid = GetUuid();
    if (mUtilizedThread == 0) {
       mUtilizedThread = pthread_self();
    } else {
       CHECK(mUtilizedThread == pthread_self());
    }
+   std::string returnString;
+   if (mCompactIds) {
+      const RequestId id = NextRequestId();
+      if (!SendAsync(id, command) || !GetAsyncReply(id, 30000, returnString)) {
+         return
+         {
+         };
+      }
+      return returnString;
+   }
+   const std::string uuid = GetUuid();
    if (!SendAsync(uuid, command)) {
       return
       {
       };
    }
-   std::string returnString;
    if (!GetAsyncReply(uuid, 30000, returnString)) {
       return
       {
@@ -294,6 +394,170 @@ std::string BoomStick::Send(const std::string& command) {
  *   If the send was successful
  */
 bool BoomStick::SendAsync(const std::string& uuid, const std::string& command) {
+   if (mCompactIds) {
+      return SendAsync(RequestId::FromString(uuid), command);
+   }
+   return SendRequest(RequestId::FromString(uuid), uuid.c_str(), uuid.size(), command, ReplyCallback());
+}
+
+/**
+ * Send a message with a binary id, but leave the reply on the socket
+ * @param id
+ *   From NextRequestId, sent as 16 raw bytes in compact mode and in uuid
+ *   format otherwise
+ * @param command
+ *   The string that will be sent
+ * @return 
+ *   If the send was successful
+ */
+bool BoomStick::SendAsync(const RequestId& id, const std::string& command) {
+   return SendRequest(id, command, ReplyCallback());
+}
+
+/**
+ * Send a message, the reply is given to the future. Nothing reads the
+ * socket in the background: the future is deferred, and get() pulls
+ * replies off the socket itself till its own has come, up to 30 seconds
+ * like Send. Call get() on the thread that uses the BoomStick, wait_for
+ * reports the future as deferred. The future follows the BoomStick when it
+ * is moved, and throws if it was destroyed or lost its socket.
+ *
+ * @param command
+ *   The string that will be sent
+ * @return 
+ *   The reply to come, it throws the error text as a std::string on failure
+ */
+std::future<std::string> BoomStick::SendAsyncFuture(const std::string& command) {
+   auto outcome = std::make_shared<Outcome>();
+   const RequestId id = NextRequestId();
+   const bool sent = SendRequest(id, command, [outcome](const bool success, const std::string& reply) {
+      outcome->done = true;
+      outcome->success = success;
+      outcome->reply = reply;
+   });
+   if (!sent) {
+      std::promise<std::string> failed;
+      failed.set_exception(std::make_exception_ptr(std::string(WindowFull() ? "Window full" : "Failed to send")));
+      return failed.get_future();
+   }
+   if (!mSelf) {
+      mSelf = std::make_shared<BoomStick*>(this);
+   }
+   const std::shared_ptr<BoomStick*> self = mSelf;
+   return std::async(std::launch::deferred, [self, id, outcome]() {
+      const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(kFutureWaitMs);
+      while (!outcome->done && !zctx_interrupted) {
+         BoomStick* stick = *self;
+         if (nullptr == stick || nullptr == stick->mChamber) {
+            throw std::string("No socket");
+         }
+         const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+         if (left.count() <= 0) {
+            break;
+         }
+         stick->PollReplies(static_cast<unsigned int> (left.count()));
+      }
+      if (!outcome->done) {
+         if (nullptr != *self) {
+            (*self)->mRequests.Erase(id);
+         }
+         throw std::string("Timed out searching for reply");
+      }
+      if (!outcome->success) {
+         throw outcome->reply;
+      }
+      return outcome->reply;
+   });
+}
+
+/**
+ * Send a message, the reply goes to the callback as soon as it is read off
+ * the socket by PollReplies or by any GetAsyncReply, it never waits in the
+ * unread cache.
+ * 
+ * @param command
+ *   The string that will be sent
+ * @param onReply
+ *   Called once, on the thread that uses the BoomStick, if the send was
+ *   successful. A request that gets no reply fails with the error text
+ *   when it is cleaned up after 5 minutes, or when the BoomStick is destroyed.
+ * @return 
+ *   If the send was successful
+ */
+bool BoomStick::SendAsyncCallback(const std::string& command, const ReplyCallback& onReply) {
+   return SendRequest(NextRequestId(), command, onReply);
+}
+
+/**
+ * Read every reply that is ready and hand the replies to their callbacks
+ * and futures
+ * @param msToWait
+ *   How long to wait for the first reply
+ * @return 
+ *   How many replies were read
+ */
+size_t BoomStick::PollReplies(const unsigned int msToWait) {
+   if (0 == mUtilizedThread) {
+      mUtilizedThread = pthread_self();
+   } else {
+      CHECK(pthread_self() == mUtilizedThread);
+   }
+   if (nullptr == mCtx || nullptr == mChamber) {
+      LOG(WARNING) << "Invalid socket";
+      return 0;
+   }
+   size_t replies = 0;
+   std::string reply;
+   bool pending = CheckForMessagePending(RequestId(), msToWait, reply);
+   while (!zctx_interrupted && pending) {
+      RequestId foundId;
+      if (!ReadFromReadySocket(foundId, reply)) {
+         break;
+      }
+      ++replies;
+      RecordRoundTrip(foundId);
+      DispatchReply(foundId, reply);
+      pending = zsocket_poll(mChamber, 0);
+   }
+   CleanOldPendingData();
+   return replies;
+}
+
+/**
+ * Send with the id framed the way this BoomStick sends ids
+ * @param id
+ *   Sent as 16 raw bytes in compact mode and in uuid format otherwise
+ * @param command
+ * @param onReply
+ *   Empty unless the reply goes to a callback
+ * @return 
+ *   If the send was successful
+ */
+bool BoomStick::SendRequest(const RequestId& id, const std::string& command, ReplyCallback onReply) {
+   if (mCompactIds) {
+      char frame[RequestId::kSize];
+      id.ToBytes(frame);
+      return SendRequest(id, frame, sizeof (frame), command, std::move(onReply));
+   }
+   const std::string uuid = id.ToString();
+   return SendRequest(id, uuid.c_str(), uuid.size(), command, std::move(onReply));
+}
+
+/**
+ * Send the id frame and the command
+ * @param id
+ *   The id the reply will be tracked by
+ * @param idFrame
+ *   The id as it goes out on the socket
+ * @param idSize
+ * @param command
+ * @param onReply
+ *   Empty unless the reply goes to a callback
+ * @return 
+ *   If the send was successful
+ */
+bool BoomStick::SendRequest(const RequestId& id, const void* idFrame, const size_t idSize, const std::string& command,
+        ReplyCallback onReply) {
    if (0 == mUtilizedThread) {
       mUtilizedThread = pthread_self();
    } else {
@@ -303,23 +567,27 @@ bool BoomStick::SendAsync(const std::string& uuid, const std::string& command) {
       return false;
    }
    bool success = true;
-   if (FindPendingUuid(uuid)) {
+   if (mRequests.Contains(id)) {
       return true;
    }
+   if (!WaitForCredit()) {
+      return false;
+   }
    zmsg_t* msg = zmsg_new();
-   if (zmsg_addmem(msg, uuid.c_str(), uuid.size()) < 0) {
+   if (zmsg_addmem(msg, idFrame, idSize) < 0) {
       success = false;
       LOG(WARNING) << "queue error " << zmq_strerror(zmq_errno());
    } else if (zmsg_addmem(msg, command.c_str(), command.size()) < 0) {
       success = false;
       LOG(WARNING) << "queue error " << zmq_strerror(zmq_errno());
    } else {
+      LatencyTimer blocked(mLatency ? &mLatency->sendBlocked : NULL);
       zmq_pollitem_t items[1];
       items[0].socket = mChamber;
       items[0].events = ZMQ_POLLOUT;
       int rc = zmq_poll(items, 1, 0);
       if (0 == rc) {
-         zmq_poll(items,1,100);
+         rc = zmq_poll(items, 1, 100);
       }
       if (rc < 0) {
          success = false;
@@ -328,17 +596,25 @@ bool BoomStick::SendAsync(const std::string& uuid, const std::string& command) {
       } else if (1 == rc) {
          if ((items[0].revents & ZMQ_POLLOUT) != ZMQ_POLLOUT) {
             LOG(WARNING) << "Queue error, cannot send messages the queue is full";
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            mStats.SendTimeout();
             success = false;
          } else if (zmsg_send(&msg, mChamber) == 0) {
             success = true;
-            mPendingReplies[uuid] = std::time(NULL);
+            mStats.Sent(command.size());
+            uint64_t sentNs = 0;
+            if (mLatency) {
+               blocked.Stop();
+               sentNs = LatencyHistogram::Now();
+            }
+            mRequests.Insert(id, std::time(NULL), sentNs, std::move(onReply));
+            mStats.SetInFlight(InFlight());
          } else {
             LOG(WARNING) << "queue error " << zmq_strerror(zmq_errno());
             success = false;
          }
       } else {
          LOG(WARNING) << "Queue error, timeout waiting for queue to be ready";
+         mStats.SendTimeout();
          success = false;
       }
    }
@@ -350,34 +626,45 @@ bool BoomStick::SendAsync(const std::string& uuid, const std::string& command) {
    return success;
 }
 
+/**
+ * Make sure the window has a credit for a send. When it is full, and the
+ * window waits, replies are read off the socket till one frees a credit.
+ * @return
+ *   false if the window stayed full
+ */
+bool BoomStick::WaitForCredit() {
+   if (!WindowFull()) {
+      return true;
+   }
+   mStats.WindowFull();
+   const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(mWindowWaitMs);
+   while (WindowFull() && !zctx_interrupted) {
+      const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      if (left.count() <= 0) {
+         break;
+      }
+      PollReplies(static_cast<unsigned int> (left.count()));
+   }
+   return !WindowFull();
+}
+
 /**
  * Attempt to grab the reply from the previously read messages
  * 
- * @param messageHash
+ * @param id
  * @param reply
  * @return 
  */
-bool BoomStick::GetReplyFromCache(const std::string& messageHash, std::string& reply) {
-   if (mUnreadReplies.find(messageHash) != mUnreadReplies.end()) {
-      reply = mUnreadReplies[messageHash];
-      mUnreadReplies.erase(messageHash);
-      if (mPendingReplies.find(messageHash) != mPendingReplies.end()) {
-         mPendingReplies.erase(messageHash);
-      } else {
-
-         LOG(WARNING) << "Found reply in cache, but it was never pending" << messageHash;
-      }
-      return true;
-   }
-   return false;
+bool BoomStick::GetReplyFromCache(const RequestId& id, std::string& reply) {
+   return mRequests.TakeReply(id, reply);
 }
 
 /**
  * Poll the socket, fail after timeout and log
- * @param messageHash
+ * @param id
  * @return 
  */
-bool BoomStick::CheckForMessagePending(const std::string& messageHash, const unsigned int msToWait, std::string& reply) {
+bool BoomStick::CheckForMessagePending(const RequestId& id, const unsigned int msToWait, std::string& reply) {
    if (0 == mUtilizedThread) {
       mUtilizedThread = pthread_self();
    } else {
@@ -387,20 +674,24 @@ bool BoomStick::CheckForMessagePending(const std::string& messageHash, const uns
       LOG(WARNING) << "Invalid socket";
       return false;
    }
+   LatencyTimer wait(mLatency ? &mLatency->receiveWait : NULL);
    if (!zsocket_poll(mChamber, msToWait)) {
       reply = "socket timed out";
+      mStats.ReceiveTimeout();
       return false;
    }
+   wait.Stop();
    return true;
 }
 
 /**
- * 
+ * Read a reply without copying the id frame into a string, in compact mode
+ * a 16 byte id frame is taken as raw bytes.
  * @param foundId
  * @param foundReply
  * @return 
  */
-bool BoomStick::ReadFromReadySocket(std::string& foundId, std::string& foundReply) {
+bool BoomStick::ReadFromReadySocket(RequestId& foundId, std::string& foundReply) {
    if (0 == mUtilizedThread) {
       mUtilizedThread = pthread_self();
    } else {
@@ -415,16 +706,20 @@ bool BoomStick::ReadFromReadySocket(std::string& foundId, std::string& foundRepl
    if (!msg) {
       foundReply = zmq_strerror(zmq_errno());
    } else if (zmsg_size(msg) == 2) {
-      char* msgChar;
-      msgChar = zmsg_popstr(msg);
-      foundId = msgChar;
-      free(msgChar);
-      msgChar = zmsg_popstr(msg);
-      foundReply = msgChar;
-      free(msgChar);
+      zframe_t* idFrame = zmsg_first(msg);
+      zframe_t* replyFrame = zmsg_next(msg);
+      if (mCompactIds && RequestId::kSize == zframe_size(idFrame)) {
+         foundId = RequestId::FromBytes(zframe_data(idFrame));
+      } else {
+         foundId = RequestId::FromString(std::string(reinterpret_cast<const char*> (zframe_data(idFrame)),
+                 zframe_size(idFrame)));
+      }
+      foundReply.assign(reinterpret_cast<const char*> (zframe_data(replyFrame)), zframe_size(replyFrame));
       success = true;
+      mStats.Received(foundReply.size());
    } else {
       foundReply = "Malformed reply, expecting 2 parts";
+      mStats.Malformed();
    }
 
    if (msg) {
@@ -446,6 +741,21 @@ bool BoomStick::ReadFromReadySocket(std::string& foundId, std::string& foundRepl
  * be in the reply return. 
  */
 bool BoomStick::GetAsyncReply(const std::string& uuid, const unsigned int msToWait, std::string& reply) {
+   return GetAsyncReply(RequestId::FromString(uuid), msToWait, reply);
+}
+
+/**
+ * Pull from the socket till the requested reply is found
+ * 
+ * @param id
+ *   An id of a message that has previously been sent
+ * @param reply
+ *   The reply 
+ * @return 
+ *   if the pull was successful.  Can timeout and return false.  Error info will 
+ * be in the reply return. 
+ */
+bool BoomStick::GetAsyncReply(const RequestId& id, const unsigned int msToWait, std::string& reply) {
    if (0 == mUtilizedThread) {
       mUtilizedThread = pthread_self();
    } else {
@@ -458,9 +768,9 @@ bool BoomStick::GetAsyncReply(const std::string& uuid, const unsigned int msToWa
       return false;
    }
 
-   bool found = GetReplyFromCache(uuid, reply);
+   bool found = GetReplyFromCache(id, reply);
    if (!found) {
-      found = GetReplyFromSocket(uuid, msToWait, reply);
+      found = GetReplyFromSocket(id, msToWait, reply);
    }
    CleanOldPendingData();
 
@@ -470,13 +780,13 @@ bool BoomStick::GetAsyncReply(const std::string& uuid, const unsigned int msToWa
 /**
  * Check the socket for a specific reply, also fill the cache when other replies 
  *   are seen
- * @param messageHash
+ * @param id
  * @param reply
  *   Either the reply, or when an error occurs an error message
  * @return 
  *   If the message was found
  */
-bool BoomStick::GetReplyFromSocket(const std::string& uuid, const unsigned int msToWait, std::string& reply) {
+bool BoomStick::GetReplyFromSocket(const RequestId& id, const unsigned int msToWait, std::string& reply) {
    if (0 == mUtilizedThread) {
       mUtilizedThread = pthread_self();
    } else {
@@ -484,28 +794,43 @@ bool BoomStick::GetReplyFromSocket(const std::string& uuid, const unsigned int m
    }
    bool found = false;
    reply = "Timed out searching for reply";
-   while (!zctx_interrupted && !found && CheckForMessagePending(uuid, msToWait, reply)) {
-      std::string foundId;
+   while (!zctx_interrupted && !found && CheckForMessagePending(id, msToWait, reply)) {
+      RequestId foundId;
       if (!ReadFromReadySocket(foundId, reply)) {
          break;
       }
-      if (uuid == foundId) {
+      RecordRoundTrip(foundId);
+      if (id == foundId) {
          found = true;
-         mPendingReplies.erase(uuid);
+         mRequests.Erase(id);
       } else {
 
-         mUnreadReplies[foundId] = reply;
+         DispatchReply(foundId, reply);
       }
    }
    return found;
 }
 
+/**
+ * Hand a reply to its callback, or keep it for a GetAsyncReply to come
+ * @param id
+ * @param reply
+ */
+void BoomStick::DispatchReply(const RequestId& id, const std::string& reply) {
+   ReplyCallback onReply;
+   if (mRequests.TakeCallback(id, onReply)) {
+      onReply(true, reply);
+   } else if (!mRequests.SetReply(id, reply)) {
+      LOG(WARNING) << "Found unmatched reply to unknown hash " << id.ToString();
+   }
+}
+
 /**
  * Clean up pending sends/replies that are older than 5 minutes 
  */
 void BoomStick::CleanOldPendingData() {
-   const auto unreadSize = mUnreadReplies.size();
-   const auto pendingSize = mPendingReplies.size();
+   const auto unreadSize = mRequests.replies();
+   const auto pendingSize = mRequests.size();
 
    if (!mUnreadAlert && unreadSize >= mUnreadAlertSize) {
       mUnreadAlert = true;
@@ -523,59 +848,65 @@ void BoomStick::CleanOldPendingData() {
       mPendingAlert = false;
       LOG(INFO) << "pending commands has dropped back below our max size " << mPendingAlertSize;
    }
-   CleanUnreadReplies();
    CleanPendingReplies();
+   mStats.SetInFlight(InFlight());
 }
 
 /**
- * Cleanup pending replies that have exceeded our timeout.
+ * Cleanup pending replies that have exceeded our timeout. Runs at most once
+ * a second, the table only walks the requests that came due since the last
+ * run. Replies to uuids that are not pending are never kept, they are
+ * dropped as they are read.
  */
 void BoomStick::CleanPendingReplies() {
    time_t now = time(NULL);
-   if (now < mLastGCTime + 5 * MINUTES_TO_SECONDS) {
+   if (now == mLastGCTime) {
       return;
    }
    mLastGCTime = now;
-   std::vector<std::string> uuidsToRemove;
-   for (auto pendingSend : mPendingReplies) {
-      if (pendingSend.second <= now - 5 * MINUTES_TO_SECONDS) {
-         LOG(DEBUG) << "Removed Pending Reply for " << pendingSend.first;
-         uuidsToRemove.push_back(pendingSend.first);
-      }
+   size_t deleteUnread = 0;
+   std::vector<ReplyCallback> expired;
+   const size_t removed = mRequests.Expire(now, deleteUnread, &expired);
+   for (auto& onReply : expired) {
+      onReply(false, "Timed out waiting for reply");
    }
-   int deleteUnread = 0;
-   for (auto uuid : uuidsToRemove) {
-      mPendingReplies.erase(uuid);
-      if (mUnreadReplies.find(uuid) != mUnreadReplies.end()) {
+   LOG_IF(DEBUG, (removed > 0)) << "Removed " << removed << " pending replies that exceed the 5 minute timeout";
+   LOG_IF(INFO, (deleteUnread > 0)) << "Deleted " << deleteUnread << " unread replies that exceed the 5 minute timeout";
+}
 
-         deleteUnread++;
-         mUnreadReplies.erase(uuid);
-      }
+/**
+ * Record how long sends and waits for replies take, and the round trip of
+ * every uuid from SendAsync until its reply is read off the socket.
+ */
+void BoomStick::EnableLatencyStats() {
+   if (!mLatency) {
+      mLatency.reset(new LatencyStats);
    }
-   LOG_IF(INFO, (deleteUnread > 0)) << "Deleted " << deleteUnread << " unread replies that exceed the 5 minute timeout";
-   ShrinkToFit(mPendingReplies);
-   ShrinkToFit(mUnreadReplies);
+}
 
+/**
+ * @return the latency stats, NULL unless they were enabled
+ */
+const LatencyStats* BoomStick::GetLatencyStats() const {
+   return mLatency.get();
 }
 
 /**
- * Cleanup unread replies that don't exist in pending.
+ * @return what was sent and received, outstanding is the requests without
+ *   a reply yet, including those that were given up on
  */
-void BoomStick::CleanUnreadReplies() {
-   std::vector<std::string> uuidsToRemove;
-   //check all unread replies and remove any that don't exist in pending.
-   for (auto unreadReply : mUnreadReplies) {
-      if (mPendingReplies.find(unreadReply.first) == mPendingReplies.end()) {
-         LOG(WARNING) << "Found unmatched reply to unknown hash " << unreadReply.first;
-         uuidsToRemove.push_back(unreadReply.first);
-      }
-   }
+EndpointStats::Counters BoomStick::Stats() const {
+   return mStats.Get();
+}
 
-   int count = 0;
-   for (auto hash : uuidsToRemove) {
-      count++;
-      mUnreadReplies.erase(hash);
+/**
+ * Record the round trip of a reply that was just read, it is counted when
+ * it comes off the socket even if it waits in the cache to be asked for.
+ * @param id
+ */
+void BoomStick::RecordRoundTrip(const RequestId& id) {
+   uint64_t sentNs = 0;
+   if (mRequests.TakeSentNs(id, sentNs) && mLatency) {
+      mLatency->endToEnd.Record(LatencyHistogram::Now() - sentNs);
    }
-   LOG_IF(INFO, (count > 0)) << "Deleted " << count << " replies that no longer exist in pending";
-
 }
@@ -1,14 +1,19 @@
 #pragma once
 #include <string>
-#include <map>
+#include <future>
+#include <memory>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
+#include "LatencyHistogram.h"
+#include "EndpointStats.h"
+#include "RequestTable.h"
 struct _zctx_t;
 typedef struct _zctx_t zctx_t;
 
 class BoomStick {
 public:
    explicit BoomStick(const std::string& binding);
+   BoomStick(const std::string& binding, zctx_t* context);
    BoomStick(BoomStick&& other);
    virtual ~BoomStick();
 
@@ -17,12 +22,25 @@ public:
    virtual std::string Send(const std::string& command);
    virtual bool SendAsync(const std::string& uuid, const std::string& command);
    virtual bool GetAsyncReply(const std::string& uuid, const unsigned int msToWait, std::string& reply);
+   bool SendAsync(const RequestId& id, const std::string& command);
+   bool GetAsyncReply(const RequestId& id, const unsigned int msToWait, std::string& reply);
+   std::future<std::string> SendAsyncFuture(const std::string& command);
+   bool SendAsyncCallback(const std::string& command, const ReplyCallback& onReply);
+   size_t PollReplies(const unsigned int msToWait);
    std::string GetUuid();
+   RequestId NextRequestId();
+   void SetCompactIds(const bool compact);
    void Swap(BoomStick& other);
    void SetBinding(const std::string& binding);
    void SetSendHWM(const int hwm);
    void SetRecvHWM(const int hwm);
+   void SetWindow(const size_t requests, const unsigned int msToWait = 0);
+   size_t InFlight() const;
+   bool WindowFull() const;
    zctx_t* GetContext();
+   void EnableLatencyStats();
+   const LatencyStats* GetLatencyStats() const;
+   EndpointStats::Counters Stats() const;
 protected:
    virtual zctx_t* GetNewContext();
    virtual void* GetNewSocket(zctx_t* ctx);
@@ -31,19 +49,34 @@ protected:
    bool FindUnreadUuid(const std::string& uuid) const;
    virtual void CleanOldPendingData();
    virtual void CleanPendingReplies();
-   virtual void CleanUnreadReplies();
-   virtual bool GetReplyFromSocket(const std::string& uuid, const unsigned int msToWait, std::string& reply);
-   virtual bool GetReplyFromCache(const std::string& uuid, std::string& reply);
-   virtual bool CheckForMessagePending(const std::string& messageHash, const unsigned int msToWait, std::string& reply);
-   virtual bool ReadFromReadySocket(std::string& foundId, std::string& foundReply);
+   virtual bool GetReplyFromSocket(const RequestId& id, const unsigned int msToWait, std::string& reply);
+   virtual bool GetReplyFromCache(const RequestId& id, std::string& reply);
+   virtual bool CheckForMessagePending(const RequestId& id, const unsigned int msToWait, std::string& reply);
+   virtual bool ReadFromReadySocket(RequestId& foundId, std::string& foundReply);
+   bool SendRequest(const RequestId& id, const std::string& command, ReplyCallback onReply);
+   bool SendRequest(const RequestId& id, const void* idFrame, const size_t idSize, const std::string& command,
+           ReplyCallback onReply);
+   void DispatchReply(const RequestId& id, const std::string& reply);
+   bool WaitForCredit();
+   void RecordRoundTrip(const RequestId& id);
 
-   std::map<std::string, std::string> mUnreadReplies;
+   // The hooks take a RequestId now and unread replies live in mRequests.
+   // The old string hooks are deleted, so an override of one fails to
+   // compile instead of quietly never being called.
+   virtual void CleanUnreadReplies() = delete;
+   virtual bool GetReplyFromSocket(const std::string& uuid, const unsigned int msToWait, std::string& reply) = delete;
+   virtual bool GetReplyFromCache(const std::string& uuid, std::string& reply) = delete;
+   virtual bool CheckForMessagePending(const std::string& messageHash, const unsigned int msToWait,
+           std::string& reply) = delete;
+   virtual bool ReadFromReadySocket(std::string& foundId, std::string& foundReply) = delete;
+
+   RequestTable mRequests;
    time_t mLastGCTime;
 private:
-   std::map<std::string, time_t> mPendingReplies;
    std::string mBinding;
    void *mChamber;
    zctx_t *mCtx;
+   zctx_t *mSharedCtx;
    boost::mt19937 mRan;
    boost::uuids::basic_random_generator<boost::mt19937> m_uuidGen;
    int mSendHWM;
@@ -53,4 +86,13 @@ private:
    bool mUnreadAlert;
    bool mPendingAlert;
    pthread_t mUtilizedThread;
+   bool mCompactIds;
+   uint64_t mIdSalt;
+   uint64_t mIdCount;
+   size_t mWindow;
+   unsigned int mWindowWaitMs;
+   std::unique_ptr<LatencyStats> mLatency;
+   // where this BoomStick lives now, for futures that outlive a move
+   std::shared_ptr<BoomStick*> mSelf;
+   EndpointStats mStats;
 };
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/**
+ * Wire format shared by a coalescing Rifle and the Vampire that unpacks it.
+ *
+ * A coalesced message has two frames, kMarker and then the records. Each
+ * record is a 4 byte little endian length followed by that many bytes.
+ * Either kind of message can end with a timestamp frame, so a bullet that
+ * reads kMarker and is followed by a stamp looks like a coalesced message
+ * until its second frame is read: when that frame is a stamp and the last
+ * one, it was a stamped bullet. Records never parse as a stamp, a stamp
+ * starts with a record length far larger than the frame.
+ */
+namespace Coalescing {
+   const char kMarker[] = "QueueNado:coalesced:1";
+   const size_t kMarkerSize = sizeof (kMarker) - 1;
+   const size_t kLengthSize = 4;
+
+   inline void AppendRecord(std::string& records, const std::string& record) {
+      const uint32_t size = record.size();
+      const char length[kLengthSize] = {
+         static_cast<char> (size & 0xff),
+         static_cast<char> ((size >> 8) & 0xff),
+         static_cast<char> ((size >> 16) & 0xff),
+         static_cast<char> ((size >> 24) & 0xff)
+      };
+      records.append(length, kLengthSize);
+      records.append(record);
+   }
+
+   /**
+    * Read the record at offset and move offset past it.
+    * @return false if there is no complete record at offset
+    */
+   inline bool ReadRecord(const char* records, const size_t size, size_t& offset,
+           const char*& record, size_t& recordSize) {
+      if (offset + kLengthSize > size) {
+         return false;
+      }
+      const unsigned char* length = reinterpret_cast<const unsigned char*> (records + offset);
+      const size_t found = static_cast<size_t> (length[0]) | (static_cast<size_t> (length[1]) << 8) |
+              (static_cast<size_t> (length[2]) << 16) | (static_cast<size_t> (length[3]) << 24);
+      if (found > size - offset - kLengthSize) {
+         return false;
+      }
+      record = records + offset + kLengthSize;
+      recordSize = found;
+      offset += kLengthSize + found;
+      return true;
+   }
+
+   inline bool IsMarker(const void* data, const size_t size) {
+      return size == kMarkerSize && memcmp(data, kMarker, kMarkerSize) == 0;
+   }
+}
@@ -0,0 +1,225 @@
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+#include "ContextPool.h"
+#include "czmq.h"
+#include "g3log/g3log.hpp"
+
+const std::string ContextPool::kDefault = "default";
+
+namespace {
+   const std::string kInproc = "inproc://";
+   const std::string kAliasPrefix = "inproc://QueueNado/";
+}
+
+/**
+ * @return the process wide pool
+ */
+ContextPool& ContextPool::Instance() {
+   static ContextPool pool;
+   return pool;
+}
+
+/**
+ * Destroy the pool contexts. Every endpoint using one of them must be gone
+ * by now, zmq_term blocks until their sockets are closed.
+ */
+ContextPool::~ContextPool() {
+   for (auto& entry : mContexts) {
+      if (entry.second.context != NULL) {
+         zctx_destroy(&entry.second.context);
+      }
+   }
+}
+
+/**
+ * Set up a named context, this must be called before it is first used.
+ * @param name
+ * @param ioThreads
+ *   Number of ZeroMQ I/O threads for the context
+ * @param cpus
+ *   CPUs to pin the I/O threads to, empty to leave them unpinned
+ * @return
+ *   false if the context already exists
+ */
+bool ContextPool::Configure(const std::string& name, const int ioThreads,
+        const std::vector<int>& cpus) {
+   std::lock_guard<std::mutex> lock(mMutex);
+   Settings& settings = mContexts[name];
+   if (settings.context != NULL) {
+      LOG(WARNING) << "Context " << name << " is already in use, can't configure it";
+      return false;
+   }
+   settings.ioThreads = ioThreads;
+   settings.cpus = cpus;
+   return true;
+}
+
+/**
+ * Get a named context, creating it on first use. Endpoints given this
+ * context shadow it, do not destroy it.
+ * @param name
+ * @return
+ *   The shared context, or NULL if it could not be created
+ */
+zctx_t* ContextPool::GetContext(const std::string& name) {
+   std::lock_guard<std::mutex> lock(mMutex);
+   Settings& settings = mContexts[name];
+   if (settings.context == NULL) {
+      settings.context = CreateContext(settings);
+   }
+   return settings.context;
+}
+
+/**
+ * @param name
+ * @return the number of I/O threads the named context has or will have
+ */
+int ContextPool::GetIOThreads(const std::string& name) {
+   std::lock_guard<std::mutex> lock(mMutex);
+   return mContexts[name].ioThreads;
+}
+
+/**
+ * @param name
+ * @return the CPUs the named context's I/O threads are pinned to
+ */
+std::vector<int> ContextPool::GetAffinity(const std::string& name) {
+   std::lock_guard<std::mutex> lock(mMutex);
+   return mContexts[name].cpus;
+}
+
+/**
+ * @param binding
+ * @return the inproc location standing in for binding inside the process
+ */
+std::string ContextPool::GetAlias(const std::string& binding) {
+   return kAliasPrefix + binding;
+}
+
+/**
+ * Bind the inproc alias of binding on a socket that is already bound to it.
+ * Only sockets on a pool context get an alias, connectors adopt that context
+ * and it lives as long as the process.
+ * @param socket
+ * @param binding
+ * @param context
+ *   The context the socket was made on, or the one it shadows
+ * @return
+ *   If the alias was bound and registered
+ */
+bool ContextPool::BindAlias(void* socket, const std::string& binding, zctx_t* context) {
+   if (context == NULL || binding.compare(0, kInproc.size(), kInproc) == 0) {
+      return false;
+   }
+   std::lock_guard<std::mutex> lock(mMutex);
+   zctx_t* pooled = FindPooled(context);
+   if (pooled == NULL) {
+      return false;
+   }
+   if (zsocket_bind(socket, GetAlias(binding).c_str()) < 0) {
+      LOG(WARNING) << "Can't bind inproc alias for " << binding << ": " << zmq_strerror(zmq_errno());
+      return false;
+   }
+   mAliases[binding] = pooled;
+   return true;
+}
+
+/**
+ * Stop handing out the alias of binding, done before its socket goes away.
+ * @param binding
+ * @param context
+ *   The context the alias was bound with
+ */
+void ContextPool::RemoveAlias(const std::string& binding, zctx_t* context) {
+   std::lock_guard<std::mutex> lock(mMutex);
+   auto alias = mAliases.find(binding);
+   if (alias != mAliases.end() && alias->second == FindPooled(context)) {
+      mAliases.erase(alias);
+   }
+}
+
+/**
+ * Find where to connect to reach binding.
+ * @param binding
+ * @param context
+ *   The shared context of the connecting endpoint, if it is NULL it is set
+ *   to the binder's so the alias can be used
+ * @return
+ *   The inproc alias if the binder is in this process on the same context,
+ *   binding otherwise
+ */
+std::string ContextPool::FindAlias(const std::string& binding, zctx_t*& context) {
+   std::lock_guard<std::mutex> lock(mMutex);
+   auto alias = mAliases.find(binding);
+   if (alias == mAliases.end()) {
+      return binding;
+   }
+   if (context == NULL) {
+      context = alias->second;
+   } else if (FindPooled(context) != alias->second) {
+      return binding;
+   }
+   return GetAlias(binding);
+}
+
+/**
+ * Find the pool context behind a context or a shadow of one. Expects
+ * mMutex to be held.
+ * @param context
+ * @return
+ *   The pool context, NULL if the context is not from the pool
+ */
+zctx_t* ContextPool::FindPooled(zctx_t* context) {
+   if (context == NULL) {
+      return NULL;
+   }
+   void* underlying = zctx_underlying(context);
+   for (const auto& entry : mContexts) {
+      if (entry.second.context != NULL && zctx_underlying(entry.second.context) == underlying) {
+         return entry.second.context;
+      }
+   }
+   return NULL;
+}
+
+/**
+ * Create the context and start its I/O threads. ZeroMQ starts them when the
+ * first socket is created, so that is done on a thread pinned to the
+ * configured CPUs and the I/O threads inherit its affinity.
+ * @param settings
+ * @return
+ */
+zctx_t* ContextPool::CreateContext(const Settings& settings) {
+   zctx_t* context = NULL;
+   std::thread starter([&]() {
+      if (!settings.cpus.empty()) {
+         cpu_set_t cpus;
+         CPU_ZERO(&cpus);
+         for (const int cpu : settings.cpus) {
+            CPU_SET(cpu, &cpus);
+         }
+         int result = pthread_setaffinity_np(pthread_self(), sizeof (cpus), &cpus);
+         if (result != 0) {
+            LOG(WARNING) << "Could not pin ZeroMQ I/O threads: " << result;
+         }
+      }
+      context = zctx_new();
+      if (context == NULL) {
+         return;
+      }
+      zctx_set_iothreads(context, settings.ioThreads);
+      void* starter = zsocket_new(context, ZMQ_PAIR);
+      if (starter == NULL) {
+         zctx_destroy(&context);
+         return;
+      }
+      zsocket_destroy(context, starter);
+   });
+   starter.join();
+   if (context == NULL) {
+      LOG(WARNING) << "Could not create ZeroMQ context";
+   }
+   return context;
+}
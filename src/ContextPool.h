@@ -0,0 +1,65 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+struct _zctx_t;
+typedef struct _zctx_t zctx_t;
+
+/**
+ * Process wide registry of named ZeroMQ contexts.
+ *
+ * Every endpoint used to create a context of its own, and with it a set of
+ * I/O threads. Endpoints that are handed a context from the pool share its
+ * I/O threads instead. They take a shadow (zctx_shadow) of it, so destroying
+ * an endpoint only closes its own sockets and the pool context stays alive.
+ *
+ *    zctx_t* context = ContextPool::Instance().GetContext();
+ *    Rifle rifle(location, context);
+ *
+ * Configure a context before it is first used to change the number of I/O
+ * threads or pin them to CPUs. The I/O threads are started from a thread
+ * pinned to those CPUs, and inherit its affinity.
+ *
+ * The pool also finds peers in the same process by binding name. A socket
+ * bound on a pool context also binds an inproc:// alias of its location,
+ * and a socket connecting to that location from the same context, or from
+ * no context yet, connects to the alias instead and skips the kernel.
+ * Messages then move between the sockets without being copied. A peer
+ * connected through an alias does not reconnect if the binder goes away.
+ */
+class ContextPool {
+public:
+   static const std::string kDefault;
+
+   static ContextPool& Instance();
+   bool Configure(const std::string& name, const int ioThreads,
+           const std::vector<int>& cpus = std::vector<int>());
+   zctx_t* GetContext(const std::string& name = kDefault);
+   int GetIOThreads(const std::string& name = kDefault);
+   std::vector<int> GetAffinity(const std::string& name = kDefault);
+   bool BindAlias(void* socket, const std::string& binding, zctx_t* context);
+   void RemoveAlias(const std::string& binding, zctx_t* context);
+   std::string FindAlias(const std::string& binding, zctx_t*& context);
+   static std::string GetAlias(const std::string& binding);
+   ~ContextPool();
+
+private:
+   struct Settings {
+      Settings() : context(NULL), ioThreads(1) {
+      }
+      zctx_t* context;
+      int ioThreads;
+      std::vector<int> cpus;
+   };
+
+   ContextPool() = default;
+   ContextPool(const ContextPool&) = delete;
+   ContextPool& operator=(const ContextPool&) = delete;
+   static zctx_t* CreateContext(const Settings& settings);
+   zctx_t* FindPooled(zctx_t* context);
+
+   std::mutex mMutex;
+   std::map<std::string, Settings> mContexts;
+   std::map<std::string, zctx_t*> mAliases;
+};
@@ -0,0 +1,96 @@
+#include <chrono>
+#include "CreditWindow.h"
+
+/**
+ * @param size
+ *   How many requests can be in flight, 0 for no limit
+ */
+CreditWindow::CreditWindow(const size_t size) : mSize(size), mInFlight(0), mWaiting(0) {
+}
+
+/**
+ * Resize the window, credits that are taken stay taken. A window that
+ * shrinks below what is in flight stays full till enough come back.
+ * @param size
+ *   How many requests can be in flight, 0 for no limit
+ */
+void CreditWindow::SetSize(const size_t size) {
+   mSize.store(size);
+   WakeWaiters(true);
+}
+
+/**
+ * Take a credit if there is one
+ * @return
+ *   false if the window is full
+ */
+bool CreditWindow::TryAcquire() {
+   size_t taken = mInFlight.load(std::memory_order_relaxed);
+   do {
+      const size_t size = mSize.load(std::memory_order_relaxed);
+      if (0 != size && taken >= size) {
+         return false;
+      }
+   } while (!mInFlight.compare_exchange_weak(taken, taken + 1, std::memory_order_acquire,
+           std::memory_order_relaxed));
+   return true;
+}
+
+/**
+ * Take a credit, waiting for one to come back if the window is full
+ * @param msToWait
+ *   How long to wait, 0 does not wait
+ * @return
+ *   false if the window stayed full
+ */
+bool CreditWindow::Acquire(const unsigned int msToWait) {
+   if (TryAcquire()) {
+      return true;
+   }
+   if (0 == msToWait) {
+      return false;
+   }
+   const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(msToWait);
+   std::unique_lock<std::mutex> lock(mMutex);
+   // registered before the credits are looked at again, so a Release that
+   // lands in between always sees the waiter and notifies
+   mWaiting.fetch_add(1);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   bool acquired = false;
+   while (!(acquired = TryAcquire()) && std::chrono::steady_clock::now() < deadline) {
+      mReturned.wait_until(lock, deadline);
+   }
+   mWaiting.fetch_sub(1);
+   return acquired;
+}
+
+/**
+ * Give a credit back, waking one waiter if there is any
+ */
+void CreditWindow::Release() {
+   size_t taken = mInFlight.load(std::memory_order_relaxed);
+   while (taken > 0 && !mInFlight.compare_exchange_weak(taken, taken - 1, std::memory_order_release,
+           std::memory_order_relaxed)) {
+   }
+   WakeWaiters(false);
+}
+
+/**
+ * Notify waiters, only taking the lock when there are any
+ * @param all
+ *   Wake every waiter instead of one
+ */
+void CreditWindow::WakeWaiters(const bool all) {
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (0 == mWaiting.load(std::memory_order_relaxed)) {
+      return;
+   }
+   {
+      std::lock_guard<std::mutex> lock(mMutex);
+   }
+   if (all) {
+      mReturned.notify_all();
+   } else {
+      mReturned.notify_one();
+   }
+}
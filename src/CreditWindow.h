@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+/**
+ * Credits for the requests an endpoint may have in flight at once. A send
+ * takes a credit and its reply, or its failure, gives it back. With every
+ * credit taken TryAcquire fails at once, Acquire waits on a condition
+ * variable till a credit comes back or the wait runs out. A window of 0
+ * credits never fills.
+ *
+ * The credits are an atomic count, taking and giving them back is lock
+ * free. Only a blocking Acquire takes the lock, and a Release only takes it
+ * to notify when someone waits.
+ *
+ * Thread safe, any thread can take and give back credits.
+ */
+class CreditWindow {
+public:
+   explicit CreditWindow(const size_t size = 0);
+
+   void SetSize(const size_t size);
+   bool TryAcquire();
+   bool Acquire(const unsigned int msToWait);
+   void Release();
+
+   size_t size() const {
+      return mSize.load(std::memory_order_relaxed);
+   }
+
+   size_t inFlight() const {
+      return mInFlight.load(std::memory_order_relaxed);
+   }
+
+private:
+   CreditWindow(const CreditWindow&) = delete;
+   CreditWindow& operator=(const CreditWindow&) = delete;
+
+   void WakeWaiters(const bool all);
+
+   std::atomic<size_t> mSize;
+   std::atomic<size_t> mInFlight;
+   std::atomic<size_t> mWaiting;
+   std::mutex mMutex;
+   std::condition_variable mReturned;
+};
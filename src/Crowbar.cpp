@@ -14,8 +14,9 @@
  *   A std::string description of a ZMQ socket
  */
 Crowbar::Crowbar(const std::string& binding) : mContext(NULL),
-mBinding(binding), mTip(NULL), mOwnsContext(true) {
-   
+mBinding(binding), mTip(NULL), mOwnsContext(true), mSwungAt(0),
+mStats("Crowbar", EndpointStats::Role::Requester) {
+   mStats.SetLocation(mBinding);
 }
 
 /**
@@ -25,7 +26,9 @@ mBinding(binding), mTip(NULL), mOwnsContext(true) {
  *   A living(initialized) headcrab
  */
 Crowbar::Crowbar(const Headcrab& target) : mContext(target.GetContext()),
-mBinding(target.GetBinding()), mTip(NULL), mOwnsContext(false) {
+mBinding(target.GetBinding()), mTip(NULL), mOwnsContext(false), mSwungAt(0),
+mStats("Crowbar", EndpointStats::Role::Requester) {
+   mStats.SetLocation(mBinding);
    if (mContext == NULL) {
       mOwnsContext = true;
    }
@@ -40,8 +43,9 @@ mBinding(target.GetBinding()), mTip(NULL), mOwnsContext(false) {
  *   A working context
  */
 Crowbar::Crowbar(const std::string& binding, zctx_t* context) : mContext(context),
-mBinding(binding), mTip(NULL), mOwnsContext(false) {
-
+mBinding(binding), mTip(NULL), mOwnsContext(false), mSwungAt(0),
+mStats("Crowbar", EndpointStats::Role::Requester) {
+   mStats.SetLocation(mBinding);
 }
 
 /**
@@ -159,18 +163,28 @@ bool Crowbar::Flurry(std::vector<std::string>& hits) {
    }
    if (!PollForReady()) {
       LOG(WARNING) << "Cannot send, no listener ready";
+      mStats.SendTimeout();
       return false;
    }
    zmsg_t* message = zmsg_new();
+   size_t bytes = 0;
    for (auto it = hits.begin();
            it != hits.end(); it++) {
       zmsg_addmem(message, &((*it)[0]), it->size());
+      bytes += it->size();
    }
    bool success = true;
    //std::cout << "Sending message with " << zmsg_size(message) << " " << hits.size() << std::endl;
+   LatencyTimer blocked(mLatency ? &mLatency->sendBlocked : NULL);
    if (zmsg_send(&message, mTip) != 0) {
       LOG(WARNING) << "zmsg_send returned non-zero exit " << zmq_strerror(zmq_errno());
       success = false;
+   } else {
+      mStats.Sent(bytes);
+      if (mLatency) {
+         blocked.Stop();
+         mSwungAt = LatencyHistogram::Now();
+      }
    }
    if (message) {
       zmsg_destroy(&message);
@@ -195,16 +209,24 @@ bool Crowbar::BlockForKill(std::vector<std::string>& guts) {
    if (!message) {
       return false;
    }
+   if (mLatency && mSwungAt != 0) {
+      // REQ gets exactly one reply per request, this is its round trip
+      mLatency->endToEnd.Record(LatencyHistogram::Now() - mSwungAt);
+      mSwungAt = 0;
+   }
    guts.clear();
+   size_t bytes = 0;
    int msgSize = zmsg_size(message);
    for (int i = 0; i < msgSize; i++) {
       zframe_t* frame = zmsg_pop(message);
       std::string aString;
       aString.insert(0, reinterpret_cast<const char*> (zframe_data(frame)), zframe_size(frame));
+      bytes += aString.size();
       guts.push_back(aString);
       zframe_destroy(&frame);
       //std::cout << guts[0] << " found " << aString << std::endl;
    }
+   mStats.Received(bytes);
 
 
    zmsg_destroy(&message);
@@ -224,12 +246,39 @@ bool Crowbar::WaitForKill(std::vector<std::string>& guts, const int timeout) {
    if (!mTip) {
       return false;
    }
+   LatencyTimer wait(mLatency ? &mLatency->receiveWait : NULL);
    if (zsocket_poll(mTip, timeout)) {
+      wait.Stop();
       return BlockForKill(guts);
    }
+   mStats.ReceiveTimeout();
    return false;
 }
 
 zctx_t* Crowbar::GetContext() {
    return mContext;
 }
+
+/**
+ * Record how long sends and waits for a reply take, and the round trip of
+ * every request as its end to end latency.
+ */
+void Crowbar::EnableLatencyStats() {
+   if (!mLatency) {
+      mLatency.reset(new LatencyStats);
+   }
+}
+
+/**
+ * @return the latency stats, NULL unless they were enabled
+ */
+const LatencyStats* Crowbar::GetLatencyStats() const {
+   return mLatency.get();
+}
+
+/**
+ * @return what was sent and received, outstanding is 1 while a reply is due
+ */
+EndpointStats::Counters Crowbar::Stats() const {
+   return mStats.Get();
+}
@@ -7,10 +7,13 @@
 #include <stdint.h>
 
 #include <map>
+#include <memory>
 #include <string>
 #include <set>
 #include <vector>
 #include "Headcrab.h"
+#include "LatencyHistogram.h"
+#include "EndpointStats.h"
 
 struct _zctx_t;
 typedef struct _zctx_t zctx_t;
@@ -31,13 +34,20 @@ public:
    void* GetTip();
    static int GetHighWater();
    zctx_t* GetContext();
+   void EnableLatencyStats();
+   const LatencyStats* GetLatencyStats() const;
+   EndpointStats::Counters Stats() const;
 private:
    bool PollForReady();
-   Crowbar(const Crowbar& that) : mContext(NULL), mTip(NULL) {
+   Crowbar(const Crowbar& that) : mContext(NULL), mTip(NULL),
+   mStats("Crowbar", EndpointStats::Role::Requester) {
    }
 
    zctx_t* mContext;
    std::string mBinding;
    void* mTip;
    bool mOwnsContext;
+   std::unique_ptr<LatencyStats> mLatency;
+   uint64_t mSwungAt;
+   EndpointStats mStats;
 };
@@ -0,0 +1,213 @@
+#include <sstream>
+#include <utility>
+
+#include "EndpointStats.h"
+
+namespace {
+
+   uint64_t Difference(const uint64_t from, const uint64_t less) {
+      return (from > less) ? from - less : 0;
+   }
+
+   void Exchange(std::atomic<uint64_t>& first, std::atomic<uint64_t>& second) {
+      first.store(second.exchange(first.load(std::memory_order_relaxed), std::memory_order_relaxed),
+              std::memory_order_relaxed);
+   }
+}
+
+EndpointStats::Counters::Counters() : messagesSent(0), bytesSent(0), messagesReceived(0),
+bytesReceived(0), sendTimeouts(0), receiveTimeouts(0), malformed(0), outstanding(0),
+windowSize(0), windowInFlight(0), windowFull(0) {
+}
+
+/**
+ * @return the counters on one line
+ */
+std::string EndpointStats::Counters::ToString() const {
+   std::ostringstream text;
+   text << kind << " " << location
+           << " sent: " << messagesSent << " (" << bytesSent << " bytes)"
+           << ", received: " << messagesReceived << " (" << bytesReceived << " bytes)"
+           << ", send timeouts: " << sendTimeouts
+           << ", receive timeouts: " << receiveTimeouts
+           << ", malformed: " << malformed
+           << ", outstanding: " << outstanding;
+   if (windowSize > 0) {
+      text << ", window: " << windowInFlight << "/" << windowSize
+              << " (full " << windowFull << " times)";
+   }
+   return text.str();
+}
+
+/**
+ * @param kind
+ *   The endpoint class, Rifle, Vampire...
+ * @param role
+ *   How the outstanding depth is estimated
+ */
+EndpointStats::EndpointStats(const std::string& kind, const Role role) :
+mKind(kind),
+mRole(role),
+mMessagesSent(0),
+mBytesSent(0),
+mMessagesReceived(0),
+mBytesReceived(0),
+mSendTimeouts(0),
+mReceiveTimeouts(0),
+mMalformed(0),
+mWindowSize(0),
+mWindowInFlight(0),
+mWindowFull(0) {
+   StatsRegistry::Instance().Add(this);
+}
+
+EndpointStats::~EndpointStats() {
+   StatsRegistry::Instance().Remove(this);
+}
+
+/**
+ * Set where the endpoint binds or connects to.
+ * @param location
+ */
+void EndpointStats::SetLocation(const std::string& location) {
+   std::lock_guard<std::mutex> lock(StatsRegistry::Instance().mMutex);
+   mLocation = location;
+}
+
+/**
+ * Trade counters and location with another endpoint of the same kind, for
+ * endpoints that move their internals.
+ * @param other
+ */
+void EndpointStats::Swap(EndpointStats& other) {
+   std::lock_guard<std::mutex> lock(StatsRegistry::Instance().mMutex);
+   std::swap(mLocation, other.mLocation);
+   Exchange(mMessagesSent, other.mMessagesSent);
+   Exchange(mBytesSent, other.mBytesSent);
+   Exchange(mMessagesReceived, other.mMessagesReceived);
+   Exchange(mBytesReceived, other.mBytesReceived);
+   Exchange(mSendTimeouts, other.mSendTimeouts);
+   Exchange(mReceiveTimeouts, other.mReceiveTimeouts);
+   Exchange(mMalformed, other.mMalformed);
+   Exchange(mWindowSize, other.mWindowSize);
+   Exchange(mWindowInFlight, other.mWindowInFlight);
+   Exchange(mWindowFull, other.mWindowFull);
+}
+
+/**
+ * @return the counters as they are now
+ */
+EndpointStats::Counters EndpointStats::Get() const {
+   const StatsRegistry& registry = StatsRegistry::Instance();
+   std::lock_guard<std::mutex> lock(registry.mMutex);
+   return registry.GetLocked(*this);
+}
+
+/**
+ * Read the counters, without the outstanding depth of one way endpoints.
+ * The registry lock must be held for the location.
+ * @return
+ */
+EndpointStats::Counters EndpointStats::Read() const {
+   Counters counters;
+   counters.kind = mKind;
+   counters.location = mLocation;
+   counters.messagesSent = mMessagesSent.load(std::memory_order_relaxed);
+   counters.bytesSent = mBytesSent.load(std::memory_order_relaxed);
+   counters.messagesReceived = mMessagesReceived.load(std::memory_order_relaxed);
+   counters.bytesReceived = mBytesReceived.load(std::memory_order_relaxed);
+   counters.sendTimeouts = mSendTimeouts.load(std::memory_order_relaxed);
+   counters.receiveTimeouts = mReceiveTimeouts.load(std::memory_order_relaxed);
+   counters.malformed = mMalformed.load(std::memory_order_relaxed);
+   counters.windowSize = mWindowSize.load(std::memory_order_relaxed);
+   counters.windowInFlight = mWindowInFlight.load(std::memory_order_relaxed);
+   counters.windowFull = mWindowFull.load(std::memory_order_relaxed);
+   if (Role::Requester == mRole) {
+      counters.outstanding = Difference(counters.messagesSent, counters.messagesReceived);
+   } else if (Role::Replier == mRole) {
+      counters.outstanding = Difference(counters.messagesReceived, counters.messagesSent);
+   }
+   return counters;
+}
+
+StatsRegistry& StatsRegistry::Instance() {
+   static StatsRegistry registry;
+   return registry;
+}
+
+/**
+ * @return the counters of every endpoint in the process
+ */
+std::vector<EndpointStats::Counters> StatsRegistry::GetAll() const {
+   std::lock_guard<std::mutex> lock(mMutex);
+   std::vector<EndpointStats::Counters> all;
+   all.reserve(mEndpoints.size());
+   for (const EndpointStats* endpoint : mEndpoints) {
+      all.push_back(GetLocked(*endpoint));
+   }
+   return all;
+}
+
+/**
+ * @return every endpoint in the process, one per line
+ */
+std::string StatsRegistry::Dump() const {
+   std::ostringstream text;
+   for (const auto& counters : GetAll()) {
+      text << counters.ToString() << "\n";
+   }
+   return text.str();
+}
+
+/**
+ * @return how many endpoints there are
+ */
+size_t StatsRegistry::size() const {
+   std::lock_guard<std::mutex> lock(mMutex);
+   return mEndpoints.size();
+}
+
+void StatsRegistry::Add(EndpointStats* endpoint) {
+   std::lock_guard<std::mutex> lock(mMutex);
+   mEndpoints.insert(endpoint);
+}
+
+void StatsRegistry::Remove(EndpointStats* endpoint) {
+   std::lock_guard<std::mutex> lock(mMutex);
+   mEndpoints.erase(endpoint);
+}
+
+/**
+ * Read an endpoint and estimate the depth of a PUSH / PULL endpoint from the
+ * other endpoints on its location.
+ * @param endpoint
+ * @return
+ */
+EndpointStats::Counters StatsRegistry::GetLocked(const EndpointStats& endpoint) const {
+   EndpointStats::Counters counters = endpoint.Read();
+   const bool oneWay = (EndpointStats::Role::Sender == endpoint.mRole ||
+           EndpointStats::Role::Receiver == endpoint.mRole);
+   if (!oneWay || counters.location.empty()) {
+      return counters;
+   }
+   uint64_t sent = 0;
+   uint64_t received = 0;
+   bool sender = false;
+   bool receiver = false;
+   for (const EndpointStats* peer : mEndpoints) {
+      if (peer->mLocation != counters.location) {
+         continue;
+      }
+      if (EndpointStats::Role::Sender == peer->mRole) {
+         sender = true;
+         sent += peer->mMessagesSent.load(std::memory_order_relaxed);
+      } else if (EndpointStats::Role::Receiver == peer->mRole) {
+         receiver = true;
+         received += peer->mMessagesReceived.load(std::memory_order_relaxed);
+      }
+   }
+   if (sender && receiver) {
+      counters.outstanding = Difference(sent, received);
+   }
+   return counters;
+}
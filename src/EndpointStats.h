@@ -0,0 +1,146 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * Counters every endpoint keeps about its own traffic, so a stalled pipeline
+ * can be read from the outside: a Rifle whose send timeouts climb is held
+ * up by its high water mark, a Vampire whose receive timeouts climb is
+ * starved.
+ *
+ * The endpoint counts with relaxed atomic adds on its own thread, Get can
+ * be called from any thread. Every EndpointStats is in the StatsRegistry
+ * from construction to destruction.
+ *
+ * The outstanding depth is an estimate. A requester has what it sent less
+ * the replies it got, a replier the requests it got less what it replied.
+ * One way PUSH / PULL endpoints have what the senders on their location have
+ * sent less what the receivers on it have received, which only counts peers
+ * in this process and is 0 without any. PUB / SUB endpoints have no
+ * estimate, their outstanding depth is always 0: every subscriber gets its
+ * own copy of what matches its subscriptions, so no count taken across the
+ * location says how far one subscriber is behind.
+ *
+ * An endpoint with an in flight window also reports its size, how much of
+ * it is taken and how often a send found it full. The window size is 0
+ * without one.
+ */
+class EndpointStats {
+public:
+
+   enum class Role {
+      Sender, Receiver, Requester, Replier, Publisher, Subscriber
+   };
+
+   struct Counters {
+      Counters();
+      std::string ToString() const;
+
+      std::string kind;
+      std::string location;
+      uint64_t messagesSent;
+      uint64_t bytesSent;
+      uint64_t messagesReceived;
+      uint64_t bytesReceived;
+      uint64_t sendTimeouts;
+      uint64_t receiveTimeouts;
+      uint64_t malformed;
+      uint64_t outstanding;
+      uint64_t windowSize;
+      uint64_t windowInFlight;
+      uint64_t windowFull;
+   };
+
+   EndpointStats(const std::string& kind, const Role role);
+   ~EndpointStats();
+   EndpointStats(const EndpointStats&) = delete;
+   EndpointStats& operator=(const EndpointStats&) = delete;
+
+   void SetLocation(const std::string& location);
+   void Swap(EndpointStats& other);
+   Counters Get() const;
+
+   void Sent(const size_t bytes, const uint64_t messages = 1) {
+      mMessagesSent.fetch_add(messages, std::memory_order_relaxed);
+      mBytesSent.fetch_add(bytes, std::memory_order_relaxed);
+   }
+
+   void Received(const size_t bytes, const uint64_t messages = 1) {
+      mMessagesReceived.fetch_add(messages, std::memory_order_relaxed);
+      mBytesReceived.fetch_add(bytes, std::memory_order_relaxed);
+   }
+
+   void SendTimeout() {
+      mSendTimeouts.fetch_add(1, std::memory_order_relaxed);
+   }
+
+   void ReceiveTimeout() {
+      mReceiveTimeouts.fetch_add(1, std::memory_order_relaxed);
+   }
+
+   void Malformed() {
+      mMalformed.fetch_add(1, std::memory_order_relaxed);
+   }
+
+   void SetWindow(const size_t size) {
+      mWindowSize.store(size, std::memory_order_relaxed);
+   }
+
+   void SetInFlight(const size_t inFlight) {
+      mWindowInFlight.store(inFlight, std::memory_order_relaxed);
+   }
+
+   void WindowFull() {
+      mWindowFull.fetch_add(1, std::memory_order_relaxed);
+   }
+
+private:
+   friend class StatsRegistry;
+   Counters Read() const;
+
+   const std::string mKind;
+   const Role mRole;
+   std::string mLocation;
+   std::atomic<uint64_t> mMessagesSent;
+   std::atomic<uint64_t> mBytesSent;
+   std::atomic<uint64_t> mMessagesReceived;
+   std::atomic<uint64_t> mBytesReceived;
+   std::atomic<uint64_t> mSendTimeouts;
+   std::atomic<uint64_t> mReceiveTimeouts;
+   std::atomic<uint64_t> mMalformed;
+   std::atomic<uint64_t> mWindowSize;
+   std::atomic<uint64_t> mWindowInFlight;
+   std::atomic<uint64_t> mWindowFull;
+};
+
+/**
+ * Every endpoint in the process, to dump them all at once:
+ *
+ *    LOG(INFO) << StatsRegistry::Instance().Dump();
+ */
+class StatsRegistry {
+public:
+   static StatsRegistry& Instance();
+
+   std::vector<EndpointStats::Counters> GetAll() const;
+   std::string Dump() const;
+   size_t size() const;
+
+private:
+   friend class EndpointStats;
+   StatsRegistry() = default;
+   StatsRegistry(const StatsRegistry&) = delete;
+   StatsRegistry& operator=(const StatsRegistry&) = delete;
+
+   void Add(EndpointStats* endpoint);
+   void Remove(EndpointStats* endpoint);
+   EndpointStats::Counters GetLocked(const EndpointStats& endpoint) const;
+
+   mutable std::mutex mMutex;
+   std::set<EndpointStats*> mEndpoints;
+};
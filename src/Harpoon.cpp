@@ -13,12 +13,18 @@
 
 
 /// Creates the client that is to connect to the server/Kraken
-Harpoon::Harpoon():
+Harpoon::Harpoon(): Harpoon(nullptr) {
+}
+
+/// Creates the client on a shared context (see ContextPool), or on a context of its own
+/// for nullptr. A shared context is shadowed and never destroyed by the Harpoon
+Harpoon::Harpoon(zctx_t* context):
    mQueueLength(1), //Number of allowed messages in queue
    mTimeoutMs(300000), //5 minutes
    mOffset(0),
-   mChunk(nullptr) {
-   mCtx = zctx_new();
+   mChunk(nullptr),
+   mStats("Harpoon", EndpointStats::Role::Requester) {
+   mCtx = (context != nullptr) ? zctx_shadow(context) : zctx_new();
    CHECK(mCtx);
    mDealer = zsocket_new(mCtx, ZMQ_DEALER);
    CHECK(mDealer);
@@ -28,6 +34,7 @@ Harpoon::Harpoon():
 /// Set location of the queue (TCP location)
 Harpoon::Spear Harpoon::Aim(const std::string& location) {
    int result = zsocket_connect(mDealer, location.c_str());
+   mStats.SetLocation(location);
    return (0 == result) ? Harpoon::Spear::IMPALED : Harpoon::Spear::MISS;
 }
 
@@ -44,6 +51,7 @@ void Harpoon::RequestChunks() {
    // Send enough data requests to fill pipeline:
    while (mCredit && !zctx_interrupted) {
       zstr_sendf (mDealer, "%ld", mOffset);
+      mStats.Sent(std::to_string(mOffset).size());
       mOffset++;
       mCredit--;
    }
@@ -87,7 +95,9 @@ Harpoon::Battling Harpoon::Heave(std::vector<uint8_t>& data) {
    static const std::vector<uint8_t> emptyOnError;
 
    //Poll to see if anything is available on the pipeline:
+   LatencyTimer wait(mLatency ? &mLatency->receiveWait : NULL);
    if (Harpoon::Battling::CONTINUE == PollTimeout(mTimeoutMs)) {
+      wait.Stop();
 
       mChunk = zframe_recv (mDealer);
       if (!mChunk) {
@@ -96,6 +106,7 @@ Harpoon::Battling Harpoon::Heave(std::vector<uint8_t>& data) {
       }
 
       int size = zframe_size (mChunk);
+      mStats.Received(size);
       data.resize(size);
       if (size <= 0) {
          return Harpoon::Battling::VICTORIOUS;
@@ -110,6 +121,7 @@ Harpoon::Battling Harpoon::Heave(std::vector<uint8_t>& data) {
    }
 
    data = emptyOnError;
+   mStats.ReceiveTimeout();
    return Harpoon::Battling::TIMEOUT;
 }
 
@@ -144,3 +156,20 @@ std::string Harpoon::EnumToString(Harpoon::Battling value) const {
    return result;
 }
 
+/// Record how long each Heave waits for a chunk
+void Harpoon::EnableLatencyStats() {
+   if (!mLatency) {
+      mLatency.reset(new LatencyStats);
+   }
+}
+
+/// @return the latency stats, nullptr unless they were enabled
+const LatencyStats* Harpoon::GetLatencyStats() const {
+   return mLatency.get();
+}
+
+/// @return the chunk requests sent, the chunks received and how often Heave
+/// timed out, outstanding is the requests the Kraken has not answered yet
+EndpointStats::Counters Harpoon::Stats() const {
+   return mStats.Get();
+}
@@ -7,8 +7,11 @@
 
 
 #pragma once
+#include <memory>
 #include <string>
 #include <czmq.h>
+#include "LatencyHistogram.h"
+#include "EndpointStats.h"
 
 /** Harpoon-Kraken is a PipeLine communication pattern used to
 *  stream files or plain data from a server to a client. 
@@ -29,6 +32,7 @@ public:
    enum class Battling : std::int8_t { TIMEOUT = -2, INTERRUPT = -1, VICTORIOUS = 0, CONTINUE = 1, CANCEL = 2 };
 
    Harpoon();
+   explicit Harpoon(zctx_t* context);
 
    Spear Aim(const std::string& location);
    void MaxWaitInMs(const int timeoutMs);
@@ -37,6 +41,9 @@ public:
    virtual ~Harpoon();
 
    std::string EnumToString(Battling type) const;
+   void EnableLatencyStats();
+   const LatencyStats* GetLatencyStats() const;
+   EndpointStats::Counters Stats() const;
 
 protected:
    Battling PollTimeout(int timeoutMs);
@@ -51,4 +58,6 @@ private:
    size_t mCredit;
    size_t mOffset;
    zframe_t *mChunk;
+   std::unique_ptr<LatencyStats> mLatency;
+   EndpointStats mStats;
 };
@@ -16,8 +16,24 @@
  * @param binding
  *   A ZeroMQ binding
  */
-Headcrab::Headcrab(const std::string& binding) : mBinding(binding), mContext(NULL), mFace(NULL) {
+Headcrab::Headcrab(const std::string& binding) : mBinding(binding), mContext(NULL),
+mSharedContext(NULL), mFace(NULL), mStats("Headcrab", EndpointStats::Role::Replier) {
+   mStats.SetLocation(mBinding);
+}
 
+/**
+ * Construct a headcrab at the given ZMQ binding on a shared context, see
+ * ContextPool
+ * 
+ * @param binding
+ *   A ZeroMQ binding
+ * @param context
+ *   A working context, it is shadowed and never destroyed by the headcrab
+ */
+Headcrab::Headcrab(const std::string& binding, zctx_t* context) : mBinding(binding),
+mContext(NULL), mSharedContext(context), mFace(NULL),
+mStats("Headcrab", EndpointStats::Role::Replier) {
+   mStats.SetLocation(mBinding);
 }
 
 /**
@@ -104,7 +120,7 @@ void Headcrab::setIpcFilePermissions() {
  */
 bool Headcrab::ComeToLife() {
    if (! mContext) {
-      mContext = zctx_new();
+      mContext = mSharedContext ? zctx_shadow(mSharedContext) : zctx_new();
       zctx_set_linger(mContext, 0); // linger for a millisecond on close
       zctx_set_sndhwm(mContext, GetHighWater());
       zctx_set_rcvhwm(mContext, GetHighWater()); // HWM on internal thread communication
@@ -156,15 +172,18 @@ bool Headcrab::GetHitBlock(std::vector<std::string>& theHits) {
    }
    //std::cout << "Got message with " << zmsg_size(message) << " parts" << std::endl;
    theHits.clear();
+   size_t bytes = 0;
    int msgSize = zmsg_size(message);
    for (int i = 0; i < msgSize; i ++) {
       zframe_t* frame = zmsg_pop(message);
       std::string aFrame;
       aFrame.insert(0, reinterpret_cast<const char*> (zframe_data(frame)), zframe_size(frame));
+      bytes += aFrame.size();
       theHits.push_back(aFrame);
       zframe_destroy(&frame);
       //std::cout << "got string " << aFrame << " " << theHits[i] << std::endl;
    }
+   mStats.Received(bytes);
 
    zmsg_destroy(&message);
    //std::cout << "got " << theHits.size() << " hits" << std::endl;
@@ -185,9 +204,12 @@ bool Headcrab::GetHitWait(std::vector<std::string>& theHits, const int timeout)
    if (! mFace) {
       return false;
    }
+   LatencyTimer wait(mLatency ? &mLatency->receiveWait : NULL);
    if (zsocket_poll(mFace, timeout)) {
+      wait.Stop();
       return GetHitBlock(theHits);
    }
+   mStats.ReceiveTimeout();
    return false;
 }
 
@@ -202,16 +224,45 @@ bool Headcrab::SendSplatter(std::vector<std::string>& feedback) {
       return false;
    }
    zmsg_t* message = zmsg_new();
+   size_t bytes = 0;
    for (auto it = feedback.begin();
            it != feedback.end(); it ++) {
       zmsg_addmem(message, &((*it)[0]), it->size());
+      bytes += it->size();
    }
    bool success = true;
+   LatencyTimer blocked(mLatency ? &mLatency->sendBlocked : NULL);
    if (zmsg_send(&message, mFace) != 0) {
       success = false;
+   } else {
+      blocked.Stop();
+      mStats.Sent(bytes);
    }
    if (message) {
       zmsg_destroy(&message);
    }
    return success;
 }
+
+/**
+ * Record how long waits for a request and sends of the reply take.
+ */
+void Headcrab::EnableLatencyStats() {
+   if (!mLatency) {
+      mLatency.reset(new LatencyStats);
+   }
+}
+
+/**
+ * @return the latency stats, NULL unless they were enabled
+ */
+const LatencyStats* Headcrab::GetLatencyStats() const {
+   return mLatency.get();
+}
+
+/**
+ * @return what was received and replied, outstanding is 1 while a reply is due
+ */
+EndpointStats::Counters Headcrab::Stats() const {
+   return mStats.Get();
+}
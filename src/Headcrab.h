@@ -7,14 +7,18 @@
 
 #include <stdint.h>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
+#include "LatencyHistogram.h"
+#include "EndpointStats.h"
 
 struct _zctx_t;
 typedef struct _zctx_t zctx_t;
 class Headcrab {
 public:
    explicit Headcrab(const std::string& binding);
+   Headcrab(const std::string& binding, zctx_t* context);
    virtual ~Headcrab();
    std::string GetBinding() const;
    zctx_t* GetContext() const;
@@ -28,14 +32,21 @@ public:
    bool GetHitWait(std::string& theHit,const int timeout);
    bool SendSplatter(const std::string& feedback);
    static int GetHighWater();
+   void EnableLatencyStats();
+   const LatencyStats* GetLatencyStats() const;
+   EndpointStats::Counters Stats() const;
 private:
 
    void setIpcFilePermissions();
-   Headcrab(const Headcrab& that) : mContext(NULL), mFace(NULL) {
+   Headcrab(const Headcrab& that) : mContext(NULL), mSharedContext(NULL), mFace(NULL),
+   mStats("Headcrab", EndpointStats::Role::Replier) {
    }
 
    std::string mBinding;
    zctx_t* mContext;
+   zctx_t* mSharedContext;
    void* mFace;
+   std::unique_ptr<LatencyStats> mLatency;
+   EndpointStats mStats;
 };
 
@@ -9,20 +9,27 @@
 #include <g3log/g3log.hpp>
 #include "Kraken.h"
 #include <chrono>
+#include <cstring>
 
 namespace {
    const size_t kDefaultMaxChunkSize_10MB_inBytes = 10 * 1024 * 1024;
 }
 /// Constructing the server/Kraken that is about to be connected/impaled by the client/Harpoon
-Kraken::Kraken():
+Kraken::Kraken(): Kraken(nullptr) {
+}
+
+/// Constructing the Kraken on a shared context (see ContextPool), or on a context of its own
+/// for nullptr. A shared context is shadowed and never destroyed by the Kraken
+Kraken::Kraken(zctx_t* context):
    mLocation(""),
    mQueueLength(1), //Number of allowed messages in queue
    mMaxChunkSize(kDefaultMaxChunkSize_10MB_inBytes), //10MB
    mNextChunk(nullptr),
    mIdentity(nullptr),
    mTimeoutMs(300000), //5 Minutes
-   mChunk(nullptr) {
-   mCtx = zctx_new();
+   mChunk(nullptr),
+   mStats("Kraken", EndpointStats::Role::Replier) {
+   mCtx = (context != nullptr) ? zctx_shadow(context) : zctx_new();
    CHECK(mCtx);
    mRouter = zsocket_new(mCtx, ZMQ_ROUTER);
    CHECK(mRouter);
@@ -31,6 +38,7 @@ Kraken::Kraken():
 /// Set location of the queue (TCP location)
 Kraken::Spear Kraken::SetLocation(const std::string& location) {
    mLocation = location;
+   mStats.SetLocation(location);
    zsocket_set_hwm(mRouter, mQueueLength * 2);
 
    int result = zsocket_bind(mRouter, mLocation.c_str());
@@ -121,7 +129,9 @@ Kraken::Battling Kraken::NextChunkId() {
       static const std::string kCancel = EnumToString(Kraken::Battling::CANCEL);
       if (!mNextChunk) {
          return Kraken::Battling::INTERRUPT;
-      } else if (EnumToString(Kraken::Battling::CANCEL)== mNextChunk) {
+      }
+      mStats.Received(strlen(mNextChunk));
+      if (EnumToString(Kraken::Battling::CANCEL)== mNextChunk) {
          LOG(WARNING) << "Client/Harpoon requested the ongoing transfer to be cancelled";
          return Kraken::Battling::CANCEL;
       }
@@ -178,15 +188,23 @@ Kraken::Battling Kraken::SendRawData(const uint8_t* data, int size) {
 
    FreeChunk();
    FreeOldRequests();
+   // The Kraken may only send once the Harpoon asked for a chunk, the wait
+   // for that request is the time the send is blocked
+   LatencyTimer blocked(mLatency ? &mLatency->sendBlocked : NULL);
    const auto next = NextChunkId();
+   if (Kraken::Battling::TIMEOUT == next) {
+      mStats.SendTimeout();
+   }
    if (Kraken::Battling::CONTINUE != next) {
       return next;
    }
+   blocked.Stop();
 
    mChunk = zframe_new(data, size);
    // Send chunk to client
    zframe_send (&mIdentity, mRouter, ZFRAME_REUSE + ZFRAME_MORE);
    zframe_send (&mChunk, mRouter, 0);
+   mStats.Sent(size);
    return Kraken::Battling::CONTINUE;
 
 }
@@ -216,3 +234,20 @@ std::string Kraken::EnumToString(Battling value) const{
    return result;
 }
 
+/// Record how long each chunk waits for the Harpoon to ask for it
+void Kraken::EnableLatencyStats() {
+   if (!mLatency) {
+      mLatency.reset(new LatencyStats);
+   }
+}
+
+/// @return the latency stats, nullptr unless they were enabled
+const LatencyStats* Kraken::GetLatencyStats() const {
+   return mLatency.get();
+}
+
+/// @return the chunks sent, the chunk requests received and how often the
+/// Kraken timed out waiting for a request
+EndpointStats::Counters Kraken::Stats() const {
+   return mStats.Get();
+}
@@ -7,9 +7,12 @@
 
  #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <czmq.h>
+#include "LatencyHistogram.h"
+#include "EndpointStats.h"
 
 struct _zctx_t;
 typedef struct _zctx_t zctx_t;
@@ -34,6 +37,7 @@ public:
 
 
    Kraken();
+   explicit Kraken(zctx_t* context);
    Spear SetLocation(const std::string& location);
    void MaxWaitInMs(const int timeout);
    void ChangeDefaultMaxChunkSizeInBytes(const size_t bytes);
@@ -43,6 +47,9 @@ public:
    virtual ~Kraken();
 
    std::string EnumToString(Battling type) const;
+   void EnableLatencyStats();
+   const LatencyStats* GetLatencyStats() const;
+   EndpointStats::Counters Stats() const;
     
 protected:
    
@@ -62,4 +69,6 @@ private:
    zframe_t* mIdentity;
    int mTimeoutMs;
    zframe_t* mChunk;
+   std::unique_ptr<LatencyStats> mLatency;
+   EndpointStats mStats;
 };
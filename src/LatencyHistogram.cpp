@@ -0,0 +1,192 @@
+#include <time.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+#include "LatencyHistogram.h"
+
+namespace {
+   const char kStampMarker[8] = {'Q', 'N', 'S', 'T', 'A', 'M', 'P', '\0'};
+   const int kSubBits = 4;
+}
+
+const size_t LatencyHistogram::kSubBuckets;
+const size_t LatencyHistogram::kBuckets;
+const size_t LatencyStats::kStampSize;
+
+LatencyHistogram::Snapshot::Snapshot() : count(0), sum(0), min(0), max(0) {
+}
+
+/**
+ * @param percentile
+ *   0 to 100
+ * @return
+ *   The highest value of the bucket the percentile falls in, capped by the
+ *   highest value recorded. 0 if nothing was recorded
+ */
+uint64_t LatencyHistogram::Snapshot::Percentile(const double percentile) const {
+   if (count == 0) {
+      return 0;
+   }
+   const double clamped = std::min(100.0, std::max(0.0, percentile));
+   const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t> (clamped / 100.0 * count + 0.5));
+   uint64_t seen = 0;
+   for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+      seen += buckets[bucket];
+      if (seen >= rank) {
+         return std::min(HighestIn(bucket), max);
+      }
+   }
+   return max;
+}
+
+double LatencyHistogram::Snapshot::Mean() const {
+   return (count == 0) ? 0 : static_cast<double> (sum) / count;
+}
+
+/**
+ * @return count, min, p50, p99, p99.9 and max in microseconds
+ */
+std::string LatencyHistogram::Snapshot::ToString() const {
+   std::ostringstream text;
+   text << "count: " << count
+           << ", min: " << min / 1000.0
+           << "us, p50: " << Percentile(50) / 1000.0
+           << "us, p99: " << Percentile(99) / 1000.0
+           << "us, p99.9: " << Percentile(99.9) / 1000.0
+           << "us, max: " << max / 1000.0 << "us";
+   return text.str();
+}
+
+LatencyHistogram::LatencyHistogram() {
+   Reset();
+}
+
+/**
+ * Record one latency.
+ * @param ns
+ */
+void LatencyHistogram::Record(const uint64_t ns) {
+   mBuckets[BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+   mSum.fetch_add(ns, std::memory_order_relaxed);
+   uint64_t min = mMin.load(std::memory_order_relaxed);
+   while (ns < min && !mMin.compare_exchange_weak(min, ns, std::memory_order_relaxed)) {
+   }
+   uint64_t max = mMax.load(std::memory_order_relaxed);
+   while (ns > max && !mMax.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+   }
+   // counted last, so a snapshot never has more counted than it has buckets for
+   mCount.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * Copy the histogram without stopping Record.
+ * @return
+ */
+LatencyHistogram::Snapshot LatencyHistogram::GetSnapshot() const {
+   Snapshot snapshot;
+   snapshot.count = mCount.load(std::memory_order_acquire);
+   snapshot.buckets.resize(kBuckets);
+   uint64_t counted = 0;
+   for (size_t bucket = 0; bucket < kBuckets; ++bucket) {
+      snapshot.buckets[bucket] = mBuckets[bucket].load(std::memory_order_relaxed);
+      counted += snapshot.buckets[bucket];
+   }
+   // Records that landed while copying are in the buckets but not the count
+   snapshot.count = std::max(snapshot.count, counted);
+   snapshot.sum = mSum.load(std::memory_order_relaxed);
+   snapshot.max = mMax.load(std::memory_order_relaxed);
+   snapshot.min = (snapshot.count == 0) ? 0 : mMin.load(std::memory_order_relaxed);
+   return snapshot;
+}
+
+/**
+ * Forget everything recorded. Records made while resetting may be lost.
+ */
+void LatencyHistogram::Reset() {
+   for (auto& bucket : mBuckets) {
+      bucket.store(0, std::memory_order_relaxed);
+   }
+   mCount.store(0, std::memory_order_relaxed);
+   mSum.store(0, std::memory_order_relaxed);
+   mMin.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+   mMax.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @return CLOCK_MONOTONIC in nanoseconds, the same in every process on the host
+ */
+uint64_t LatencyHistogram::Now() {
+   timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return static_cast<uint64_t> (now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @param ns
+ * @return
+ *   The bucket ns is counted in
+ */
+size_t LatencyHistogram::BucketOf(const uint64_t ns) {
+   if (ns < kSubBuckets) {
+      return ns;
+   }
+   const int highestBit = 63 - __builtin_clzll(ns);
+   const int shift = highestBit - kSubBits;
+   return (highestBit - kSubBits + 1) * kSubBuckets + ((ns >> shift) & (kSubBuckets - 1));
+}
+
+/**
+ * @param bucket
+ * @return
+ *   The highest value that is counted in bucket
+ */
+uint64_t LatencyHistogram::HighestIn(const size_t bucket) {
+   if (bucket < kSubBuckets) {
+      return bucket;
+   }
+   const size_t shift = bucket / kSubBuckets - 1;
+   const uint64_t lowest = (kSubBuckets + bucket % kSubBuckets) << shift;
+   return lowest + ((uint64_t(1) << shift) - 1);
+}
+
+/**
+ * Write the current time as a timestamp frame.
+ * @param frame
+ *   kStampSize bytes
+ */
+void LatencyStats::WriteStamp(void* frame) {
+   const uint64_t now = LatencyHistogram::Now();
+   memcpy(frame, kStampMarker, sizeof (kStampMarker));
+   memcpy(static_cast<char*> (frame) + sizeof (kStampMarker), &now, sizeof (now));
+}
+
+/**
+ * @param frame
+ * @param size
+ * @param sentNs
+ *   Set to the time in the stamp
+ * @return
+ *   If the frame is a timestamp frame
+ */
+bool LatencyStats::ReadStamp(const void* frame, const size_t size, uint64_t& sentNs) {
+   if (size != kStampSize || memcmp(frame, kStampMarker, sizeof (kStampMarker)) != 0) {
+      return false;
+   }
+   memcpy(&sentNs, static_cast<const char*> (frame) + sizeof (kStampMarker), sizeof (sentNs));
+   return true;
+}
+
+/**
+ * Record the end to end latency of a timestamp frame, if it is one.
+ * @param frame
+ * @param size
+ */
+void LatencyStats::RecordStamp(const void* frame, const size_t size) {
+   uint64_t sent = 0;
+   if (ReadStamp(frame, size, sent)) {
+      const uint64_t now = LatencyHistogram::Now();
+      endToEnd.Record((now > sent) ? now - sent : 0);
+   }
+}
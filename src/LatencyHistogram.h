@@ -0,0 +1,103 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * A histogram of latencies in nanoseconds, in the style of HdrHistogram.
+ * Values below 16ns get a bucket each, above that every power of two is cut
+ * into 16 buckets, so a percentile is within 1/16 of the true value from
+ * nanoseconds up to minutes.
+ *
+ * Record is a few relaxed atomic adds and never locks, so it can sit on
+ * the send and receive paths. GetSnapshot reads the buckets while traffic
+ * goes on. A snapshot taken during a Record can be one value behind, it is
+ * never torn beyond that.
+ */
+class LatencyHistogram {
+public:
+   static const size_t kSubBuckets = 16;
+   static const size_t kBuckets = (64 - 3) * kSubBuckets;
+
+   struct Snapshot {
+      Snapshot();
+      uint64_t Percentile(const double percentile) const;
+      double Mean() const;
+      std::string ToString() const;
+
+      uint64_t count;
+      uint64_t sum;
+      uint64_t min;
+      uint64_t max;
+      std::vector<uint64_t> buckets;
+   };
+
+   LatencyHistogram();
+   LatencyHistogram(const LatencyHistogram&) = delete;
+   LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+   void Record(const uint64_t ns);
+   Snapshot GetSnapshot() const;
+   void Reset();
+
+   static uint64_t Now();
+   static size_t BucketOf(const uint64_t ns);
+   static uint64_t HighestIn(const size_t bucket);
+
+private:
+   std::array<std::atomic<uint64_t>, kBuckets> mBuckets;
+   std::atomic<uint64_t> mCount;
+   std::atomic<uint64_t> mSum;
+   std::atomic<uint64_t> mMin;
+   std::atomic<uint64_t> mMax;
+};
+
+/**
+ * What an endpoint records once EnableLatencyStats is called on it:
+ *   sendBlocked  how long a send waited for the socket to take the message
+ *   receiveWait  how long a receive waited for a message to arrive
+ *   endToEnd     from the sender's timestamp to the receiver, or the round
+ *                trip of a request on the requesting side
+ *
+ * One way senders (Rifle, Shotgun) with stats on add a trailing frame with
+ * the send time to every message. Receivers always take that frame off,
+ * so a sender can turn stats on without its receivers knowing. The time is
+ * CLOCK_MONOTONIC, which all processes on a host share.
+ */
+struct LatencyStats {
+   static const size_t kStampSize = 16;
+
+   static void WriteStamp(void* frame);
+   static bool ReadStamp(const void* frame, const size_t size, uint64_t& sentNs);
+   void RecordStamp(const void* frame, const size_t size);
+
+   LatencyHistogram sendBlocked;
+   LatencyHistogram receiveWait;
+   LatencyHistogram endToEnd;
+};
+
+/**
+ * Times from construction until Stop, for a histogram that may be NULL when
+ * stats are off. Nothing is recorded if Stop is never called, so failed
+ * sends and timed out receives are left out.
+ */
+class LatencyTimer {
+public:
+   explicit LatencyTimer(LatencyHistogram* histogram) :
+   mHistogram(histogram), mStart(histogram ? LatencyHistogram::Now() : 0) {
+   }
+
+   void Stop() {
+      if (mHistogram) {
+         mHistogram->Record(LatencyHistogram::Now() - mStart);
+         mHistogram = NULL;
+      }
+   }
+
+private:
+   LatencyHistogram* mHistogram;
+   const uint64_t mStart;
+};
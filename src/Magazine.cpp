@@ -0,0 +1,108 @@
+#include "Magazine.h"
+#include <g3log/g3log.hpp>
+
+namespace {
+   const size_t kCacheLine = 64;
+   const uint64_t kIndexMask = 0xffffffffULL;
+
+   uint64_t NextHead(const uint64_t head, const uint32_t index) {
+      return (((head >> 32) + 1) << 32) | index;
+   }
+}
+
+/**
+ * Carve out slotCount slots of slotSize bytes, each starting on its own
+ * cache line, all of them free.
+ * @param slotSize
+ * @param slotCount
+ */
+Magazine::Magazine(const size_t slotSize, const uint32_t slotCount) :
+mSlotSize(slotSize),
+mSlotStride(((slotSize + kCacheLine - 1) / kCacheLine) * kCacheLine),
+mSlotCount(slotCount),
+mMemory(new char[(mSlotStride * slotCount) + kCacheLine]),
+mSlab(NULL),
+mNext(new std::atomic<uint32_t>[slotCount]),
+mHead(0) {
+   CHECK(slotSize > 0 && slotCount > 0);
+   const uintptr_t address = reinterpret_cast<uintptr_t> (mMemory.get());
+   mSlab = mMemory.get() + ((kCacheLine - (address % kCacheLine)) % kCacheLine);
+   for (uint32_t i = 0; i < mSlotCount; i++) {
+      // links hold index + 1 so 0 can end the list
+      mNext[i].store((i + 1 < mSlotCount) ? i + 2 : 0, std::memory_order_relaxed);
+   }
+   mHead.store(1, std::memory_order_release);
+}
+
+/**
+ * Take a free slot out of the magazine.
+ * @return
+ *   A slot of GetSlotSize() bytes, NULL if every slot is in flight
+ */
+char* Magazine::Load() {
+   uint64_t head = mHead.load(std::memory_order_acquire);
+   while (true) {
+      const uint32_t index = head & kIndexMask;
+      if (index == 0) {
+         return NULL;
+      }
+      const uint32_t next = mNext[index - 1].load(std::memory_order_relaxed);
+      if (mHead.compare_exchange_weak(head, NextHead(head, next),
+         std::memory_order_acquire, std::memory_order_acquire)) {
+         return mSlab + ((index - 1) * mSlotStride);
+      }
+   }
+}
+
+/**
+ * Put a slot back into the magazine.
+ * @param slot
+ *   Must have come from Load on this magazine
+ */
+void Magazine::Unload(char* slot) {
+   const uint32_t index = SlotIndex(slot);
+   uint64_t head = mHead.load(std::memory_order_relaxed);
+   do {
+      mNext[index].store(head & kIndexMask, std::memory_order_relaxed);
+   } while (!mHead.compare_exchange_weak(head, NextHead(head, index + 1),
+      std::memory_order_release, std::memory_order_relaxed));
+}
+
+/**
+ * @return the usable size of each slot
+ */
+size_t Magazine::GetSlotSize() const {
+   return mSlotSize;
+}
+
+/**
+ * @return the number of slots in the magazine
+ */
+uint32_t Magazine::GetSlotCount() const {
+   return mSlotCount;
+}
+
+/**
+ * @param slot
+ * @return if slot is the start of one of our slots
+ */
+bool Magazine::Owns(const char* slot) const {
+   if (slot < mSlab || slot >= mSlab + (mSlotStride * mSlotCount)) {
+      return false;
+   }
+   return ((slot - mSlab) % mSlotStride) == 0;
+}
+
+/**
+ * zeromq free function, hands a fired slot back to its magazine.
+ * @param slot
+ * @param magazine
+ */
+void Magazine::ZeroCopyRelease(void* slot, void* magazine) {
+   static_cast<Magazine*> (magazine)->Unload(static_cast<char*> (slot));
+}
+
+uint32_t Magazine::SlotIndex(const char* slot) const {
+   CHECK(Owns(slot)) << "Slot does not belong to this magazine";
+   return (slot - mSlab) / mSlotStride;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * A fixed-size slab of equally sized payload slots for FireZeroCopy.
+ *
+ * The producer Loads a slot, fills it and fires it with
+ * Rifle::FireZeroCopy(magazine, slot, size). Once zeromq is done with the
+ * message its IO thread Unloads the slot straight back into the magazine,
+ * so no payload goes through the global allocator.
+ *
+ * Load and Unload are lock free and can be called from any thread. The
+ * magazine has to outlive every slot that has been fired from it.
+ */
+class Magazine {
+public:
+   Magazine(const size_t slotSize, const uint32_t slotCount);
+   Magazine(const Magazine&) = delete;
+   Magazine& operator=(const Magazine&) = delete;
+
+   char* Load();
+   void Unload(char* slot);
+   size_t GetSlotSize() const;
+   uint32_t GetSlotCount() const;
+   bool Owns(const char* slot) const;
+
+   static void ZeroCopyRelease(void* slot, void* magazine);
+
+private:
+   uint32_t SlotIndex(const char* slot) const;
+
+   const size_t mSlotSize;
+   const size_t mSlotStride;
+   const uint32_t mSlotCount;
+   std::unique_ptr<char[]> mMemory;
+   char* mSlab;
+   std::unique_ptr<std::atomic<uint32_t>[]> mNext;
+   // lower 32 bits: index + 1 of the first free slot, 0 when empty
+   // upper 32 bits: tag bumped on every change so a recycled head is never mistaken (ABA)
+   alignas(64) std::atomic<uint64_t> mHead;
+};
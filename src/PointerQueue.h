@@ -0,0 +1,273 @@
+#pragma once
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <g3log/g3log.hpp>
+#include "QAPI.h"
+#include "Rifle.h"
+#include "Vampire.h"
+
+/**
+ * Typed pointer queues that hand over unique_ptr<T> ownership.
+ *
+ * On inproc:// locations the pointers never touch ZeroMQ, both ends share a
+ * QAPI mpmc queue found through a process wide registry, so handing over a
+ * pointer costs no message allocation. Any other location falls back to
+ * FireStake / GetStake on a Rifle / Vampire and the receiver gets the
+ * pointer back typed.
+ *
+ * Either end can be set up first on inproc, the first one decides the queue
+ * size from its high water mark. Pointers still in the queue when the last
+ * end goes away are deleted. A PointerRifle that finds the queue full parks
+ * on the queue's ParkingLot and the PointerVampire wakes it as it takes
+ * pointers out.
+ */
+namespace PointerQueue {
+   const std::string kInproc = "inproc://";
+
+   template <typename T>
+   using Queue = mpmc::flexible_lock_queue<std::unique_ptr<T>>;
+
+   inline bool IsInproc(const std::string& location) {
+      return location.compare(0, kInproc.size(), kInproc) == 0;
+   }
+
+   /**
+    * The queue of an inproc location with the lot its Rifles wait for room
+    * in. The queue has a wait_and_pop of its own, so no Receiver parks on
+    * the lot.
+    */
+   template <typename T>
+   struct Link {
+      explicit Link(const size_t size) : queue(size) {
+      }
+
+      Queue<T> queue;
+      QAPI::ParkingLot lot;
+   };
+
+   /**
+    * Find the queue for an inproc location, creating it if neither end has
+    * been set up yet.
+    */
+   template <typename T>
+   std::shared_ptr<Link<T>> Attach(const std::string& location, const size_t size) {
+      static std::mutex registryMutex;
+      static std::map<std::string, std::weak_ptr<Link<T>>> registry;
+      std::lock_guard<std::mutex> lock(registryMutex);
+      auto link = registry[location].lock();
+      if (!link) {
+         link = std::make_shared<Link<T>>(size);
+         registry[location] = link;
+      }
+      return link;
+   }
+}
+
+template <typename T>
+class PointerRifle {
+public:
+
+   explicit PointerRifle(const std::string& location) :
+   mLocation(location),
+   mHwm(500),
+   mOwnSocket(true) {
+   }
+
+   PointerRifle(const PointerRifle&) = delete;
+   PointerRifle& operator=(const PointerRifle&) = delete;
+
+   /**
+    * Set up the queue, or aim the Rifle for non inproc locations.
+    * @return
+    */
+   bool Aim() {
+      if (mSender || mRifle) {
+         return true;
+      }
+      if (PointerQueue::IsInproc(mLocation)) {
+         auto link = PointerQueue::Attach<T>(mLocation, mHwm);
+         mSender.reset(new QAPI::Sender<PointerQueue::Queue<T>>(
+                 std::shared_ptr<PointerQueue::Queue<T>>(link, &link->queue),
+                 std::shared_ptr<QAPI::ParkingLot>(link, &link->lot)));
+         return true;
+      }
+      std::unique_ptr<Rifle> rifle(new Rifle(mLocation));
+      rifle->SetHighWater(mHwm);
+      rifle->SetOwnSocket(mOwnSocket);
+      if (!rifle->Aim()) {
+         return false;
+      }
+      mRifle = std::move(rifle);
+      return true;
+   }
+
+   /**
+    * Hand over a pointer.
+    * @param stake
+    *   Released on success, still owned by the caller on failure
+    * @param waitToFire in milliseconds, while the queue is full
+    * @return
+    */
+   bool Fire(std::unique_ptr<T>& stake, const int waitToFire = 10000) {
+      if (!stake) {
+         LOG(WARNING) << "Tried to send empty packet";
+         return false;
+      }
+      if (mSender) {
+         if (mSender->push(stake)) {
+            return true;
+         }
+         // full, wait for the PointerVampire to make room
+         const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(waitToFire);
+         return mSender->mParkingLot->Park([this, &stake]() {
+            return mSender->push(stake);
+         }, deadline);
+      }
+      if (!mRifle) {
+         LOG(WARNING) << "Socket uninitialized!";
+         return false;
+      }
+      if (!mRifle->FireStake(stake.get(), waitToFire)) {
+         return false;
+      }
+      stake.release();
+      return true;
+   }
+
+   /**
+    * Set our high water mark, the queue size on inproc. This must be called
+    * before Aim.
+    * @param hwm
+    */
+   void SetHighWater(const int hwm) {
+      mHwm = hwm;
+   }
+
+   int GetHighWater() const {
+      return mHwm;
+   }
+
+   /**
+    * Bind if we own the socket, only used for non inproc locations.
+    * @param own
+    */
+   void SetOwnSocket(const bool own) {
+      mOwnSocket = own;
+   }
+
+   std::string GetBinding() const {
+      return mLocation;
+   }
+
+private:
+   const std::string mLocation;
+   int mHwm;
+   bool mOwnSocket;
+   std::unique_ptr<QAPI::Sender<PointerQueue::Queue<T>>> mSender;
+   std::unique_ptr<Rifle> mRifle;
+};
+
+template <typename T>
+class PointerVampire {
+public:
+
+   explicit PointerVampire(const std::string& location) :
+   mLocation(location),
+   mHwm(250),
+   mOwnSocket(false) {
+   }
+
+   PointerVampire(const PointerVampire&) = delete;
+   PointerVampire& operator=(const PointerVampire&) = delete;
+
+   /**
+    * Set up the queue, or prepare the Vampire for non inproc locations.
+    * @return
+    */
+   bool PrepareToBeShot() {
+      if (mReceiver || mVampire) {
+         return true;
+      }
+      if (PointerQueue::IsInproc(mLocation)) {
+         auto link = PointerQueue::Attach<T>(mLocation, mHwm);
+         mReceiver.reset(new QAPI::Receiver<PointerQueue::Queue<T>>(
+                 std::shared_ptr<PointerQueue::Queue<T>>(link, &link->queue),
+                 std::shared_ptr<QAPI::ParkingLot>(link, &link->lot)));
+         return true;
+      }
+      std::unique_ptr<Vampire> vampire(new Vampire(mLocation));
+      vampire->SetHighWater(mHwm);
+      vampire->SetOwnSocket(mOwnSocket);
+      if (!vampire->PrepareToBeShot()) {
+         return false;
+      }
+      mVampire = std::move(vampire);
+      return true;
+   }
+
+   /**
+    * Take ownership of the next pointer.
+    * @param stake
+    *   Empty if nothing was found
+    * @param timeout in milliseconds
+    * @return
+    *   If something was found
+    */
+   bool GetStake(std::unique_ptr<T>& stake, const int timeout = 1000) {
+      stake.reset();
+      if (mReceiver) {
+         const bool found = (timeout <= 0) ? mReceiver->pop(stake) :
+                 mReceiver->wait_and_pop(stake, std::chrono::milliseconds(timeout));
+         if (found) {
+            // room for a PointerRifle waiting on a full queue
+            mReceiver->mParkingLot->Notify();
+         }
+         return found;
+      }
+      if (!mVampire) {
+         LOG(WARNING) << "Socket uninitialized!";
+         return false;
+      }
+      void* pointer = NULL;
+      if (!mVampire->GetStake(pointer, timeout)) {
+         return false;
+      }
+      stake.reset(static_cast<T*> (pointer));
+      return true;
+   }
+
+   /**
+    * Set our high water mark, the queue size on inproc. This must be called
+    * before PrepareToBeShot.
+    * @param hwm
+    */
+   void SetHighWater(const int hwm) {
+      mHwm = hwm;
+   }
+
+   int GetHighWater() const {
+      return mHwm;
+   }
+
+   /**
+    * Bind if we own the socket, only used for non inproc locations.
+    * @param own
+    */
+   void SetOwnSocket(const bool own) {
+      mOwnSocket = own;
+   }
+
+   std::string GetBinding() const {
+      return mLocation;
+   }
+
+private:
+   const std::string mLocation;
+   int mHwm;
+   bool mOwnSocket;
+   std::unique_ptr<QAPI::Receiver<PointerQueue::Queue<T>>> mReceiver;
+   std::unique_ptr<Vampire> mVampire;
+};
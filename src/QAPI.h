@@ -18,22 +18,279 @@
 
 #include <tuple>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include <TimeStats.h>
 #include <TriggerTimeStats.h>
 #include <q/spsc.hpp>
 #include <q/mpmc.hpp>
 
 namespace QAPI {
+   // How a Receiver waits in wait_and_pop on a queue without its own
+   // wait_and_pop: spin on pop() a few times, then yield a few times, then park
+   // until a Sender pushes. Sleep() is the old behaviour of polling pop()
+   // with a sleep in between, which keeps a core busy with nanosleep calls.
+   struct WaitStrategy {
+      WaitStrategy(const size_t spinCount = 100, const size_t yieldCount = 10)
+         : spins(spinCount)
+         , yields(yieldCount)
+         , park(true)
+         , sleep(0) {
+      }
+
+      static WaitStrategy Sleep(const std::chrono::nanoseconds interval = std::chrono::nanoseconds(100)) {
+         WaitStrategy strategy(0, 0);
+         strategy.park = false;
+         strategy.sleep = interval;
+         return strategy;
+      }
+
+      size_t spins;
+      size_t yields;
+      bool park;
+      std::chrono::nanoseconds sleep;
+   };
+
+
+   // Where Receivers of one queue park. A Sender only takes the lock to
+   // notify when a Receiver is registered as parked, so pushing to a queue
+   // nobody waits on costs one fence and one load. There is one lot per
+   // queue: CreateQueue and handles built from a queue find it with Of(),
+   // copied and borrowed handles share the lot of the handle they came from.
+   class ParkingLot {
+    public:
+      ParkingLot() : mParked(0) {}
+
+      // The lot of a queue, made on first use. Only making a handle from a
+      // queue looks here. A handle owns its queue, so while a lot is alive
+      // the queue at that address is too, and the entry goes with the lot.
+      static std::shared_ptr<ParkingLot> Of(const void* queue) {
+         // never destroyed, a lot may outlive other statics at exit
+         static std::mutex& tableMutex = *new std::mutex;
+         static std::map<const void*, std::weak_ptr<ParkingLot>>& table =
+            *new std::map<const void*, std::weak_ptr<ParkingLot>>;
+         std::lock_guard<std::mutex> lock(tableMutex);
+         auto& entry = table[queue];
+         auto lot = entry.lock();
+         if (!lot) {
+            lot.reset(new ParkingLot, [queue](ParkingLot* gone) {
+               {
+                  std::lock_guard<std::mutex> lock(tableMutex);
+                  auto found = table.find(queue);
+                  if (found != table.end() && found->second.expired()) {
+                     table.erase(found);
+                  }
+               }
+               delete gone;
+            });
+            entry = lot;
+         }
+         return lot;
+      }
+
+      // Park until tryPop succeeds or the deadline passes. The Receiver is
+      // registered before tryPop is tried again, so a push that lands in
+      // between always sees it and notifies.
+      template <typename TryPop>
+      bool Park(TryPop tryPop, const std::chrono::steady_clock::time_point deadline) {
+         std::unique_lock<std::mutex> lock(mMutex);
+         mParked.fetch_add(1);
+         bool result = false;
+         while (!(result = tryPop()) && std::chrono::steady_clock::now() < deadline) {
+            mCondition.wait_until(lock, deadline);
+         }
+         mParked.fetch_sub(1);
+         return result;
+      }
+
+      // Wake as many parked waiters as there are new items, at most all
+      void Notify(const size_t items = 1) {
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         const size_t parked = mParked.load(std::memory_order_relaxed);
+         if (0 == parked) {
+            return;
+         }
+         {
+            std::lock_guard<std::mutex> lock(mMutex);
+         }
+         if (items >= parked) {
+            mCondition.notify_all();
+            return;
+         }
+         for (size_t i = 0; i < items; ++i) {
+            mCondition.notify_one();
+         }
+      }
+
+      size_t Parked() const { return mParked.load(); }
+
+    private:
+      std::atomic<size_t> mParked;
+      std::mutex mMutex;
+      std::condition_variable mCondition;
+   };
+
+
+   // How a Sender / Receiver times its push and pop calls, picked at compile
+   // time with its Stats template parameter. Each policy has a FlushAsString()
+   // and a Trigger that is started on the call and can Skip() a miss.
+   //   Full        every call goes to one TimeStats (the default)
+   //   None        no clock reads at all
+   //   Sampled<N>  one call in N goes to the TimeStats
+   //   Sharded     every call goes to a TimeStats of the calling thread, for
+   //               a Sender or Receiver shared by many threads
+   namespace stats {
+      struct Full : public TimeStats {
+         using Trigger = TriggerTimeStats;
+      };
+
+      struct None {
+         struct Trigger {
+            explicit Trigger(None&) {}
+            void Skip() {}
+         };
+         std::string FlushAsString() { return {}; }
+      };
+
+      // Calls are counted per thread, so threads sharing a Sender do not
+      // contend on the counter. Counts in the stats are 1/N of the calls made
+      template <size_t N>
+      struct Sampled : public TimeStats {
+         static_assert(N > 0, "Sampled<0> would never sample, use None");
+
+         class Trigger {
+          public:
+            explicit Trigger(Sampled& stats) : mTrigger(nullptr) {
+               static thread_local size_t calls = 0;
+               if (0 == (calls++ % N)) {
+                  mTrigger = new (&mStorage) TriggerTimeStats(stats);
+               }
+            }
+            ~Trigger() {
+               if (mTrigger) {
+                  mTrigger->~TriggerTimeStats();
+               }
+            }
+            Trigger(const Trigger&) = delete;
+            Trigger& operator=(const Trigger&) = delete;
+            void Skip() {
+               if (mTrigger) {
+                  mTrigger->Skip();
+               }
+            }
+
+          private:
+            typename std::aligned_storage<sizeof(TriggerTimeStats), alignof(TriggerTimeStats)>::type mStorage;
+            TriggerTimeStats* mTrigger;
+         };
+      };
+
+      // One TimeStats per calling thread. A thread finds its own through a
+      // thread local cache and only takes the lock the first time it calls,
+      // or when it goes back and forth between Sharded instances.
+      // A copy starts out with no shards.
+      class Sharded {
+       public:
+         Sharded() : mId(NextId()) {}
+         Sharded(const Sharded&) : mId(NextId()) {}
+         Sharded& operator=(const Sharded&) { return *this; }
+
+         struct Trigger : public TriggerTimeStats {
+            explicit Trigger(Sharded& stats) : TriggerTimeStats(stats.Local()) {}
+         };
+
+         std::string FlushAsString() {
+            std::lock_guard<std::mutex> lock(mMutex);
+            std::string flushed;
+            for (auto& shard : mShards) {
+               flushed += shard->FlushAsString();
+            }
+            return flushed;
+         }
+
+         size_t Shards() {
+            std::lock_guard<std::mutex> lock(mMutex);
+            return mShards.size();
+         }
+
+       private:
+         struct Cached {
+            uint64_t id;
+            TimeStats* stats;
+         };
+
+         static uint64_t NextId() {
+            static std::atomic<uint64_t> ids{1};
+            return ids.fetch_add(1, std::memory_order_relaxed);
+         }
+
+         TimeStats& Local() {
+            static thread_local Cached cached = {0, nullptr};
+            if (cached.id != mId) {
+               cached = {mId, &Find(std::this_thread::get_id())};
+            }
+            return *cached.stats;
+         }
+
+         TimeStats& Find(const std::thread::id thread) {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto& shard = mThreads[thread];
+            if (!shard) {
+               mShards.push_back(std::make_shared<TimeStats>());
+               shard = mShards.back();
+            }
+            return *shard;
+         }
+
+         const uint64_t mId;
+         std::mutex mMutex;
+         std::map<std::thread::id, std::shared_ptr<TimeStats>> mThreads;
+         std::vector<std::shared_ptr<TimeStats>> mShards;
+      };
+   } // stats
+
+
+   // Handles used by different threads keep their written state (the stats)
+   // a cache line apart so they don't invalidate each other's
+   const size_t kCacheLine = 64;
+
+   // Tag for a handle that does not own the queue, see Sender::Borrow()
+   struct Borrowed {};
+
    // Base Queue API without pop() and push()
    // This follows the 'tail' first design on FIFO
    // http://en.wikipedia.org/wiki/FIFO#Head_or_tail_first
    // This implementation follows "pop on head", "push on tail"
+   // Handles made from the same queue share its ParkingLot unless they are
+   // given one, so a Sender wakes the Receivers parked on its queue
    template<typename QType>
    struct Base {
-      Base(std::shared_ptr<QType> q)
+      Base(std::shared_ptr<QType> q, std::shared_ptr<ParkingLot> lot)
          : mQueueStorage(q)
-         , mQueueRef(*(q.get())) {
+         , mQueueRef(*(q.get()))
+         , mParkingLot(lot ? lot : ParkingLot::Of(q.get())) {
+      }
+
+      // A handle on the queue of owner that does not take part in owning it.
+      // The pointers alias an empty owner, so neither making this handle nor
+      // copying it touches a reference count. The owner must outlive it
+      Base(const Base& owner, Borrowed)
+         : mQueueStorage(std::shared_ptr<QType>(), owner.mQueueStorage.get())
+         , mQueueRef(owner.mQueueRef)
+         , mParkingLot(std::shared_ptr<ParkingLot>(), owner.mParkingLot.get()) {
       }
+
+      bool owner() const { return mQueueStorage.use_count() > 0; }
       bool empty() const { return mQueueRef.empty();}
       bool full() const { return mQueueRef.full(); }
       size_t capacity() const { return mQueueRef.capacity(); }
@@ -46,26 +303,7 @@ namespace QAPI {
 
       std::shared_ptr<QType> mQueueStorage;
       QType& mQueueRef;
-   };
-
-
-   // push() + base Queue API
-   template<typename QType>
-   struct Sender : public Base<QType> {
-    public:
-      Sender(std::shared_ptr<QType> q): Base<QType>(q) {}
-      virtual ~Sender() = default;
-
-      template<typename Element>
-      bool push(Element& item) {
-         TriggerTimeStats trigger(mStats);
-         auto result = Base<QType>::mQueueRef.push(item);
-         if (!result) {
-            trigger.Skip();
-         }
-         return result;
-      }
-      TimeStats mStats;
+      std::shared_ptr<ParkingLot> mParkingLot;
    };
 
 
@@ -73,56 +311,193 @@ namespace QAPI {
       // SFINAE: Substitution Failure Is Not An Error
       // Decide at compile time what function signature to use
       // 1. If 'wait_and_pop' exists in the queue it uses that
-      // 2. If only 'pop' exists it implements 'wait_and_pop' expected
-      // -- FYI: The wait is set to increments of 100 ns
+      // 2. If only 'pop' exists it implements 'wait_and_pop' with a WaitStrategy
+      template <typename T, typename Element, typename = void>
+      struct native_wait : std::false_type {};
+
+      template <typename T, typename Element>
+      struct native_wait<T, Element, decltype(void(std::declval<T&>().wait_and_pop(
+         std::declval<Element&>(), std::declval<std::chrono::milliseconds>())))> : std::true_type {};
+
       template <typename T, typename Element>
-      bool wrapper(T& t, Element& e, std::chrono::milliseconds max_wait) {
-         using milliseconds = std::chrono::milliseconds;
+      bool wrapper(T& t, Element& e, std::chrono::milliseconds max_wait,
+                   const WaitStrategy& strategy, ParkingLot& lot) {
          using clock = std::chrono::steady_clock;
-         using namespace std::chrono_literals;
-         auto t1 = clock::now();
-         bool result = false;
-         while (!(result = t.pop(e))) {
-            std::this_thread::sleep_for(100ns);
-            auto elapsed_ms = std::chrono::duration_cast<milliseconds>(clock::now() - t1);
-            if (elapsed_ms > max_wait) {
-               return result;
+         if (t.pop(e)) {
+            return true;
+         }
+         const auto deadline = clock::now() + max_wait;
+         for (size_t i = 0; i < strategy.spins; ++i) {
+            if (t.pop(e)) {
+               return true;
             }
          }
-         return result;
+         for (size_t i = 0; i < strategy.yields; ++i) {
+            std::this_thread::yield();
+            if (t.pop(e)) {
+               return true;
+            }
+         }
+         if (strategy.park) {
+            return lot.Park([&]() { return t.pop(e); }, deadline);
+         }
+         while (clock::now() <= deadline) {
+            std::this_thread::sleep_for(strategy.sleep);
+            if (t.pop(e)) {
+               return true;
+            }
+         }
+         return false;
       }
 
       template <typename T, typename Element>
-      auto match_call(T& t, Element& e, std::chrono::milliseconds ms, int) -> decltype( t.wait_and_pop(e, ms) )
+      auto match_call(T& t, Element& e, std::chrono::milliseconds ms, const WaitStrategy&, ParkingLot&, int)
+         -> decltype( t.wait_and_pop(e, ms) )
       { return t.wait_and_pop(e, ms); }
 
       template <typename T, typename Element>
-      auto match_call(T& t, Element& e, std::chrono::milliseconds ms, long) -> decltype( wrapper(t, e, ms) )
-      { return wrapper(t, e, ms); }
+      auto match_call(T& t, Element& e, std::chrono::milliseconds ms, const WaitStrategy& strategy,
+                      ParkingLot& lot, long) -> decltype( wrapper(t, e, ms, strategy, lot) )
+      { return wrapper(t, e, ms, strategy, lot); }
 
       template <typename T, typename Element>
-      int wait_and_pop (T& t, Element& e, std::chrono::milliseconds ms) {
+      int wait_and_pop (T& t, Element& e, std::chrono::milliseconds ms,
+                        const WaitStrategy& strategy, ParkingLot& lot) {
          // SFINAE magic happens with the '0'.  
          // For the matching call the '0' will be typed to int. 
          // For non-matching call it will be typed to long
-         return match_call(t, e, ms, 0);
+         return match_call(t, e, ms, strategy, lot, 0);
+      }
+
+
+      // The element type of the queues, needed to pop into when the queue
+      // has no pop_bulk of its own
+      template <typename T>
+      struct element_of;
+
+      template <template <typename...> class Q, typename Element, typename... Rest>
+      struct element_of<Q<Element, Rest...>> { using type = Element; };
+
+      template <template <typename, size_t> class Q, typename Element, size_t Size>
+      struct element_of<Q<Element, Size>> { using type = Element; };
+
+      // Bulk transfer: 'push_bulk' / 'pop_bulk' if the queue has them,
+      // otherwise one push / pop at a time until the queue is full / empty
+      template <typename T, typename Iterator>
+      auto match_push_bulk(T& t, Iterator first, Iterator last, int) -> decltype( t.push_bulk(first, last) )
+      { return t.push_bulk(first, last); }
+
+      template <typename T, typename Iterator>
+      size_t match_push_bulk(T& t, Iterator first, Iterator last, long) {
+         size_t pushed = 0;
+         for (; first != last && t.push(*first); ++first) {
+            ++pushed;
+         }
+         return pushed;
+      }
+
+      template <typename T, typename OutputIt>
+      auto match_pop_bulk(T& t, OutputIt out, size_t max_count, int) -> decltype( t.pop_bulk(out, max_count) )
+      { return t.pop_bulk(out, max_count); }
+
+      template <typename T, typename OutputIt>
+      size_t match_pop_bulk(T& t, OutputIt out, size_t max_count, long) {
+         typename element_of<T>::type element;
+         size_t popped = 0;
+         while (popped < max_count && t.pop(element)) {
+            *out = std::move(element);
+            ++out;
+            ++popped;
+         }
+         return popped;
+      }
+
+      template <typename T, typename Iterator>
+      size_t push_bulk(T& t, Iterator first, Iterator last) {
+         return match_push_bulk(t, first, last, 0);
+      }
+
+      template <typename T, typename OutputIt>
+      size_t pop_bulk(T& t, OutputIt out, size_t max_count) {
+         return match_pop_bulk(t, out, max_count, 0);
       }
    } // sfinae
 
 
+   // push() + base Queue API
+   template<typename QType, typename Stats = stats::Full>
+   struct Sender : public Base<QType> {
+    public:
+      Sender(std::shared_ptr<QType> q, std::shared_ptr<ParkingLot> lot = nullptr)
+         : Base<QType>(q, lot) {}
+      Sender(const Sender& owner, Borrowed tag): Base<QType>(owner, tag) {}
+      virtual ~Sender() = default;
+
+      // A non-owning handle with stats of its own, for a thread to push with
+      // while this Sender keeps the queue alive
+      Sender Borrow() const { return Sender(*this, Borrowed{}); }
+
+      template<typename Element>
+      bool push(Element& item) {
+         typename Stats::Trigger trigger(mStats);
+         auto result = Base<QType>::mQueueRef.push(item);
+         if (!result) {
+            trigger.Skip();
+         } else if (!sfinae::native_wait<QType, Element>::value) {
+            // queues with their own wait_and_pop wake their own waiters
+            Base<QType>::mParkingLot->Notify();
+         }
+         return result;
+      }
+
+      // Push [first, last) in order until the queue is full. Time stats are
+      // taken once for the whole batch, which wakes up to one parked
+      // Receiver per pushed item.
+      // Returns how many were pushed, counted from first
+      template<typename Iterator>
+      size_t push_bulk(Iterator first, Iterator last) {
+         using Element = typename std::iterator_traits<Iterator>::value_type;
+         typename Stats::Trigger trigger(mStats);
+         const size_t pushed = sfinae::push_bulk(Base<QType>::mQueueRef, first, last);
+         if (0 == pushed) {
+            trigger.Skip();
+         } else if (!sfinae::native_wait<QType, Element>::value) {
+            Base<QType>::mParkingLot->Notify(pushed);
+         }
+         return pushed;
+      }
+    private:
+      char mPadding[kCacheLine];
+    public:
+      Stats mStats;
+    private:
+      char mTailPadding[kCacheLine];
+   };
+
+
 
    // pop(), wait_and_pop + base Queue API
    // if the QType does not support wait_and_pop then 
-   // it will follow the sfinae::wrapper's wait_and_pop implementation
-   template<typename QType>
+   // it will follow the sfinae::wrapper's wait_and_pop implementation,
+   // waiting as told by the WaitStrategy
+   template<typename QType, typename Stats = stats::Full>
    struct Receiver : public Base<QType> {
     public:
-      Receiver(std::shared_ptr<QType> q) :  Base<QType>(q) {}
+      Receiver(std::shared_ptr<QType> q, std::shared_ptr<ParkingLot> lot = nullptr)
+         : Base<QType>(q, lot) {}
+      Receiver(const Receiver& owner, Borrowed tag) : Base<QType>(owner, tag), mStrategy(owner.mStrategy) {}
       virtual ~Receiver() = default;
 
+      // A non-owning handle with stats of its own, for a thread to pop with
+      // while this Receiver keeps the queue alive
+      Receiver Borrow() const { return Receiver(*this, Borrowed{}); }
+
+      void SetWaitStrategy(const WaitStrategy& strategy) { mStrategy = strategy; }
+      const WaitStrategy& GetWaitStrategy() const { return mStrategy; }
+
       template<typename Element>
       bool pop(Element& item) {
-         TriggerTimeStats trigger(mStats);
+         typename Stats::Trigger trigger(mStats);
          auto result =  Base<QType>::mQueueRef.pop(item);
          if (!result) {
             trigger.Skip();
@@ -130,23 +505,43 @@ namespace QAPI {
          return result;
       }
 
+      // Pop up to max_count elements into out without waiting. Time stats are
+      // taken once for the whole batch. Returns how many were popped
+      template<typename OutputIt>
+      size_t pop_bulk(OutputIt out, const size_t max_count) {
+         typename Stats::Trigger trigger(mStats);
+         const size_t popped = sfinae::pop_bulk(Base<QType>::mQueueRef, out, max_count);
+         if (0 == popped) {
+            trigger.Skip();
+         }
+         return popped;
+      }
+
       template<typename Element>
       bool wait_and_pop(Element& item, const std::chrono::milliseconds wait_ms) {
-         TriggerTimeStats trigger(mStats);
-         auto result = sfinae::wait_and_pop(Base<QType>::mQueueRef, item, wait_ms);
+         typename Stats::Trigger trigger(mStats);
+         auto result = sfinae::wait_and_pop(Base<QType>::mQueueRef, item, wait_ms,
+                                            mStrategy, *(Base<QType>::mParkingLot));
          if (!result) {
             trigger.Skip();
          }
          return result;
       }
-      TimeStats mStats;
+    private:
+      char mPadding[kCacheLine];
+    public:
+      Stats mStats;
+      WaitStrategy mStrategy;
+    private:
+      char mTailPadding[kCacheLine];
    };  
 
 
-   template<typename QType, typename... Args>
-   std::pair<Sender<QType>, Receiver<QType>> CreateQueue(Args&& ... args) {
+   template<typename QType, typename Stats = stats::Full, typename... Args>
+   std::pair<Sender<QType, Stats>, Receiver<QType, Stats>> CreateQueue(Args&& ... args) {
       std::shared_ptr<QType> ptr = std::make_shared<QType>(std::forward< Args >(args)...);
-      return std::make_pair(Sender<QType> {ptr}, Receiver<QType> {ptr});
+      auto lot = ParkingLot::Of(ptr.get());
+      return std::make_pair(Sender<QType, Stats> {ptr, lot}, Receiver<QType, Stats> {ptr, lot});
    }
 
    enum index {sender = 0, receiver = 1};
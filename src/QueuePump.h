@@ -0,0 +1,145 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <g3log/g3log.hpp>
+#include "QAPI.h"
+#include "Rifle.h"
+
+namespace QueuePumpTiming {
+   // how long an empty queue is waited on before Stop is checked again
+   const std::chrono::milliseconds kIdleWait(10);
+   // how long a batch waits for the Rifle's socket
+   const int kWaitToFireMs = 100;
+}
+
+/**
+ * Drains a local QAPI queue of strings into a Rifle on a thread of its own,
+ * so a stage can hand its output to another process without waiting on
+ * the socket.
+ *
+ *    auto queue = QAPI::CreateQueue<spsc::flexible::circular_fifo<std::string>>(size);
+ *    Rifle rifle("ipc:///tmp/stage.ipc");
+ *    QueuePump<spsc::flexible::circular_fifo<std::string>> pump(std::get<QAPI::index::receiver>(queue), rifle);
+ *    pump.Start();
+ *
+ * What is waiting is taken with one pop_bulk and sent with one FireBatch,
+ * up to batchSize at a time, so the pump keeps up by sending bigger batches
+ * as the queue fills. When the queue is empty the pump waits in
+ * wait_and_pop. Once started the Rifle belongs to the pump thread.
+ * Stop sends what is still in the queue before it returns, as long as the
+ * Rifle takes it.
+ */
+template <typename QType, typename Stats = QAPI::stats::Full>
+class QueuePump {
+public:
+
+   QueuePump(const QAPI::Receiver<QType, Stats>& receiver, Rifle& rifle, const size_t batchSize = 256) :
+   mReceiver(receiver),
+   mRifle(rifle),
+   mBatchSize(batchSize),
+   mStop(false),
+   mPumped(0) {
+   }
+
+   ~QueuePump() {
+      Stop();
+   }
+
+   QueuePump(const QueuePump&) = delete;
+   QueuePump& operator=(const QueuePump&) = delete;
+
+   /**
+    * Aim the Rifle and start pumping.
+    * @return
+    *   false if the Rifle could not be aimed
+    */
+   bool Start() {
+      if (mThread.joinable()) {
+         return true;
+      }
+      if (!mRifle.Aim()) {
+         LOG(WARNING) << "QueuePump can't aim at " << mRifle.GetBinding();
+         return false;
+      }
+      mStop.store(false);
+      mThread = std::thread(&QueuePump::Run, this);
+      return true;
+   }
+
+   /**
+    * Send what is left in the queue and stop pumping.
+    */
+   void Stop() {
+      if (!mThread.joinable()) {
+         return;
+      }
+      mStop.store(true);
+      mThread.join();
+   }
+
+   /**
+    * @return how many strings were fired
+    */
+   uint64_t GetPumped() const {
+      return mPumped.load(std::memory_order_relaxed);
+   }
+
+private:
+
+   void Run() {
+      std::vector<std::string> batch;
+      batch.reserve(mBatchSize);
+      while (!mStop.load()) {
+         if (!Fill(batch)) {
+            std::string first;
+            if (mReceiver.wait_and_pop(first, QueuePumpTiming::kIdleWait)) {
+               batch.push_back(std::move(first));
+               Fill(batch);
+            }
+         }
+         Fire(batch);
+      }
+      // drain, until the queue is empty or the Rifle stops taking more
+      while (Fill(batch) && Fire(batch)) {
+      }
+   }
+
+   /**
+    * Top the batch up with what is waiting, without waiting for more.
+    * @return
+    *   false if the batch is empty
+    */
+   bool Fill(std::vector<std::string>& batch) {
+      if (batch.size() < mBatchSize) {
+         mReceiver.pop_bulk(std::back_inserter(batch), mBatchSize - batch.size());
+      }
+      return !batch.empty();
+   }
+
+   /**
+    * Fire the batch, what the Rifle did not take stays for the next try.
+    * @return
+    *   false if nothing could be fired
+    */
+   bool Fire(std::vector<std::string>& batch) {
+      if (batch.empty()) {
+         return true;
+      }
+      const size_t fired = mRifle.FireBatch(batch, QueuePumpTiming::kWaitToFireMs);
+      batch.erase(batch.begin(), batch.begin() + fired);
+      mPumped.fetch_add(fired, std::memory_order_relaxed);
+      return fired > 0;
+   }
+
+   QAPI::Receiver<QType, Stats> mReceiver;
+   Rifle& mRifle;
+   const size_t mBatchSize;
+   std::atomic<bool> mStop;
+   std::atomic<uint64_t> mPumped;
+   std::thread mThread;
+};
@@ -7,6 +7,14 @@ using namespace std;
 ReceiveDpiMsgLRZMQ::ReceiveDpiMsgLRZMQ(const std::string& binding) :
       Vampire(binding) {
 
+}
+
+/**
+ * Construct on a shared context, see ContextPool.
+ */
+ReceiveDpiMsgLRZMQ::ReceiveDpiMsgLRZMQ(zctx_t* context, const std::string& binding) :
+      Vampire(binding, context) {
+
 }
 bool ReceiveDpiMsgLRZMQ::Initialize() {
    return Vampire::PrepareToBeShot();
@@ -15,6 +23,14 @@ bool ReceiveDpiMsgLRZMQ::ReceiveDataBlock(std::string& data,const int timeout) {
    return Vampire::GetShot(data,timeout);
 }
 
+/**
+ * Receive a data block without copying it, the data is only valid until the
+ * next receive.
+ */
+bool ReceiveDpiMsgLRZMQ::ReceiveDataBlock(const char*& data, size_t& size, const int timeout) {
+   return Vampire::GetShotView(data, size, timeout);
+}
+
 /**
  * This must be called before initialize.
  * @param size
@@ -5,8 +5,10 @@
 class ReceiveDpiMsgLRZMQ: public Vampire {
 public:
    explicit ReceiveDpiMsgLRZMQ(const std::string& binding);
+   ReceiveDpiMsgLRZMQ(zctx_t* context, const std::string& binding);
    bool Initialize();
    bool ReceiveDataBlock(std::string& wound,const int timeout);
+   bool ReceiveDataBlock(const char*& wound, size_t& size, const int timeout);
    void SetQueueSize(const int size);
 protected:
 };
@@ -0,0 +1,502 @@
+#include <utility>
+
+#include "RequestTable.h"
+
+namespace {
+   const size_t kInitialIndexSize = 16;
+   const size_t kUuidSize = 36;
+
+   uint64_t Mix(uint64_t bits) {
+      bits ^= bits >> 30;
+      bits *= 0xbf58476d1ce4e5b9ULL;
+      bits ^= bits >> 27;
+      bits *= 0x94d049bb133111ebULL;
+      bits ^= bits >> 31;
+      return bits;
+   }
+
+   uint64_t Fnv1a(const std::string& text, uint64_t hash) {
+      for (const unsigned char byte : text) {
+         hash ^= byte;
+         hash *= 0x100000001b3ULL;
+      }
+      return hash;
+   }
+
+   int HexValue(const char digit) {
+      if (digit >= '0' && digit <= '9') {
+         return digit - '0';
+      }
+      if (digit >= 'a' && digit <= 'f') {
+         return digit - 'a' + 10;
+      }
+      return -1;
+   }
+
+   bool IsDash(const size_t position) {
+      return 8 == position || 13 == position || 18 == position || 23 == position;
+   }
+
+   /**
+    * Parse a lower case uuid, as boost writes it, into its 128 bits
+    */
+   bool ParseUuid(const std::string& text, uint64_t& high, uint64_t& low) {
+      if (kUuidSize != text.size()) {
+         return false;
+      }
+      uint64_t words[2] = {0, 0};
+      size_t nibble = 0;
+      for (size_t i = 0; i < kUuidSize; ++i) {
+         if (IsDash(i)) {
+            if ('-' != text[i]) {
+               return false;
+            }
+            continue;
+         }
+         const int value = HexValue(text[i]);
+         if (value < 0) {
+            return false;
+         }
+         uint64_t& word = words[nibble / 16];
+         word = (word << 4) | static_cast<uint64_t>(value);
+         ++nibble;
+      }
+      high = words[0];
+      low = words[1];
+      return true;
+   }
+}
+
+/**
+ * @param id
+ *   Any id given to BoomStick::SendAsync
+ * @return
+ *   The uuid bits of a canonical uuid, a 128 bit hash of anything else
+ */
+RequestId RequestId::FromString(const std::string& id) {
+   RequestId parsed;
+   if (ParseUuid(id, parsed.high, parsed.low)) {
+      return parsed;
+   }
+   parsed.high = Mix(Fnv1a(id, 0x84222325cbf29ce4ULL) ^ id.size());
+   parsed.low = Fnv1a(id, 0xcbf29ce484222325ULL);
+   return parsed;
+}
+
+const size_t RequestId::kSize;
+
+/**
+ * @param bytes
+ *   kSize bytes, as ToBytes wrote them
+ * @return
+ */
+RequestId RequestId::FromBytes(const void* bytes) {
+   const uint8_t* raw = static_cast<const uint8_t*> (bytes);
+   RequestId id;
+   for (size_t i = 0; i < kSize / 2; ++i) {
+      id.high = (id.high << 8) | raw[i];
+      id.low = (id.low << 8) | raw[kSize / 2 + i];
+   }
+   return id;
+}
+
+/**
+ * @param bytes
+ *   Room for kSize bytes
+ */
+void RequestId::ToBytes(void* bytes) const {
+   uint8_t* raw = static_cast<uint8_t*> (bytes);
+   for (size_t i = 0; i < kSize / 2; ++i) {
+      const unsigned shift = 56 - 8 * i;
+      raw[i] = static_cast<uint8_t> (high >> shift);
+      raw[kSize / 2 + i] = static_cast<uint8_t> (low >> shift);
+   }
+}
+
+/**
+ * @return the id in uuid format, for logging
+ */
+std::string RequestId::ToString() const {
+   static const char kDigits[] = "0123456789abcdef";
+   std::string text;
+   text.reserve(kUuidSize);
+   const uint64_t words[2] = {high, low};
+   size_t nibble = 0;
+   for (size_t i = 0; i < kUuidSize; ++i) {
+      if (IsDash(i)) {
+         text.push_back('-');
+         continue;
+      }
+      const uint64_t word = words[nibble / 16];
+      const unsigned shift = 60 - 4 * (nibble % 16);
+      text.push_back(kDigits[(word >> shift) & 0xf]);
+      ++nibble;
+   }
+   return text;
+}
+
+const uint32_t RequestTable::kNone;
+
+/**
+ * @param timeoutSeconds
+ *   How long a request is kept after it was sent, with or without a reply
+ */
+RequestTable::RequestTable(const time_t timeoutSeconds) :
+mTimeout(timeoutSeconds),
+mIndex(kInitialIndexSize, kNone),
+mWheel(static_cast<size_t>(timeoutSeconds) + 2, kNone),
+mNextTick(0),
+mSize(0),
+mReplies(0) {
+}
+
+/**
+ * Start waiting on a request
+ * @param id
+ * @param sentAt
+ *   When it was sent, in seconds
+ * @param sentNs
+ *   When it was sent on the latency clock, 0 when not timed
+ * @param onReply
+ *   Called by whoever reads the reply, see TakeCallback, instead of keeping
+ *   the reply in the table
+ * @return
+ *   false if the id is already pending
+ */
+bool RequestTable::Insert(const RequestId& id, const time_t sentAt, const uint64_t sentNs,
+        ReplyCallback onReply) {
+   if (kNone != FindIndex(id)) {
+      return false;
+   }
+   if ((mSize + 1) * 2 > mIndex.size()) {
+      Grow();
+   }
+   const uint32_t entry = Allocate();
+   Entry& added = mEntries[entry];
+   added.id = id;
+   added.sentAt = sentAt;
+   added.sentNs = sentNs;
+   added.onReply = std::move(onReply);
+   added.hasReply = false;
+   added.used = true;
+
+   const size_t mask = mIndex.size() - 1;
+   size_t slot = Home(id);
+   while (kNone != mIndex[slot]) {
+      slot = (slot + 1) & mask;
+   }
+   mIndex[slot] = entry;
+   LinkToWheel(entry);
+   ++mSize;
+   return true;
+}
+
+/**
+ * @param id
+ * @return if the request is pending, replied to or not
+ */
+bool RequestTable::Contains(const RequestId& id) const {
+   return kNone != FindIndex(id);
+}
+
+/**
+ * @param id
+ * @return if the request is pending and its reply is waiting to be taken
+ */
+bool RequestTable::HasReply(const RequestId& id) const {
+   const uint32_t entry = FindIndex(id);
+   return kNone != entry && mEntries[entry].hasReply;
+}
+
+/**
+ * Keep a reply that was read while waiting for another
+ * @param id
+ * @param reply
+ * @return
+ *   false if the request is not pending, the reply is not kept
+ */
+bool RequestTable::SetReply(const RequestId& id, const std::string& reply) {
+   const uint32_t entry = FindIndex(id);
+   if (kNone == entry) {
+      return false;
+   }
+   Entry& found = mEntries[entry];
+   if (!found.hasReply) {
+      found.hasReply = true;
+      ++mReplies;
+   }
+   found.reply = reply;
+   return true;
+}
+
+/**
+ * Take a kept reply, the request is done with
+ * @param id
+ * @param reply
+ * @return
+ *   false if there is no reply for the request yet
+ */
+bool RequestTable::TakeReply(const RequestId& id, std::string& reply) {
+   const uint32_t entry = FindIndex(id);
+   if (kNone == entry || !mEntries[entry].hasReply) {
+      return false;
+   }
+   reply.swap(mEntries[entry].reply);
+   Remove(entry);
+   return true;
+}
+
+/**
+ * Take the send time of a request, it is only given out once
+ * @param id
+ * @param sentNs
+ * @return
+ *   false if the request is not pending or was not timed
+ */
+bool RequestTable::TakeSentNs(const RequestId& id, uint64_t& sentNs) {
+   const uint32_t entry = FindIndex(id);
+   if (kNone == entry || 0 == mEntries[entry].sentNs) {
+      return false;
+   }
+   sentNs = mEntries[entry].sentNs;
+   mEntries[entry].sentNs = 0;
+   return true;
+}
+
+/**
+ * Take the callback of a request that was inserted with one, the request
+ * is done with.
+ * @param id
+ * @param onReply
+ * @return
+ *   false if the request is not pending or has no callback
+ */
+bool RequestTable::TakeCallback(const RequestId& id, ReplyCallback& onReply) {
+   const uint32_t entry = FindIndex(id);
+   if (kNone == entry || !mEntries[entry].onReply) {
+      return false;
+   }
+   onReply.swap(mEntries[entry].onReply);
+   Remove(entry);
+   return true;
+}
+
+/**
+ * Stop waiting on a request
+ * @param id
+ * @return
+ *   false if it was not pending
+ */
+bool RequestTable::Erase(const RequestId& id) {
+   const uint32_t entry = FindIndex(id);
+   if (kNone == entry) {
+      return false;
+   }
+   Remove(entry);
+   return true;
+}
+
+/**
+ * Drop every request sent at least the timeout before now. Only the wheel
+ * slots that came due since the last call are walked. A request sent at a
+ * time the wheel has already passed, when the clock went back, is dropped
+ * when the wheel comes round to it again.
+ * @param now
+ * @param expiredReplies
+ *   How many of the dropped requests had a reply nobody took
+ * @param expiredCallbacks
+ *   Gets the callbacks of dropped requests, for the caller to fail them
+ *   once the table is consistent again
+ * @return
+ *   How many requests were dropped
+ */
+size_t RequestTable::Expire(const time_t now, size_t& expiredReplies, std::vector<ReplyCallback>* expiredCallbacks) {
+   expiredReplies = 0;
+   const time_t cutoff = now - mTimeout;
+   const time_t span = static_cast<time_t>(mWheel.size());
+   if (mNextTick > cutoff + span) {
+      // the clock went back further than the wheel reaches
+      mNextTick = 0;
+   }
+   time_t first = mNextTick;
+   if (0 == first || cutoff - first >= span) {
+      first = cutoff - span + 1;
+   }
+   size_t expired = 0;
+   for (time_t tick = first; tick <= cutoff; ++tick) {
+      uint32_t entry = mWheel[WheelSlot(tick)];
+      while (kNone != entry) {
+         const uint32_t next = mEntries[entry].wheelNext;
+         if (mEntries[entry].sentAt <= cutoff) {
+            if (mEntries[entry].hasReply) {
+               ++expiredReplies;
+            }
+            if (expiredCallbacks && mEntries[entry].onReply) {
+               expiredCallbacks->push_back(std::move(mEntries[entry].onReply));
+            }
+            Remove(entry);
+            ++expired;
+         }
+         entry = next;
+      }
+   }
+   if (cutoff >= first) {
+      mNextTick = cutoff + 1;
+   }
+
+   // give the memory of a burst back once it has drained
+   if (0 == mSize && !mEntries.empty()) {
+      std::vector<Entry>().swap(mEntries);
+      std::vector<uint32_t>().swap(mFree);
+   }
+   if (mIndex.size() > kInitialIndexSize && mSize * 8 < mIndex.size()) {
+      size_t size = kInitialIndexSize;
+      while (size < mSize * 4) {
+         size *= 2;
+      }
+      std::vector<uint32_t> index(size, kNone);
+      mIndex.swap(index);
+      for (uint32_t entry = 0; entry < mEntries.size(); ++entry) {
+         if (mEntries[entry].used) {
+            size_t slot = Home(mEntries[entry].id);
+            while (kNone != mIndex[slot]) {
+               slot = (slot + 1) & (size - 1);
+            }
+            mIndex[slot] = entry;
+         }
+      }
+   }
+   return expired;
+}
+
+/**
+ * Visit every pending request
+ * @param visit
+ */
+void RequestTable::ForEach(const std::function<void(const RequestId&, bool hasReply)>& visit) const {
+   for (const Entry& entry : mEntries) {
+      if (entry.used) {
+         visit(entry.id, entry.hasReply);
+      }
+   }
+}
+
+void RequestTable::swap(RequestTable& other) {
+   std::swap(mTimeout, other.mTimeout);
+   mEntries.swap(other.mEntries);
+   mFree.swap(other.mFree);
+   mIndex.swap(other.mIndex);
+   mWheel.swap(other.mWheel);
+   std::swap(mNextTick, other.mNextTick);
+   std::swap(mSize, other.mSize);
+   std::swap(mReplies, other.mReplies);
+}
+
+size_t RequestTable::Home(const RequestId& id) const {
+   return static_cast<size_t>(Mix(id.high ^ Mix(id.low))) & (mIndex.size() - 1);
+}
+
+uint32_t RequestTable::FindIndex(const RequestId& id) const {
+   const size_t mask = mIndex.size() - 1;
+   for (size_t slot = Home(id); kNone != mIndex[slot]; slot = (slot + 1) & mask) {
+      if (mEntries[mIndex[slot]].id == id) {
+         return mIndex[slot];
+      }
+   }
+   return kNone;
+}
+
+uint32_t RequestTable::Allocate() {
+   if (!mFree.empty()) {
+      const uint32_t entry = mFree.back();
+      mFree.pop_back();
+      return entry;
+   }
+   mEntries.emplace_back();
+   return static_cast<uint32_t>(mEntries.size() - 1);
+}
+
+void RequestTable::Remove(const uint32_t entry) {
+   RemoveFromIndex(entry);
+   UnlinkFromWheel(entry);
+   Entry& removed = mEntries[entry];
+   if (removed.hasReply) {
+      --mReplies;
+   }
+   std::string().swap(removed.reply);
+   removed.onReply = nullptr;
+   removed.hasReply = false;
+   removed.used = false;
+   mFree.push_back(entry);
+   --mSize;
+}
+
+/**
+ * Take an entry out of the index and shift the probe chain behind it back,
+ * so lookups never need tombstones.
+ */
+void RequestTable::RemoveFromIndex(const uint32_t entry) {
+   const size_t mask = mIndex.size() - 1;
+   size_t hole = Home(mEntries[entry].id);
+   while (entry != mIndex[hole]) {
+      hole = (hole + 1) & mask;
+   }
+   size_t slot = hole;
+   while (true) {
+      slot = (slot + 1) & mask;
+      if (kNone == mIndex[slot]) {
+         break;
+      }
+      const size_t home = Home(mEntries[mIndex[slot]].id);
+      const bool reachable = (hole <= slot) ? (hole < home && home <= slot) : (hole < home || home <= slot);
+      if (reachable) {
+         continue;
+      }
+      mIndex[hole] = mIndex[slot];
+      hole = slot;
+   }
+   mIndex[hole] = kNone;
+}
+
+void RequestTable::Grow() {
+   std::vector<uint32_t> index(mIndex.size() * 2, kNone);
+   mIndex.swap(index);
+   const size_t mask = mIndex.size() - 1;
+   for (const uint32_t entry : index) {
+      if (kNone != entry) {
+         size_t slot = Home(mEntries[entry].id);
+         while (kNone != mIndex[slot]) {
+            slot = (slot + 1) & mask;
+         }
+         mIndex[slot] = entry;
+      }
+   }
+}
+
+void RequestTable::LinkToWheel(const uint32_t entry) {
+   uint32_t& head = mWheel[WheelSlot(mEntries[entry].sentAt)];
+   mEntries[entry].wheelPrev = kNone;
+   mEntries[entry].wheelNext = head;
+   if (kNone != head) {
+      mEntries[head].wheelPrev = entry;
+   }
+   head = entry;
+}
+
+void RequestTable::UnlinkFromWheel(const uint32_t entry) {
+   const Entry& unlinked = mEntries[entry];
+   if (kNone != unlinked.wheelPrev) {
+      mEntries[unlinked.wheelPrev].wheelNext = unlinked.wheelNext;
+   } else {
+      mWheel[WheelSlot(unlinked.sentAt)] = unlinked.wheelNext;
+   }
+   if (kNone != unlinked.wheelNext) {
+      mEntries[unlinked.wheelNext].wheelPrev = unlinked.wheelPrev;
+   }
+}
+
+size_t RequestTable::WheelSlot(const time_t when) const {
+   const time_t span = static_cast<time_t>(mWheel.size());
+   const time_t slot = when % span;
+   return static_cast<size_t>(slot < 0 ? slot + span : slot);
+}
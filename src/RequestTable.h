@@ -0,0 +1,124 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+#include "QueueNadoMacros.h"
+
+/**
+ * Completes a request, success is false when the reply is an error text.
+ */
+typedef std::function<void(const bool success, const std::string& reply)> ReplyCallback;
+
+/**
+ * A 128 bit request id. A canonical 36 character uuid is parsed into its
+ * 16 bytes, any other id string is hashed to 128 bits. On the wire a
+ * compact id is its 16 bytes, high word first.
+ */
+struct RequestId {
+   static const size_t kSize = 16;
+
+   RequestId() : high(0), low(0) {
+   }
+
+   RequestId(const uint64_t highBits, const uint64_t lowBits) : high(highBits), low(lowBits) {
+   }
+
+   static RequestId FromString(const std::string& id);
+   static RequestId FromBytes(const void* bytes);
+   std::string ToString() const;
+   void ToBytes(void* bytes) const;
+
+   bool operator==(const RequestId& other) const {
+      return high == other.high && low == other.low;
+   }
+
+   bool operator!=(const RequestId& other) const {
+      return !(*this == other);
+   }
+
+   uint64_t high;
+   uint64_t low;
+};
+
+/**
+ * The requests a BoomStick is waiting on, with the replies that were read
+ * while waiting for another one.
+ *
+ * Entries live in a slab, a vector that reallocates as it grows, so only
+ * their indices are stable: no Entry reference is held across an Insert.
+ * An open addressing index with linear probing finds them by id. Every entry is also on a timer wheel
+ * with one slot per second of its send time, so expiring old requests only
+ * touches the slots that have come due. Insert, lookup, erase and expiry
+ * are all O(1) amortized.
+ *
+ * Not thread safe, like the BoomStick that owns it.
+ */
+class RequestTable {
+public:
+   explicit RequestTable(const time_t timeoutSeconds = 5 * MINUTES_TO_SECONDS);
+
+   bool Insert(const RequestId& id, const time_t sentAt, const uint64_t sentNs = 0,
+           ReplyCallback onReply = ReplyCallback());
+   bool Contains(const RequestId& id) const;
+   bool HasReply(const RequestId& id) const;
+   bool SetReply(const RequestId& id, const std::string& reply);
+   bool TakeReply(const RequestId& id, std::string& reply);
+   bool TakeSentNs(const RequestId& id, uint64_t& sentNs);
+   bool TakeCallback(const RequestId& id, ReplyCallback& onReply);
+   bool Erase(const RequestId& id);
+   size_t Expire(const time_t now, size_t& expiredReplies, std::vector<ReplyCallback>* expiredCallbacks = nullptr);
+   void ForEach(const std::function<void(const RequestId&, bool hasReply)>& visit) const;
+   void swap(RequestTable& other);
+
+   size_t size() const {
+      return mSize;
+   }
+
+   bool empty() const {
+      return 0 == mSize;
+   }
+
+   size_t replies() const {
+      return mReplies;
+   }
+
+private:
+   static const uint32_t kNone = UINT32_MAX;
+
+   struct Entry {
+      Entry() : sentAt(0), sentNs(0), hasReply(false), used(false), wheelPrev(kNone), wheelNext(kNone) {
+      }
+
+      RequestId id;
+      time_t sentAt;
+      uint64_t sentNs;
+      std::string reply;
+      ReplyCallback onReply;
+      bool hasReply;
+      bool used;
+      uint32_t wheelPrev;
+      uint32_t wheelNext;
+   };
+
+   size_t Home(const RequestId& id) const;
+   uint32_t FindIndex(const RequestId& id) const;
+   uint32_t Allocate();
+   void Remove(const uint32_t entry);
+   void RemoveFromIndex(const uint32_t entry);
+   void Grow();
+   void LinkToWheel(const uint32_t entry);
+   void UnlinkFromWheel(const uint32_t entry);
+   size_t WheelSlot(const time_t when) const;
+
+   time_t mTimeout;
+   std::vector<Entry> mEntries;
+   std::vector<uint32_t> mFree;
+   std::vector<uint32_t> mIndex;
+   std::vector<uint32_t> mWheel;
+   time_t mNextTick;
+   size_t mSize;
+   size_t mReplies;
+};
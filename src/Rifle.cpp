@@ -1,10 +1,24 @@
 #define _OPEN_SYS
 #include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
 
 #include "Rifle.h"
 #include "czmq.h"
 #include "g3log/g3log.hpp"
 #include "Death.h"
+#include "ContextPool.h"
+#include "Magazine.h"
+#include "Coalescing.h"
+#include "StakeBundle.h"
+#include "ShmRing.h"
+
+namespace {
+   void DeleteByteArray(void* data, void*) {
+      delete [] static_cast<uint8_t*> (data);
+   }
+}
+
 /**
  * Construct our Rifle which is a push in our ZMQ push pull.
  */
@@ -13,9 +27,31 @@ mLocation(location),
 mHwm(500),
 mChamber(NULL),
 mContext(NULL),
+mSharedContext(NULL),
+mAliased(false),
 mLinger(10),
 mIOThredCount(1),
-mOwnSocket(true) {
+mOwnSocket(true),
+mShmSlotSize(ShmRing::kDefaultSlotSize),
+mOptimisticFire(false),
+mFireFallbacks(0),
+mCoalesceBudget(0),
+mCoalesceDelay(0),
+mCoalescedCount(0),
+mFlushing(false),
+mStats("Rifle", EndpointStats::Role::Sender) {
+   mStats.SetLocation(location);
+}
+
+/**
+ * Construct our Rifle on a shared context, see ContextPool. The I/O thread
+ * count is the shared context's.
+ * @param location
+ * @param context
+ *   A working context, it is shadowed and never destroyed by the Rifle
+ */
+Rifle::Rifle(const std::string& location, zctx_t* context) : Rifle(location) {
+   mSharedContext = context;
 }
 
 /**
@@ -75,16 +111,49 @@ bool Rifle::GetOwnSocket() {
 }
 
 /**
- * Set the location we want to shoot at.
+ * Set the largest bullet a shm:// ring carries. This must be called before
+ * Aim, and only counts if this end creates the ring, see ShmRing.
+ * @param bytes
+ */
+void Rifle::SetShmSlotSize(const size_t bytes) {
+   mShmSlotSize = bytes;
+}
+
+/**
+ * @return the largest bullet a shm:// ring made by this Rifle carries
+ */
+size_t Rifle::GetShmSlotSize() const {
+   return mShmSlotSize;
+}
+
+/**
+ * Set the location we want to shoot at. A shm:// location is a shared memory
+ * ring for a Vampire in another process on this host, see ShmRing. It holds
+ * high water mark messages of up to GetShmSlotSize() bytes. A Rifle is only
+ * ever a producer on the ring, it never removes it whatever GetOwnSocket().
+ * It moves to the new ring on its own if the Vampire starts over.
  * @param location
  * @return 
  */
 bool Rifle::Aim() {
-   if (mChamber) {
+   if (mChamber || mRing) {
+      return true;
+   }
+   if (ShmRing::IsShm(mLocation)) {
+      std::unique_ptr<ShmRing> ring(new ShmRing(mLocation));
+      if (!ring->Attach(GetHighWater(), mShmSlotSize, false)) {
+         LOG(WARNING) << "Rifle can't attach to " << mLocation;
+         return false;
+      }
+      mRing = std::move(ring);
       return true;
    }
    if (!mContext) {
-      mContext = zctx_new();
+      if (!GetOwnSocket() && !mSharedContext) {
+         // a binder in this process on a pool context can be reached over inproc
+         ContextPool::Instance().FindAlias(mLocation, mSharedContext);
+      }
+      mContext = mSharedContext ? zctx_shadow(mSharedContext) : zctx_new();
       zctx_set_sndhwm(mContext, GetHighWater());
       zctx_set_rcvhwm(mContext, GetHighWater());
       //zctx_set_linger(mContext, mLinger); // linger for a millisecond on close
@@ -104,8 +173,11 @@ bool Rifle::Aim() {
          }
          setIpcFilePermissions();
          Death::Instance().RegisterDeathEvent(&Death::DeleteIpcFiles, mLocation);
+         mAliased = ContextPool::Instance().BindAlias(mChamber, mLocation, mContext);
       } else {
-         int result = zsocket_connect(mChamber, mLocation.c_str());
+         zctx_t* context = mContext;
+         const std::string location = ContextPool::Instance().FindAlias(mLocation, context);
+         int result = zsocket_connect(mChamber, location.c_str());
          if (result < 0) {
             LOG(WARNING) << "Rifle can't connect : " << result;
             zsocket_destroy(mContext, mChamber);
@@ -149,7 +221,8 @@ void Rifle::setIpcFilePermissions() {
  */
 bool Rifle::Fire(const std::string& bullet, const int waitToFire) {
    //LOG(DEBUG) << "RifleFire";
-   if (!mChamber) {
+   std::unique_lock<std::mutex> lock(LockIfCoalescing());
+   if (!mChamber && !mRing) {
       LOG(WARNING) << "Socket uninitialized!";
       return false;
    }
@@ -157,27 +230,108 @@ bool Rifle::Fire(const std::string& bullet, const int waitToFire) {
       LOG(WARNING) << "Tried to send empty packet";
       return false;
    }
+   if (mRing) {
+      LatencyTimer blocked(SendBlocked());
+      if (!mRing->Push(&(bullet[0]), bullet.size(), waitToFire)) {
+         mStats.SendTimeout();
+         return false;
+      }
+      blocked.Stop();
+      mStats.Sent(bullet.size());
+      return true;
+   }
+   if (mCoalesceBudget > 0) {
+      return Coalesce(bullet, waitToFire);
+   }
+   zmq_msg_t message;
+   zmq_msg_init_size(&message, bullet.size());
+   memcpy(zmq_msg_data(&message), &(bullet[0]), bullet.size());
+   if (!SendMessage(message, waitToFire)) {
+      zmq_msg_close(&message);
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Shoot a batch of bullets / messages to the Vampires / pull.
+ *
+ * The socket is polled once, after that as many bullets as the pipe has room
+ * for are sent without waiting. The socket is only polled again if the pipe
+ * fills up part way through the batch. Optimistic fire skips the first poll.
+ *
+ * @param bullets
+ *
+ * @param waitToFire in milliseconds, for each time the pipe is full
+ *
+ * @return the number of bullets fired, counted from the front of the batch
+ */
+size_t Rifle::FireBatch(const std::vector<std::string>& bullets, const int waitToFire) {
+   if (!mChamber && !mRing) {
+      LOG(WARNING) << "Socket uninitialized!";
+      return 0;
+   }
    zmq_pollitem_t items [] = {
       { mChamber, 0, ZMQ_POLLOUT, 0}
    };
-
-   if (zmq_poll(items, 1, waitToFire) > 0) {
-      if (items[0].revents & ZMQ_POLLOUT) {
-         zmsg_t* message = zmsg_new();
-         zmsg_addmem(message, &(bullet[0]), bullet.size());
-         return CZMQToolkit::SendExistingMessage(message, mChamber);
-      } else {
-         LOG(WARNING) << "Error on Zmq socket send: " << zmq_strerror(zmq_errno());
-         return false;
+   size_t fired = 0;
+   if (mCoalesceBudget > 0 || mRing) {
+      while (fired < bullets.size() && Fire(bullets[fired], waitToFire)) {
+         ++fired;
       }
-   } else {
-      //      LOG(WARNING) << "timeout in zmq_pollout " << GetBinding();
-      return false;
+      return fired;
    }
+   bool ready = mOptimisticFire;
+   const int more = mLatency ? ZMQ_SNDMORE : 0;
+   while (fired < bullets.size()) {
+      const std::string& bullet = bullets[fired];
+      if (bullet.empty()) {
+         LOG(WARNING) << "Tried to send empty packet";
+         break;
+      }
+      if (!ready) {
+         LatencyTimer blocked(SendBlocked());
+         if (zmq_poll(items, 1, waitToFire) <= 0) {
+            //      LOG(WARNING) << "timeout in zmq_pollout " << GetBinding();
+            mStats.SendTimeout();
+            break;
+         }
+         if (!(items[0].revents & ZMQ_POLLOUT)) {
+            LOG(WARNING) << "Error on Zmq socket send: " << zmq_strerror(zmq_errno());
+            break;
+         }
+         blocked.Stop();
+         ready = true;
+      }
+      zmq_msg_t message;
+      zmq_msg_init_size(&message, bullet.size());
+      memcpy(zmq_msg_data(&message), &(bullet[0]), bullet.size());
+      if (zmq_msg_send(&message, mChamber, more | ZMQ_DONTWAIT) >= 0) {
+         if (more) {
+            SendStamp();
+         }
+         mStats.Sent(bullet.size());
+         ++fired;
+         continue;
+      }
+      const int error = zmq_errno();
+      zmq_msg_close(&message);
+      if (EAGAIN != error) {
+         LOG(WARNING) << "Error on Zmq socket send: " << zmq_strerror(error);
+         break;
+      }
+      // the pipe filled up, wait for room before firing the rest
+      if (mOptimisticFire) {
+         mFireFallbacks.fetch_add(1, std::memory_order_relaxed);
+      }
+      ready = false;
+   }
+   return fired;
 }
 
 /**
- * Fire a string without copying it to zeromq. 
+ * Fire a string without copying it to zeromq. If it could not be sent it is
+ * handed to FreeFunction right away.
  * @param zero
  * @param size
  * @param FreeFunction
@@ -185,37 +339,74 @@ bool Rifle::Fire(const std::string& bullet, const int waitToFire) {
  * @return 
  */
 bool Rifle::FireZeroCopy(std::string* zero, const size_t size, void (*FreeFunction)(void*, void*), const int waitToFire) {
-   bool success = false;
-   if (!mChamber) {
+   return FireZeroCopyData(&((*zero)[0]), size, FreeFunction, zero, waitToFire);
+}
+
+/**
+ * Fire a byte array without copying it to zeromq, it is deleted once zeromq
+ * is done with it.
+ * @param zero
+ * @param size
+ * @param waitToFire
+ * @return 
+ */
+bool Rifle::FireZeroCopy(std::unique_ptr<uint8_t[]> zero, const size_t size, const int waitToFire) {
+   return FireZeroCopyData(zero.release(), size, &DeleteByteArray, NULL, waitToFire);
+}
+
+/**
+ * Fire a slot loaded from a Magazine without copying it to zeromq. The slot
+ * goes back into the magazine once zeromq is done with it, or right away if
+ * it could not be sent.
+ * @param magazine
+ * @param slot
+ * @param size
+ *   Bytes used in the slot
+ * @param waitToFire
+ * @return 
+ */
+bool Rifle::FireZeroCopy(Magazine& magazine, char* slot, const size_t size, const int waitToFire) {
+   if (size > magazine.GetSlotSize()) {
+      LOG(WARNING) << "Tried to send " << size << " bytes from a slot of " << magazine.GetSlotSize();
+      magazine.Unload(slot);
+      return false;
+   }
+   return FireZeroCopyData(slot, size, &Magazine::ZeroCopyRelease, &magazine, waitToFire);
+}
+
+/**
+ * Fire data without copying it to zeromq. The data always belongs to
+ * FreeFunction afterwards, it is called right away if the data could not be
+ * sent.
+ * @param data
+ * @param size
+ * @param FreeFunction
+ * @param hint
+ *   Passed on to FreeFunction
+ * @param waitToFire
+ * @return 
+ */
+bool Rifle::FireZeroCopyData(void* data, const size_t size, void (*FreeFunction)(void*, void*),
+   void* hint, const int waitToFire) {
+   std::unique_lock<std::mutex> lock(LockIfCoalescing());
+   if (!mChamber && !mRing) {
       LOG(WARNING) << "Socket uninitialized!";
-   } else if (size == 0) {
+      FreeFunction(data, hint);
+      return false;
+   }
+   if (size == 0) {
       LOG(WARNING) << "Tried to send empty packet";
-   } else {
-      zmq_pollitem_t items [] = {
-         { mChamber, 0, ZMQ_POLLOUT, 0}
-      };
-
-      if (zmq_poll(items, 1, waitToFire) > 0) {
-         if (items[0].revents & ZMQ_POLLOUT) {
-
-            zmq_msg_t message;
-            zmq_msg_init_data(&message, &((*zero)[0]), size, FreeFunction, zero);
-            if ((int) size == zmq_msg_send(&message, mChamber, ZMQ_DONTWAIT)) {
-               success = true;
-               zero = NULL;
-            }
-         } else {
-            LOG(WARNING) << "Error on Zmq socket send: " << zmq_strerror(zmq_errno());
-         }
-      } else {
-         //      LOG(WARNING) << "timeout in zmq_pollout " << GetBinding();
-      }
+      FreeFunction(data, hint);
+      return false;
    }
-   if (!success && zero) {
-      delete zero;
-      zero = NULL;
+   zmq_msg_t message;
+   zmq_msg_init_data(&message, data, size, FreeFunction, hint);
+   if (!SendMessage(message, waitToFire)) {
+      // closing the unsent message calls FreeFunction
+      zmq_msg_close(&message);
+      return false;
    }
-   return success;
+   return true;
 }
 
 /**
@@ -224,7 +415,8 @@ bool Rifle::FireZeroCopy(std::string* zero, const size_t size, void (*FreeFuncti
  * @return 
  */
 bool Rifle::FireStake(const void* stake, const int waitToFire) {
-   if (!mChamber) {
+   std::unique_lock<std::mutex> lock(LockIfCoalescing());
+   if (!mChamber && !mRing) {
       LOG(WARNING) << "Socket uninitialized!";
       return false;
    }
@@ -232,28 +424,29 @@ bool Rifle::FireStake(const void* stake, const int waitToFire) {
       LOG(WARNING) << "Tried to send empty packet";
       return false;
    }
-   zmq_pollitem_t items [] = {
-      { mChamber, 0, ZMQ_POLLOUT, 0}
-   };
-
-   if (zmq_poll(items, 1, waitToFire) > 0) {
-      if (items[0].revents & ZMQ_POLLOUT) {
-         zmsg_t* message = zmsg_new();
-         zmsg_addmem(message, &(stake), sizeof (void*));
-         return CZMQToolkit::SendExistingMessage(message, mChamber);
-      } else {
-
-         LOG(WARNING) << "Error in zmq_pollout in " << GetBinding() << ": " << zmq_strerror(zmq_errno());
+   if (mRing) {
+      LatencyTimer blocked(SendBlocked());
+      if (!mRing->Push(&stake, sizeof (void*), waitToFire)) {
+         mStats.SendTimeout();
          return false;
       }
-   } else {
-      //      LOG(WARNING) << "timeout in zmq_pollout " << GetBinding();
+      blocked.Stop();
+      mStats.Sent(sizeof (void*));
+      return true;
+   }
+   zmq_msg_t message;
+   zmq_msg_init_size(&message, sizeof (void*));
+   memcpy(zmq_msg_data(&message), &(stake), sizeof (void*));
+   if (!SendMessage(message, waitToFire)) {
+      zmq_msg_close(&message);
       return false;
    }
+   return true;
 }
 
 /**
  * Shoot a vector of pointers and some sort of hash message to the Vampires / pull.
+ * They are sent packed, see StakeBundle.
  * @param stakes
  *   A vector of pairs, first being a pointer that the sender gives ownership
  * of, and a has of the data associated with the pointer
@@ -262,36 +455,341 @@ bool Rifle::FireStake(const void* stake, const int waitToFire) {
  */
 bool Rifle::FireStakes(const std::vector<std::pair<void*, unsigned int> >
    & stakes, const int waitToFire) {
-   bool success = false;
-   if (!mChamber) {
+   std::unique_lock<std::mutex> lock(LockIfCoalescing());
+   if (!mChamber && !mRing) {
       LOG(WARNING) << "Socket uninitialized!";
-   } else if (stakes.empty()) {
+      return false;
+   }
+   if (stakes.empty()) {
       LOG(WARNING) << "Tried to send nothing";
-   } else {
-      zmq_pollitem_t items [] = {
-         { mChamber, 0, ZMQ_POLLOUT, 0}
-      };
-
-      if (zmq_poll(items, 1, waitToFire) > 0) {
-         if (items[0].revents & ZMQ_POLLOUT) {
-            zmsg_t* message = zmsg_new();
-            zmsg_addmem(message, &(stakes[0]),
-               stakes.size() * (sizeof (std::pair<void*, unsigned int>)));
-            success = CZMQToolkit::SendExistingMessage(message, mChamber);
-         } else {
-            LOG(WARNING) << "Error in zmq_pollout in " << GetBinding() << ": " << zmq_strerror(zmq_errno());
+      return false;
+   }
+   zmq_msg_t message;
+   zmq_msg_init_size(&message, StakeBundle::EncodedSize(stakes.size()));
+   StakeBundle::Encode(stakes, zmq_msg_data(&message));
+   if (!SendMessage(message, waitToFire)) {
+      zmq_msg_close(&message);
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Add a bullet to the coalesced message, firing it once it is over the byte
+ * budget or the first bullet in it has waited longer than the deadline. A
+ * message that could not be fired is kept and tried again, by the next
+ * bullet or on its deadline.
+ * @param bullet
+ * @param waitToFire in milliseconds
+ * @return 
+ *   false if the coalesced message is still full from a failed fire, the
+ *   bullet is not taken then
+ */
+bool Rifle::Coalesce(const std::string& bullet, const int waitToFire) {
+   if (mCoalesced.size() >= mCoalesceBudget && !FlushCoalesced(waitToFire)) {
+      return false;
+   }
+   if (mCoalesced.empty()) {
+      mCoalesceStart = std::chrono::steady_clock::now();
+      mFlushWake.notify_one();
+   }
+   Coalescing::AppendRecord(mCoalesced, bullet);
+   ++mCoalescedCount;
+   if (mCoalesced.size() >= mCoalesceBudget ||
+      std::chrono::steady_clock::now() - mCoalesceStart >= mCoalesceDelay) {
+      FlushCoalesced(waitToFire);
+   }
+   return true;
+}
+
+/**
+ * Fire everything that is waiting in the coalesced message. Bullets are also
+ * fired on their deadline without this, it is for getting them out sooner.
+ * @param waitToFire in milliseconds
+ * @return 
+ *   false if the bullets could not be sent, they are kept for the next try
+ */
+bool Rifle::Flush(const int waitToFire) {
+   std::unique_lock<std::mutex> lock(LockIfCoalescing());
+   const size_t count = mCoalescedCount;
+   if (!FlushCoalesced(waitToFire)) {
+      LOG(WARNING) << "Could not fire " << count << " coalesced bullets, they are kept for the next try";
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Fire the coalesced message, with the coalescing lock held if there is a
+ * flusher
+ * @param waitToFire in milliseconds
+ * @return 
+ *   false if it could not be sent, it stays as it was
+ */
+bool Rifle::FlushCoalesced(const int waitToFire) {
+   if (mCoalesced.empty()) {
+      return true;
+   }
+   if (!mChamber) {
+      LOG(WARNING) << "Socket uninitialized! Dropped " << mCoalescedCount << " coalesced bullets";
+      mCoalesced.clear();
+      mCoalescedCount = 0;
+      return false;
+   }
+   zmq_msg_t marker;
+   zmq_msg_init_size(&marker, Coalescing::kMarkerSize);
+   memcpy(zmq_msg_data(&marker), Coalescing::kMarker, Coalescing::kMarkerSize);
+   if (!SendMessage(marker, waitToFire, ZMQ_SNDMORE)) {
+      zmq_msg_close(&marker);
+      return false;
+   }
+   const size_t count = mCoalescedCount;
+   const size_t bytes = mCoalesced.size();
+   zmq_msg_t records;
+   zmq_msg_init_size(&records, bytes);
+   memcpy(zmq_msg_data(&records), &(mCoalesced[0]), bytes);
+   mCoalesced.clear();
+   mCoalescedCount = 0;
+   // the rest of a multi part message always goes once the first part went
+   if (zmq_msg_send(&records, mChamber, (mLatency ? ZMQ_SNDMORE : 0) | ZMQ_DONTWAIT) < 0) {
+      zmq_msg_close(&records);
+      LOG(WARNING) << "Failed on send " << zmq_strerror(zmq_errno()) << ", dropped " << count << " coalesced bullets";
+      return false;
+   }
+   mStats.Sent(bytes, count);
+   return !mLatency || SendStamp();
+}
+
+/**
+ * Runs on the flusher thread while coalescing is on. Fires the coalesced
+ * message once its first bullet is due, so bullets don't wait on the next
+ * Fire. A fire that fails is tried again a deadline later.
+ */
+void Rifle::FlushOnDeadline() {
+   std::unique_lock<std::mutex> lock(mCoalesceMutex);
+   while (mFlushing) {
+      if (mCoalesced.empty()) {
+         mFlushWake.wait(lock);
+         continue;
+      }
+      const std::chrono::steady_clock::time_point due = mCoalesceStart + mCoalesceDelay;
+      if (std::chrono::steady_clock::now() < due) {
+         mFlushWake.wait_until(lock, due);
+         continue;
+      }
+      if (!FlushCoalesced(0)) {
+         mFlushWake.wait_for(lock, std::max(mCoalesceDelay, std::chrono::microseconds(1000)));
+      }
+   }
+}
+
+/**
+ * Stop the flusher thread, what is coalesced stays where it is
+ */
+void Rifle::StopFlusher() {
+   if (!mFlusher.joinable()) {
+      return;
+   }
+   {
+      std::lock_guard<std::mutex> lock(mCoalesceMutex);
+      mFlushing = false;
+   }
+   mFlushWake.notify_one();
+   mFlusher.join();
+}
+
+/**
+ * Only the flusher thread shares the socket, so the lock is only taken while
+ * there is one
+ * @return the coalescing lock, owned while coalescing is on
+ */
+std::unique_lock<std::mutex> Rifle::LockIfCoalescing() {
+   std::unique_lock<std::mutex> lock(mCoalesceMutex, std::defer_lock);
+   if (mFlusher.joinable()) {
+      lock.lock();
+   }
+   return lock;
+}
+
+/**
+ * Pack bullets fired with Fire / FireBatch into one coalesced message until
+ * it holds byteBudget bytes or its first bullet is maxDelayUs old. A flusher
+ * thread fires it on the deadline if no other bullet comes along, and from
+ * then on the Rifle's sends take a lock it shares with that thread. Vampires
+ * unpack them again so GetShot still returns one bullet at a time. Stakes
+ * and zero copy sends are not coalesced, they flush what is waiting first to
+ * keep the order. Bullets fired through a shm:// ring are never coalesced.
+ * @param byteBudget
+ *   0 turns coalescing off
+ * @param maxDelayUs
+ *   How much latency to trade for throughput
+ */
+void Rifle::SetCoalescing(const size_t byteBudget, const int maxDelayUs) {
+   StopFlusher();
+   if (byteBudget == 0) {
+      Flush();
+   }
+   mCoalesceBudget = byteBudget;
+   mCoalesceDelay = std::chrono::microseconds(maxDelayUs);
+   mCoalesced.reserve(byteBudget + Coalescing::kLengthSize);
+   if (byteBudget > 0) {
+      mFlushing = true;
+      mFlusher = std::thread(&Rifle::FlushOnDeadline, this);
+   }
+}
+
+/**
+ * Send a message that is ready to go. With optimistic fire it is sent right
+ * away and the socket is only polled if the pipe is full, otherwise the socket
+ * is always polled first. Coalesced bullets that are waiting go first. With
+ * latency stats on the last part is followed by a timestamp frame.
+ * @param message
+ *   Still belongs to the caller if the send failed
+ * @param waitToFire in milliseconds
+ * @param flags
+ *   ZMQ_SNDMORE for the first part of a multi part message
+ * @return 
+ */
+bool Rifle::SendMessage(zmq_msg_t& message, const int waitToFire, const int flags) {
+   LatencyTimer blocked(SendBlocked());
+   // the parts of a multi part message are counted by the caller
+   const size_t bytes = (flags & ZMQ_SNDMORE) ? 0 : zmq_msg_size(&message);
+   const uint64_t messages = (flags & ZMQ_SNDMORE) ? 0 : 1;
+   if (mRing) {
+      // copied into the ring, so the message is done with either way on success
+      if (!mRing->Push(zmq_msg_data(&message), zmq_msg_size(&message), waitToFire)) {
+         mStats.SendTimeout();
+         return false;
+      }
+      blocked.Stop();
+      mStats.Sent(bytes, messages);
+      zmq_msg_close(&message);
+      return true;
+   }
+   if (!mCoalesced.empty() && !FlushCoalesced(waitToFire)) {
+      return false;
+   }
+   const bool stamp = mLatency && !(flags & ZMQ_SNDMORE);
+   const int sendFlags = flags | (stamp ? ZMQ_SNDMORE : 0) | ZMQ_DONTWAIT;
+   if (mOptimisticFire) {
+      if (zmq_msg_send(&message, mChamber, sendFlags) >= 0) {
+         blocked.Stop();
+         mStats.Sent(bytes, messages);
+         return !stamp || SendStamp();
+      }
+      if (EAGAIN != zmq_errno()) {
+         LOG(WARNING) << "Error on Zmq socket send: " << zmq_strerror(zmq_errno());
+         return false;
+      }
+      mFireFallbacks.fetch_add(1, std::memory_order_relaxed);
+   }
+   zmq_pollitem_t items [] = {
+      { mChamber, 0, ZMQ_POLLOUT, 0}
+   };
+
+   if (zmq_poll(items, 1, waitToFire) > 0) {
+      if (items[0].revents & ZMQ_POLLOUT) {
+         if (zmq_msg_send(&message, mChamber, sendFlags) < 0) {
+            LOG(WARNING) << "Failed on send " << zmq_strerror(zmq_errno());
+            return false;
          }
+         blocked.Stop();
+         mStats.Sent(bytes, messages);
+         return !stamp || SendStamp();
       } else {
-         //      LOG(WARNING) << "timeout in zmq_pollout " << GetBinding();
+         LOG(WARNING) << "Error in zmq_pollout in " << GetBinding() << ": " << zmq_strerror(zmq_errno());
+         return false;
       }
+   } else {
+      //      LOG(WARNING) << "timeout in zmq_pollout " << GetBinding();
+      mStats.SendTimeout();
+      return false;
+   }
+}
+
+/**
+ * Send the timestamp frame that ends a message, the rest of a multi part
+ * message always goes once the first part went.
+ * @return 
+ */
+bool Rifle::SendStamp() {
+   zmq_msg_t stamp;
+   zmq_msg_init_size(&stamp, LatencyStats::kStampSize);
+   LatencyStats::WriteStamp(zmq_msg_data(&stamp));
+   if (zmq_msg_send(&stamp, mChamber, ZMQ_DONTWAIT) < 0) {
+      zmq_msg_close(&stamp);
+      LOG(WARNING) << "Failed on send " << zmq_strerror(zmq_errno());
+      return false;
    }
-   return success;
+   return true;
+}
+
+/**
+ * Record how long sends wait for the socket, and stamp every message so
+ * Vampires with stats on can record the end to end latency. Messages through
+ * a shm:// ring are not stamped. This must be called before firing.
+ */
+void Rifle::EnableLatencyStats() {
+   if (!mLatency) {
+      mLatency.reset(new LatencyStats);
+   }
+}
+
+/**
+ * @return the latency stats, NULL unless they were enabled
+ */
+const LatencyStats* Rifle::GetLatencyStats() const {
+   return mLatency.get();
+}
+
+/**
+ * @return what was sent and how often sends timed out
+ */
+EndpointStats::Counters Rifle::Stats() const {
+   return mStats.Get();
+}
+
+/**
+ * @return the send blocked histogram, NULL with stats off
+ */
+LatencyHistogram* Rifle::SendBlocked() {
+   return mLatency ? &mLatency->sendBlocked : NULL;
+}
+
+/**
+ * Optimistic fire sends without polling first and only polls when the pipe
+ * is full. Off by default.
+ * @param optimistic
+ */
+void Rifle::SetOptimisticFire(const bool optimistic) {
+   mOptimisticFire = optimistic;
+}
+
+/**
+ * @return if optimistic fire is on
+ */
+bool Rifle::GetOptimisticFire() const {
+   return mOptimisticFire;
+}
+
+/**
+ * @return how many optimistic sends found the pipe full and had to poll
+ */
+uint64_t Rifle::GetFireFallbacks() const {
+   return mFireFallbacks.load(std::memory_order_relaxed);
 }
 
 /**
  * Destroy the gun.
  */
 void Rifle::Destroy() {
+   StopFlusher();
+   Flush(mLinger);
+   mRing.reset();
+   if (mAliased) {
+      ContextPool::Instance().RemoveAlias(mLocation, mContext);
+      mAliased = false;
+   }
    if (mContext != NULL) {
       //LOG(DEBUG) << "Rifle: destroying context";
       zsocket_destroy(mContext, mChamber);
@@ -1,38 +1,169 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <memory>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <zmq.h>
 #include "CZMQToolkit.h"
+#include "LatencyHistogram.h"
+#include "EndpointStats.h"
 
 #define SIZE_OF_STAKE_BUNDLE 500
 struct _zctx_t;
 typedef struct _zctx_t zctx_t;
+class Magazine;
+class ShmRing;
 class Rifle {
 public:
    explicit Rifle(const std::string& location);
+   Rifle(const std::string& location, zctx_t* context);
    bool Aim();
    std::string GetBinding() const;
    bool Fire(const std::string& bullet, const int waitToFire = 10000);
+   size_t FireBatch(const std::vector<std::string>& bullets, const int waitToFire = 10000);
    bool FireStake(const void* stake,const int waitToFire = 10000);
    bool FireStakes(const std::vector<std::pair<void*, unsigned int> >& stakes,
            const int waitToFire = 10000);
 
    bool FireZeroCopy( std::string* zero, const size_t size, void (*FreeFunction)(void*,void*), const int waitToFire = 10000);
+   bool FireZeroCopy(std::unique_ptr<uint8_t[]> zero, const size_t size, const int waitToFire = 10000);
+   bool FireZeroCopy(Magazine& magazine, char* slot, const size_t size, const int waitToFire = 10000);
+   template <typename Buffer, typename = decltype(std::declval<Buffer&>().data())>
+   bool FireZeroCopy(Buffer&& zero, const int waitToFire = 10000);
+   template <typename Buffer, typename Pool, typename = decltype(std::declval<Buffer&>().data()),
+           typename = typename std::enable_if<std::is_class<Pool>::value>::type>
+   bool FireZeroCopy(Buffer&& zero, Pool& pool, const int waitToFire = 10000);
    int GetHighWater();
    void SetHighWater(const int hwm);
    int GetIOThreads();
    void SetIOThreads(const int count);
    void SetOwnSocket(const bool own);
    bool GetOwnSocket();
+   void SetShmSlotSize(const size_t bytes);
+   size_t GetShmSlotSize() const;
+   void SetOptimisticFire(const bool optimistic);
+   bool GetOptimisticFire() const;
+   uint64_t GetFireFallbacks() const;
+   void SetCoalescing(const size_t byteBudget, const int maxDelayUs);
+   bool Flush(const int waitToFire = 10000);
+   void EnableLatencyStats();
+   const LatencyStats* GetLatencyStats() const;
+   EndpointStats::Counters Stats() const;
    virtual ~Rifle();
 protected:
    void Destroy();
 private:
    void setIpcFilePermissions();
+   bool SendMessage(zmq_msg_t& message, const int waitToFire, const int flags = 0);
+   bool SendStamp();
+   LatencyHistogram* SendBlocked();
+   bool Coalesce(const std::string& bullet, const int waitToFire);
+   bool FlushCoalesced(const int waitToFire);
+   void FlushOnDeadline();
+   void StopFlusher();
+   std::unique_lock<std::mutex> LockIfCoalescing();
+   bool FireZeroCopyData(void* data, const size_t size, void (*FreeFunction)(void*, void*),
+           void* hint, const int waitToFire);
+
+   template <typename Buffer>
+   static void* BufferData(Buffer& buffer) {
+      return const_cast<void*> (static_cast<const void*> (buffer.data()));
+   }
+
+   template <typename Buffer>
+   static size_t BufferSize(const Buffer& buffer) {
+      return buffer.size() * sizeof (typename Buffer::value_type);
+   }
+
+   template <typename Buffer>
+   static void DeleteBuffer(void*, void* hint) {
+      delete static_cast<Buffer*> (hint);
+   }
+
+   template <typename Buffer, typename Pool>
+   struct PooledBuffer {
+      Buffer buffer;
+      Pool* pool;
+   };
+
+   template <typename Buffer, typename Pool>
+   static void ReleaseBuffer(void*, void* hint) {
+      PooledBuffer<Buffer, Pool>* pooled = static_cast<PooledBuffer<Buffer, Pool>*> (hint);
+      pooled->pool->Release(std::move(pooled->buffer));
+      delete pooled;
+   }
+
    std::string mLocation;
    int mHwm;
    void* mChamber;
    zctx_t* mContext;
+   zctx_t* mSharedContext;
+   std::unique_ptr<ShmRing> mRing;
+   bool mAliased;
    int mLinger;
    int mIOThredCount;
    bool mOwnSocket;
+   size_t mShmSlotSize;
+   bool mOptimisticFire;
+   std::atomic<uint64_t> mFireFallbacks;
+   size_t mCoalesceBudget;
+   std::chrono::microseconds mCoalesceDelay;
+   std::chrono::steady_clock::time_point mCoalesceStart;
+   std::string mCoalesced;
+   size_t mCoalescedCount;
+   // fires coalesced bullets on their deadline when the Rifle goes quiet
+   std::mutex mCoalesceMutex;
+   std::condition_variable mFlushWake;
+   std::thread mFlusher;
+   bool mFlushing;
+   std::unique_ptr<LatencyStats> mLatency;
+   EndpointStats mStats;
 };
+
+/**
+ * Fire any owned contiguous buffer (std::vector, std::string, std::array...)
+ * without copying it. The buffer is moved onto the heap and deleted once
+ * zeromq is done with it, or right away if it could not be sent.
+ * @param zero
+ *   Has to be moved in, it must have data(), size() and value_type
+ * @param waitToFire
+ * @return 
+ */
+template <typename Buffer, typename>
+bool Rifle::FireZeroCopy(Buffer&& zero, const int waitToFire) {
+   static_assert(!std::is_lvalue_reference<Buffer>::value,
+           "FireZeroCopy takes ownership of the buffer, move it in");
+   typedef typename std::decay<Buffer>::type Owned;
+   // Take the data pointer after the move, a moved small string changes address
+   Owned* owned = new Owned(std::move(zero));
+   return FireZeroCopyData(BufferData(*owned), BufferSize(*owned),
+           &Rifle::DeleteBuffer<Owned>, owned, waitToFire);
+}
+
+/**
+ * Fire an owned contiguous buffer without copying it, handing it back to
+ * pool.Release(Buffer&&) once zeromq is done with it, or right away if it
+ * could not be sent. Release is called from a zeromq IO thread so the pool
+ * has to be thread safe and outlive every buffer fired from it.
+ * @param zero
+ *   Has to be moved in, it must have data(), size() and value_type
+ * @param pool
+ * @param waitToFire
+ * @return 
+ */
+template <typename Buffer, typename Pool, typename, typename>
+bool Rifle::FireZeroCopy(Buffer&& zero, Pool& pool, const int waitToFire) {
+   static_assert(!std::is_lvalue_reference<Buffer>::value,
+           "FireZeroCopy takes ownership of the buffer, move it in");
+   typedef typename std::decay<Buffer>::type Owned;
+   PooledBuffer<Owned, Pool>* pooled = new PooledBuffer<Owned, Pool>{std::move(zero), &pool};
+   return FireZeroCopyData(BufferData(pooled->buffer), BufferSize(pooled->buffer),
+           &Rifle::ReleaseBuffer<Owned, Pool>, pooled, waitToFire);
+}
@@ -1,6 +1,16 @@
 #include "SendDpiMsgLRZMQ.h"
 SendDpiMsgLRZMQ::SendDpiMsgLRZMQ(const std::string& binding) :
       Rifle(binding) {
+   // the DPI pipe is rarely full, don't pay for a poll on every send
+   Rifle::SetOptimisticFire(true);
+}
+
+/**
+ * Construct on a shared context, see ContextPool.
+ */
+SendDpiMsgLRZMQ::SendDpiMsgLRZMQ(zctx_t* context, const std::string& binding) :
+      Rifle(binding, context) {
+   Rifle::SetOptimisticFire(true);
 }
 
 bool SendDpiMsgLRZMQ::SendData(const std::string& data) {
@@ -0,0 +1,580 @@
+#include "g3log/g3log.hpp"
+#include <czmq.h>
+#include <zctx.h>
+#include <zsocket.h>
+#include <zsockopt.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+#include "SharedBoomStick.h"
+
+namespace {
+   // the same wait BoomStick::Send gives a reply
+   const time_t kDefaultReplyTimeout = 30;
+   const long kPollMs = 1000;
+   const std::string kShutDown = "SharedBoomStick shut down";
+   const std::string kNotInitialized = "SharedBoomStick not initialized";
+   const std::string kTimedOut = "Timed out waiting for reply";
+   const std::string kWindowFull = "Window full";
+}
+
+/**
+ * Construct with a ZMQ socket binding
+ * @param binding
+ *   The binding is stored, but Initialize must be used to connect to it.
+ */
+SharedBoomStick::SharedBoomStick(const std::string& binding) :
+mBinding(binding),
+mCtx(nullptr),
+mSharedCtx(nullptr),
+mChamber(nullptr),
+mWakeUp(-1),
+mSendHWM(1000),
+mRecvHWM(1000),
+mReplyTimeout(kDefaultReplyTimeout),
+mIdSalt(0),
+mIdCount(0),
+mRunning(false),
+mAsleep(false),
+mWindowWaitMs(0),
+mDrained(false),
+mHead(&mStub),
+mTail(&mStub),
+mRequests(kDefaultReplyTimeout),
+mLastExpiry(0),
+mStats("SharedBoomStick", EndpointStats::Role::Requester) {
+   mStub.next.store(nullptr);
+   std::random_device random;
+   mIdSalt = (static_cast<uint64_t> (random()) << 32) | random();
+   mStats.SetLocation(binding);
+}
+
+/**
+ * Construct with a ZMQ socket binding on a shared context, see ContextPool
+ * @param binding
+ * @param context
+ *   A working context, it is shadowed and never destroyed by the SharedBoomStick
+ */
+SharedBoomStick::SharedBoomStick(const std::string& binding, zctx_t* context) : SharedBoomStick(binding) {
+   mSharedCtx = context;
+}
+
+/**
+ * Stop the I/O thread, every request still waiting fails
+ */
+SharedBoomStick::~SharedBoomStick() {
+   if (mThread.joinable()) {
+      mRunning.store(false);
+      const uint64_t wake = 1;
+      if (write(mWakeUp, &wake, sizeof (wake)) < 0) {
+         LOG(WARNING) << "Cannot wake the I/O thread " << strerror(errno);
+      }
+      mThread.join();
+   }
+   // anything that was submitted while the I/O thread stopped
+   std::vector<ReplyCallback> failed;
+   {
+      std::lock_guard<std::mutex> lock(mDrainMutex);
+      TakeAll(failed);
+   }
+   FailAll(failed, kShutDown);
+   if (mWakeUp >= 0) {
+      close(mWakeUp);
+   }
+   if (nullptr != mCtx) {
+      zctx_destroy(&mCtx);
+   }
+}
+
+/**
+ * Set the High water for sending messages, only works before Initialize
+ * @param hwm
+ */
+void SharedBoomStick::SetSendHWM(const int hwm) {
+   mSendHWM = hwm;
+}
+
+/**
+ * Set the High water for receiving messages, only works before Initialize
+ * @param hwm
+ */
+void SharedBoomStick::SetRecvHWM(const int hwm) {
+   mRecvHWM = hwm;
+}
+
+/**
+ * How long a request waits for its reply, only works before Initialize
+ * @param seconds
+ */
+void SharedBoomStick::SetReplyTimeout(const unsigned int seconds) {
+   mReplyTimeout = static_cast<time_t> (seconds);
+}
+
+/**
+ * Limit how many requests can be in flight at once, only works before
+ * Initialize. A request takes a credit when it is submitted and gives it
+ * back when it completes. Without a window no credits are counted.
+ * @param requests
+ *   The window size, 0 for no limit
+ * @param msToWait
+ *   How long a full window blocks a send, 0 fails the send at once
+ */
+void SharedBoomStick::SetWindow(const size_t requests, const unsigned int msToWait) {
+   if (mRunning.load()) {
+      LOG(WARNING) << "The window can only be set before Initialize";
+      return;
+   }
+   mWindow.SetSize(requests);
+   mWindowWaitMs = msToWait;
+   mStats.SetWindow(requests);
+}
+
+/**
+ * Start the I/O thread, which connects the socket
+ * @return
+ *   true when connected
+ */
+bool SharedBoomStick::Initialize() {
+   if (mRunning.load()) {
+      return true;
+   }
+   if (mThread.joinable()) {
+      mThread.join();
+   }
+   if (nullptr == mCtx) {
+      mCtx = (nullptr != mSharedCtx) ? zctx_shadow(mSharedCtx) : zctx_new();
+      if (nullptr == mCtx) {
+         LOG(WARNING) << "queue error " << zmq_strerror(zmq_errno());
+         return false;
+      }
+   }
+   if (mWakeUp < 0) {
+      mWakeUp = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (mWakeUp < 0) {
+         LOG(WARNING) << "Cannot create eventfd " << strerror(errno);
+         return false;
+      }
+   }
+   RequestTable(mReplyTimeout).swap(mRequests);
+   mLastExpiry = std::time(NULL);
+   {
+      std::lock_guard<std::mutex> lock(mDrainMutex);
+      mDrained = false;
+   }
+
+   mRunning.store(true);
+   std::promise<bool> connected;
+   std::future<bool> ready = connected.get_future();
+   mThread = std::thread(&SharedBoomStick::Run, this, std::ref(connected));
+   if (!ready.get()) {
+      mThread.join();
+      return false;
+   }
+   return true;
+}
+
+/**
+ * A synchronous send with a blocking receive, from any thread
+ * @param command
+ * @return
+ *   The reply, empty when there was none
+ */
+std::string SharedBoomStick::Send(const std::string& command) {
+   std::future<std::string> reply = SendAsync(command);
+   try {
+      return reply.get();
+   } catch (const std::string&) {
+      return
+      {
+      };
+   }
+}
+
+/**
+ * Send a command from any thread
+ * @param command
+ * @return
+ *   The reply to come, it throws the error text as a std::string on failure
+ */
+std::future<std::string> SharedBoomStick::SendAsync(const std::string& command) {
+   auto promise = std::make_shared<std::promise<std::string>>();
+   std::future<std::string> reply = promise->get_future();
+   SendAsync(command, [promise](const bool success, const std::string& text) {
+      if (success) {
+         promise->set_value(text);
+      } else {
+         promise->set_exception(std::make_exception_ptr(text));
+      }
+   });
+   return reply;
+}
+
+/**
+ * Send a command from any thread
+ * @param command
+ * @param onReply
+ *   Called once on the I/O thread, with the reply or with the error text.
+ *   When the send fails at once, not initialized or the window full, it is
+ *   called on the calling thread.
+ */
+void SharedBoomStick::SendAsync(const std::string& command, const ReplyCallback& onReply) {
+   if (!mRunning.load()) {
+      onReply(false, kNotInitialized);
+      return;
+   }
+   if (Windowed() && !mWindow.TryAcquire()) {
+      mStats.WindowFull();
+      if (0 == mWindowWaitMs || !mWindow.Acquire(mWindowWaitMs)) {
+         onReply(false, kWindowFull);
+         return;
+      }
+   }
+   Submission* submission = new Submission;
+   submission->id = RequestId(mIdSalt, mIdCount.fetch_add(1, std::memory_order_relaxed) + 1);
+   submission->submittedAt = std::time(NULL);
+   submission->command = command;
+   submission->onReply = onReply;
+   Push(submission);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (!mRunning.load()) {
+      // the I/O thread stopped, it may have drained the queue before this push
+      std::vector<ReplyCallback> failed;
+      {
+         std::lock_guard<std::mutex> lock(mDrainMutex);
+         if (mDrained) {
+            TakeAll(failed);
+         }
+      }
+      FailAll(failed, kShutDown);
+      return;
+   }
+   if (mAsleep.exchange(false)) {
+      const uint64_t wake = 1;
+      if (write(mWakeUp, &wake, sizeof (wake)) < 0) {
+         LOG(WARNING) << "Cannot wake the I/O thread " << strerror(errno);
+      }
+   }
+}
+
+/**
+ * @return what was sent and received, outstanding is the requests without
+ *   a reply yet, including those that timed out
+ */
+EndpointStats::Counters SharedBoomStick::Stats() const {
+   return mStats.Get();
+}
+
+/**
+ * Add to the submission queue, any thread can push
+ * @param submission
+ */
+void SharedBoomStick::Push(Submission* submission) {
+   submission->next.store(nullptr, std::memory_order_relaxed);
+   Submission* previous = mHead.exchange(submission, std::memory_order_acq_rel);
+   previous->next.store(submission, std::memory_order_release);
+}
+
+/**
+ * Take from the submission queue, only the I/O thread pops while it runs
+ * @return
+ *   The oldest submission, nullptr when empty or while a push is half done
+ */
+SharedBoomStick::Submission* SharedBoomStick::Pop() {
+   Submission* tail = mTail;
+   Submission* next = tail->next.load(std::memory_order_acquire);
+   if (&mStub == tail) {
+      if (nullptr == next) {
+         return nullptr;
+      }
+      mTail = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+   }
+   if (nullptr != next) {
+      mTail = next;
+      return tail;
+   }
+   if (tail != mHead.load(std::memory_order_acquire)) {
+      return nullptr;
+   }
+   Push(&mStub);
+   next = tail->next.load(std::memory_order_acquire);
+   if (nullptr != next) {
+      mTail = next;
+      return tail;
+   }
+   return nullptr;
+}
+
+/**
+ * The I/O thread: send what was submitted, complete what was replied to and
+ * fail what timed out
+ * @param connected
+ *   Set once the socket is connected, or failed to
+ */
+void SharedBoomStick::Run(std::promise<bool>& connected) {
+   if (!Connect()) {
+      StopAndDrain();
+      connected.set_value(false);
+      return;
+   }
+   connected.set_value(true);
+
+   zmq_pollitem_t items[2];
+   items[0].socket = mChamber;
+   items[0].fd = 0;
+   items[1].socket = nullptr;
+   items[1].fd = mWakeUp;
+   items[1].events = ZMQ_POLLIN;
+   while (mRunning.load() && !zctx_interrupted) {
+      SendSubmissions();
+      mAsleep.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (SendSubmissions() > 0) {
+         mAsleep.store(false);
+         continue;
+      }
+      items[0].events = ZMQ_POLLIN | (mBacklog.empty() ? 0 : ZMQ_POLLOUT);
+      items[0].revents = 0;
+      items[1].revents = 0;
+      const int rc = zmq_poll(items, 2, kPollMs);
+      mAsleep.store(false);
+      if (rc < 0) {
+         if (ETERM == zmq_errno()) {
+            break;
+         }
+         continue;
+      }
+      if (items[1].revents & ZMQ_POLLIN) {
+         uint64_t wakes = 0;
+         if (read(mWakeUp, &wakes, sizeof (wakes)) < 0 && EAGAIN != errno) {
+            LOG(WARNING) << "Cannot read the wake up " << strerror(errno);
+         }
+      }
+      if (items[0].revents & ZMQ_POLLIN) {
+         ReadReplies();
+      }
+      ExpireRequests();
+      mStats.SetInFlight(mWindow.inFlight());
+   }
+   StopAndDrain();
+   zsocket_destroy(mCtx, mChamber);
+   mChamber = nullptr;
+}
+
+/**
+ * Open and connect the DEALER socket, on the I/O thread that uses it
+ * @return
+ */
+bool SharedBoomStick::Connect() {
+   mChamber = zsocket_new(mCtx, ZMQ_DEALER);
+   if (nullptr == mChamber) {
+      LOG(WARNING) << "queue error " << zmq_strerror(zmq_errno());
+      return false;
+   }
+   zsocket_set_sndhwm(mChamber, mSendHWM);
+   zsocket_set_rcvhwm(mChamber, mRecvHWM);
+   if (zsocket_connect(mChamber, mBinding.c_str()) < 0) {
+      LOG(WARNING) << "Cannot connect to " << mBinding << ", " << zmq_strerror(zmq_errno());
+      zsocket_destroy(mCtx, mChamber);
+      mChamber = nullptr;
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Move the submission queue to the backlog and send from the backlog till
+ * the socket is full
+ * @return
+ *   How many submissions were taken off the queue
+ */
+size_t SharedBoomStick::SendSubmissions() {
+   size_t popped = 0;
+   Submission* submission = nullptr;
+   while (nullptr != (submission = Pop())) {
+      mBacklog.push_back(submission);
+      ++popped;
+   }
+   while (!mBacklog.empty() && SendSubmission(mBacklog.front())) {
+      mBacklog.pop_front();
+   }
+   return popped;
+}
+
+/**
+ * Send one request, with its id as a raw 16 byte frame
+ * @param submission
+ *   Deleted unless the socket is full
+ * @return
+ *   false if the socket is full and the submission has to wait
+ */
+bool SharedBoomStick::SendSubmission(Submission* submission) {
+   char frame[RequestId::kSize];
+   submission->id.ToBytes(frame);
+   if (zmq_send(mChamber, frame, sizeof (frame), ZMQ_SNDMORE | ZMQ_DONTWAIT) < 0) {
+      if (EAGAIN == zmq_errno()) {
+         return false;
+      }
+      LOG(WARNING) << "queue error " << zmq_strerror(zmq_errno());
+      Complete(submission->onReply, false, zmq_strerror(zmq_errno()));
+      delete submission;
+      return true;
+   }
+   // the rest of a message never blocks once its first part went out
+   if (zmq_send(mChamber, submission->command.data(), submission->command.size(), ZMQ_DONTWAIT) < 0) {
+      LOG(WARNING) << "queue error " << zmq_strerror(zmq_errno());
+      Complete(submission->onReply, false, zmq_strerror(zmq_errno()));
+      delete submission;
+      return true;
+   }
+   mStats.Sent(submission->command.size());
+   mRequests.Insert(submission->id, std::time(NULL), 0, std::move(submission->onReply));
+   delete submission;
+   return true;
+}
+
+/**
+ * Complete every reply that is ready, they never wait in a cache
+ */
+void SharedBoomStick::ReadReplies() {
+   while (true) {
+      zmq_msg_t id;
+      zmq_msg_init(&id);
+      if (zmq_msg_recv(&id, mChamber, ZMQ_DONTWAIT) < 0) {
+         zmq_msg_close(&id);
+         return;
+      }
+      zmq_msg_t reply;
+      zmq_msg_init(&reply);
+      size_t parts = 1;
+      bool more = zmq_msg_more(&id);
+      if (more) {
+         zmq_msg_recv(&reply, mChamber, 0);
+         more = zmq_msg_more(&reply);
+         ++parts;
+      }
+      while (more) {
+         zmq_msg_t extra;
+         zmq_msg_init(&extra);
+         zmq_msg_recv(&extra, mChamber, 0);
+         more = zmq_msg_more(&extra);
+         zmq_msg_close(&extra);
+         ++parts;
+      }
+
+      if (2 != parts || RequestId::kSize != zmq_msg_size(&id)) {
+         LOG(WARNING) << "Malformed reply, expecting 2 parts and a 16 byte id";
+         mStats.Malformed();
+      } else {
+         const RequestId found = RequestId::FromBytes(zmq_msg_data(&id));
+         ReplyCallback onReply;
+         if (mRequests.TakeCallback(found, onReply)) {
+            const std::string text(static_cast<const char*> (zmq_msg_data(&reply)), zmq_msg_size(&reply));
+            mStats.Received(text.size());
+            Complete(onReply, true, text);
+         } else {
+            LOG(WARNING) << "Found unmatched reply to unknown hash " << found.ToString();
+         }
+      }
+      zmq_msg_close(&reply);
+      zmq_msg_close(&id);
+   }
+}
+
+/**
+ * Fail the requests that waited longer than the reply timeout, at most
+ * once a second. That includes those that never got out of the backlog
+ * because the socket stayed full.
+ */
+void SharedBoomStick::ExpireRequests() {
+   const time_t now = std::time(NULL);
+   if (now == mLastExpiry) {
+      return;
+   }
+   mLastExpiry = now;
+   while (!mBacklog.empty() && mBacklog.front()->submittedAt <= now - mReplyTimeout) {
+      Submission* stuck = mBacklog.front();
+      mBacklog.pop_front();
+      mStats.SendTimeout();
+      Complete(stuck->onReply, false, kTimedOut);
+      delete stuck;
+   }
+   std::vector<ReplyCallback> expired;
+   size_t unread = 0;
+   mRequests.Expire(now, unread, &expired);
+   for (auto& onReply : expired) {
+      mStats.ReceiveTimeout();
+      Complete(onReply, false, kTimedOut);
+   }
+}
+
+/**
+ * Stop taking submissions and fail everything left, on the I/O thread as it
+ * exits. A caller that sees it stopped after pushing fails its own
+ * submission if the drain already ran, otherwise the drain finds it.
+ */
+void SharedBoomStick::StopAndDrain() {
+   mRunning.store(false);
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   std::vector<ReplyCallback> failed;
+   {
+      std::lock_guard<std::mutex> lock(mDrainMutex);
+      TakeAll(failed);
+      mDrained = true;
+   }
+   FailAll(failed, kShutDown);
+}
+
+/**
+ * Take everything submitted or sent that has no reply yet. Only called
+ * with mDrainMutex held once the I/O thread has stopped, so one thread at a
+ * time pops the submission queue. The callbacks are not run here, a callback
+ * that submits again would take mDrainMutex a second time.
+ * @param failed gets the callback of every request taken
+ */
+void SharedBoomStick::TakeAll(std::vector<ReplyCallback>& failed) {
+   Submission* submission = nullptr;
+   while (nullptr != (submission = Pop())) {
+      mBacklog.push_back(submission);
+   }
+   for (Submission* waiting : mBacklog) {
+      failed.push_back(std::move(waiting->onReply));
+      delete waiting;
+   }
+   mBacklog.clear();
+
+   size_t unread = 0;
+   mRequests.Expire(std::time(NULL) + mReplyTimeout + 1, unread, &failed);
+}
+
+/**
+ * Call back every request taken by TakeAll, with mDrainMutex released
+ * @param failed
+ * @param why
+ */
+void SharedBoomStick::FailAll(std::vector<ReplyCallback>& failed, const std::string& why) {
+   for (auto& onReply : failed) {
+      Complete(onReply, false, why);
+   }
+   failed.clear();
+   mStats.SetInFlight(mWindow.inFlight());
+}
+
+/**
+ * Give the request's credit back to the window if there is one, then call
+ * it back
+ * @param onReply
+ * @param success
+ * @param reply
+ */
+void SharedBoomStick::Complete(const ReplyCallback& onReply, const bool success, const std::string& reply) {
+   if (Windowed()) {
+      mWindow.Release();
+   }
+   onReply(success, reply);
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <atomic>
+#include <ctime>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CreditWindow.h"
+#include "EndpointStats.h"
+#include "RequestTable.h"
+struct _zctx_t;
+typedef struct _zctx_t zctx_t;
+
+/**
+ * A BoomStick that any number of threads can send through at once.
+ *
+ * One DEALER socket is owned by an internal I/O thread. Callers push their
+ * requests onto a lock free queue and wake the I/O thread through an
+ * eventfd, the I/O thread sends them with compact ids and completes every
+ * reply as it comes off the socket. Worker threads that each needed a
+ * BoomStick of their own, with its own context and connection, can share
+ * one of these instead.
+ *
+ *    SharedBoomStick stick(binding);
+ *    stick.Initialize();
+ *    std::future<std::string> reply = stick.SendAsync("command");
+ *    stick.SendAsync("command", [](const bool success, const std::string& reply) { ... });
+ *
+ * Callbacks run on the I/O thread: they must not block, and must not wait
+ * on another reply from the same SharedBoomStick. A future that fails
+ * throws the error text as a std::string. A request that is not answered
+ * within the reply timeout fails, replies after that are dropped.
+ *
+ * SetWindow limits how many requests are in flight at once. With the
+ * window full a send fails at once, or the calling thread blocks till a
+ * reply comes back. A callback that sends through a full window that waits
+ * holds up the I/O thread, and with it every reply, for that whole wait.
+ */
+class SharedBoomStick {
+public:
+   explicit SharedBoomStick(const std::string& binding);
+   SharedBoomStick(const std::string& binding, zctx_t* context);
+   ~SharedBoomStick();
+
+   void SetSendHWM(const int hwm);
+   void SetRecvHWM(const int hwm);
+   void SetReplyTimeout(const unsigned int seconds);
+   void SetWindow(const size_t requests, const unsigned int msToWait = 0);
+   bool Initialize();
+
+   std::string Send(const std::string& command);
+   std::future<std::string> SendAsync(const std::string& command);
+   void SendAsync(const std::string& command, const ReplyCallback& onReply);
+   EndpointStats::Counters Stats() const;
+
+private:
+   SharedBoomStick(const SharedBoomStick&) = delete;
+   SharedBoomStick& operator=(const SharedBoomStick&) = delete;
+
+   struct Submission {
+      std::atomic<Submission*> next;
+      RequestId id;
+      time_t submittedAt;
+      std::string command;
+      ReplyCallback onReply;
+   };
+
+   void Push(Submission* submission);
+   Submission* Pop();
+   void Run(std::promise<bool>& connected);
+   bool Connect();
+   size_t SendSubmissions();
+   bool SendSubmission(Submission* submission);
+   void ReadReplies();
+   void ExpireRequests();
+   void StopAndDrain();
+   void TakeAll(std::vector<ReplyCallback>& failed);
+   void FailAll(std::vector<ReplyCallback>& failed, const std::string& why);
+   void Complete(const ReplyCallback& onReply, const bool success, const std::string& reply);
+
+   bool Windowed() const {
+      return mWindow.size() > 0;
+   }
+
+   const std::string mBinding;
+   zctx_t* mCtx;
+   zctx_t* mSharedCtx;
+   void* mChamber;
+   int mWakeUp;
+   int mSendHWM;
+   int mRecvHWM;
+   time_t mReplyTimeout;
+   uint64_t mIdSalt;
+   std::atomic<uint64_t> mIdCount;
+   std::atomic<bool> mRunning;
+   std::atomic<bool> mAsleep;
+   CreditWindow mWindow;
+   unsigned int mWindowWaitMs;
+   std::thread mThread;
+   // the last drain of the queue after the I/O thread stops
+   std::mutex mDrainMutex;
+   bool mDrained;
+
+   // lock free multi producer, single consumer queue of submissions
+   std::atomic<Submission*> mHead;
+   Submission* mTail;
+   Submission mStub;
+
+   // only touched by the I/O thread
+   std::deque<Submission*> mBacklog;
+   RequestTable mRequests;
+   time_t mLastExpiry;
+   EndpointStats mStats;
+};
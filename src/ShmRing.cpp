@@ -0,0 +1,606 @@
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <thread>
+
+#include "ShmRing.h"
+#include "g3log/g3log.hpp"
+
+const std::string ShmRing::kShm = "shm://";
+const size_t ShmRing::kDefaultSlotSize;
+const int ShmRing::kAbandonedMs;
+
+namespace {
+   const size_t kCacheLine = 64;
+   const uint32_t kMagic = 0x514e5352; // "QNSR"
+   const uint32_t kVersion = 2;
+   const int kSpins = 64;
+   const int kOpenRetries = 1000;
+   // a claim the consumer took back, the producer must not publish it
+   const uint64_t kRevoked = 1ULL << 63;
+
+   size_t RoundToCacheLine(const size_t size) {
+      return ((size + kCacheLine - 1) / kCacheLine) * kCacheLine;
+   }
+
+   uint32_t RoundToPowerOfTwo(const uint32_t count) {
+      uint32_t rounded = 1;
+      while (rounded < count) {
+         rounded <<= 1;
+      }
+      return rounded;
+   }
+
+   int Futex(std::atomic<uint32_t>* word, const int op, const uint32_t value,
+      const struct timespec* timeout) {
+      return syscall(SYS_futex, reinterpret_cast<uint32_t*> (word), op, value, timeout, NULL, 0);
+   }
+
+   bool IsAlive(const pid_t pid) {
+      return pid > 0 && (kill(pid, 0) == 0 || EPERM == errno);
+   }
+}
+
+/**
+ * Lives at the start of the segment. The counters are on their own cache
+ * lines so producers and the consumer don't fight over them. The first line
+ * is only written when the segment changes hands.
+ */
+struct ShmRing::Header {
+   std::atomic<uint32_t> magic;
+   uint32_t version;
+   uint32_t slotCount;
+   uint32_t slotSize;
+   std::atomic<int32_t> consumer;
+   std::atomic<uint32_t> retired;
+   alignas(kCacheLine) std::atomic<uint64_t> enqueue;
+   alignas(kCacheLine) std::atomic<uint64_t> dequeue;
+   alignas(kCacheLine) std::atomic<uint32_t> sleeping;
+   std::atomic<uint64_t> wakeups;
+   alignas(kCacheLine) std::atomic<uint32_t> parked;
+   std::atomic<uint32_t> freed;
+};
+
+/**
+ * A slot is published when its sequence is position + 1 and free for the
+ * next lap when it is position + slotCount. A producer stamps the position
+ * it claimed and its pid before it writes, so the consumer can tell a slow
+ * producer from a dead one. The message follows on the next cache line.
+ */
+struct ShmRing::Slot {
+   std::atomic<uint64_t> sequence;
+   uint32_t size;
+   std::atomic<int32_t> producer;
+   std::atomic<uint64_t> claim;
+};
+
+static_assert(sizeof (std::atomic<uint32_t>) == sizeof (uint32_t), "futex word must be 32 bits");
+static_assert(sizeof (pid_t) == sizeof (int32_t), "a pid must fit the segment");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared memory atomics must be lock free");
+
+/**
+ * @param location
+ *   shm://name, the segment is /dev/shm/QueueNado.name
+ */
+ShmRing::ShmRing(const std::string& location) :
+mName("/QueueNado." + location.substr(IsShm(location) ? kShm.size() : 0)),
+mHeader(NULL),
+mSlots(NULL),
+mMappedSize(0),
+mSlotStride(0),
+mMask(0),
+mWantedSlotCount(0),
+mWantedSlotSize(0),
+mPid(getpid()),
+mConsumer(false),
+mHolding(false),
+mStalledPosition(~0ULL) {
+}
+
+ShmRing::~ShmRing() {
+   Close();
+}
+
+/**
+ * @param location
+ * @return if the location is a shm:// location
+ */
+bool ShmRing::IsShm(const std::string& location) {
+   return location.compare(0, kShm.size(), kShm) == 0;
+}
+
+/**
+ * @return the name of the segment in /dev/shm
+ */
+std::string ShmRing::GetName() const {
+   return mName;
+}
+
+/**
+ * Create the segment, or open it if the other end got there first. The
+ * consumer starts over on a new segment when the one it finds is not a ring,
+ * or was left by a consumer that died.
+ * @param slotCount
+ *   Rounded up to a power of two, only used when creating
+ * @param slotSize
+ *   The largest message, only used when creating
+ * @param consumer
+ *   There is one consumer, it removes the segment name when it closes
+ * @return
+ *   false if the segment can't be used, or already has a live consumer
+ */
+bool ShmRing::Attach(const uint32_t slotCount, const size_t slotSize, const bool consumer) {
+   if (mHeader != NULL) {
+      return true;
+   }
+   mWantedSlotCount = slotCount;
+   mWantedSlotSize = slotSize;
+   mConsumer = consumer;
+   bool invalid = false;
+   if (!Open(slotCount, slotSize, invalid)) {
+      if (!consumer || !invalid) {
+         return false;
+      }
+      LOG(WARNING) << "Shared memory " << mName << " is not a ring, replacing it";
+      shm_unlink(mName.c_str());
+      if (!Open(slotCount, slotSize, invalid)) {
+         return false;
+      }
+   }
+   if (!consumer) {
+      return true;
+   }
+   const pid_t previous = mHeader->consumer.load();
+   if (previous != 0 && !IsAlive(previous)) {
+      LOG(WARNING) << "Consumer " << previous << " of shared memory " << mName
+         << " died, starting over on a new ring";
+      Retire();
+      if (!Open(slotCount, slotSize, invalid)) {
+         return false;
+      }
+   }
+   int32_t none = 0;
+   if (!mHeader->consumer.compare_exchange_strong(none, mPid)) {
+      LOG(WARNING) << "Shared memory " << mName << " already has a consumer, process " << none;
+      Unmap();
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Map the segment, creating it if it does not exist
+ * @param slotCount
+ * @param slotSize
+ * @param invalid
+ *   set when the segment exists but is not a ring of this version
+ * @return
+ */
+bool ShmRing::Open(const uint32_t slotCount, const size_t slotSize, bool& invalid) {
+   invalid = false;
+   const size_t headerSize = RoundToCacheLine(sizeof (Header));
+   bool created = true;
+   int fd = shm_open(mName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+   if (fd < 0 && EEXIST == errno) {
+      created = false;
+      fd = shm_open(mName.c_str(), O_RDWR, 0666);
+   }
+   if (fd < 0) {
+      LOG(WARNING) << "Can't open shared memory " << mName << ": " << strerror(errno);
+      return false;
+   }
+   size_t mappedSize = 0;
+   if (created) {
+      fchmod(fd, 0666);
+      const uint32_t count = RoundToPowerOfTwo(slotCount);
+      mappedSize = headerSize + (count * (kCacheLine + RoundToCacheLine(slotSize)));
+      if (ftruncate(fd, mappedSize) < 0) {
+         LOG(WARNING) << "Can't size shared memory " << mName << ": " << strerror(errno);
+         close(fd);
+         shm_unlink(mName.c_str());
+         return false;
+      }
+   } else {
+      // the creator sizes the segment in one go, wait for it
+      struct stat status;
+      for (int retry = 0; retry < kOpenRetries; ++retry) {
+         if (fstat(fd, &status) == 0 && status.st_size > 0) {
+            mappedSize = status.st_size;
+            break;
+         }
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      invalid = (mappedSize < headerSize);
+   }
+   void* memory = (mappedSize < headerSize) ? MAP_FAILED :
+      mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (memory == MAP_FAILED) {
+      LOG(WARNING) << "Can't map shared memory " << mName;
+      return false;
+   }
+   Header* header = static_cast<Header*> (memory);
+   if (created) {
+      header->version = kVersion;
+      header->slotCount = RoundToPowerOfTwo(slotCount);
+      header->slotSize = slotSize;
+      header->consumer.store(0, std::memory_order_relaxed);
+      header->retired.store(0, std::memory_order_relaxed);
+      header->enqueue.store(0, std::memory_order_relaxed);
+      header->dequeue.store(0, std::memory_order_relaxed);
+      header->sleeping.store(0, std::memory_order_relaxed);
+      header->wakeups.store(0, std::memory_order_relaxed);
+      header->parked.store(0, std::memory_order_relaxed);
+      header->freed.store(0, std::memory_order_relaxed);
+      const size_t stride = kCacheLine + RoundToCacheLine(slotSize);
+      char* slots = static_cast<char*> (memory) + headerSize;
+      for (uint32_t i = 0; i < header->slotCount; i++) {
+         Slot* slot = reinterpret_cast<Slot*> (slots + (i * stride));
+         slot->sequence.store(i, std::memory_order_relaxed);
+         slot->producer.store(0, std::memory_order_relaxed);
+         slot->claim.store(~0ULL, std::memory_order_relaxed);
+      }
+      header->magic.store(kMagic, std::memory_order_release);
+   } else {
+      int retry = 0;
+      while (header->magic.load(std::memory_order_acquire) != kMagic && retry++ < kOpenRetries) {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      if (header->magic.load(std::memory_order_acquire) != kMagic || header->version != kVersion) {
+         LOG(WARNING) << "Shared memory " << mName << " is not a ring";
+         munmap(memory, mappedSize);
+         invalid = true;
+         return false;
+      }
+   }
+   mHeader = header;
+   mSlots = static_cast<char*> (memory) + headerSize;
+   mMappedSize = mappedSize;
+   mSlotStride = kCacheLine + RoundToCacheLine(header->slotSize);
+   mMask = header->slotCount - 1;
+   return true;
+}
+
+/**
+ * Move a producer to the segment that replaced the one it is on
+ * @return
+ */
+bool ShmRing::Reattach() {
+   LOG(INFO) << "Shared memory " << mName << " was retired by its consumer, attaching again";
+   Unmap();
+   return Attach(mWantedSlotCount, mWantedSlotSize, false);
+}
+
+/**
+ * Copy a message into the ring.
+ * @param data
+ * @param size
+ * @param waitMs
+ *   How long to wait for a free slot while the ring is full
+ * @return
+ */
+bool ShmRing::Push(const void* data, const size_t size, const int waitMs) {
+   if (mHeader == NULL) {
+      LOG(WARNING) << "Shared memory uninitialized!";
+      return false;
+   }
+   if (mHeader->retired.load(std::memory_order_relaxed) != 0 && !Reattach()) {
+      return false;
+   }
+   if (size > mHeader->slotSize) {
+      LOG(WARNING) << "Tried to send " << size << " bytes through slots of " << mHeader->slotSize;
+      return false;
+   }
+   using namespace std::chrono;
+   const steady_clock::time_point deadline = steady_clock::now() + milliseconds(waitMs);
+   uint64_t position = mHeader->enqueue.load(std::memory_order_relaxed);
+   Slot* slot = NULL;
+   int spins = 0;
+   while (true) {
+      slot = SlotAt(position);
+      const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const int64_t difference = static_cast<int64_t> (sequence - position);
+      if (difference == 0) {
+         if (mHeader->enqueue.compare_exchange_weak(position, position + 1,
+            std::memory_order_relaxed, std::memory_order_relaxed)) {
+            break;
+         }
+      } else if (difference < 0) {
+         // full, the consumer hasn't released this slot from the last lap
+         if (++spins > kSpins) {
+            if (steady_clock::now() >= deadline) {
+               return false;
+            }
+            SleepProducer(slot, position, deadline);
+            if (mHeader->retired.load(std::memory_order_relaxed) != 0) {
+               if (!Reattach() || size > mHeader->slotSize) {
+                  return false;
+               }
+               spins = 0;
+            }
+         }
+         position = mHeader->enqueue.load(std::memory_order_relaxed);
+      } else {
+         position = mHeader->enqueue.load(std::memory_order_relaxed);
+      }
+   }
+   if (!Stamp(slot, position)) {
+      LOG(WARNING) << "Shared memory " << mName << " consumer took back a slot that was claimed too long";
+      return false;
+   }
+   memcpy(reinterpret_cast<char*> (slot) + kCacheLine, data, size);
+   slot->size = size;
+   slot->sequence.store(position + 1, std::memory_order_release);
+   WakeConsumer();
+   return true;
+}
+
+/**
+ * Mark a claimed slot as being written by this process. Fails if the
+ * consumer gave up on the claim first, the slot is no longer ours then.
+ * @param slot
+ * @param position
+ * @return
+ */
+bool ShmRing::Stamp(Slot* slot, const uint64_t position) {
+   slot->producer.store(mPid, std::memory_order_relaxed);
+   uint64_t claim = slot->claim.load(std::memory_order_relaxed);
+   while (claim != (position | kRevoked)) {
+      if (slot->claim.compare_exchange_weak(claim, position)) {
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * Read the next message in place. It stays in the ring until Release, or
+ * the next Peek, so only one consumer may Peek.
+ * @param data
+ * @param size
+ * @param timeoutMs
+ *   0 to not wait, negative to wait forever
+ * @return
+ *   false on timeout
+ */
+bool ShmRing::Peek(const char*& data, size_t& size, const int timeoutMs) {
+   if (mHeader == NULL) {
+      LOG(WARNING) << "Shared memory uninitialized!";
+      return false;
+   }
+   Release();
+   using namespace std::chrono;
+   const steady_clock::time_point deadline = steady_clock::now() + milliseconds(timeoutMs);
+   uint64_t position = mHeader->dequeue.load(std::memory_order_relaxed);
+   Slot* slot = SlotAt(position);
+   int spins = 0;
+   while (slot->sequence.load(std::memory_order_acquire) != position + 1) {
+      if (SkipAbandoned(position)) {
+         slot = SlotAt(++position);
+         continue;
+      }
+      if (timeoutMs == 0) {
+         return false;
+      }
+      if (++spins <= kSpins) {
+         continue;
+      }
+      int remaining = -1;
+      if (timeoutMs > 0) {
+         remaining = duration_cast<milliseconds>(deadline - steady_clock::now()).count();
+         if (remaining <= 0) {
+            return false;
+         }
+      }
+      if (mHeader->enqueue.load(std::memory_order_relaxed) > position) {
+         // claimed but not published, look again in case its producer died
+         remaining = (remaining < 0) ? kAbandonedMs : std::min(remaining, kAbandonedMs);
+      }
+      mHeader->sleeping.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (slot->sequence.load(std::memory_order_acquire) == position + 1) {
+         mHeader->sleeping.store(0, std::memory_order_relaxed);
+         break;
+      }
+      SleepConsumer(remaining);
+      mHeader->sleeping.store(0, std::memory_order_relaxed);
+   }
+   data = reinterpret_cast<const char*> (slot) + kCacheLine;
+   size = slot->size;
+   mHolding = true;
+   return true;
+}
+
+/**
+ * Hand the slot of the last Peek back to the producers.
+ */
+void ShmRing::Release() {
+   if (!mHolding) {
+      return;
+   }
+   mHolding = false;
+   const uint64_t position = mHeader->dequeue.load(std::memory_order_relaxed);
+   SlotAt(position)->sequence.store(position + mMask + 1, std::memory_order_release);
+   mHeader->dequeue.store(position + 1, std::memory_order_relaxed);
+   WakeProducers(1);
+}
+
+/**
+ * Free the slot at position if its claim was never published and is
+ * abandoned: unpublished for kAbandonedMs and either its producer is gone,
+ * or it never stamped the claim. A producer that stamps after that finds its
+ * claim revoked and fails the Push instead of writing.
+ * @param position
+ *   The next position to read, not published yet
+ * @return
+ *   true if the slot was skipped
+ */
+bool ShmRing::SkipAbandoned(const uint64_t position) {
+   if (mHeader->enqueue.load(std::memory_order_relaxed) <= position) {
+      // empty, nothing claimed
+      return false;
+   }
+   const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+   if (mStalledPosition != position) {
+      mStalledPosition = position;
+      mStalledSince = now;
+      return false;
+   }
+   if (now - mStalledSince < std::chrono::milliseconds(kAbandonedMs)) {
+      return false;
+   }
+   Slot* slot = SlotAt(position);
+   uint64_t claim = slot->claim.load();
+   const pid_t producer = slot->producer.load(std::memory_order_relaxed);
+   if (claim == position) {
+      if (IsAlive(producer)) {
+         return false;
+      }
+   } else if (!slot->claim.compare_exchange_strong(claim, position | kRevoked)) {
+      // stamped just now
+      return false;
+   }
+   uint64_t sequence = position;
+   if (!slot->sequence.compare_exchange_strong(sequence, position + mMask + 1)) {
+      // published right before its producer died
+      return false;
+   }
+   LOG(WARNING) << "Skipped a message on " << mName << " abandoned by process " << producer;
+   mHeader->dequeue.store(position + 1, std::memory_order_relaxed);
+   WakeProducers(1);
+   return true;
+}
+
+/**
+ * @return the largest message that fits in a slot
+ */
+size_t ShmRing::GetSlotSize() const {
+   return (mHeader == NULL) ? 0 : mHeader->slotSize;
+}
+
+/**
+ * @return the number of slots in the ring
+ */
+uint32_t ShmRing::GetSlotCount() const {
+   return (mHeader == NULL) ? 0 : mHeader->slotCount;
+}
+
+/**
+ * @return how many times a producer had to wake the consumer up
+ */
+uint64_t ShmRing::GetWakeups() const {
+   return (mHeader == NULL) ? 0 : mHeader->wakeups.load(std::memory_order_relaxed);
+}
+
+ShmRing::Slot* ShmRing::SlotAt(const uint64_t position) const {
+   return reinterpret_cast<Slot*> (mSlots + ((position & mMask) * mSlotStride));
+}
+
+/**
+ * Wake the consumer if it went to sleep on an empty ring. Pairs with the
+ * sleeping flag / sequence check in Peek.
+ */
+void ShmRing::WakeConsumer() {
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (mHeader->sleeping.load(std::memory_order_relaxed) != 0 &&
+      mHeader->sleeping.exchange(0, std::memory_order_relaxed) != 0) {
+      mHeader->wakeups.fetch_add(1, std::memory_order_relaxed);
+      Futex(&mHeader->sleeping, FUTEX_WAKE, 1, NULL);
+   }
+}
+
+/**
+ * Sleep until a producer wakes us or the timeout runs out.
+ * @param timeoutMs
+ *   negative to wait forever
+ * @return
+ *   false on error
+ */
+bool ShmRing::SleepConsumer(const int timeoutMs) {
+   struct timespec timeout;
+   timeout.tv_sec = (timeoutMs > 0) ? timeoutMs / 1000 : 0;
+   timeout.tv_nsec = (timeoutMs > 0) ? (timeoutMs % 1000) * 1000000 : 0;
+   if (Futex(&mHeader->sleeping, FUTEX_WAIT, 1, (timeoutMs < 0) ? NULL : &timeout) < 0 &&
+      EAGAIN != errno && ETIMEDOUT != errno && EINTR != errno) {
+      LOG(WARNING) << "futex wait failed on " << mName << ": " << strerror(errno);
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Wake producers parked on a full ring, if there are any. Pairs with the
+ * parked count / sequence check in SleepProducer.
+ * @param count
+ */
+void ShmRing::WakeProducers(const int count) {
+   std::atomic_thread_fence(std::memory_order_seq_cst);
+   if (mHeader->parked.load(std::memory_order_relaxed) != 0) {
+      mHeader->freed.fetch_add(1);
+      Futex(&mHeader->freed, FUTEX_WAKE, count, NULL);
+   }
+}
+
+/**
+ * Park a producer until the consumer frees a slot, the ring is retired or
+ * the deadline passes.
+ * @param slot
+ *   The slot the producer wants, still full from the last lap
+ * @param position
+ * @param deadline
+ */
+void ShmRing::SleepProducer(Slot* slot, const uint64_t position,
+   const std::chrono::steady_clock::time_point deadline) {
+   using namespace std::chrono;
+   mHeader->parked.fetch_add(1);
+   const uint32_t freed = mHeader->freed.load();
+   const int64_t remaining = duration_cast<microseconds>(deadline - steady_clock::now()).count();
+   if (remaining > 0 && mHeader->retired.load() == 0 &&
+      static_cast<int64_t> (slot->sequence.load(std::memory_order_acquire) - position) < 0) {
+      struct timespec timeout;
+      timeout.tv_sec = remaining / 1000000;
+      timeout.tv_nsec = (remaining % 1000000) * 1000;
+      Futex(&mHeader->freed, FUTEX_WAIT, freed, &timeout);
+   }
+   mHeader->parked.fetch_sub(1);
+}
+
+/**
+ * Take the segment away from every producer and remove its name. Producers
+ * move to a new segment on their next Push.
+ */
+void ShmRing::Retire() {
+   mHeader->retired.store(1);
+   mHeader->freed.fetch_add(1);
+   Futex(&mHeader->freed, FUTEX_WAKE, INT_MAX, NULL);
+   Unmap();
+   shm_unlink(mName.c_str());
+}
+
+void ShmRing::Unmap() {
+   munmap(mHeader, mMappedSize);
+   mHeader = NULL;
+   mSlots = NULL;
+   mHolding = false;
+}
+
+void ShmRing::Close() {
+   if (mHeader == NULL) {
+      return;
+   }
+   if (mConsumer) {
+      Release();
+      Retire();
+      return;
+   }
+   Unmap();
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <sys/types.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * A multi producer / single consumer ring of fixed size slots in a shared
+ * memory segment, the transport behind shm:// Rifle and Vampire locations.
+ *
+ * Producers in any process claim a slot, copy the message into it and
+ * publish it. The consumer reads the message in place and releases the slot.
+ * Nothing goes through the kernel while the consumer keeps up. A consumer
+ * that finds the ring empty sleeps on a futex in the segment, and producers
+ * only make the wake up syscall when it is actually asleep, so the reader is
+ * woken when the ring goes from empty to non empty and not per message.
+ * Producers that find the ring full park on a futex the same way, and the
+ * consumer only wakes them when one is parked.
+ *
+ * Whoever attaches first creates the segment and decides its size, later
+ * ends open it. There can be any number of producers but only one consumer
+ * per ring, and only the consumer removes the name from /dev/shm when it
+ * closes. Producers still attached then move to a new segment on their next
+ * Push. A consumer that finds the segment of a consumer that died starts
+ * over on a new one the same way. A producer that dies between claiming a
+ * slot and publishing it leaves a hole, the consumer skips it once the claim
+ * has been unpublished for kAbandonedMs and its producer is gone. All ends
+ * must share a pid namespace.
+ */
+class ShmRing {
+public:
+   static const std::string kShm;
+   static const size_t kDefaultSlotSize = 4 * 1024;
+   static const int kAbandonedMs = 1000;
+
+   explicit ShmRing(const std::string& location);
+   ~ShmRing();
+   ShmRing(const ShmRing&) = delete;
+   ShmRing& operator=(const ShmRing&) = delete;
+
+   bool Attach(const uint32_t slotCount, const size_t slotSize, const bool consumer);
+   bool Push(const void* data, const size_t size, const int waitMs);
+   bool Peek(const char*& data, size_t& size, const int timeoutMs);
+   void Release();
+   size_t GetSlotSize() const;
+   uint32_t GetSlotCount() const;
+   uint64_t GetWakeups() const;
+   std::string GetName() const;
+
+   static bool IsShm(const std::string& location);
+
+private:
+   struct Header;
+   struct Slot;
+
+   bool Open(const uint32_t slotCount, const size_t slotSize, bool& invalid);
+   bool Reattach();
+   Slot* SlotAt(const uint64_t position) const;
+   bool Stamp(Slot* slot, const uint64_t position);
+   bool SkipAbandoned(const uint64_t position);
+   void WakeConsumer();
+   bool SleepConsumer(const int timeoutMs);
+   void WakeProducers(const int count);
+   void SleepProducer(Slot* slot, const uint64_t position,
+      const std::chrono::steady_clock::time_point deadline);
+   void Retire();
+   void Unmap();
+   void Close();
+
+   const std::string mName;
+   Header* mHeader;
+   char* mSlots;
+   size_t mMappedSize;
+   size_t mSlotStride;
+   uint64_t mMask;
+   uint32_t mWantedSlotCount;
+   size_t mWantedSlotSize;
+   pid_t mPid;
+   bool mConsumer;
+   bool mHolding;
+   uint64_t mStalledPosition;
+   std::chrono::steady_clock::time_point mStalledSince;
+};
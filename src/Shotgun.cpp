@@ -8,12 +8,23 @@
 /**
  * Shotgun class is a ZeroMQ Publisher.
  */
-Shotgun::Shotgun() {
+Shotgun::Shotgun() : mStats("Shotgun", EndpointStats::Role::Publisher) {
    mCtx = zctx_new();
    assert(mCtx);
    mGun = zsocket_new(mCtx, ZMQ_PUB);
 }
 
+/**
+ * Shotgun on a shared context, see ContextPool.
+ * @param context
+ *   A working context, it is shadowed and never destroyed by the Shotgun
+ */
+Shotgun::Shotgun(zctx_t* context) : mStats("Shotgun", EndpointStats::Role::Publisher) {
+   mCtx = zctx_shadow(context);
+   assert(mCtx);
+   mGun = zsocket_new(mCtx, ZMQ_PUB);
+}
+
 /**
  * Where to fire our messages.
  * @param location
@@ -30,6 +41,7 @@ void Shotgun::Aim(const std::string& location) {
       throw std::string("Failed to connect to bind socket");
    }
    setIpcFilePermissions(location);
+   mStats.SetLocation(location);
    Death::Instance().RegisterDeathEvent(&Death::DeleteIpcFiles, location);
 }
 
@@ -72,19 +84,54 @@ void Shotgun::Fire(const std::vector<std::string>& bullets) {
 
    zmsg_t* msg = zmsg_new();
    zmsg_add(msg, key);
+   size_t bytes = 0;
    for (auto it = bullets.begin(); it != bullets.end(); it ++) {
       zframe_t* body = zframe_new(it->c_str(), it->size());
       zmsg_add(msg, body);
+      bytes += it->size();
+   }
+   if (mLatency) {
+      zframe_t* stamp = zframe_new(NULL, LatencyStats::kStampSize);
+      LatencyStats::WriteStamp(zframe_data(stamp));
+      zmsg_add(msg, stamp);
    }
 
+   LatencyTimer blocked(mLatency ? &mLatency->sendBlocked : NULL);
    if (zmsg_send(&msg, mGun) != 0) {
       LOG(WARNING) << "could not send message";
+   } else {
+      blocked.Stop();
+      mStats.Sent(bytes);
    }
    if (msg) {
       zmsg_destroy(&msg);
    }
 }
 
+/**
+ * Record how long sends take and end every message with a timestamp frame,
+ * so Aliens with stats on can record the end to end latency.
+ */
+void Shotgun::EnableLatencyStats() {
+   if (!mLatency) {
+      mLatency.reset(new LatencyStats);
+   }
+}
+
+/**
+ * @return the latency stats, NULL unless they were enabled
+ */
+const LatencyStats* Shotgun::GetLatencyStats() const {
+   return mLatency.get();
+}
+
+/**
+ * @return what was sent
+ */
+EndpointStats::Counters Shotgun::Stats() const {
+   return mStats.Get();
+}
+
 /**
  * Cleanup our socket and context.
  */
@@ -4,17 +4,26 @@
 #include <stdlib.h>
 #include <vector>
 #include <string>
+#include <memory>
+#include "LatencyHistogram.h"
+#include "EndpointStats.h"
 struct _zctx_t;
 typedef struct _zctx_t zctx_t;
 class Shotgun {
 public:
    Shotgun();
+   explicit Shotgun(zctx_t* context);
    void Aim(const std::string& location);
    void Fire(const std::string& msg);
    void Fire(const std::vector<std::string>& bullets);
+   void EnableLatencyStats();
+   const LatencyStats* GetLatencyStats() const;
+   EndpointStats::Counters Stats() const;
    virtual ~Shotgun();
 private:
    void setIpcFilePermissions(const std::string& location);
    void *mGun;
    zctx_t *mCtx;
+   std::unique_ptr<LatencyStats> mLatency;
+   EndpointStats mStats;
 };
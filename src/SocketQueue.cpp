@@ -0,0 +1,157 @@
+#include <algorithm>
+
+#include "SocketQueue.h"
+#include "Rifle.h"
+#include "Vampire.h"
+#include "g3log/g3log.hpp"
+
+/**
+ * Set up both ends, nothing is bound or connected until the first push / pop.
+ * @param location
+ * @param capacity
+ *   The high water mark of the Rifle and the Vampire
+ * @param context
+ *   A shared context for both ends (see ContextPool), NULL for their own
+ */
+SocketQueue::SocketQueue(const std::string& location, const size_t capacity, zctx_t* context) :
+mLocation(location),
+mCapacity(capacity),
+mRifle(context ? new Rifle(location, context) : new Rifle(location)),
+mVampire(context ? new Vampire(location, context) : new Vampire(location)),
+mPushed(0),
+mPopped(0) {
+   mRifle->SetHighWater(capacity);
+   mRifle->SetOwnSocket(true);
+   mVampire->SetHighWater(capacity);
+   mVampire->SetOwnSocket(false);
+}
+
+SocketQueue::~SocketQueue() {
+}
+
+/**
+ * Push without waiting for room.
+ * @param item
+ *   Left as it is, the bullet is copied into the message
+ * @return
+ *   false if the socket is full, not connected or item is empty
+ */
+bool SocketQueue::push(std::string& item) {
+   if (!Aim() || !mRifle->Fire(item, 0)) {
+      return false;
+   }
+   mPushed.fetch_add(1, std::memory_order_relaxed);
+   return true;
+}
+
+/**
+ * Pop what is waiting without waiting.
+ * @param item
+ * @return
+ *   false if nothing was waiting
+ */
+bool SocketQueue::pop(std::string& item) {
+   return wait_and_pop(item, std::chrono::milliseconds(0));
+}
+
+/**
+ * Pop, waiting for something to be pushed for as long as wait.
+ * @param item
+ * @param wait
+ * @return
+ *   false on timeout
+ */
+bool SocketQueue::wait_and_pop(std::string& item, const std::chrono::milliseconds wait) {
+   if (!PrepareToBeShot() || !mVampire->GetShot(item, wait.count())) {
+      return false;
+   }
+   mPopped.fetch_add(1, std::memory_order_relaxed);
+   return true;
+}
+
+bool SocketQueue::empty() const {
+   return size() == 0;
+}
+
+bool SocketQueue::full() const {
+   return size() >= mCapacity;
+}
+
+size_t SocketQueue::capacity() const {
+   return mCapacity;
+}
+
+size_t SocketQueue::capacity_free() const {
+   return mCapacity - std::min(size(), mCapacity);
+}
+
+/**
+ * @return what was pushed through this object and not popped from it yet
+ */
+size_t SocketQueue::size() const {
+   const size_t popped = mPopped.load(std::memory_order_relaxed);
+   const size_t pushed = mPushed.load(std::memory_order_relaxed);
+   return (pushed > popped) ? pushed - popped : 0;
+}
+
+/**
+ * @return how full the queue is in percent
+ */
+size_t SocketQueue::usage() const {
+   return (mCapacity == 0) ? 0 : (100 * size()) / mCapacity;
+}
+
+std::string SocketQueue::GetBinding() const {
+   return mLocation;
+}
+
+/**
+ * Aim the Rifle the first time it is needed, on the pushing thread.
+ * @return
+ */
+bool SocketQueue::Aim() {
+   if (!mRifle->Aim()) {
+      LOG(WARNING) << "SocketQueue can't aim at " << mLocation;
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Prepare the Vampire the first time it is needed, on the popping thread.
+ * @return
+ */
+bool SocketQueue::PrepareToBeShot() {
+   if (!mVampire->PrepareToBeShot()) {
+      LOG(WARNING) << "SocketQueue can't be shot at " << mLocation;
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Fire what push_bulk put in mBatch, without waiting for room.
+ * @return
+ *   The number fired from the front of mBatch
+ */
+size_t SocketQueue::FireBatch() {
+   const size_t fired = mRifle->FireBatch(mBatch, 0);
+   mPushed.fetch_add(fired, std::memory_order_relaxed);
+   return fired;
+}
+
+/**
+ * Receive into mShots.
+ * @param maxCount
+ * @param timeout in milliseconds, for the first shot
+ * @return
+ *   The number received into the front of mShots
+ */
+size_t SocketQueue::GetShots(const size_t maxCount, const int timeout) {
+   if (maxCount == 0 || !PrepareToBeShot()) {
+      return 0;
+   }
+   const size_t received = mVampire->GetShots(mShots, maxCount, timeout);
+   mPopped.fetch_add(received, std::memory_order_relaxed);
+   return received;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+struct _zctx_t;
+typedef struct _zctx_t zctx_t;
+class Rifle;
+class Vampire;
+
+/**
+ * A queue of strings with the QAPI queue interface, carried by a Rifle and
+ * a Vampire on one location. A stage that talks through a QAPI queue moves
+ * out of process by changing the queue type:
+ *
+ *    auto queue = QAPI::CreateQueue<spsc::flexible::circular_fifo<std::string>>(size);
+ *    auto queue = QAPI::CreateQueue<SocketQueue>("ipc:///tmp/stage.ipc", size);
+ *
+ * The Rifle is aimed on the first push and the Vampire prepared on the first
+ * pop, each from the thread that uses it. The process that only pushes has
+ * only the Rifle and the one that only pops only the Vampire. The Rifle
+ * binds and the Vampire connects.
+ *
+ * Like the spsc queues there is one pushing and one popping thread.
+ * push does not wait, it fails while the socket is at its high water mark,
+ * which is the capacity, or while nobody is connected. Empty strings can't
+ * be sent. size() is what this object pushed less what it popped, so it is
+ * only exact when both ends are in the same process.
+ */
+class SocketQueue {
+public:
+   SocketQueue(const std::string& location, const size_t capacity, zctx_t* context = NULL);
+   ~SocketQueue();
+   SocketQueue(const SocketQueue&) = delete;
+   SocketQueue& operator=(const SocketQueue&) = delete;
+
+   bool push(std::string& item);
+   bool pop(std::string& item);
+   bool wait_and_pop(std::string& item, const std::chrono::milliseconds wait);
+   template <typename Iterator>
+   size_t push_bulk(Iterator first, Iterator last);
+   template <typename OutputIt>
+   size_t pop_bulk(OutputIt out, const size_t maxCount);
+
+   bool empty() const;
+   bool full() const;
+   size_t capacity() const;
+   size_t capacity_free() const;
+   size_t size() const;
+   size_t usage() const;
+   std::string GetBinding() const;
+
+private:
+   bool Aim();
+   bool PrepareToBeShot();
+   size_t FireBatch();
+   size_t GetShots(const size_t maxCount, const int timeout);
+
+   const std::string mLocation;
+   const size_t mCapacity;
+   std::unique_ptr<Rifle> mRifle;
+   std::unique_ptr<Vampire> mVampire;
+   std::atomic<size_t> mPushed;
+   std::atomic<size_t> mPopped;
+   std::vector<std::string> mBatch;
+   std::vector<std::string> mShots;
+};
+
+/**
+ * Fire [first, last) as one batch. What could not be sent is moved back,
+ * so [first + pushed, last) is still the caller's.
+ * @param first
+ * @param last
+ * @return
+ *   The number pushed, counted from first
+ */
+template <typename Iterator>
+size_t SocketQueue::push_bulk(Iterator first, Iterator last) {
+   if (first == last || !Aim()) {
+      return 0;
+   }
+   mBatch.assign(std::make_move_iterator(first), std::make_move_iterator(last));
+   const size_t pushed = FireBatch();
+   std::move(mBatch.begin() + pushed, mBatch.end(), std::next(first, pushed));
+   mBatch.clear();
+   return pushed;
+}
+
+/**
+ * Pop what is waiting, up to maxCount, without waiting for more.
+ * @param out
+ * @param maxCount
+ * @return
+ *   The number popped
+ */
+template <typename OutputIt>
+size_t SocketQueue::pop_bulk(OutputIt out, const size_t maxCount) {
+   const size_t popped = GetShots(maxCount, 0);
+   for (size_t i = 0; i < popped; ++i) {
+      *out = std::move(mShots[i]);
+      ++out;
+   }
+   return popped;
+}
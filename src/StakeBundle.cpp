@@ -0,0 +1,150 @@
+#include <cstring>
+#include "StakeBundle.h"
+
+namespace {
+   const uint32_t kMagic = 0x514e5342; // "QNSB"
+   const size_t kHeaderSize = 2 * sizeof (uint32_t);
+   const size_t kStakeSize = sizeof (uint64_t) + sizeof (uint32_t);
+}
+
+StakeBundle::StakeBundle() :
+mCount(0),
+mPointers(NULL),
+mHashes(NULL) {
+   zmq_msg_init(&mMessage);
+}
+
+StakeBundle::~StakeBundle() {
+   zmq_msg_close(&mMessage);
+}
+
+/**
+ * @return the number of stakes in the bundle
+ */
+size_t StakeBundle::size() const {
+   return mCount;
+}
+
+bool StakeBundle::empty() const {
+   return mCount == 0;
+}
+
+/**
+ * @param index
+ * @return the pointer of the stake at index
+ */
+void* StakeBundle::Pointer(const size_t index) const {
+   uint64_t pointer;
+   memcpy(&pointer, mPointers + (index * sizeof (uint64_t)), sizeof (uint64_t));
+   return reinterpret_cast<void*> (static_cast<uintptr_t> (pointer));
+}
+
+/**
+ * @param index
+ * @return the hash of the stake at index
+ */
+unsigned int StakeBundle::Hash(const size_t index) const {
+   uint32_t hash;
+   memcpy(&hash, mHashes + (index * sizeof (uint32_t)), sizeof (uint32_t));
+   return hash;
+}
+
+/**
+ * @param count
+ * @return the size of a frame holding count stakes
+ */
+size_t StakeBundle::EncodedSize(const size_t count) {
+   return kHeaderSize + (count * kStakeSize);
+}
+
+/**
+ * Write stakes into a frame of EncodedSize(stakes.size()) bytes.
+ * @param stakes
+ * @param frame
+ */
+void StakeBundle::Encode(const Stakes& stakes, void* frame) {
+   char* out = static_cast<char*> (frame);
+   const uint32_t count = stakes.size();
+   memcpy(out, &kMagic, sizeof (uint32_t));
+   memcpy(out + sizeof (uint32_t), &count, sizeof (uint32_t));
+   char* pointers = out + kHeaderSize;
+   char* hashes = pointers + (count * sizeof (uint64_t));
+   for (uint32_t i = 0; i < count; i++) {
+      const uint64_t pointer = reinterpret_cast<uintptr_t> (stakes[i].first);
+      const uint32_t hash = stakes[i].second;
+      memcpy(pointers + (i * sizeof (uint64_t)), &pointer, sizeof (uint64_t));
+      memcpy(hashes + (i * sizeof (uint32_t)), &hash, sizeof (uint32_t));
+   }
+}
+
+/**
+ * Read the stakes out of a frame.
+ * @param frame
+ * @param size
+ * @param stakes
+ *   Cleared if the frame is not a stake bundle
+ * @return
+ */
+bool StakeBundle::Decode(const void* frame, const size_t size, Stakes& stakes) {
+   size_t count = 0;
+   if (!Parse(frame, size, count)) {
+      stakes.clear();
+      return false;
+   }
+   const char* pointers = static_cast<const char*> (frame) + kHeaderSize;
+   const char* hashes = pointers + (count * sizeof (uint64_t));
+   stakes.resize(count);
+   for (size_t i = 0; i < count; i++) {
+      uint64_t pointer;
+      uint32_t hash;
+      memcpy(&pointer, pointers + (i * sizeof (uint64_t)), sizeof (uint64_t));
+      memcpy(&hash, hashes + (i * sizeof (uint32_t)), sizeof (uint32_t));
+      stakes[i].first = reinterpret_cast<void*> (static_cast<uintptr_t> (pointer));
+      stakes[i].second = hash;
+   }
+   return true;
+}
+
+/**
+ * Check the header against the frame size.
+ * @param frame
+ * @param size
+ * @param count
+ *   The number of stakes in the frame
+ * @return
+ */
+bool StakeBundle::Parse(const void* frame, const size_t size, size_t& count) {
+   if (size < kHeaderSize) {
+      return false;
+   }
+   uint32_t magic;
+   uint32_t found;
+   memcpy(&magic, frame, sizeof (uint32_t));
+   memcpy(&found, static_cast<const char*> (frame) + sizeof (uint32_t), sizeof (uint32_t));
+   if (magic != kMagic || found == 0 || size != EncodedSize(found)) {
+      return false;
+   }
+   count = found;
+   return true;
+}
+
+/**
+ * Point the bundle at the frame in mMessage.
+ * @return if it is a valid bundle
+ */
+bool StakeBundle::Parse() {
+   const char* frame = static_cast<const char*> (zmq_msg_data(&mMessage));
+   if (!Parse(frame, zmq_msg_size(&mMessage), mCount)) {
+      Clear();
+      return false;
+   }
+   mPointers = frame + kHeaderSize;
+   mHashes = mPointers + (mCount * sizeof (uint64_t));
+   return true;
+}
+
+void StakeBundle::Clear() {
+   mCount = 0;
+   mPointers = NULL;
+   mHashes = NULL;
+}
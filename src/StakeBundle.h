@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <zmq.h>
+
+/**
+ * A bundle of stakes (pointer + hash pairs) as it is sent by
+ * Rifle::FireStakes.
+ *
+ * The wire format is packed structure of arrays with no padding and the
+ * same layout on 32 and 64 bit builds:
+ *
+ *    uint32_t magic, uint32_t count, uint64_t pointers[count], uint32_t hashes[count]
+ *
+ * Vampire::GetStakes(StakeBundle&) receives straight into the bundle, which
+ * then reads the pointers and hashes out of the frame without building a
+ * vector. The bundle is valid until the next GetStakes into it.
+ */
+class StakeBundle {
+public:
+   typedef std::vector<std::pair<void*, unsigned int> > Stakes;
+
+   StakeBundle();
+   ~StakeBundle();
+   StakeBundle(const StakeBundle&) = delete;
+   StakeBundle& operator=(const StakeBundle&) = delete;
+
+   size_t size() const;
+   bool empty() const;
+   void* Pointer(const size_t index) const;
+   unsigned int Hash(const size_t index) const;
+
+   static size_t EncodedSize(const size_t count);
+   static void Encode(const Stakes& stakes, void* frame);
+   static bool Decode(const void* frame, const size_t size, Stakes& stakes);
+
+private:
+   friend class Vampire;
+   static bool Parse(const void* frame, const size_t size, size_t& count);
+   bool Parse();
+   void Clear();
+
+   zmq_msg_t mMessage;
+   size_t mCount;
+   const char* mPointers;
+   const char* mHashes;
+};
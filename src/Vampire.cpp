@@ -1,11 +1,16 @@
 #include <boost/thread.hpp>
 #define _OPEN_SYS
 #include <sys/stat.h>
+#include <cstring>
 
 #include "Vampire.h"
 #include "czmq.h"
 #include "g3log/g3log.hpp"
 #include "Death.h"
+#include "ContextPool.h"
+#include "Coalescing.h"
+#include "StakeBundle.h"
+#include "ShmRing.h"
 
 
 /**
@@ -16,9 +21,29 @@ mLocation(location),
 mHwm(250),
 mBody(NULL),
 mContext(NULL),
+mSharedContext(NULL),
+mAliased(false),
 mLinger(10),
 mIOThredCount(1),
-mOwnSocket(false) {
+mOwnSocket(false),
+mShmSlotSize(ShmRing::kDefaultSlotSize),
+mCoalescedOffset(0),
+mCoalescedSize(0),
+mStats("Vampire", EndpointStats::Role::Receiver) {
+   mStats.SetLocation(location);
+   zmq_msg_init(&mShot);
+   zmq_msg_init(&mCoalesced);
+}
+
+/**
+ * Construct our Vampire on a shared context, see ContextPool. The I/O thread
+ * count is the shared context's.
+ * @param location
+ * @param context
+ *   A working context, it is shadowed and never destroyed by the Vampire
+ */
+Vampire::Vampire(const std::string& location, zctx_t* context) : Vampire(location) {
+   mSharedContext = context;
 }
 
 /**
@@ -69,6 +94,22 @@ bool Vampire::GetOwnSocket() {
    return mOwnSocket;
 }
 
+/**
+ * Set the largest bullet a shm:// ring carries. This must be called before
+ * PrepareToBeShot, and only counts if this end creates the ring, see ShmRing.
+ * @param bytes
+ */
+void Vampire::SetShmSlotSize(const size_t bytes) {
+   mShmSlotSize = bytes;
+}
+
+/**
+ * @return the largest bullet a shm:// ring made by this Vampire carries
+ */
+size_t Vampire::GetShmSlotSize() const {
+   return mShmSlotSize;
+}
+
 /**
  * Get IO thread count;
  * @param count
@@ -78,16 +119,32 @@ int Vampire::GetIOThreads() {
 }
 
 /**
- * Set the location we are going to be shot at.
+ * Set the location we are going to be shot at. A shm:// location is a shared
+ * memory ring that Rifles in other processes on this host write into, see
+ * ShmRing. Only one Vampire can read a ring. It is the ring's consumer
+ * whatever GetOwnSocket(), and removes the ring when it is destroyed.
  * @param location
  * @return 
  */
 bool Vampire::PrepareToBeShot() {
-   if (mBody) {
+   if (mBody || mRing) {
+      return true;
+   }
+   if (ShmRing::IsShm(mLocation)) {
+      std::unique_ptr<ShmRing> ring(new ShmRing(mLocation));
+      if (!ring->Attach(GetHighWater(), mShmSlotSize, true)) {
+         LOG(WARNING) << "Vampire can't attach to " << mLocation;
+         return false;
+      }
+      mRing = std::move(ring);
       return true;
    }
    if (!mContext) {
-      mContext = zctx_new();
+      if (!GetOwnSocket() && !mSharedContext) {
+         // a binder in this process on a pool context can be reached over inproc
+         ContextPool::Instance().FindAlias(mLocation, mSharedContext);
+      }
+      mContext = mSharedContext ? zctx_shadow(mSharedContext) : zctx_new();
       zctx_set_sndhwm(mContext, GetHighWater());
       zctx_set_rcvhwm(mContext, GetHighWater());// HWM on internal thread communication
       //zctx_set_linger(mContext, mLinger); // linger for a millisecond on close
@@ -107,8 +164,11 @@ bool Vampire::PrepareToBeShot() {
          }
          setIpcFilePermissions();
          Death::Instance().RegisterDeathEvent(&Death::DeleteIpcFiles, mLocation);
+         mAliased = ContextPool::Instance().BindAlias(mBody, mLocation, mContext);
       } else {
-         int result = zsocket_connect(mBody, mLocation.c_str());
+         zctx_t* context = mContext;
+         const std::string location = ContextPool::Instance().FindAlias(mLocation, context);
+         int result = zsocket_connect(mBody, location.c_str());
          if (result < 0) {
             zsocket_destroy(mContext, mBody);
             mBody = NULL;
@@ -143,35 +203,90 @@ void Vampire::setIpcFilePermissions() {
 
 /**
  * Get shot by the rifle.
- * @param bullet
+ *
+ * The bullet is received into a message that is reused between calls and
+ * assigned into wound, so a wound that is reused by the caller keeps its
+ * capacity and no allocations happen once it is big enough. Coalesced
+ * bullets are handed out one at a time.
+ *
+ * @param wound
+ * @param timeout
  * @return 
  */
 bool Vampire::GetShot(std::string& wound, const int timeout) {
+   const char* data = NULL;
+   size_t size = 0;
+   if (!NextShot(data, size, timeout)) {
+      return false;
+   }
+   wound.assign(data, size);
+   return true;
+}
+
+/**
+ * Get shot by the rifle without copying the bullet out of zeromq.
+ *
+ * The view points into the Vampire's own receive buffer. It is only valid
+ * until the next GetShot, GetShotView or GetShots call, or until the Vampire
+ * is destroyed.
+ *
+ * @param wound
+ *   Set to the first byte of the bullet
+ * @param size
+ *   Set to the size of the bullet
+ * @param timeout
+ * @return 
+ */
+bool Vampire::GetShotView(const char*& wound, size_t& size, const int timeout) {
+   if (!NextShot(wound, size, timeout)) {
+      wound = NULL;
+      size = 0;
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Find the next bullet, either left over from a coalesced message or
+ * waiting on the socket.
+ * @param data
+ * @param size
+ * @param timeout
+ * @return 
+ *   false on timeout, error or an invalid message
+ */
+bool Vampire::NextShot(const char*& data, size_t& size, const int timeout) {
+   LatencyTimer wait(ReceiveWait());
+   if (mRing) {
+      // read in place, the slot is released by the next read
+      if (!mRing->Peek(data, size, timeout)) {
+         mStats.ReceiveTimeout();
+         return false;
+      }
+      wait.Stop();
+      mStats.Received(size);
+      return true;
+   }
    if (!mBody) {
       LOG(WARNING) << "Socket uninitialized!";
       boost::this_thread::sleep(boost::posix_time::seconds(1));
       return false;
    }
+   if (NextCoalescedShot(data, size)) {
+      mStats.Received(size);
+      return true;
+   }
    bool success = false;
-   zmsg_t* message = NULL;
    zmq_pollitem_t items [] = {
       { mBody, 0, ZMQ_POLLIN, 0}
    };
    int pollResult = zmq_poll(items, 1, timeout);
    if (pollResult > 0) {
       if (items[0].revents & ZMQ_POLLIN) {
-         message = zmsg_recv(mBody);
-         if (message && zmsg_size(message) == 1) {
-            zframe_t* frame = zmsg_last(message);
-            wound.clear();
-            wound.append(reinterpret_cast<char*> (zframe_data(frame)), zframe_size(frame));
-            success = true;
-         } else {
-            if (!message) {
-               LOG(INFO) << "received null message, time for shutdown.";
-            } else {
-               LOG(WARNING) << "Received invalid sized message of size: " << zmsg_size(message);
-            }
+         success = (Receipt::Shot == ReceiveShot(0, data, size));
+         if (success) {
+            wait.Stop();
+            mStats.Received(size);
          }
       } else {
          LOG(WARNING) << "Error in zmq_pollin " << GetBinding();
@@ -181,13 +296,259 @@ bool Vampire::GetShot(std::string& wound, const int timeout) {
       LOG(WARNING) << "Error on zmq socket receiving " << GetBinding() << ": " << zmq_strerror(zmq_errno());
    } else {
       //socket timed out
-   }
-   if (message) {
-      zmsg_destroy(&message);
+      mStats.ReceiveTimeout();
    }
    return success;
 }
 
+/**
+ * Receive one message from the socket. A single frame is a bullet in mShot,
+ * a coalesced message is kept in mCoalesced and its first bullet handed out.
+ * Either can be followed by a timestamp frame, see Coalescing.h for how a
+ * stamped bullet that reads kMarker is told apart.
+ * @param flags
+ *   0 or ZMQ_DONTWAIT
+ * @param data
+ * @param size
+ * @return 
+ *   Shot if data and size were set, Invalid if a message was thrown away,
+ *   None if nothing could be received
+ */
+Vampire::Receipt Vampire::ReceiveShot(const int flags, const char*& data, size_t& size) {
+   if (zmq_msg_recv(&mShot, mBody, flags) < 0) {
+      const int error = zmq_errno();
+      if (ETERM == error) {
+         LOG(INFO) << "received null message, time for shutdown.";
+      } else if (EAGAIN != error) {
+         LOG(WARNING) << "Error on zmq socket receiving " << GetBinding() << ": " << zmq_strerror(error);
+      }
+      return Receipt::None;
+   }
+   if (!zmq_msg_more(&mShot) || !Coalescing::IsMarker(zmq_msg_data(&mShot), zmq_msg_size(&mShot))) {
+      if (zmq_msg_more(&mShot) && !ReceiveStamp()) {
+         return Receipt::Invalid;
+      }
+      data = reinterpret_cast<const char*> (zmq_msg_data(&mShot));
+      size = zmq_msg_size(&mShot);
+      return Receipt::Shot;
+   }
+   mCoalescedOffset = 0;
+   mCoalescedSize = 0;
+   if (zmq_msg_recv(&mCoalesced, mBody, 0) < 0) {
+      LOG(WARNING) << "Error on zmq socket receiving " << GetBinding() << ": " << zmq_strerror(zmq_errno());
+      return Receipt::None;
+   }
+   uint64_t sent = 0;
+   if (!zmq_msg_more(&mCoalesced) &&
+           LatencyStats::ReadStamp(zmq_msg_data(&mCoalesced), zmq_msg_size(&mCoalesced), sent)) {
+      // a stamped bullet that happens to read kMarker
+      if (mLatency) {
+         mLatency->RecordStamp(zmq_msg_data(&mCoalesced), zmq_msg_size(&mCoalesced));
+      }
+      data = reinterpret_cast<const char*> (zmq_msg_data(&mShot));
+      size = zmq_msg_size(&mShot);
+      return Receipt::Shot;
+   }
+   if (zmq_msg_more(&mCoalesced) && !ReceiveStamp()) {
+      return Receipt::Invalid;
+   }
+   mCoalescedSize = zmq_msg_size(&mCoalesced);
+   return NextCoalescedShot(data, size) ? Receipt::Shot : Receipt::Invalid;
+}
+
+/**
+ * Hand out the next bullet of the last coalesced message.
+ * @param data
+ * @param size
+ * @return 
+ *   false if there is nothing left in it
+ */
+bool Vampire::NextCoalescedShot(const char*& data, size_t& size) {
+   if (mCoalescedOffset >= mCoalescedSize) {
+      return false;
+   }
+   if (!Coalescing::ReadRecord(reinterpret_cast<const char*> (zmq_msg_data(&mCoalesced)),
+      mCoalescedSize, mCoalescedOffset, data, size)) {
+      LOG(WARNING) << "Received invalid coalesced message of size: " << mCoalescedSize;
+      mStats.Malformed();
+      mCoalescedOffset = mCoalescedSize;
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Get shot by a batch of bullets from the rifle.
+ *
+ * The socket is polled once, after that every bullet that is already waiting
+ * is drained without polling again, up to maxCount. The strings already held
+ * in wounds are reused so their buffers do not have to be reallocated.
+ *
+ * @param wounds
+ *   Resized to the number of bullets received
+ * @param maxCount
+ *   The most bullets to take in one call
+ * @param timeout
+ *   in milliseconds, for the first bullet only
+ * @return
+ *   The number of bullets received
+ */
+size_t Vampire::GetShots(std::vector<std::string>& wounds, const size_t maxCount, const int timeout) {
+   LatencyTimer wait(ReceiveWait());
+   if (mRing) {
+      size_t received = 0;
+      const char* data = NULL;
+      size_t size = 0;
+      while (received < maxCount && mRing->Peek(data, size, (received == 0) ? timeout : 0)) {
+         if (received < wounds.size()) {
+            wounds[received].assign(data, size);
+         } else {
+            wounds.emplace_back(data, size);
+         }
+         mStats.Received(size);
+         ++received;
+      }
+      wounds.resize(received);
+      if (received > 0) {
+         wait.Stop();
+      } else {
+         mStats.ReceiveTimeout();
+      }
+      return received;
+   }
+   if (!mBody) {
+      LOG(WARNING) << "Socket uninitialized!";
+      boost::this_thread::sleep(boost::posix_time::seconds(1));
+      wounds.clear();
+      return 0;
+   }
+   size_t received = 0;
+   // coalesced bullets that are left over don't need a poll
+   bool ready = (mCoalescedOffset < mCoalescedSize);
+   if (!ready) {
+      zmq_pollitem_t items [] = {
+         { mBody, 0, ZMQ_POLLIN, 0}
+      };
+      int pollResult = zmq_poll(items, 1, timeout);
+      if (pollResult > 0) {
+         if (items[0].revents & ZMQ_POLLIN) {
+            ready = true;
+         } else {
+            LOG(WARNING) << "Error in zmq_pollin " << GetBinding();
+         }
+      } else if (pollResult < 0) {
+         LOG(WARNING) << "Error on zmq socket receiving " << GetBinding() << ": " << zmq_strerror(zmq_errno());
+      } else {
+         //socket timed out
+         mStats.ReceiveTimeout();
+      }
+   }
+   while (ready && received < maxCount) {
+      const char* data = NULL;
+      size_t size = 0;
+      if (!NextCoalescedShot(data, size)) {
+         const Receipt receipt = ReceiveShot(ZMQ_DONTWAIT, data, size);
+         if (Receipt::None == receipt) {
+            break;
+         } else if (Receipt::Invalid == receipt) {
+            continue;
+         }
+      }
+      if (received < wounds.size()) {
+         wounds[received].assign(data, size);
+      } else {
+         wounds.emplace_back(data, size);
+      }
+      mStats.Received(size);
+      ++received;
+   }
+   wounds.resize(received);
+   if (received > 0) {
+      wait.Stop();
+   }
+   return received;
+}
+
+/**
+ * Read and drop the rest of a multi part message, only single frame bullets
+ * and coalesced messages are valid.
+ * @param message
+ *   Holding the first frame of the message
+ * @return
+ *   false if the socket failed part way through the message
+ */
+bool Vampire::DiscardMultiPart(zmq_msg_t& message) {
+   size_t frames = 1;
+   while (zmq_msg_more(&message)) {
+      if (zmq_msg_recv(&message, mBody, 0) < 0) {
+         LOG(WARNING) << "Error on zmq socket receiving " << GetBinding() << ": " << zmq_strerror(zmq_errno());
+         return false;
+      }
+      ++frames;
+   }
+   LOG(WARNING) << "Received invalid sized message of size: " << frames;
+   return true;
+}
+
+/**
+ * Read the frame after a bullet, which has to be the timestamp frame a Rifle
+ * with latency stats on ends its messages with. Its end to end latency is
+ * recorded if stats are on here too.
+ * @return
+ *   false if it was something else, the rest of the message is dropped
+ */
+bool Vampire::ReceiveStamp() {
+   zmq_msg_t stamp;
+   zmq_msg_init(&stamp);
+   if (zmq_msg_recv(&stamp, mBody, 0) < 0) {
+      LOG(WARNING) << "Error on zmq socket receiving " << GetBinding() << ": " << zmq_strerror(zmq_errno());
+      zmq_msg_close(&stamp);
+      return false;
+   }
+   uint64_t sent = 0;
+   const bool valid = !zmq_msg_more(&stamp) &&
+           LatencyStats::ReadStamp(zmq_msg_data(&stamp), zmq_msg_size(&stamp), sent);
+   if (!valid) {
+      mStats.Malformed();
+      DiscardMultiPart(stamp);
+   } else if (mLatency) {
+      mLatency->RecordStamp(zmq_msg_data(&stamp), zmq_msg_size(&stamp));
+   }
+   zmq_msg_close(&stamp);
+   return valid;
+}
+
+/**
+ * Record how long receives wait for a bullet, and the end to end latency
+ * of bullets from Rifles that stamp them.
+ */
+void Vampire::EnableLatencyStats() {
+   if (!mLatency) {
+      mLatency.reset(new LatencyStats);
+   }
+}
+
+/**
+ * @return the latency stats, NULL unless they were enabled
+ */
+const LatencyStats* Vampire::GetLatencyStats() const {
+   return mLatency.get();
+}
+
+/**
+ * @return what was received and how often receives timed out
+ */
+EndpointStats::Counters Vampire::Stats() const {
+   return mStats.Get();
+}
+
+/**
+ * @return the receive wait histogram, NULL with stats off
+ */
+LatencyHistogram* Vampire::ReceiveWait() {
+   return mLatency ? &mLatency->receiveWait : NULL;
+}
+
 /**
  * Get a pointer from the rifle
  * @param stake
@@ -196,6 +557,25 @@ bool Vampire::GetShot(std::string& wound, const int timeout) {
  *   If something was found
  */
 bool Vampire::GetStake(void*& stake, const int timeout) {
+   LatencyTimer wait(ReceiveWait());
+   if (mRing) {
+      const char* data = NULL;
+      size_t size = 0;
+      stake = NULL;
+      if (!mRing->Peek(data, size, timeout)) {
+         mStats.ReceiveTimeout();
+         return false;
+      }
+      wait.Stop();
+      if (size != sizeof (void*)) {
+         LOG(WARNING) << "Received non-pointer message.";
+         mStats.Malformed();
+         return false;
+      }
+      memcpy(&stake, data, sizeof (void*));
+      mStats.Received(size);
+      return true;
+   }
    if (!mBody) {
       LOG(WARNING) << "Socket uninitialized!";
       boost::this_thread::sleep(boost::posix_time::seconds(1));
@@ -205,13 +585,28 @@ bool Vampire::GetStake(void*& stake, const int timeout) {
    zmsg_t* message = NULL;
    if (zsocket_poll(mBody, timeout)) {
       message = zmsg_recv(mBody);
+      if (message && (zmsg_size(message) == 2)) {
+         // a stake followed by a timestamp frame
+         zframe_t* last = zmsg_last(message);
+         uint64_t sent = 0;
+         if (LatencyStats::ReadStamp(zframe_data(last), zframe_size(last), sent)) {
+            if (mLatency) {
+               mLatency->RecordStamp(zframe_data(last), zframe_size(last));
+            }
+            zmsg_remove(message, last);
+            zframe_destroy(&last);
+         }
+      }
       if (message && (zmsg_size(message) == 1)) {
          zframe_t* frame = zmsg_pop(message);
          if (frame && zframe_size(frame) != sizeof (void*)) {
             LOG(WARNING) << "Received non-pointer message.";
+            mStats.Malformed();
          } else if(frame) {
             stake = *reinterpret_cast<void**> (zframe_data(frame));
             success = true;
+            wait.Stop();
+            mStats.Received(sizeof (void*));
          }
          //always delete frame if it exists
          if (frame) {
@@ -219,7 +614,10 @@ bool Vampire::GetStake(void*& stake, const int timeout) {
          }
       } else if (message) {
          LOG(WARNING) << "Received an invalid message";
+         mStats.Malformed();
       }
+   } else {
+      mStats.ReceiveTimeout();
    }
    if (message) {
       zmsg_destroy(&message);
@@ -251,41 +649,85 @@ bool Vampire::GetStakeNoWait(void*& stake) {
  */
 bool Vampire::GetStakes(std::vector<std::pair<void*, unsigned int> >& stakes,
    const int timeout) {
+   bool success = false;
+   if (ReceiveFrame(mShot, timeout)) {
+      success = StakeBundle::Decode(zmq_msg_data(&mShot), zmq_msg_size(&mShot), stakes);
+      if (!success) {
+         LOG(WARNING) << "Received non-pointer message.";
+         mStats.Malformed();
+      }
+   }
+   if (!success) {
+      stakes.clear();
+   }
+   return success;
+}
+
+/**
+ * Get a collection of pointers from the rifle without copying them out of
+ * the message.
+ * @param stakes
+ *   Reads straight from the received frame, valid until the next GetStakes
+ *   into it
+ * @return 
+ *   If something was found
+ */
+bool Vampire::GetStakes(StakeBundle& stakes, const int timeout) {
+   bool success = false;
+   if (ReceiveFrame(stakes.mMessage, timeout)) {
+      success = stakes.Parse();
+      if (!success) {
+         LOG(WARNING) << "Received non-pointer message.";
+         mStats.Malformed();
+      }
+   } else {
+      stakes.Clear();
+   }
+   return success;
+}
+
+/**
+ * Receive a single frame message.
+ * @param message
+ * @param timeout
+ * @return 
+ *   false on timeout, error or an invalid message
+ */
+bool Vampire::ReceiveFrame(zmq_msg_t& message, const int timeout) {
+   LatencyTimer wait(ReceiveWait());
+   if (mRing) {
+      const char* data = NULL;
+      size_t size = 0;
+      if (!mRing->Peek(data, size, timeout)) {
+         mStats.ReceiveTimeout();
+         return false;
+      }
+      wait.Stop();
+      zmq_msg_close(&message);
+      zmq_msg_init_size(&message, size);
+      memcpy(zmq_msg_data(&message), data, size);
+      mStats.Received(size);
+      return true;
+   }
    if (!mBody) {
       LOG(WARNING) << "Socket uninitialized!";
       boost::this_thread::sleep(boost::posix_time::seconds(1));
       return false;
    }
-   bool success = false;
-   zmsg_t* message = NULL;
-   if (zsocket_poll(mBody, timeout)) {
-      message = zmsg_recv(mBody);
-      if (message && zmsg_size(message) == 1) {
-         zframe_t* frame = zmsg_pop(message);
-         if (frame && zframe_size(frame) < (sizeof (std::pair<void*, unsigned int>))) {
-            LOG(WARNING) << "Received non-pointer message.";
-         } else if (frame) {
-            stakes.clear();
-            stakes.assign(reinterpret_cast<std::pair<void*, unsigned int>*> (zframe_data(frame)),
-               reinterpret_cast<std::pair<void*, unsigned int>*> (zframe_data(frame))
-               + (zframe_size(frame) / sizeof (std::pair<void*, unsigned int>)));
-            success = true;
-         }
-         //always delete frame if it exists
-         if (frame) {
-            zframe_destroy(&frame);
-         }
-      } else if (!message || (zmsg_size(message) != 1)) {
-         LOG(WARNING) << "Received invalid message.";
-      }
+   if (!zsocket_poll(mBody, timeout)) {
+      mStats.ReceiveTimeout();
+      return false;
    }
-   if (message) {
-      zmsg_destroy(&message);
+   if (zmq_msg_recv(&message, mBody, 0) < 0) {
+      LOG(INFO) << "received null message, time for shutdown.";
+      return false;
    }
-   if (!success) {
-      stakes.clear();
+   if (zmq_msg_more(&message) && !ReceiveStamp()) {
+      return false;
    }
-   return success;
+   wait.Stop();
+   mStats.Received(zmq_msg_size(&message));
+   return true;
 }
 
 /**
@@ -293,6 +735,11 @@ bool Vampire::GetStakes(std::vector<std::pair<void*, unsigned int> >& stakes,
  * @return 
  */
 void Vampire::Destroy() {
+   mRing.reset();
+   if (mAliased) {
+      ContextPool::Instance().RemoveAlias(mLocation, mContext);
+      mAliased = false;
+   }
    if (mContext != NULL) {
       //LOG(DEBUG) << "Vampire: destroying context";
       zsocket_destroy(mContext, mBody);
@@ -308,4 +755,6 @@ void Vampire::Destroy() {
  */
 Vampire::~Vampire() {
    Destroy();
+   zmq_msg_close(&mShot);
+   zmq_msg_close(&mCoalesced);
 }
@@ -1,35 +1,72 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <memory>
+#include <zmq.h>
 #include "CZMQToolkit.h"
+#include "LatencyHistogram.h"
+#include "EndpointStats.h"
 struct _zctx_t;
 typedef struct _zctx_t zctx_t;
+class StakeBundle;
+class ShmRing;
 class Vampire {
 public:
    explicit Vampire(const std::string& location);
+   Vampire(const std::string& location, zctx_t* context);
+   Vampire(const Vampire&) = delete;
+   Vampire& operator=(const Vampire&) = delete;
    bool PrepareToBeShot();
    std::string GetBinding() const;
    bool GetShot(std::string& wound, const int timeout);
+   bool GetShotView(const char*& wound, size_t& size, const int timeout);
+   size_t GetShots(std::vector<std::string>& wounds, const size_t maxCount, const int timeout);
    bool GetStake(void*& stake, const int timeout=1000);
    bool GetStakeNoWait(void*& stake);
    bool GetStakes(std::vector<std::pair<void*, unsigned int> >& stakes,
            const int timeout=1000);
+   bool GetStakes(StakeBundle& stakes, const int timeout=1000);
    int GetHighWater();
    void SetHighWater(const int hwm);
    int GetIOThreads();
    void SetIOThreads(const int count);
    void SetOwnSocket(const bool own);
    bool GetOwnSocket();
+   void SetShmSlotSize(const size_t bytes);
+   size_t GetShmSlotSize() const;
+   void EnableLatencyStats();
+   const LatencyStats* GetLatencyStats() const;
+   EndpointStats::Counters Stats() const;
    virtual ~Vampire();
 protected:
    void Destroy();
 private:
    void setIpcFilePermissions();
+   enum class Receipt {
+      None, Invalid, Shot
+   };
+   bool NextShot(const char*& data, size_t& size, const int timeout);
+   Receipt ReceiveShot(const int flags, const char*& data, size_t& size);
+   bool NextCoalescedShot(const char*& data, size_t& size);
+   bool ReceiveFrame(zmq_msg_t& message, const int timeout);
+   bool DiscardMultiPart(zmq_msg_t& message);
+   bool ReceiveStamp();
+   LatencyHistogram* ReceiveWait();
    std::string mLocation;
    int mHwm;
    void* mBody;
    zctx_t* mContext;
+   zctx_t* mSharedContext;
+   std::unique_ptr<ShmRing> mRing;
+   bool mAliased;
    int mLinger;
    int mIOThredCount;
    bool mOwnSocket;
+   size_t mShmSlotSize;
+   zmq_msg_t mShot;
+   zmq_msg_t mCoalesced;
+   size_t mCoalescedOffset;
+   size_t mCoalescedSize;
+   std::unique_ptr<LatencyStats> mLatency;
+   EndpointStats mStats;
 };
@@ -0,0 +1,193 @@
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "QAPI.h"
+
+namespace QAPI {
+   /**
+    * A set of queues, one lane per worker of a thread pool. Pushes are spread
+    * over the lanes round robin, each worker pops from the head of its own
+    * lane. A worker whose lane is empty steals half of the longest lane from
+    * its tail, so one slow worker does not sit on a backlog while the others
+    * are idle, which round robin on its own (PUSH / PULL) can't avoid.
+    *
+    * A lane has many consumers once it can be stolen from, so lanes are not
+    * spsc rings but deques behind a lock of their own. The owner and a thief
+    * only meet on a lane when it is being stolen from, and nobody holds two
+    * lane locks at once. Lanes are kept a cache line apart.
+    *
+    * Workers wait in wait_and_pop on one ParkingLot for the whole set, a push
+    * wakes one of them and whoever wakes up can steal the item.
+    *
+    *    QAPI::WorkStealingQueue<Job> jobs(workers, 1024);
+    *    jobs.SetAffinity({2, 3, 4, 5});
+    *    // on worker thread lane:
+    *    jobs.PinToLane(lane);
+    *    while (jobs.wait_and_pop(lane, job, std::chrono::milliseconds(100))) { ... }
+    */
+   template <typename T>
+   class WorkStealingQueue {
+    public:
+      WorkStealingQueue(const size_t lanes, const size_t laneCapacity)
+         : mLaneCapacity(laneCapacity)
+         , mNext(0)
+         , mSteals(0)
+         , mStealing(true) {
+         for (size_t i = 0; i < std::max(lanes, size_t(1)); ++i) {
+            mLanes.emplace_back(new Lane);
+         }
+      }
+
+      WorkStealingQueue(const WorkStealingQueue&) = delete;
+      WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+      // Push onto the next lane round robin, or the one after it if that is full
+      bool push(T& item) {
+         const size_t start = mNext.fetch_add(1, std::memory_order_relaxed);
+         for (size_t i = 0; i < mLanes.size(); ++i) {
+            if (push(item, (start + i) % mLanes.size())) {
+               return true;
+            }
+         }
+         return false;
+      }
+
+      // Push onto a given lane
+      bool push(T& item, const size_t lane) {
+         Lane& target = *mLanes[lane];
+         {
+            std::lock_guard<std::mutex> lock(target.mutex);
+            if (target.items.size() >= mLaneCapacity) {
+               return false;
+            }
+            target.items.push_back(std::move(item));
+            target.size.store(target.items.size(), std::memory_order_relaxed);
+         }
+         mParkingLot.Notify();
+         return true;
+      }
+
+      // Pop from the head of the worker's own lane, stealing if it is empty
+      bool pop(const size_t lane, T& item) {
+         return PopOwn(lane, item) || (mStealing.load(std::memory_order_relaxed) && Steal(lane) && PopOwn(lane, item));
+      }
+
+      bool wait_and_pop(const size_t lane, T& item, const std::chrono::milliseconds wait) {
+         if (pop(lane, item)) {
+            return true;
+         }
+         const auto deadline = std::chrono::steady_clock::now() + wait;
+         return mParkingLot.Park([&]() { return pop(lane, item); }, deadline);
+      }
+
+      // Turn stealing off to get plain round robin lanes
+      void SetStealing(const bool stealing) { mStealing.store(stealing); }
+
+      // CPUs to pin the workers of each lane to, lane i gets cpus[i % cpus.size()]
+      void SetAffinity(const std::vector<int>& cpus) { mCpus = cpus; }
+
+      // Pin the calling thread to the CPU of its lane
+      // @return false if no CPUs were set or the thread could not be pinned
+      bool PinToLane(const size_t lane) const {
+         if (mCpus.empty()) {
+            return false;
+         }
+         cpu_set_t cpus;
+         CPU_ZERO(&cpus);
+         CPU_SET(mCpus[lane % mCpus.size()], &cpus);
+         return 0 == pthread_setaffinity_np(pthread_self(), sizeof (cpus), &cpus);
+      }
+
+      size_t lanes() const { return mLanes.size(); }
+      size_t capacity() const { return mLaneCapacity * mLanes.size(); }
+      size_t size(const size_t lane) const { return mLanes[lane]->size.load(std::memory_order_relaxed); }
+      size_t size() const {
+         size_t total = 0;
+         for (size_t lane = 0; lane < mLanes.size(); ++lane) {
+            total += size(lane);
+         }
+         return total;
+      }
+      bool empty() const { return size() == 0; }
+      uint64_t GetSteals() const { return mSteals.load(std::memory_order_relaxed); }
+
+    private:
+      struct Lane {
+         Lane() : size(0) {}
+         char padding[kCacheLine];
+         std::mutex mutex;
+         std::deque<T> items;
+         std::atomic<size_t> size;
+         char tailPadding[kCacheLine];
+      };
+
+      bool PopOwn(const size_t lane, T& item) {
+         Lane& own = *mLanes[lane];
+         if (0 == own.size.load(std::memory_order_relaxed)) {
+            return false;
+         }
+         std::lock_guard<std::mutex> lock(own.mutex);
+         if (own.items.empty()) {
+            return false;
+         }
+         item = std::move(own.items.front());
+         own.items.pop_front();
+         own.size.store(own.items.size(), std::memory_order_relaxed);
+         return true;
+      }
+
+      // Move the newest half of the longest lane onto the thief's lane
+      bool Steal(const size_t thief) {
+         size_t victim = thief;
+         size_t longest = 0;
+         for (size_t lane = 0; lane < mLanes.size(); ++lane) {
+            const size_t length = size(lane);
+            if (lane != thief && length > longest) {
+               victim = lane;
+               longest = length;
+            }
+         }
+         if (victim == thief) {
+            return false;
+         }
+         std::vector<T> loot;
+         {
+            Lane& busy = *mLanes[victim];
+            std::lock_guard<std::mutex> lock(busy.mutex);
+            const size_t take = (busy.items.size() + 1) / 2;
+            if (take == 0) {
+               return false;
+            }
+            loot.reserve(take);
+            std::move(busy.items.end() - take, busy.items.end(), std::back_inserter(loot));
+            busy.items.erase(busy.items.end() - take, busy.items.end());
+            busy.size.store(busy.items.size(), std::memory_order_relaxed);
+         }
+         Lane& own = *mLanes[thief];
+         {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            std::move(loot.begin(), loot.end(), std::back_inserter(own.items));
+            own.size.store(own.items.size(), std::memory_order_relaxed);
+         }
+         mSteals.fetch_add(1, std::memory_order_relaxed);
+         return true;
+      }
+
+      const size_t mLaneCapacity;
+      std::vector<std::unique_ptr<Lane>> mLanes;
+      std::vector<int> mCpus;
+      std::atomic<size_t> mNext;
+      std::atomic<uint64_t> mSteals;
+      std::atomic<bool> mStealing;
+      ParkingLot mParkingLot;
+   };
+} // QAPI
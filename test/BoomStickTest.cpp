@@ -7,7 +7,10 @@
 #include <set>
 #include <memory>
 #include <future>
+#include <vector>
 #include <map>
+#include <chrono>
+#include <iostream>
 #ifdef QN_DEBUG
 namespace {
 
@@ -64,6 +67,46 @@ namespace {
       ASSERT_TRUE(stick.Initialize());
       runAsync(stick, 100);
    }
+
+   /**
+    * Keep 10k SendAsync calls outstanding, then read the replies newest
+    * first so nearly every one is read into the request table before it is
+    * asked for.
+    */
+   void OutstandingAsyncBenchmark(const std::string& address, const bool compact) {
+      const int kOutstanding = 10000;
+      BoomStick stick{address};
+      stick.SetCompactIds(compact);
+      // room for every request and reply at once
+      stick.SetSendHWM(kOutstanding);
+      stick.SetRecvHWM(kOutstanding);
+      MockSkelleton target{address};
+      ASSERT_TRUE(target.Initialize());
+      ASSERT_TRUE(stick.Initialize());
+      target.BeginListenAndRepeat();
+
+      std::vector<RequestId> ids;
+      ids.reserve(kOutstanding);
+      const auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < kOutstanding && !zctx_interrupted; ++i) {
+         ids.push_back(compact ? stick.NextRequestId() : RequestId::FromString(stick.GetUuid()));
+         ASSERT_TRUE(stick.SendAsync(ids.back(), std::to_string(i)));
+      }
+      const auto sent = std::chrono::steady_clock::now();
+      for (int i = kOutstanding - 1; i >= 0 && !zctx_interrupted; --i) {
+         std::string reply;
+         ASSERT_TRUE(stick.GetAsyncReply(ids[i], 5000, reply));
+         EXPECT_EQ(std::to_string(i) + " reply", reply);
+      }
+      const auto replied = std::chrono::steady_clock::now();
+      EXPECT_EQ(0, stick.Stats().outstanding);
+      using std::chrono::microseconds;
+      std::cout << kOutstanding << (compact ? " compact" : " uuid") << " outstanding SendAsync: "
+              << std::chrono::duration_cast<microseconds>(sent - start).count() << "us to send, "
+              << std::chrono::duration_cast<microseconds>(replied - sent).count() << "us to get the replies"
+              << std::endl;
+      target.EndListendAndRepeat();
+   }
 }
 TEST_F(BoomStickTest, ipcFilesCleanedOnFatal) {
    BoomStick stick{mAddress};
@@ -468,6 +511,180 @@ TEST_F(BoomStickTest, DontSearchSocketForever) {
 
 }
 
+TEST_F(BoomStickTest, CompactIds) {
+   BoomStick stick{mAddress};
+   stick.SetCompactIds(true);
+   MockSkelleton target{mAddress};
+   ASSERT_TRUE(target.Initialize());
+   ASSERT_TRUE(stick.Initialize());
+   target.BeginListenAndRepeat();
+
+   EXPECT_EQ("foo reply", stick.Send("foo"));
+   const RequestId first = stick.NextRequestId();
+   const RequestId second = stick.NextRequestId();
+   EXPECT_NE(first, second);
+   EXPECT_EQ(first.high, second.high);
+   ASSERT_TRUE(stick.SendAsync(first, "first"));
+   ASSERT_TRUE(stick.SendAsync(second, "second"));
+   // string ids go out as 16 bytes as well
+   ASSERT_TRUE(stick.SendAsync("third", "third"));
+   std::string reply;
+   ASSERT_TRUE(stick.GetAsyncReply("third", 1000, reply));
+   EXPECT_EQ("third reply", reply);
+   ASSERT_TRUE(stick.GetAsyncReply(second, 1000, reply));
+   EXPECT_EQ("second reply", reply);
+   ASSERT_TRUE(stick.GetAsyncReply(first, 1000, reply));
+   EXPECT_EQ("first reply", reply);
+   EXPECT_EQ(0, stick.Stats().outstanding);
+   target.EndListendAndRepeat();
+}
+
+TEST_F(BoomStickTest, FuturesAndCallbacks) {
+   BoomStick stick{mAddress};
+   MockSkelleton target{mAddress};
+   ASSERT_TRUE(target.Initialize());
+   ASSERT_TRUE(stick.Initialize());
+   target.BeginListenAndRepeat();
+
+   const int kRequests = 300;
+   std::vector<std::future<std::string>> futures;
+   for (int i = 0; i < kRequests; ++i) {
+      futures.push_back(stick.SendAsyncFuture("future " + std::to_string(i)));
+   }
+   int called = 0;
+   for (int i = 0; i < kRequests; ++i) {
+      const std::string expected = "callback " + std::to_string(i) + " reply";
+      ASSERT_TRUE(stick.SendAsyncCallback("callback " + std::to_string(i),
+              [&called, expected](const bool success, const std::string& reply) {
+                 EXPECT_TRUE(success);
+                 EXPECT_EQ(expected, reply);
+                 ++called;
+              }));
+   }
+   ASSERT_TRUE(stick.SendAsync("plain", "plain"));
+   // newest first, waiting on one future hands out every reply read before it
+   for (int i = kRequests - 1; i >= 0; --i) {
+      EXPECT_EQ("future " + std::to_string(i) + " reply", futures[i].get());
+   }
+   for (int polls = 0; called < kRequests && polls < 100; ++polls) {
+      stick.PollReplies(100);
+   }
+   EXPECT_EQ(kRequests, called);
+   std::string reply;
+   ASSERT_TRUE(stick.GetAsyncReply("plain", 1000, reply));
+   EXPECT_EQ("plain reply", reply);
+   EXPECT_EQ(0, stick.Stats().outstanding);
+   target.EndListendAndRepeat();
+}
+
+TEST_F(BoomStickTest, FutureFollowsAMove) {
+   MockSkelleton target{mAddress};
+   ASSERT_TRUE(target.Initialize());
+   target.BeginListenAndRepeat();
+   std::future<std::string> reply;
+   std::future<std::string> orphan;
+   {
+      BoomStick stick{mAddress};
+      ASSERT_TRUE(stick.Initialize());
+      reply = stick.SendAsyncFuture("foo");
+      BoomStick moved(std::move(stick));
+      EXPECT_EQ("foo reply", reply.get());
+      orphan = moved.SendAsyncFuture("bar");
+   }
+   EXPECT_THROW(orphan.get(), std::string);
+   target.EndListendAndRepeat();
+}
+
+TEST_F(BoomStickTest, FuturesAndCallbacksWithoutASocket) {
+   BoomStick stick{mAddress};
+   std::future<std::string> reply = stick.SendAsyncFuture("foo");
+   EXPECT_THROW(reply.get(), std::string);
+   bool called = false;
+   EXPECT_FALSE(stick.SendAsyncCallback("foo", [&called](const bool, const std::string&) {
+      called = true;
+   }));
+   EXPECT_FALSE(called);
+}
+
+TEST_F(BoomStickTest, CallbacksFailWhenDestroyed) {
+   std::string failure;
+   {
+      BoomStick stick{mAddress};
+      ASSERT_TRUE(stick.Initialize());
+      ASSERT_TRUE(stick.SendAsyncCallback("nobody listens", [&failure](const bool success, const std::string& reply) {
+         EXPECT_FALSE(success);
+         failure = reply;
+      }));
+   }
+   EXPECT_FALSE(failure.empty());
+}
+
+TEST_F(BoomStickTest, WindowFullFailsAtOnce) {
+   BoomStick stick{mAddress};
+   MockSkelleton target{mAddress};
+   ASSERT_TRUE(target.Initialize());
+   ASSERT_TRUE(stick.Initialize());
+   target.BeginListenAndRepeat();
+   stick.SetWindow(2);
+
+   ASSERT_TRUE(stick.SendAsync("1", "one"));
+   ASSERT_TRUE(stick.SendAsync("2", "two"));
+   EXPECT_EQ(2, stick.InFlight());
+   EXPECT_TRUE(stick.WindowFull());
+   EXPECT_FALSE(stick.SendAsync("3", "three"));
+   EXPECT_THROW(stick.SendAsyncFuture("three").get(), std::string);
+   auto counters = stick.Stats();
+   EXPECT_EQ(2, counters.windowSize);
+   EXPECT_EQ(2, counters.windowInFlight);
+   EXPECT_EQ(2, counters.windowFull);
+
+   // a reply that waits in the cache has given its credit back
+   std::string reply;
+   ASSERT_TRUE(stick.GetAsyncReply("2", 1000, reply));
+   EXPECT_EQ("two reply", reply);
+   EXPECT_EQ(0, stick.InFlight());
+   EXPECT_TRUE(stick.SendAsync("3", "three"));
+   ASSERT_TRUE(stick.GetAsyncReply("1", 1000, reply));
+   ASSERT_TRUE(stick.GetAsyncReply("3", 1000, reply));
+   EXPECT_EQ("three reply", reply);
+   EXPECT_EQ(0, stick.Stats().windowInFlight);
+   target.EndListendAndRepeat();
+}
+
+TEST_F(BoomStickTest, WindowWaitsForReplies) {
+   BoomStick stick{mAddress};
+   MockSkelleton target{mAddress};
+   ASSERT_TRUE(target.Initialize());
+   ASSERT_TRUE(stick.Initialize());
+   target.BeginListenAndRepeat();
+   const size_t kWindow = 10;
+   stick.SetWindow(kWindow, 1000);
+
+   const int kRequests = 1000;
+   int called = 0;
+   for (int i = 0; i < kRequests; ++i) {
+      ASSERT_TRUE(stick.SendAsyncCallback(std::to_string(i), [&called](const bool success, const std::string&) {
+         EXPECT_TRUE(success);
+         ++called;
+      }));
+      ASSERT_LE(stick.InFlight(), kWindow);
+   }
+   for (int polls = 0; called < kRequests && polls < 100; ++polls) {
+      stick.PollReplies(100);
+   }
+   EXPECT_EQ(kRequests, called);
+   EXPECT_LT(0, stick.Stats().windowFull);
+   target.EndListendAndRepeat();
+}
+
+TEST_F(BoomStickTest, TenThousandOutstandingAsync) {
+   OutstandingAsyncBenchmark(mAddress, false);
+}
+
+TEST_F(BoomStickTest, TenThousandOutstandingAsyncCompact) {
+   OutstandingAsyncBenchmark(mAddress, true);
+}
+
 #else 
 
 TEST_F(BoomStickTest, emptyTest) {
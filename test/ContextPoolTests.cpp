@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "ContextPool.h"
+#include "Rifle.h"
+#include "Vampire.h"
+#include "Shotgun.h"
+#include "Alien.h"
+#include "Crowbar.h"
+#include "Headcrab.h"
+
+namespace {
+   const int kWaitTimeMs = 1000;
+
+   std::string GetIpcLocation() {
+      return "ipc:///tmp/ContextPoolTests" + std::to_string(getpid()) + ".ipc";
+   }
+}
+
+TEST(ContextPool, SameNameSameContext) {
+   ContextPool& pool = ContextPool::Instance();
+   zctx_t* context = pool.GetContext();
+   ASSERT_TRUE(context != nullptr);
+   EXPECT_EQ(context, pool.GetContext());
+   EXPECT_EQ(context, pool.GetContext(ContextPool::kDefault));
+   zctx_t* other = pool.GetContext("ContextPoolTestsOther");
+   ASSERT_TRUE(other != nullptr);
+   EXPECT_NE(context, other);
+}
+
+TEST(ContextPool, ConfigureBeforeUse) {
+   ContextPool& pool = ContextPool::Instance();
+   const std::string name = "ContextPoolTestsConfigured";
+   const std::vector<int> cpus = {0};
+   EXPECT_TRUE(pool.Configure(name, 2, cpus));
+   EXPECT_EQ(2, pool.GetIOThreads(name));
+   EXPECT_EQ(cpus, pool.GetAffinity(name));
+
+   cpu_set_t before;
+   CPU_ZERO(&before);
+   pthread_getaffinity_np(pthread_self(), sizeof (before), &before);
+   ASSERT_TRUE(pool.GetContext(name) != nullptr);
+   cpu_set_t after;
+   CPU_ZERO(&after);
+   pthread_getaffinity_np(pthread_self(), sizeof (after), &after);
+   EXPECT_TRUE(CPU_EQUAL(&before, &after));
+
+   EXPECT_FALSE(pool.Configure(name, 4));
+   EXPECT_EQ(2, pool.GetIOThreads(name));
+}
+
+TEST(ContextPool, RifleAndVampireShareInproc) {
+   zctx_t* context = ContextPool::Instance().GetContext();
+   const std::string location = "inproc://ContextPoolTestsRifle";
+   for (int round = 0; round < 2; ++round) {
+      // the shared context outlives each pair
+      Rifle rifle(location, context);
+      Vampire vampire(location, context);
+      ASSERT_TRUE(rifle.Aim());
+      ASSERT_TRUE(vampire.PrepareToBeShot());
+      ASSERT_TRUE(rifle.Fire("bullet"));
+      std::string wound;
+      ASSERT_TRUE(vampire.GetShot(wound, kWaitTimeMs));
+      EXPECT_EQ("bullet", wound);
+   }
+}
+
+TEST(ContextPool, CrowbarAndHeadcrabShareInproc) {
+   zctx_t* context = ContextPool::Instance().GetContext();
+   const std::string location = "inproc://ContextPoolTestsHeadcrab";
+   Headcrab headcrab(location, context);
+   ASSERT_TRUE(headcrab.ComeToLife());
+   Crowbar crowbar(headcrab);
+   ASSERT_TRUE(crowbar.Wield());
+   ASSERT_TRUE(crowbar.Swing("hit"));
+   std::string hit;
+   ASSERT_TRUE(headcrab.GetHitWait(hit, kWaitTimeMs));
+   EXPECT_EQ("hit", hit);
+}
+
+TEST(ContextPool, ShotgunAndAlienOnSharedContext) {
+   zctx_t* context = ContextPool::Instance().GetContext();
+   const std::string location = "inproc://ContextPoolTestsShotgun";
+   Shotgun shotgun(context);
+   shotgun.Aim(location);
+   Alien alien(context);
+   alien.PrepareToBeShot(location);
+   std::vector<std::string> bullets;
+   // subscriptions take a moment to reach the publisher
+   for (int i = 0; i < 100 && bullets.empty(); ++i) {
+      shotgun.Fire("bullet");
+      alien.GetShot(10, bullets);
+   }
+   ASSERT_EQ(2, bullets.size());
+   EXPECT_EQ("bullet", bullets[1]);
+}
+
+TEST(ContextPool, SameProcessPeersUseInprocAlias) {
+   ContextPool& pool = ContextPool::Instance();
+   const std::string location = GetIpcLocation();
+   {
+      Rifle rifle(location, pool.GetContext());
+      ASSERT_TRUE(rifle.Aim());
+      zctx_t* found = NULL;
+      EXPECT_EQ(ContextPool::GetAlias(location), pool.FindAlias(location, found));
+      EXPECT_EQ(pool.GetContext(), found);
+
+      // no context of its own yet, so it joins the Rifle's
+      Vampire vampire(location);
+      ASSERT_TRUE(vampire.PrepareToBeShot());
+      ASSERT_TRUE(rifle.Fire("bullet"));
+      std::string wound;
+      ASSERT_TRUE(vampire.GetShot(wound, kWaitTimeMs));
+      EXPECT_EQ("bullet", wound);
+   }
+   zctx_t* found = NULL;
+   EXPECT_EQ(location, pool.FindAlias(location, found));
+   EXPECT_TRUE(found == nullptr);
+}
+
+TEST(ContextPool, NoAliasAcrossContexts) {
+   ContextPool& pool = ContextPool::Instance();
+   const std::string location = GetIpcLocation();
+   Rifle rifle(location, pool.GetContext());
+   ASSERT_TRUE(rifle.Aim());
+   zctx_t* other = pool.GetContext("ContextPoolTestsOther");
+   EXPECT_EQ(location, pool.FindAlias(location, other));
+
+   // a Rifle on its own context is not aliased
+   Rifle own(GetIpcLocation() + "own");
+   ASSERT_TRUE(own.Aim());
+   zctx_t* found = NULL;
+   EXPECT_EQ(own.GetBinding(), pool.FindAlias(own.GetBinding(), found));
+}
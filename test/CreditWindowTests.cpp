@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "CreditWindow.h"
+
+TEST(CreditWindow, UnlimitedNeverFills) {
+   CreditWindow window;
+   for (int i = 0; i < 10000; ++i) {
+      ASSERT_TRUE(window.TryAcquire());
+   }
+   EXPECT_EQ(10000, window.inFlight());
+   EXPECT_TRUE(window.Acquire(0));
+}
+
+TEST(CreditWindow, FullFailsAtOnce) {
+   CreditWindow window(2);
+   EXPECT_TRUE(window.TryAcquire());
+   EXPECT_TRUE(window.Acquire(0));
+   EXPECT_FALSE(window.TryAcquire());
+   EXPECT_FALSE(window.Acquire(0));
+   window.Release();
+   EXPECT_EQ(1, window.inFlight());
+   EXPECT_TRUE(window.TryAcquire());
+
+   // shrinking keeps what is taken, growing hands out more
+   window.SetSize(1);
+   EXPECT_EQ(2, window.inFlight());
+   window.Release();
+   EXPECT_FALSE(window.TryAcquire());
+   window.SetSize(3);
+   EXPECT_TRUE(window.TryAcquire());
+   EXPECT_TRUE(window.TryAcquire());
+   EXPECT_FALSE(window.TryAcquire());
+}
+
+TEST(CreditWindow, AcquireTimesOut) {
+   CreditWindow window(1);
+   ASSERT_TRUE(window.TryAcquire());
+   const auto start = std::chrono::steady_clock::now();
+   EXPECT_FALSE(window.Acquire(50));
+   EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+}
+
+TEST(CreditWindow, AcquireWaitsForARelease) {
+   CreditWindow window(1);
+   ASSERT_TRUE(window.TryAcquire());
+   std::thread releaser([&window]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      window.Release();
+   });
+   EXPECT_TRUE(window.Acquire(10000));
+   releaser.join();
+   EXPECT_EQ(1, window.inFlight());
+}
+
+TEST(CreditWindow, ManyThreadsStayInside) {
+   const size_t kWindow = 4;
+   CreditWindow window(kWindow);
+   std::atomic<size_t> inside(0);
+   std::atomic<size_t> most(0);
+   std::vector<std::thread> workers;
+   for (int t = 0; t < 8; ++t) {
+      workers.emplace_back([&]() {
+         for (int i = 0; i < 1000; ++i) {
+            ASSERT_TRUE(window.Acquire(10000));
+            const size_t now = ++inside;
+            size_t seen = most.load();
+            while (now > seen && !most.compare_exchange_weak(seen, now)) {
+            }
+            --inside;
+            window.Release();
+         }
+      });
+   }
+   for (auto& worker : workers) {
+      worker.join();
+   }
+   EXPECT_LE(most.load(), kWindow);
+   EXPECT_EQ(0, window.inFlight());
+}
+
+TEST(CreditWindow, GrowingWakesEveryWaiter) {
+   CreditWindow window(1);
+   ASSERT_TRUE(window.TryAcquire());
+   std::vector<std::thread> waiters;
+   std::atomic<int> acquired(0);
+   for (int t = 0; t < 3; ++t) {
+      waiters.emplace_back([&window, &acquired]() {
+         if (window.Acquire(10000)) {
+            ++acquired;
+         }
+      });
+   }
+   std::this_thread::sleep_for(std::chrono::milliseconds(20));
+   const auto start = std::chrono::steady_clock::now();
+   window.SetSize(4);
+   for (auto& waiter : waiters) {
+      waiter.join();
+   }
+   EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+   EXPECT_EQ(3, acquired.load());
+   EXPECT_EQ(4, window.inFlight());
+}
@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <czmq.h>
+#include <string>
+#include "EndpointStats.h"
+#include "Rifle.h"
+#include "Vampire.h"
+#include "Crowbar.h"
+#include "Headcrab.h"
+
+namespace {
+   const int kWaitTimeMs = 1000;
+
+   std::string GetIpcLocation(const std::string& name) {
+      return "ipc:///tmp/EndpointStatsTests" + name + std::to_string(getpid()) + ".ipc";
+   }
+}
+
+TEST(EndpointStats, CountsAndRegistry) {
+   const size_t before = StatsRegistry::Instance().size();
+   {
+      EndpointStats sender("Sender", EndpointStats::Role::Sender);
+      EndpointStats receiver("Receiver", EndpointStats::Role::Receiver);
+      EXPECT_EQ(before + 2, StatsRegistry::Instance().size());
+      sender.SetLocation("somewhere");
+      receiver.SetLocation("somewhere");
+      sender.Sent(10);
+      sender.Sent(20, 2);
+      sender.SendTimeout();
+      receiver.Received(10);
+      receiver.ReceiveTimeout();
+      receiver.Malformed();
+
+      auto counters = sender.Get();
+      EXPECT_EQ("Sender", counters.kind);
+      EXPECT_EQ("somewhere", counters.location);
+      EXPECT_EQ(3, counters.messagesSent);
+      EXPECT_EQ(30, counters.bytesSent);
+      EXPECT_EQ(1, counters.sendTimeouts);
+      EXPECT_EQ(2, counters.outstanding);
+      counters = receiver.Get();
+      EXPECT_EQ(1, counters.messagesReceived);
+      EXPECT_EQ(10, counters.bytesReceived);
+      EXPECT_EQ(1, counters.receiveTimeouts);
+      EXPECT_EQ(1, counters.malformed);
+      EXPECT_EQ(2, counters.outstanding);
+
+      // no peer in the process, no estimate
+      receiver.SetLocation("elsewhere");
+      EXPECT_EQ(0, sender.Get().outstanding);
+      EXPECT_NE(std::string::npos, StatsRegistry::Instance().Dump().find("Sender somewhere"));
+   }
+   EXPECT_EQ(before, StatsRegistry::Instance().size());
+}
+
+TEST(EndpointStats, PublishersAndSubscribersHaveNoEstimate) {
+   EndpointStats publisher("Publisher", EndpointStats::Role::Publisher);
+   EndpointStats first("Subscriber", EndpointStats::Role::Subscriber);
+   EndpointStats second("Subscriber", EndpointStats::Role::Subscriber);
+   publisher.SetLocation("fanout");
+   first.SetLocation("fanout");
+   second.SetLocation("fanout");
+   publisher.Sent(10, 10);
+   first.Received(10, 10);
+   second.Received(4, 4);
+   EXPECT_EQ(0, publisher.Get().outstanding);
+   EXPECT_EQ(0, first.Get().outstanding);
+   EXPECT_EQ(0, second.Get().outstanding);
+}
+
+TEST(EndpointStats, Window) {
+   EndpointStats requester("Requester", EndpointStats::Role::Requester);
+   EXPECT_EQ(std::string::npos, requester.Get().ToString().find("window"));
+   requester.SetWindow(8);
+   requester.SetInFlight(3);
+   requester.WindowFull();
+   const auto counters = requester.Get();
+   EXPECT_EQ(8, counters.windowSize);
+   EXPECT_EQ(3, counters.windowInFlight);
+   EXPECT_EQ(1, counters.windowFull);
+   EXPECT_NE(std::string::npos, counters.ToString().find("window: 3/8 (full 1 times)"));
+}
+
+TEST(EndpointStats, RifleAndVampire) {
+   const std::string location = GetIpcLocation("RifleAndVampire");
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   // nobody connected, so the send times out
+   EXPECT_FALSE(rifle.Fire("nobody", 10));
+   EXPECT_EQ(1, rifle.Stats().sendTimeouts);
+
+   Vampire vampire(location);
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::string wound;
+   EXPECT_FALSE(vampire.GetShot(wound, 10));
+   EXPECT_EQ(1, vampire.Stats().receiveTimeouts);
+
+   for (int i = 0; i < 10; ++i) {
+      ASSERT_TRUE(rifle.Fire("bullet", kWaitTimeMs));
+   }
+   auto fired = rifle.Stats();
+   EXPECT_EQ("Rifle", fired.kind);
+   EXPECT_EQ(location, fired.location);
+   EXPECT_EQ(10, fired.messagesSent);
+   EXPECT_EQ(60, fired.bytesSent);
+   EXPECT_EQ(10, fired.outstanding);
+
+   for (int i = 0; i < 4; ++i) {
+      ASSERT_TRUE(vampire.GetShot(wound, kWaitTimeMs));
+   }
+   auto shot = vampire.Stats();
+   EXPECT_EQ(4, shot.messagesReceived);
+   EXPECT_EQ(24, shot.bytesReceived);
+   EXPECT_EQ(6, shot.outstanding);
+   EXPECT_EQ(6, rifle.Stats().outstanding);
+
+   const std::string dump = StatsRegistry::Instance().Dump();
+   EXPECT_NE(std::string::npos, dump.find("Rifle " + location));
+   EXPECT_NE(std::string::npos, dump.find("Vampire " + location));
+}
+
+TEST(EndpointStats, VampireCountsMalformedMessages) {
+   const std::string location = GetIpcLocation("Malformed");
+   zctx_t* context = zctx_new();
+   void* push = zsocket_new(context, ZMQ_PUSH);
+   ASSERT_LE(0, zsocket_bind(push, location.c_str()));
+   Vampire vampire(location);
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   zmq_send(push, "three", 5, ZMQ_SNDMORE);
+   zmq_send(push, "part", 4, ZMQ_SNDMORE);
+   zmq_send(push, "message", 7, 0);
+   zmq_send(push, "bullet", 6, 0);
+   std::string wound;
+   EXPECT_FALSE(vampire.GetShot(wound, kWaitTimeMs));
+   ASSERT_TRUE(vampire.GetShot(wound, kWaitTimeMs));
+   EXPECT_EQ("bullet", wound);
+   EXPECT_EQ(1, vampire.Stats().malformed);
+   EXPECT_EQ(1, vampire.Stats().messagesReceived);
+   zctx_destroy(&context);
+}
+
+TEST(EndpointStats, CrowbarAndHeadcrabOutstanding) {
+   const std::string location = GetIpcLocation("Crowbar");
+   Headcrab headcrab(location);
+   ASSERT_TRUE(headcrab.ComeToLife());
+   Crowbar crowbar(headcrab);
+   ASSERT_TRUE(crowbar.Wield());
+   ASSERT_TRUE(crowbar.Swing("hit"));
+   std::string hit;
+   ASSERT_TRUE(headcrab.GetHitWait(hit, kWaitTimeMs));
+   EXPECT_EQ(1, crowbar.Stats().outstanding);
+   EXPECT_EQ(1, headcrab.Stats().outstanding);
+
+   ASSERT_TRUE(headcrab.SendSplatter("splat"));
+   EXPECT_EQ(0, headcrab.Stats().outstanding);
+   std::string splat;
+   ASSERT_TRUE(crowbar.WaitForKill(splat, kWaitTimeMs));
+   auto counters = crowbar.Stats();
+   EXPECT_EQ(0, counters.outstanding);
+   EXPECT_EQ(1, counters.messagesSent);
+   EXPECT_EQ(1, counters.messagesReceived);
+   EXPECT_EQ(5, counters.bytesReceived);
+
+   EXPECT_FALSE(headcrab.GetHitWait(hit, 10));
+   EXPECT_EQ(1, headcrab.Stats().receiveTimeouts);
+}
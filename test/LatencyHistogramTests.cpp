@@ -0,0 +1,199 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Coalescing.h"
+#include "LatencyHistogram.h"
+#include "Rifle.h"
+#include "Vampire.h"
+#include "Shotgun.h"
+#include "Alien.h"
+#include "Crowbar.h"
+#include "Headcrab.h"
+
+namespace {
+   const int kWaitTimeMs = 1000;
+
+   std::string GetIpcLocation(const std::string& name) {
+      return "ipc:///tmp/LatencyHistogramTests" + name + std::to_string(getpid()) + ".ipc";
+   }
+}
+
+TEST(LatencyHistogram, BucketsKeepValuesWithinASixteenth) {
+   for (uint64_t ns : {0ULL, 1ULL, 15ULL, 16ULL, 17ULL, 100ULL, 1000ULL, 123456ULL, 1000000007ULL, ~0ULL}) {
+      const size_t bucket = LatencyHistogram::BucketOf(ns);
+      ASSERT_LT(bucket, LatencyHistogram::kBuckets);
+      const uint64_t highest = LatencyHistogram::HighestIn(bucket);
+      EXPECT_LE(ns, highest);
+      EXPECT_LE(highest - ns, ns / LatencyHistogram::kSubBuckets) << ns;
+      if (bucket > 0) {
+         EXPECT_GT(ns, LatencyHistogram::HighestIn(bucket - 1)) << ns;
+      }
+   }
+}
+
+TEST(LatencyHistogram, Percentiles) {
+   LatencyHistogram histogram;
+   EXPECT_EQ(0, histogram.GetSnapshot().Percentile(50));
+   for (uint64_t ns = 1; ns <= 1000; ++ns) {
+      histogram.Record(ns * 1000);
+   }
+   auto snapshot = histogram.GetSnapshot();
+   EXPECT_EQ(1000, snapshot.count);
+   EXPECT_EQ(1000, snapshot.min);
+   EXPECT_EQ(1000000, snapshot.max);
+   EXPECT_DOUBLE_EQ(500500.0, snapshot.Mean());
+   EXPECT_NEAR(500000, snapshot.Percentile(50), 500000 / LatencyHistogram::kSubBuckets);
+   EXPECT_NEAR(990000, snapshot.Percentile(99), 990000 / LatencyHistogram::kSubBuckets);
+   EXPECT_EQ(1000000, snapshot.Percentile(100));
+   EXPECT_FALSE(snapshot.ToString().empty());
+
+   histogram.Reset();
+   snapshot = histogram.GetSnapshot();
+   EXPECT_EQ(0, snapshot.count);
+   EXPECT_EQ(0, snapshot.min);
+}
+
+TEST(LatencyHistogram, SnapshotWhileRecording) {
+   LatencyHistogram histogram;
+   const uint64_t kPerThread = 100000;
+   std::atomic<bool> done(false);
+   std::vector<std::thread> recorders;
+   for (int i = 0; i < 4; ++i) {
+      recorders.emplace_back([&histogram, kPerThread]() {
+         for (uint64_t ns = 0; ns < kPerThread; ++ns) {
+            histogram.Record(ns);
+         }
+      });
+   }
+   std::thread reader([&histogram, &done]() {
+      uint64_t last = 0;
+      while (!done.load()) {
+         const auto snapshot = histogram.GetSnapshot();
+         EXPECT_LE(last, snapshot.count);
+         last = snapshot.count;
+      }
+   });
+   for (auto& recorder : recorders) {
+      recorder.join();
+   }
+   done.store(true);
+   reader.join();
+   const auto snapshot = histogram.GetSnapshot();
+   EXPECT_EQ(4 * kPerThread, snapshot.count);
+   EXPECT_EQ(kPerThread - 1, snapshot.max);
+}
+
+TEST(LatencyHistogram, StampFrames) {
+   char frame[LatencyStats::kStampSize];
+   LatencyStats::WriteStamp(frame);
+   uint64_t sent = 0;
+   EXPECT_TRUE(LatencyStats::ReadStamp(frame, sizeof (frame), sent));
+   EXPECT_LE(sent, LatencyHistogram::Now());
+   EXPECT_FALSE(LatencyStats::ReadStamp(frame, sizeof (frame) - 1, sent));
+   const std::string notAStamp(LatencyStats::kStampSize, 'x');
+   EXPECT_FALSE(LatencyStats::ReadStamp(notAStamp.data(), notAStamp.size(), sent));
+}
+
+TEST(LatencyHistogram, RifleToVampire) {
+   const std::string location = GetIpcLocation("RifleToVampire");
+   Rifle rifle(location);
+   Vampire vampire(location);
+   EXPECT_EQ(nullptr, rifle.GetLatencyStats());
+   rifle.EnableLatencyStats();
+   vampire.EnableLatencyStats();
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   const size_t kShots = 1000;
+   for (size_t i = 0; i < kShots; ++i) {
+      ASSERT_TRUE(rifle.Fire(std::to_string(i)));
+      std::string wound;
+      ASSERT_TRUE(vampire.GetShot(wound, kWaitTimeMs));
+      EXPECT_EQ(std::to_string(i), wound);
+   }
+   EXPECT_EQ(kShots, rifle.GetLatencyStats()->sendBlocked.GetSnapshot().count);
+   EXPECT_EQ(kShots, vampire.GetLatencyStats()->receiveWait.GetSnapshot().count);
+   const auto endToEnd = vampire.GetLatencyStats()->endToEnd.GetSnapshot();
+   EXPECT_EQ(kShots, endToEnd.count);
+   EXPECT_GT(endToEnd.max, 0);
+}
+
+TEST(LatencyHistogram, VampireStripsStampsWithStatsOff) {
+   const std::string location = GetIpcLocation("StatsOnlyOnRifle");
+   Rifle rifle(location);
+   Vampire vampire(location);
+   rifle.EnableLatencyStats();
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   ASSERT_TRUE(rifle.Fire("bullet"));
+   std::vector<std::string> wounds;
+   ASSERT_EQ(1, vampire.GetShots(wounds, 10, kWaitTimeMs));
+   EXPECT_EQ("bullet", wounds[0]);
+   EXPECT_EQ(nullptr, vampire.GetLatencyStats());
+}
+
+TEST(LatencyHistogram, StampedBulletThatReadsAsCoalescedMarker) {
+   const std::string location = GetIpcLocation("StampedMarker");
+   Rifle rifle(location);
+   Vampire vampire(location);
+   rifle.EnableLatencyStats();
+   vampire.EnableLatencyStats();
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   const std::string marker(Coalescing::kMarker, Coalescing::kMarkerSize);
+   ASSERT_TRUE(rifle.Fire(marker));
+   ASSERT_TRUE(rifle.Fire("after"));
+   std::string wound;
+   ASSERT_TRUE(vampire.GetShot(wound, kWaitTimeMs));
+   EXPECT_EQ(marker, wound);
+   ASSERT_TRUE(vampire.GetShot(wound, kWaitTimeMs));
+   EXPECT_EQ("after", wound);
+   EXPECT_EQ(2, vampire.GetLatencyStats()->endToEnd.GetSnapshot().count);
+}
+
+TEST(LatencyHistogram, ShotgunToAlien) {
+   const std::string location = "inproc://LatencyHistogramTestsShotgun";
+   Shotgun shotgun;
+   shotgun.EnableLatencyStats();
+   shotgun.Aim(location);
+   Alien alien;
+   alien.EnableLatencyStats();
+   alien.PrepareToBeShot(location);
+   std::vector<std::string> bullets;
+   // subscriptions take a moment to reach the publisher
+   for (int i = 0; i < 100 && bullets.empty(); ++i) {
+      shotgun.Fire("bullet");
+      alien.GetShot(10, bullets);
+   }
+   ASSERT_EQ(2, bullets.size());
+   EXPECT_EQ("bullet", bullets[1]);
+   EXPECT_EQ(1, alien.GetLatencyStats()->endToEnd.GetSnapshot().count);
+   EXPECT_LE(1, shotgun.GetLatencyStats()->sendBlocked.GetSnapshot().count);
+}
+
+TEST(LatencyHistogram, CrowbarRoundTrip) {
+   const std::string location = GetIpcLocation("Crowbar");
+   Headcrab headcrab(location);
+   headcrab.EnableLatencyStats();
+   ASSERT_TRUE(headcrab.ComeToLife());
+   Crowbar crowbar(headcrab);
+   crowbar.EnableLatencyStats();
+   ASSERT_TRUE(crowbar.Wield());
+   const int kSwings = 100;
+   for (int i = 0; i < kSwings; ++i) {
+      ASSERT_TRUE(crowbar.Swing("hit"));
+      std::string hit;
+      ASSERT_TRUE(headcrab.GetHitWait(hit, kWaitTimeMs));
+      ASSERT_TRUE(headcrab.SendSplatter("splat"));
+      std::string splat;
+      ASSERT_TRUE(crowbar.WaitForKill(splat, kWaitTimeMs));
+      EXPECT_EQ("splat", splat);
+   }
+   EXPECT_EQ(kSwings, crowbar.GetLatencyStats()->endToEnd.GetSnapshot().count);
+   EXPECT_EQ(kSwings, crowbar.GetLatencyStats()->receiveWait.GetSnapshot().count);
+   EXPECT_EQ(kSwings, headcrab.GetLatencyStats()->receiveWait.GetSnapshot().count);
+   EXPECT_EQ(kSwings, headcrab.GetLatencyStats()->sendBlocked.GetSnapshot().count);
+   EXPECT_EQ(0, headcrab.GetLatencyStats()->endToEnd.GetSnapshot().count);
+}
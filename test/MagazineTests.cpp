@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <vector>
+#include "Magazine.h"
+#include "QAPI.h"
+#include <q/spsc.hpp>
+
+namespace {
+   const size_t kSlotSize = 100;
+   const uint32_t kSlotCount = 8;
+   const size_t kBenchmarkAmount = 200000;
+   const uint32_t kBenchmarkSlots = 256;
+
+   /**
+    * Allocate a payload on this thread and free it on another one, the way
+    * FireZeroCopy payloads are freed from the zeromq IO thread.
+    * @return nanoseconds per payload
+    */
+   template <typename Allocate, typename Release>
+   double CrossThreadPayloads(const size_t payloadSize, Allocate allocate, Release release) {
+      using namespace std::chrono_literals;
+      auto queue = QAPI::CreateQueue<spsc::flexible::circular_fifo<char*>>(kBenchmarkSlots);
+      auto producer = std::get<QAPI::index::sender>(queue);
+      auto consumer = std::get<QAPI::index::receiver>(queue);
+      auto start = std::chrono::steady_clock::now();
+      auto freed = std::async(std::launch::async, [&]() {
+         size_t count = 0;
+         char* payload = nullptr;
+         while (count < kBenchmarkAmount) {
+            if (consumer.pop(payload)) {
+               release(payload);
+               ++count;
+            } else {
+               std::this_thread::yield();
+            }
+         }
+         return count;
+      });
+      for (size_t i = 0; i < kBenchmarkAmount; ++i) {
+         char* payload = allocate();
+         while (payload == nullptr) {
+            std::this_thread::yield();
+            payload = allocate();
+         }
+         payload[0] = 'a';
+         payload[payloadSize - 1] = 'z';
+         while (false == producer.push(payload)) {
+            std::this_thread::sleep_for(1us);
+         }
+      }
+      EXPECT_EQ(kBenchmarkAmount, freed.get());
+      auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::steady_clock::now() - start).count();
+      return (elapsed * 1.0) / kBenchmarkAmount;
+   }
+
+   void MagazineVsNewDelete(const size_t payloadSize) {
+      Magazine magazine(payloadSize, kBenchmarkSlots);
+      double magazineNs = CrossThreadPayloads(payloadSize,
+         [&]() { return magazine.Load(); },
+         [&](char* payload) { magazine.Unload(payload); });
+      double newDeleteNs = CrossThreadPayloads(payloadSize,
+         [&]() { return new char[payloadSize]; },
+         [](char* payload) { delete [] payload; });
+      std::cout << payloadSize << " byte payloads, Magazine: " << magazineNs
+         << " ns/payload, new/delete: " << newDeleteNs << " ns/payload" << std::endl;
+   }
+}
+
+TEST(Magazine, LoadUntilEmpty) {
+   Magazine magazine(kSlotSize, kSlotCount);
+   EXPECT_EQ(kSlotSize, magazine.GetSlotSize());
+   EXPECT_EQ(kSlotCount, magazine.GetSlotCount());
+   std::set<char*> slots;
+   for (uint32_t i = 0; i < kSlotCount; ++i) {
+      char* slot = magazine.Load();
+      ASSERT_TRUE(slot != nullptr);
+      EXPECT_TRUE(magazine.Owns(slot));
+      EXPECT_EQ(0, reinterpret_cast<uintptr_t> (slot) % 64);
+      memset(slot, 'x', kSlotSize);
+      slots.insert(slot);
+   }
+   EXPECT_EQ(kSlotCount, slots.size());
+   EXPECT_TRUE(magazine.Load() == nullptr);
+   char* returned = *slots.begin();
+   magazine.Unload(returned);
+   EXPECT_EQ(returned, magazine.Load());
+   EXPECT_TRUE(magazine.Load() == nullptr);
+   EXPECT_FALSE(magazine.Owns(returned + 1));
+}
+
+TEST(Magazine, ZeroCopyReleaseReturnsSlot) {
+   Magazine magazine(kSlotSize, 1);
+   char* slot = magazine.Load();
+   ASSERT_TRUE(slot != nullptr);
+   EXPECT_TRUE(magazine.Load() == nullptr);
+   Magazine::ZeroCopyRelease(slot, &magazine);
+   EXPECT_EQ(slot, magazine.Load());
+}
+
+TEST(Magazine, ManyThreadsLoadAndUnload) {
+   Magazine magazine(kSlotSize, kSlotCount);
+   std::atomic<size_t> collisions{0};
+   std::vector<std::thread> threads;
+   for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&, t]() {
+         for (int i = 0; i < 100000; ++i) {
+            char* slot = magazine.Load();
+            if (slot == nullptr) {
+               continue;
+            }
+            slot[0] = static_cast<char> (t);
+            std::this_thread::yield();
+            if (slot[0] != static_cast<char> (t)) {
+               collisions++;
+            }
+            magazine.Unload(slot);
+         }
+      });
+   }
+   for (auto& thread : threads) {
+      thread.join();
+   }
+   EXPECT_EQ(0, collisions.load());
+   std::set<char*> slots;
+   for (uint32_t i = 0; i < kSlotCount; ++i) {
+      slots.insert(magazine.Load());
+   }
+   EXPECT_EQ(kSlotCount, slots.size());
+   EXPECT_EQ(0, slots.count(nullptr));
+}
+
+/**
+ * The new/delete numbers are for whatever allocator the runner is linked
+ * with, run it with tcmalloc preloaded to compare against tcmalloc.
+ */
+TEST(Performance, Magazine_64B) {
+   MagazineVsNewDelete(64);
+}
+
+TEST(Performance, Magazine_1KB) {
+   MagazineVsNewDelete(1024);
+}
+
+TEST(Performance, Magazine_64KB) {
+   MagazineVsNewDelete(64 * 1024);
+}
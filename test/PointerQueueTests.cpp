@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <unistd.h>
+#include "PointerQueue.h"
+
+namespace {
+   const int kWaitTimeMs = 500;
+
+   struct Packet {
+      explicit Packet(const int id) : mId(id) {
+      }
+
+      ~Packet() {
+         gDeleted++;
+      }
+      int mId;
+      static std::atomic<int> gDeleted;
+   };
+   std::atomic<int> Packet::gDeleted{0};
+
+   std::string GetIpcLocation() {
+      return "ipc:///tmp/PointerQueueTests" + std::to_string(getpid()) + ".ipc";
+   }
+}
+
+TEST(PointerQueue, InprocHandsOverOwnership) {
+   PointerRifle<Packet> rifle("inproc://PointerQueueTests");
+   PointerVampire<Packet> vampire("inproc://PointerQueueTests");
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   const int kPackets = 10000;
+   auto received = std::async(std::launch::async, [&]() {
+      int count = 0;
+      std::unique_ptr<Packet> packet;
+      while (count < kPackets && vampire.GetStake(packet, kWaitTimeMs)) {
+         EXPECT_EQ(count, packet->mId);
+         ++count;
+      }
+      return count;
+   });
+   for (int i = 0; i < kPackets; ++i) {
+      std::unique_ptr<Packet> packet(new Packet(i));
+      ASSERT_TRUE(rifle.Fire(packet));
+      EXPECT_TRUE(packet.get() == nullptr);
+   }
+   EXPECT_EQ(kPackets, received.get());
+}
+
+TEST(PointerQueue, InprocFullQueueKeepsOwnership) {
+   PointerRifle<Packet> rifle("inproc://PointerQueueTestsFull");
+   rifle.SetHighWater(1);
+   ASSERT_TRUE(rifle.Aim());
+   std::unique_ptr<Packet> first(new Packet(1));
+   std::unique_ptr<Packet> second(new Packet(2));
+   EXPECT_TRUE(rifle.Fire(first));
+   EXPECT_FALSE(rifle.Fire(second, 1));
+   ASSERT_TRUE(second.get() != nullptr);
+   EXPECT_EQ(2, second->mId);
+   std::unique_ptr<Packet> empty;
+   EXPECT_FALSE(rifle.Fire(empty));
+
+   PointerVampire<Packet> vampire("inproc://PointerQueueTestsFull");
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::unique_ptr<Packet> packet;
+   ASSERT_TRUE(vampire.GetStake(packet, 0));
+   EXPECT_EQ(1, packet->mId);
+   EXPECT_FALSE(vampire.GetStake(packet, 1));
+   EXPECT_TRUE(packet.get() == nullptr);
+}
+
+TEST(PointerQueue, InprocFullQueueWaitsForRoom) {
+   PointerRifle<Packet> rifle("inproc://PointerQueueTestsWait");
+   PointerVampire<Packet> vampire("inproc://PointerQueueTestsWait");
+   rifle.SetHighWater(1);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::unique_ptr<Packet> first(new Packet(1));
+   ASSERT_TRUE(rifle.Fire(first));
+   auto fired = std::async(std::launch::async, [&rifle]() {
+      std::unique_ptr<Packet> second(new Packet(2));
+      return rifle.Fire(second, 10000);
+   });
+   EXPECT_EQ(std::future_status::timeout, fired.wait_for(std::chrono::milliseconds(20)));
+   std::unique_ptr<Packet> packet;
+   ASSERT_TRUE(vampire.GetStake(packet, kWaitTimeMs));
+   EXPECT_EQ(1, packet->mId);
+   ASSERT_EQ(std::future_status::ready, fired.wait_for(std::chrono::seconds(5)));
+   EXPECT_TRUE(fired.get());
+   ASSERT_TRUE(vampire.GetStake(packet, kWaitTimeMs));
+   EXPECT_EQ(2, packet->mId);
+}
+
+TEST(PointerQueue, InprocLeftoversAreDeleted) {
+   const int deleted = Packet::gDeleted.load();
+   {
+      PointerRifle<Packet> rifle("inproc://PointerQueueTestsLeftovers");
+      ASSERT_TRUE(rifle.Aim());
+      for (int i = 0; i < 5; ++i) {
+         std::unique_ptr<Packet> packet(new Packet(i));
+         ASSERT_TRUE(rifle.Fire(packet));
+      }
+      EXPECT_EQ(deleted, Packet::gDeleted.load());
+   }
+   EXPECT_EQ(deleted + 5, Packet::gDeleted.load());
+}
+
+TEST(PointerQueue, IpcFallsBackToStakes) {
+   std::string location = GetIpcLocation();
+   PointerRifle<Packet> rifle(location);
+   PointerVampire<Packet> vampire(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::unique_ptr<Packet> packet(new Packet(42));
+   Packet* raw = packet.get();
+   ASSERT_TRUE(rifle.Fire(packet));
+   EXPECT_TRUE(packet.get() == nullptr);
+   std::unique_ptr<Packet> received;
+   ASSERT_TRUE(vampire.GetStake(received, kWaitTimeMs));
+   EXPECT_EQ(raw, received.get());
+   EXPECT_EQ(42, received->mId);
+}
+
+TEST(PointerQueue, Uninitialized) {
+   PointerRifle<Packet> rifle(GetIpcLocation());
+   PointerVampire<Packet> vampire(GetIpcLocation());
+   std::unique_ptr<Packet> packet(new Packet(1));
+   EXPECT_FALSE(rifle.Fire(packet, 1));
+   EXPECT_TRUE(packet.get() != nullptr);
+   std::unique_ptr<Packet> received;
+   EXPECT_FALSE(vampire.GetStake(received, 1));
+}
@@ -13,14 +13,84 @@
 #include "QApiTests.h"
 #include <q/spsc.hpp>
 #include <q/mpmc.hpp>
+#include <atomic>
+#include <future>
 #include <thread>
 #include <algorithm>
+#include <deque>
+#include <iterator>
 
 using namespace QApiTests;
 
 namespace {
    const size_t kAmount = 1000000;
    const size_t kSmallQueueSize = 100;
+
+   // A queue with its own bulk transfer, to check that QAPI uses it
+   template <typename T>
+   struct BulkQueue {
+      explicit BulkQueue(size_t capacity) : mCapacity(capacity), mBulkPushes(0), mBulkPops(0) {}
+      bool push(T& item) {
+         if (mItems.size() >= mCapacity) {
+            return false;
+         }
+         mItems.push_back(std::move(item));
+         return true;
+      }
+      bool pop(T& item) {
+         if (mItems.empty()) {
+            return false;
+         }
+         item = std::move(mItems.front());
+         mItems.pop_front();
+         return true;
+      }
+      template <typename Iterator>
+      size_t push_bulk(Iterator first, Iterator last) {
+         ++mBulkPushes;
+         size_t pushed = 0;
+         for (; first != last && push(*first); ++first) {
+            ++pushed;
+         }
+         return pushed;
+      }
+      template <typename OutputIt>
+      size_t pop_bulk(OutputIt out, size_t maxCount) {
+         ++mBulkPops;
+         size_t popped = 0;
+         for (; popped < maxCount && !mItems.empty(); ++popped) {
+            *out++ = std::move(mItems.front());
+            mItems.pop_front();
+         }
+         return popped;
+      }
+      size_t mCapacity;
+      size_t mBulkPushes;
+      size_t mBulkPops;
+      std::deque<T> mItems;
+   };
+
+   template <typename QType>
+   void BulkPushAndPop(std::shared_ptr<QType> queue) {
+      QAPI::Sender<QType> producer(queue);
+      QAPI::Receiver<QType> consumer(queue);
+      std::vector<std::string> values;
+      for (size_t i = 0; i < kSmallQueueSize + 10; ++i) {
+         values.push_back(std::to_string(i));
+      }
+      // only what fits is pushed, in order
+      EXPECT_EQ(kSmallQueueSize, producer.push_bulk(values.begin(), values.end()));
+      EXPECT_EQ(0, producer.push_bulk(values.begin() + kSmallQueueSize, values.end()));
+
+      std::vector<std::string> received;
+      EXPECT_EQ(10, consumer.pop_bulk(std::back_inserter(received), 10));
+      EXPECT_EQ(kSmallQueueSize - 10, consumer.pop_bulk(std::back_inserter(received), kSmallQueueSize));
+      EXPECT_EQ(0, consumer.pop_bulk(std::back_inserter(received), kSmallQueueSize));
+      ASSERT_EQ(kSmallQueueSize, received.size());
+      for (size_t i = 0; i < kSmallQueueSize; ++i) {
+         EXPECT_EQ(std::to_string(i), received[i]);
+      }
+   }
 }
 
 TEST(Queue, ProdConsInitializationCopy) {
@@ -75,6 +145,250 @@ TEST(Queue, BaseAPI_Flexible_Locked) {
 
 
 
+TEST(Queue, WaitAndPopParksUntilPushed) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   auto queue = QAPI::CreateQueue<QType>(kSmallQueueSize);
+   auto producer = std::get<QAPI::index::sender>(queue);
+   auto consumer = std::get<QAPI::index::receiver>(queue);
+   EXPECT_EQ(producer.mParkingLot, consumer.mParkingLot);
+   EXPECT_TRUE(consumer.GetWaitStrategy().park);
+
+   auto received = std::async(std::launch::async, [&consumer]() {
+      std::string value;
+      consumer.wait_and_pop(value, std::chrono::seconds(5));
+      return value;
+   });
+   while (consumer.mParkingLot->Parked() == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   std::string value = "wake up";
+   EXPECT_TRUE(producer.push(value));
+   EXPECT_EQ("wake up", received.get());
+   EXPECT_EQ(0, consumer.mParkingLot->Parked());
+}
+
+TEST(Queue, HandlesBuiltFromAQueueShareItsParkingLot) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   auto queue = std::make_shared<QType>(kSmallQueueSize);
+   QAPI::Sender<QType> producer(queue);
+   QAPI::Receiver<QType> consumer(queue);
+   EXPECT_EQ(producer.mParkingLot, consumer.mParkingLot);
+   auto other = std::make_shared<QType>(kSmallQueueSize);
+   EXPECT_NE(producer.mParkingLot, QAPI::Receiver<QType>(other).mParkingLot);
+
+   auto received = std::async(std::launch::async, [&consumer]() {
+      std::string value;
+      consumer.wait_and_pop(value, std::chrono::seconds(5));
+      return std::make_pair(value, std::chrono::steady_clock::now());
+   });
+   while (consumer.mParkingLot->Parked() == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   std::string value = "wake up";
+   const auto pushed = std::chrono::steady_clock::now();
+   EXPECT_TRUE(producer.push(value));
+   auto woken = received.get();
+   EXPECT_EQ("wake up", woken.first);
+   // woken by the push, not by the timeout
+   EXPECT_LT(woken.second - pushed, std::chrono::seconds(1));
+}
+
+TEST(Queue, WaitAndPopTimesOut) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   auto queue = QAPI::CreateQueue<QType>(kSmallQueueSize);
+   auto consumer = std::get<QAPI::index::receiver>(queue);
+   const std::vector<QAPI::WaitStrategy> strategies = {QAPI::WaitStrategy(), QAPI::WaitStrategy::Sleep()};
+   for (const auto& strategy : strategies) {
+      consumer.SetWaitStrategy(strategy);
+      std::string value;
+      auto start = std::chrono::steady_clock::now();
+      EXPECT_FALSE(consumer.wait_and_pop(value, std::chrono::milliseconds(50)));
+      EXPECT_TRUE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+   }
+}
+
+TEST(Queue, BulkPushAndPop) {
+   BulkPushAndPop(std::make_shared<spsc::flexible::circular_fifo<std::string>>(kSmallQueueSize));
+   BulkPushAndPop(std::make_shared<spsc::fixed::circular_fifo<std::string, kSmallQueueSize>>());
+   BulkPushAndPop(std::make_shared<mpmc::flexible_lock_queue<std::string>>(kSmallQueueSize));
+   BulkPushAndPop(std::make_shared<BulkQueue<std::string>>(kSmallQueueSize));
+}
+
+TEST(Queue, BulkUsesTheQueuesOwnBulkTransfer) {
+   using QType = BulkQueue<std::string>;
+   auto queue = std::make_shared<QType>(kSmallQueueSize);
+   QAPI::Sender<QType> producer(queue);
+   QAPI::Receiver<QType> consumer(queue);
+   std::vector<std::string> values = {"a", "b", "c"};
+   EXPECT_EQ(3, producer.push_bulk(values.begin(), values.end()));
+   std::vector<std::string> received(3);
+   EXPECT_EQ(3, consumer.pop_bulk(received.begin(), 3));
+   EXPECT_EQ(1, queue->mBulkPushes);
+   EXPECT_EQ(1, queue->mBulkPops);
+   EXPECT_EQ((std::vector<std::string>{"a", "b", "c"}), received);
+}
+
+TEST(Queue, BulkPushWakesParkedReceiver) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   auto queue = QAPI::CreateQueue<QType>(kSmallQueueSize);
+   auto producer = std::get<QAPI::index::sender>(queue);
+   auto consumer = std::get<QAPI::index::receiver>(queue);
+   auto received = std::async(std::launch::async, [&consumer]() {
+      std::string value;
+      consumer.wait_and_pop(value, std::chrono::seconds(5));
+      return value;
+   });
+   while (consumer.mParkingLot->Parked() == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   std::vector<std::string> values = {"first", "second"};
+   EXPECT_EQ(2, producer.push_bulk(values.begin(), values.end()));
+   EXPECT_EQ("first", received.get());
+}
+
+TEST(Queue, BulkNotifyWakesOneParkedReceiverPerItem) {
+   QAPI::ParkingLot lot;
+   std::atomic<int> items(0);
+   auto take = [&items]() {
+      int left = items.load();
+      while (left > 0 && !items.compare_exchange_weak(left, left - 1)) {
+      }
+      return left > 0;
+   };
+   const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+   std::vector<std::future<bool>> waiters;
+   for (int i = 0; i < 3; ++i) {
+      waiters.push_back(std::async(std::launch::async, [&lot, &take, deadline]() {
+         return lot.Park(take, deadline);
+      }));
+   }
+   while (lot.Parked() < 3) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   items.store(3);
+   lot.Notify(3);
+   for (auto& waiter : waiters) {
+      ASSERT_EQ(std::future_status::ready, waiter.wait_for(std::chrono::seconds(5)));
+      EXPECT_TRUE(waiter.get());
+   }
+   EXPECT_EQ(0, lot.Parked());
+}
+
+TEST(Queue, StatsPolicies) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   auto none = QAPI::CreateQueue<QType, QAPI::stats::None>(kSmallQueueSize);
+   auto sampled = QAPI::CreateQueue<QType, QAPI::stats::Sampled<10>>(kSmallQueueSize);
+   auto sharded = QAPI::CreateQueue<QType, QAPI::stats::Sharded>(kSmallQueueSize);
+   std::string value = "value";
+   std::string received;
+   for (size_t i = 0; i < 20; ++i) {
+      EXPECT_TRUE(std::get<QAPI::index::sender>(none).push(value));
+      EXPECT_TRUE(std::get<QAPI::index::receiver>(none).pop(received));
+      EXPECT_TRUE(std::get<QAPI::index::sender>(sampled).push(value));
+      EXPECT_TRUE(std::get<QAPI::index::receiver>(sampled).pop(received));
+      EXPECT_TRUE(std::get<QAPI::index::sender>(sharded).push(value));
+      EXPECT_TRUE(std::get<QAPI::index::receiver>(sharded).pop(received));
+   }
+   EXPECT_EQ("value", received);
+   EXPECT_TRUE(std::get<QAPI::index::sender>(none).mStats.FlushAsString().empty());
+}
+
+TEST(Queue, ShardedStatsHaveOneShardPerThread) {
+   using QType = mpmc::flexible_lock_queue<size_t>;
+   auto queue = QAPI::CreateQueue<QType, QAPI::stats::Sharded>(kSmallQueueSize);
+   auto& producer = std::get<QAPI::index::sender>(queue);
+   EXPECT_EQ(0, producer.mStats.Shards());
+   std::vector<std::thread> threads;
+   for (size_t t = 0; t < 4; ++t) {
+      threads.emplace_back([&producer, t]() {
+         for (size_t i = 0; i < 10; ++i) {
+            EXPECT_TRUE(producer.push(i));
+         }
+      });
+   }
+   for (auto& thread : threads) {
+      thread.join();
+   }
+   EXPECT_EQ(40, producer.size());
+   EXPECT_EQ(4, producer.mStats.Shards());
+   // a copy does not share the shards
+   auto copy = producer;
+   EXPECT_EQ(0, copy.mStats.Shards());
+}
+
+TEST(Queue, BorrowedHandles) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   auto queue = QAPI::CreateQueue<QType>(kSmallQueueSize);
+   auto& producer = std::get<QAPI::index::sender>(queue);
+   auto& consumer = std::get<QAPI::index::receiver>(queue);
+   const auto owners = producer.mQueueStorage.use_count();
+   consumer.SetWaitStrategy(QAPI::WaitStrategy::Sleep());
+   auto borrowedProducer = producer.Borrow();
+   auto borrowedConsumer = consumer.Borrow();
+   auto copy = borrowedProducer;
+   EXPECT_TRUE(producer.owner());
+   EXPECT_FALSE(borrowedProducer.owner());
+   EXPECT_FALSE(copy.owner());
+   EXPECT_EQ(owners, producer.mQueueStorage.use_count());
+   EXPECT_FALSE(borrowedConsumer.GetWaitStrategy().park);
+
+   std::string value = "borrowed";
+   EXPECT_TRUE(copy.push(value));
+   EXPECT_EQ(1, producer.size());
+   std::string received;
+   EXPECT_TRUE(borrowedConsumer.pop(received));
+   EXPECT_EQ("borrowed", received);
+   EXPECT_EQ(producer.mParkingLot.get(), borrowedProducer.mParkingLot.get());
+}
+
+TEST(Queue, HandleStatsAreCacheLinesApart) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   auto queue = QAPI::CreateQueue<QType, QAPI::stats::None>(kSmallQueueSize);
+   auto& producer = std::get<QAPI::index::sender>(queue);
+   std::vector<decltype(producer.Borrow())> handles(4, producer.Borrow());
+   for (size_t i = 1; i < handles.size(); ++i) {
+      auto previous = reinterpret_cast<const char*>(&handles[i - 1].mStats);
+      auto current = reinterpret_cast<const char*>(&handles[i].mStats);
+      EXPECT_GE(static_cast<size_t>(current - previous), QAPI::kCacheLine);
+   }
+   // nor do they share a line with the queue pointers at the front of a handle
+   auto front = reinterpret_cast<const char*>(&producer);
+   EXPECT_GE(static_cast<size_t>(reinterpret_cast<const char*>(&producer.mStats) - front), QAPI::kCacheLine);
+}
+
+TEST(Performance, StatsPolicyCostPerOp) {
+   using QType = spsc::flexible::circular_fifo<size_t>;
+   const size_t kQueueSize = 1024;
+   RunStatsCost(QAPI::CreateQueue<QType, QAPI::stats::None>(kQueueSize), "None", kAmount);
+   RunStatsCost(QAPI::CreateQueue<QType, QAPI::stats::Sampled<64>>(kQueueSize), "Sampled<64>", kAmount);
+   RunStatsCost(QAPI::CreateQueue<QType, QAPI::stats::Sharded>(kQueueSize), "Sharded", kAmount);
+   RunStatsCost(QAPI::CreateQueue<QType, QAPI::stats::Full>(kQueueSize), "Full", kAmount);
+}
+
+TEST(Performance, MPMC_SharedSender_StatsPolicyCost) {
+   // Full and Sampled share one TimeStats and are not for a Sender used
+   // by many threads at once
+   using QType = mpmc::flexible_lock_queue<size_t>;
+   const size_t kProducers = 4;
+   const size_t kPerProducer = kAmount / kProducers;
+   RunSharedSenderCost(QAPI::CreateQueue<QType, QAPI::stats::None>(kAmount), "None", kProducers, kPerProducer);
+   RunSharedSenderCost(QAPI::CreateQueue<QType, QAPI::stats::Sharded>(kAmount), "Sharded", kProducers, kPerProducer);
+}
+
+TEST(Performance, SPSC_Flexible_CircularFifo_Bulk) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   RunBulk(QAPI::CreateQueue<QType>(kSmallQueueSize), kAmount, 1);
+   RunBulk(QAPI::CreateQueue<QType>(kSmallQueueSize), kAmount, 32);
+   RunBulk(QAPI::CreateQueue<QType>(kSmallQueueSize), kAmount, kSmallQueueSize);
+}
+
+TEST(Performance, SPSC_IdleCpuAndWakeup) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   RunIdleAndWakeup(QAPI::CreateQueue<QType>(kSmallQueueSize), QAPI::WaitStrategy::Sleep(), "sleep 100ns");
+   RunIdleAndWakeup(QAPI::CreateQueue<QType>(kSmallQueueSize), QAPI::WaitStrategy(), "spin, yield, park");
+   RunIdleAndWakeup(QAPI::CreateQueue<QType>(kSmallQueueSize), QAPI::WaitStrategy(0, 0), "park");
+}
+
 TEST(Performance, SPSC_Flexible_CircularFifo) {
    auto queue = QAPI::CreateQueue<spsc::flexible::circular_fifo<std::string>>(kAmount);
    RunSPSC(queue, kAmount);
@@ -115,6 +429,21 @@ TEST(Performance, MPMC_1_to_1_Smaller) {
 }
 
 
+// Throughput as producers and consumers are added, each thread with a copy
+// of the handles and then with a borrowed handle
+TEST(Performance, MPMC_Scaling_1_to_16) {
+   using QType = mpmc::flexible_lock_queue<std::string>;
+   const size_t kTimeToRunSec = 1;
+   const std::string data = "scaling";
+   for (size_t threads = 1; threads <= 16; threads *= 2) {
+      for (const bool borrow : {false, true}) {
+         std::cout << threads << " producers and consumers, " << (borrow ? "borrowed" : "copied") << " handles" << std::endl;
+         auto queue = QAPI::CreateQueue<QType, QAPI::stats::None>(kSmallQueueSize);
+         RunMPMC(queue, data, threads, threads, kTimeToRunSec, borrow);
+      }
+   }
+}
+
 TEST(Performance, SPSC_Flexible_20secRun_LargeData) {
    using namespace std;
    auto queue = QAPI::CreateQueue<spsc::flexible::circular_fifo<std::string>>(kSmallQueueSize);
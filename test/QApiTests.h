@@ -6,6 +6,9 @@
 #include <atomic>
 #include <iostream>
 #include <future>
+#include <iterator>
+#include <algorithm>
+#include <time.h>
 
 namespace QApiTests {
    using ResultType = std::vector<std::string>;
@@ -152,9 +155,10 @@ namespace QApiTests {
    }
 
 
+   // With borrow each thread gets a non-owning handle instead of a copy
    template<typename T>
    void RunMPMC(T queue, std::string data, size_t numberProducers,
-                size_t numberConsumers, const size_t timeToRunInSec) {
+                size_t numberConsumers, const size_t timeToRunInSec, const bool borrow = false) {
       std::atomic<size_t> producerCount{0};
       std::atomic<size_t> consumerCount{0};
       std::atomic<bool> producerStop{false};
@@ -169,7 +173,7 @@ namespace QApiTests {
       producerResult.reserve(numberProducers);
       for (size_t i = 0; i < numberProducers; ++i) {
          producerResult.emplace_back(std::async(std::launch::async, PushUntil<decltype(producer)>,
-                                                producer, data, numberProducers, 
+                                                borrow ? producer.Borrow() : producer, data, numberProducers, 
                                                 std::ref(producerCount), std::ref(consumerCount), 
                                                 std::ref(producerStop)));
       }
@@ -177,7 +181,7 @@ namespace QApiTests {
       consumerResult.reserve(numberConsumers);
       for (size_t i = 0; i < numberConsumers; ++i) {
          consumerResult.emplace_back(std::async(std::launch::async, GetUntil<decltype(consumer)>,
-                                                consumer, data, numberConsumers, 
+                                                borrow ? consumer.Borrow() : consumer, data, numberConsumers, 
                                                 std::ref(producerCount), std::ref(consumerCount), 
                                                 std::ref(consumerStop)));
       }
@@ -215,5 +219,144 @@ namespace QApiTests {
                 << amountConsumed* data.size() / (1024 * 1024 * 1024) / elapsedTimeSec << std::endl;
    }
 
+
+   // Push and pop batches of batchSize, a full queue pushes what fits
+   template<typename T>
+   void RunBulk(T queue, const size_t howMany, const size_t batchSize) {
+      using namespace std::chrono;
+      auto producer = std::get<QAPI::index::sender>(queue);
+      auto consumer = std::get<QAPI::index::receiver>(queue);
+      auto t1 = high_resolution_clock::now();
+      auto consResult = std::async(std::launch::async, [&consumer, howMany, batchSize]() {
+         ResultType received;
+         received.reserve(howMany);
+         while (received.size() < howMany) {
+            if (0 == consumer.pop_bulk(std::back_inserter(received), batchSize)) {
+               std::this_thread::sleep_for(microseconds(1));
+            }
+         }
+         return received;
+      });
+      ResultType expected;
+      expected.reserve(howMany);
+      for (size_t i = 0; i < howMany; ++i) {
+         expected.push_back(std::to_string(i));
+      }
+      ResultType batch;
+      for (size_t start = 0; start < howMany; start += batchSize) {
+         const size_t stop = std::min(howMany, start + batchSize);
+         batch.assign(expected.begin() + start, expected.begin() + stop);
+         auto next = batch.begin();
+         while (next != batch.end()) {
+            const size_t pushed = producer.push_bulk(next, batch.end());
+            next += pushed;
+            if (0 == pushed) {
+               std::this_thread::sleep_for(microseconds(1));
+            }
+         }
+      }
+      auto received = consResult.get();
+      auto us = duration_cast<microseconds>(high_resolution_clock::now() - t1).count();
+      std::cout << "Bulk of " << batchSize << " push - pull #" << howMany << " items in: " << us << " us" << std::endl;
+      std::cout << "Average: " << 1000 * ((float)us / (float) howMany) << " ns" << std::endl;
+      EXPECT_EQ(expected, received);
+   }
+
+   // Cost of one push + pop on a queue nobody else uses, which is mostly
+   // what the Stats policy of the Sender and Receiver adds
+   template<typename T>
+   double RunStatsCost(T queue, const std::string& policy, const size_t howMany) {
+      using namespace std::chrono;
+      auto producer = std::get<QAPI::index::sender>(queue);
+      auto consumer = std::get<QAPI::index::receiver>(queue);
+      size_t value = 0;
+      size_t sum = 0;
+      auto t1 = high_resolution_clock::now();
+      for (size_t i = 0; i < howMany; ++i) {
+         producer.push(i);
+         consumer.pop(value);
+         sum += value;
+      }
+      auto ns = duration_cast<nanoseconds>(high_resolution_clock::now() - t1).count();
+      EXPECT_EQ(howMany * (howMany - 1) / 2, sum);
+      const double perOp = (double) ns / (2 * howMany);
+      std::cout << policy << " stats: " << perOp << " ns per push or pop" << std::endl;
+      return perOp;
+   }
+
+   // Cost of a push from many threads through one shared Sender, the queue
+   // must have room for producers * howMany
+   template<typename T>
+   double RunSharedSenderCost(T queue, const std::string& policy, const size_t producers, const size_t howMany) {
+      using namespace std::chrono;
+      auto producer = std::get<QAPI::index::sender>(queue);
+      std::atomic<bool> start{false};
+      std::vector<std::future<void>> results;
+      for (size_t p = 0; p < producers; ++p) {
+         results.emplace_back(std::async(std::launch::async, [&producer, &start, howMany]() {
+            while (!start.load()) {
+               std::this_thread::yield();
+            }
+            for (size_t i = 0; i < howMany; ++i) {
+               EXPECT_TRUE(producer.push(i));
+            }
+         }));
+      }
+      auto t1 = high_resolution_clock::now();
+      start.store(true);
+      for (auto& result : results) {
+         result.get();
+      }
+      auto ns = duration_cast<nanoseconds>(high_resolution_clock::now() - t1).count();
+      EXPECT_EQ(producers * howMany, producer.size());
+      const double perOp = (double) ns / (producers * howMany);
+      std::cout << policy << " stats, " << producers << " threads on one Sender: "
+                << perOp << " ns per push" << std::endl;
+      return perOp;
+   }
+
+   // CPU a Receiver burns while it waits on an empty queue, and how long it
+   // takes to wake up once something is pushed
+   template<typename T>
+   void RunIdleAndWakeup(T queue, const QAPI::WaitStrategy& strategy, const std::string& name) {
+      using namespace std::chrono;
+      auto producer = std::get<QAPI::index::sender>(queue);
+      auto consumer = std::get<QAPI::index::receiver>(queue);
+      consumer.SetWaitStrategy(strategy);
+      auto nowNs = []() {
+         return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+      };
+
+      auto idle = std::async(std::launch::async, [&consumer]() {
+         timespec start, stop;
+         clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+         std::string value;
+         EXPECT_FALSE(consumer.wait_and_pop(value, milliseconds(1000)));
+         clock_gettime(CLOCK_THREAD_CPUTIME_ID, &stop);
+         return ((stop.tv_sec - start.tv_sec) * 1000.0) + ((stop.tv_nsec - start.tv_nsec) / 1000000.0);
+      });
+      const double idleCpuMs = idle.get();
+
+      const size_t kWakeups = 1000;
+      auto woken = std::async(std::launch::async, [&consumer, &nowNs]() {
+         int64_t totalNs = 0;
+         for (size_t i = 0; i < kWakeups; ++i) {
+            std::string value;
+            EXPECT_TRUE(consumer.wait_and_pop(value, milliseconds(1000)));
+            totalNs += nowNs() - std::stoll(value);
+         }
+         return totalNs;
+      });
+      for (size_t i = 0; i < kWakeups; ++i) {
+         // give the receiver time to go all the way to sleep
+         std::this_thread::sleep_for(milliseconds(1));
+         std::string value = std::to_string(nowNs());
+         EXPECT_TRUE(producer.push(value));
+      }
+      const int64_t totalNs = woken.get();
+      std::cout << name << ": idle CPU " << idleCpuMs << " ms per second waiting, wake up "
+                << (totalNs / kWakeups) / 1000.0 << " us on average" << std::endl;
+   }
+
 } // Q API Tests
 
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "RequestTable.h"
+
+namespace {
+   const time_t kTimeout = 300;
+   const time_t kStart = 1000000;
+
+   RequestId Id(const uint64_t n) {
+      return RequestId(n * 0x9e3779b97f4a7c15ULL, n);
+   }
+}
+
+TEST(RequestTable, UuidsParseExactly) {
+   const std::string uuid = "01234567-89ab-cdef-0011-2233445566ff";
+   const RequestId id = RequestId::FromString(uuid);
+   EXPECT_EQ(0x0123456789abcdefULL, id.high);
+   EXPECT_EQ(0x00112233445566ffULL, id.low);
+   EXPECT_EQ(uuid, id.ToString());
+}
+
+TEST(RequestTable, BytesRoundTrip) {
+   const RequestId id(0x0123456789abcdefULL, 0xfedcba9876543210ULL);
+   unsigned char bytes[RequestId::kSize];
+   id.ToBytes(bytes);
+   EXPECT_EQ(0x01, bytes[0]);
+   EXPECT_EQ(0x10, bytes[RequestId::kSize - 1]);
+   EXPECT_EQ(id, RequestId::FromBytes(bytes));
+   EXPECT_EQ("01234567-89ab-cdef-fedc-ba9876543210", id.ToString());
+}
+
+TEST(RequestTable, OtherIdsHash) {
+   std::set<std::pair<uint64_t, uint64_t>> seen;
+   for (int i = 0; i < 10000; ++i) {
+      const RequestId id = RequestId::FromString(std::to_string(i));
+      EXPECT_TRUE(seen.insert({id.high, id.low}).second) << i;
+   }
+   EXPECT_EQ(RequestId::FromString("foo"), RequestId::FromString("foo"));
+   EXPECT_NE(RequestId::FromString("foo"), RequestId::FromString("foo "));
+   // upper case is a different string, so a different id
+   EXPECT_NE(RequestId::FromString("01234567-89AB-CDEF-0011-2233445566FF"),
+           RequestId::FromString("01234567-89ab-cdef-0011-2233445566ff"));
+}
+
+TEST(RequestTable, InsertReplyTake) {
+   RequestTable table(kTimeout);
+   EXPECT_TRUE(table.Insert(Id(1), kStart));
+   EXPECT_FALSE(table.Insert(Id(1), kStart));
+   EXPECT_TRUE(table.Contains(Id(1)));
+   EXPECT_FALSE(table.Contains(Id(2)));
+   EXPECT_FALSE(table.SetReply(Id(2), "nobody asked"));
+
+   std::string reply;
+   EXPECT_FALSE(table.TakeReply(Id(1), reply));
+   EXPECT_TRUE(table.SetReply(Id(1), "reply"));
+   EXPECT_TRUE(table.HasReply(Id(1)));
+   EXPECT_EQ(1, table.replies());
+   EXPECT_TRUE(table.TakeReply(Id(1), reply));
+   EXPECT_EQ("reply", reply);
+   EXPECT_FALSE(table.Contains(Id(1)));
+   EXPECT_EQ(0, table.replies());
+   EXPECT_TRUE(table.empty());
+}
+
+TEST(RequestTable, SentNsIsTakenOnce) {
+   RequestTable table(kTimeout);
+   ASSERT_TRUE(table.Insert(Id(1), kStart, 1234));
+   ASSERT_TRUE(table.Insert(Id(2), kStart));
+   uint64_t sentNs = 0;
+   EXPECT_TRUE(table.TakeSentNs(Id(1), sentNs));
+   EXPECT_EQ(1234, sentNs);
+   EXPECT_FALSE(table.TakeSentNs(Id(1), sentNs));
+   EXPECT_FALSE(table.TakeSentNs(Id(2), sentNs));
+   EXPECT_TRUE(table.Contains(Id(1)));
+}
+
+TEST(RequestTable, ManyInsertsAndErases) {
+   RequestTable table(kTimeout);
+   const uint64_t kRequests = 10000;
+   for (uint64_t n = 0; n < kRequests; ++n) {
+      ASSERT_TRUE(table.Insert(Id(n), kStart));
+   }
+   EXPECT_EQ(kRequests, table.size());
+   // erase every other one, the probe chains must stay intact
+   for (uint64_t n = 0; n < kRequests; n += 2) {
+      ASSERT_TRUE(table.Erase(Id(n)));
+   }
+   for (uint64_t n = 0; n < kRequests; ++n) {
+      EXPECT_EQ(n % 2 == 1, table.Contains(Id(n))) << n;
+   }
+   for (uint64_t n = 1; n < kRequests; n += 2) {
+      ASSERT_TRUE(table.SetReply(Id(n), std::to_string(n)));
+   }
+   std::string reply;
+   for (uint64_t n = kRequests - 1; n < kRequests; n -= 2) {
+      ASSERT_TRUE(table.TakeReply(Id(n), reply));
+      EXPECT_EQ(std::to_string(n), reply);
+   }
+   EXPECT_TRUE(table.empty());
+}
+
+TEST(RequestTable, ExpireOnlyWhatIsDue) {
+   RequestTable table(kTimeout);
+   ASSERT_TRUE(table.Insert(Id(1), kStart));
+   ASSERT_TRUE(table.Insert(Id(2), kStart + 1));
+   ASSERT_TRUE(table.Insert(Id(3), kStart + 2));
+   ASSERT_TRUE(table.SetReply(Id(2), "unread"));
+
+   size_t expiredReplies = 0;
+   EXPECT_EQ(0, table.Expire(kStart + kTimeout - 1, expiredReplies));
+   EXPECT_EQ(1, table.Expire(kStart + kTimeout, expiredReplies));
+   EXPECT_EQ(0, expiredReplies);
+   EXPECT_FALSE(table.Contains(Id(1)));
+   EXPECT_EQ(1, table.Expire(kStart + kTimeout + 1, expiredReplies));
+   EXPECT_EQ(1, expiredReplies);
+   EXPECT_EQ(0, table.replies());
+   EXPECT_TRUE(table.Contains(Id(3)));
+
+   // a request sent after the last expiry, in a slot that was already walked
+   ASSERT_TRUE(table.Insert(Id(4), kStart + kTimeout));
+   EXPECT_EQ(1, table.Expire(kStart + kTimeout + 2, expiredReplies));
+   EXPECT_TRUE(table.Contains(Id(4)));
+   EXPECT_EQ(1, table.Expire(kStart + 2 * kTimeout, expiredReplies));
+   EXPECT_TRUE(table.empty());
+}
+
+TEST(RequestTable, ExpireAfterALongPause) {
+   RequestTable table(kTimeout);
+   for (uint64_t n = 0; n < 1000; ++n) {
+      ASSERT_TRUE(table.Insert(Id(n), kStart + static_cast<time_t>(n)));
+   }
+   size_t expiredReplies = 0;
+   EXPECT_EQ(1000, table.Expire(kStart + 100 * kTimeout, expiredReplies));
+   EXPECT_TRUE(table.empty());
+   ASSERT_TRUE(table.Insert(Id(1), kStart));
+   EXPECT_TRUE(table.Contains(Id(1)));
+}
+
+TEST(RequestTable, Swap) {
+   RequestTable first(kTimeout);
+   RequestTable second(kTimeout);
+   ASSERT_TRUE(first.Insert(Id(1), kStart));
+   first.swap(second);
+   EXPECT_TRUE(first.empty());
+   EXPECT_TRUE(second.Contains(Id(1)));
+   std::vector<std::string> ids;
+   second.ForEach([&ids](const RequestId& id, bool) {
+      ids.push_back(id.ToString());
+   });
+   ASSERT_EQ(1, ids.size());
+   EXPECT_EQ(Id(1).ToString(), ids[0]);
+}
@@ -11,7 +11,12 @@
 #include <q/spsc.hpp>
 #include <q/mpmc.hpp>
 #include <future>
+#include <chrono>
 #include <QueueNadoMacros.h>
+#include <Magazine.h>
+#include <StakeBundle.h>
+#include <ContextPool.h>
+#include <ShmRing.h>
 #include <limits>
 
 namespace {
@@ -57,6 +62,23 @@ class TestRifle : public Rifle {
    }
 };
 
+/**
+ * Counts the buffers FireZeroCopy hands back.
+ */
+class TestBufferPool {
+ public:
+
+   TestBufferPool() : mReleased(0) {
+   }
+
+   void Release(std::vector<uint8_t>&& buffer) {
+      mReleasedSize += buffer.size();
+      mReleased++;
+   }
+   std::atomic<int> mReleased;
+   std::atomic<size_t> mReleasedSize{0};
+};
+
 std::string RifleVampireTests::GetTcpLocation() {
    int max = 9000;
    int min = 7000;
@@ -66,6 +88,10 @@ std::string RifleVampireTests::GetTcpLocation() {
    return tcpLocation;
 }
 
+std::string RifleVampireTests::GetShmLocation() {
+   return "shm://RifleVampireTests" + std::to_string(getpid());
+}
+
 std::string RifleVampireTests::GetIpcLocation() {
    int pid = getpid();
    std::string ipcLocation("ipc:///tmp/");
@@ -617,6 +643,239 @@ void RifleVampireTests::NRiflesOneVampireBenchmark(int nRifles, int nIOThreads,
    EXPECT_TRUE(TimedSectionPassed());
 }
 
+/**
+ * Compare messages per second of Fire / GetShot against FireBatch / GetShots
+ * over the same socket pair.
+ * @param location
+ * @param dataSize
+ * @param nShots
+ * @param batchSize
+ */
+void RifleVampireTests::OneRifleOneVampireBatchBenchmark(std::string& location,
+      int dataSize, int nShots, size_t batchSize) {
+   const std::string exampleData(dataSize, 'a');
+   Rifle rifle(location);
+   rifle.SetHighWater(static_cast<int> (batchSize * 4));
+   Vampire vampire(location);
+   vampire.SetHighWater(static_cast<int> (batchSize * 4));
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   const size_t total = nShots;
+
+   auto start = std::chrono::steady_clock::now();
+   auto singleReceived = std::async(std::launch::async, [&]() {
+      size_t received = 0;
+      std::string bullet;
+      while (received < total && !zctx_interrupted && vampire.GetShot(bullet, kLongWaitTimeMs)) {
+         EXPECT_EQ(exampleData, bullet);
+         ++received;
+      }
+      return received;
+   });
+   size_t singleFired = 0;
+   while (singleFired < total && !zctx_interrupted && rifle.Fire(exampleData, kLongWaitTimeMs)) {
+      ++singleFired;
+   }
+   EXPECT_EQ(singleFired, singleReceived.get());
+   auto singleUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+   const std::vector<std::string> bullets(batchSize, exampleData);
+   start = std::chrono::steady_clock::now();
+   auto batchReceived = std::async(std::launch::async, [&]() {
+      size_t received = 0;
+      std::vector<std::string> wounds;
+      while (received < total && !zctx_interrupted) {
+         size_t shots = vampire.GetShots(wounds, batchSize, kLongWaitTimeMs);
+         if (shots == 0) {
+            break;
+         }
+         EXPECT_EQ(exampleData, wounds.back());
+         received += shots;
+      }
+      return received;
+   });
+   size_t batchFired = 0;
+   while (batchFired < total && !zctx_interrupted) {
+      size_t fired = rifle.FireBatch(bullets, kLongWaitTimeMs);
+      batchFired += fired;
+      if (fired < bullets.size()) {
+         break;
+      }
+   }
+   EXPECT_EQ(batchFired, batchReceived.get());
+   auto batchUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+   std::cout << "Single Fire/GetShot: " << singleFired << " msgs of " << dataSize << " bytes at "
+      << (singleFired * 1000000.0) / std::max<int64_t>(singleUs, 1) << " msgs/sec" << std::endl;
+   std::cout << "FireBatch/GetShots (" << batchSize << " per batch): " << batchFired << " msgs of "
+      << dataSize << " bytes at " << (batchFired * 1000000.0) / std::max<int64_t>(batchUs, 1)
+      << " msgs/sec" << std::endl;
+}
+
+/**
+ * Messages per second through Fire / GetShot, coalesced when byteBudget is
+ * not 0.
+ * @param location
+ * @param dataSize
+ * @param nShots
+ * @param byteBudget
+ * @param maxDelayUs
+ * @param context
+ *   A pool context for the Rifle, the Vampire then finds it over inproc
+ * @return 
+ */
+double RifleVampireTests::OneRifleOneVampireShotsPerSecond(std::string& location,
+      int dataSize, int nShots, size_t byteBudget, int maxDelayUs, zctx_t* context) {
+   const std::string exampleData(dataSize, 'a');
+   Rifle rifle(location, context);
+   rifle.SetHighWater(1000);
+   rifle.SetShmSlotSize(dataSize);
+   rifle.SetCoalescing(byteBudget, maxDelayUs);
+   Vampire vampire(location);
+   vampire.SetHighWater(1000);
+   vampire.SetShmSlotSize(dataSize);
+   EXPECT_TRUE(rifle.Aim());
+   EXPECT_TRUE(vampire.PrepareToBeShot());
+   const size_t total = nShots;
+
+   auto start = std::chrono::steady_clock::now();
+   auto received = std::async(std::launch::async, [&]() {
+      size_t count = 0;
+      std::string bullet;
+      while (count < total && !zctx_interrupted && vampire.GetShot(bullet, kLongWaitTimeMs)) {
+         ++count;
+      }
+      return count;
+   });
+   size_t fired = 0;
+   while (fired < total && !zctx_interrupted && rifle.Fire(exampleData, kLongWaitTimeMs)) {
+      ++fired;
+   }
+   EXPECT_TRUE(rifle.Flush(kLongWaitTimeMs));
+   EXPECT_EQ(fired, received.get());
+   auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+   return (fired * 1000000.0) / std::max<int64_t>(elapsedUs, 1);
+}
+
+/**
+ * Bounce a bullet off an echo thread and back, nRoundTrips times, one at a
+ * time so every trip pays the full latency of both legs.
+ * @param there
+ * @param back
+ * @param dataSize
+ * @param nRoundTrips
+ * @return the mean round trip in microseconds
+ */
+double RifleVampireTests::OneRifleOneVampireRoundTripUs(std::string& there, std::string& back,
+      int dataSize, int nRoundTrips) {
+   const std::string exampleData(dataSize, 'a');
+   Rifle rifle(there);
+   rifle.SetShmSlotSize(dataSize);
+   Vampire vampire(back);
+   vampire.SetShmSlotSize(dataSize);
+   EXPECT_TRUE(rifle.Aim());
+   auto echoed = std::async(std::launch::async, [&]() {
+      Vampire echoVampire(there);
+      echoVampire.SetShmSlotSize(dataSize);
+      Rifle echoRifle(back);
+      echoRifle.SetShmSlotSize(dataSize);
+      EXPECT_TRUE(echoVampire.PrepareToBeShot());
+      EXPECT_TRUE(echoRifle.Aim());
+      int count = 0;
+      std::string bullet;
+      while (count < nRoundTrips && !zctx_interrupted && echoVampire.GetShot(bullet, kLongWaitTimeMs)) {
+         EXPECT_TRUE(echoRifle.Fire(bullet, kLongWaitTimeMs));
+         ++count;
+      }
+      // the reply has to be read before the echo rifle goes away
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      return count;
+   });
+   EXPECT_TRUE(vampire.PrepareToBeShot());
+   std::string bullet;
+   // the first trip pays for connecting, it isn't timed
+   EXPECT_TRUE(rifle.Fire(exampleData, kLongWaitTimeMs));
+   EXPECT_TRUE(vampire.GetShot(bullet, kLongWaitTimeMs));
+   int trips = 1;
+   auto start = std::chrono::steady_clock::now();
+   for (; trips < nRoundTrips && !zctx_interrupted; ++trips) {
+      EXPECT_TRUE(rifle.Fire(exampleData, kLongWaitTimeMs));
+      EXPECT_TRUE(vampire.GetShot(bullet, kLongWaitTimeMs));
+   }
+   auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+   EXPECT_EQ(nRoundTrips, echoed.get());
+   return static_cast<double> (elapsedUs) / std::max(trips - 1, 1);
+}
+
+/**
+ * Compare bundles per second of SIZE_OF_STAKE_BUNDLE stakes received into a
+ * vector against reading them straight out of a StakeBundle.
+ * @param location
+ * @param nBundles
+ */
+void RifleVampireTests::OneRifleOneVampireStakeBundleBenchmark(std::string& location, int nBundles) {
+   std::string exampleString("stake");
+   std::vector<std::pair<void*, unsigned int> > exampleData;
+   for (int i = 0; i < SIZE_OF_STAKE_BUNDLE; i++) {
+      exampleData.push_back(make_pair(&exampleString, i));
+   }
+   Rifle rifle(location);
+   rifle.SetHighWater(1000);
+   Vampire vampire(location);
+   vampire.SetHighWater(1000);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   const int total = nBundles;
+
+   auto start = std::chrono::steady_clock::now();
+   auto vectorReceived = std::async(std::launch::async, [&]() {
+      int received = 0;
+      std::vector<std::pair<void*, unsigned int> > stakes;
+      while (received < total && !zctx_interrupted && vampire.GetStakes(stakes, kLongWaitTimeMs)) {
+         EXPECT_EQ(exampleData.back(), stakes.back());
+         ++received;
+      }
+      return received;
+   });
+   int vectorFired = 0;
+   while (vectorFired < total && !zctx_interrupted && rifle.FireStakes(exampleData, kLongWaitTimeMs)) {
+      ++vectorFired;
+   }
+   EXPECT_EQ(vectorFired, vectorReceived.get());
+   auto vectorUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+   start = std::chrono::steady_clock::now();
+   auto bundleReceived = std::async(std::launch::async, [&]() {
+      int received = 0;
+      StakeBundle stakes;
+      while (received < total && !zctx_interrupted && vampire.GetStakes(stakes, kLongWaitTimeMs)) {
+         EXPECT_EQ(exampleData.back().first, stakes.Pointer(stakes.size() - 1));
+         EXPECT_EQ(exampleData.back().second, stakes.Hash(stakes.size() - 1));
+         ++received;
+      }
+      return received;
+   });
+   int bundleFired = 0;
+   while (bundleFired < total && !zctx_interrupted && rifle.FireStakes(exampleData, kLongWaitTimeMs)) {
+      ++bundleFired;
+   }
+   EXPECT_EQ(bundleFired, bundleReceived.get());
+   auto bundleUs = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+   std::cout << SIZE_OF_STAKE_BUNDLE << " stakes per bundle, " << StakeBundle::EncodedSize(SIZE_OF_STAKE_BUNDLE)
+      << " bytes on the wire" << std::endl;
+   std::cout << "GetStakes into a vector: " << (vectorFired * 1000000.0) / std::max<int64_t>(vectorUs, 1)
+      << " bundles/sec" << std::endl;
+   std::cout << "GetStakes into a StakeBundle: " << (bundleFired * 1000000.0) / std::max<int64_t>(bundleUs, 1)
+      << " bundles/sec" << std::endl;
+}
+
 TEST_F(RifleVampireTests, ipcFilesCleanedOnNormalExitRifleOwner) {
    std::string target("ipc:///rifleVampireExit");
    std::string addressRealPath(target, target.find("ipc://") + 6);
@@ -698,6 +957,71 @@ TEST_F(RifleVampireTests, RifleOwnsSocketOneRifleOneVampireIPCSmallSize) {
 
 }
 
+TEST_F(RifleVampireTests, OneRifleOneVampireIPCSmallSizeBatch) {
+   if (geteuid() == 0) {
+      std::string location = GetIpcLocation();
+      int dataSize = 100;
+      int nShots = 1000000;
+      size_t batchSize = 500;
+      OneRifleOneVampireBatchBenchmark(location, dataSize, nShots, batchSize);
+   }
+}
+
+TEST_F(RifleVampireTests, OneRifleOneVampireIPCSmallSizeCoalesced) {
+   if (geteuid() == 0) {
+      std::string location = GetIpcLocation();
+      int dataSize = 64;
+      int nShots = 1000000;
+      double plain = OneRifleOneVampireShotsPerSecond(location, dataSize, nShots, 0, 0);
+      double coalesced = OneRifleOneVampireShotsPerSecond(location, dataSize, nShots, 64 * 1024, 100);
+      std::cout << dataSize << " byte bullets, plain: " << plain << " msgs/sec, coalesced (64KB, 100us): "
+         << coalesced << " msgs/sec" << std::endl;
+   }
+}
+
+TEST_F(RifleVampireTests, OneRifleOneVampireIPCVersusInproc) {
+   if (geteuid() == 0) {
+      zctx_t* context = ContextPool::Instance().GetContext();
+      const std::vector<int> dataSizes = {100, 350, 56554};
+      for (const int dataSize : dataSizes) {
+         std::string location = GetIpcLocation();
+         int nShots = (dataSize > 1000) ? 200000 : 1000000;
+         double ipc = OneRifleOneVampireShotsPerSecond(location, dataSize, nShots, 0, 0);
+         double inproc = OneRifleOneVampireShotsPerSecond(location, dataSize, nShots, 0, 0, context);
+         std::cout << dataSize << " byte bullets, ipc: " << ipc << " msgs/sec, inproc alias: "
+            << inproc << " msgs/sec" << std::endl;
+      }
+   }
+}
+
+TEST_F(RifleVampireTests, OneRifleOneVampireIPCVersusShm) {
+   if (geteuid() == 0) {
+      const std::vector<int> dataSizes = {100, 350, 56554};
+      for (const int dataSize : dataSizes) {
+         std::string ipcThere = GetIpcLocation();
+         std::string ipcBack = GetIpcLocation() + "back";
+         std::string shmThere = GetShmLocation();
+         std::string shmBack = GetShmLocation() + "back";
+         int nRoundTrips = 20000;
+         double ipc = OneRifleOneVampireRoundTripUs(ipcThere, ipcBack, dataSize, nRoundTrips);
+         double shm = OneRifleOneVampireRoundTripUs(shmThere, shmBack, dataSize, nRoundTrips);
+         int nShots = (dataSize > 1000) ? 200000 : 1000000;
+         double ipcRate = OneRifleOneVampireShotsPerSecond(ipcThere, dataSize, nShots, 0, 0);
+         double shmRate = OneRifleOneVampireShotsPerSecond(shmThere, dataSize, nShots, 0, 0);
+         std::cout << dataSize << " byte bullets, round trip ipc: " << ipc << " us, shm: " << shm
+            << " us; ipc: " << ipcRate << " msgs/sec, shm: " << shmRate << " msgs/sec" << std::endl;
+      }
+   }
+}
+
+TEST_F(RifleVampireTests, OneRifleOneVampireIPCStakeBundles) {
+   if (geteuid() == 0) {
+      std::string location = GetIpcLocation();
+      int nBundles = 100000;
+      OneRifleOneVampireStakeBundleBenchmark(location, nBundles);
+   }
+}
+
 #if 0
 /**
 *
@@ -1855,6 +2179,396 @@ TEST_F(RifleVampireTests, StopPreparingAlreadyAndJustGoPointer) {
 
 }
 
+TEST_F(RifleVampireTests, FireBatchAndGetShots) {
+   std::string location = GetIpcLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::vector<std::string> bullets;
+   for (int i = 0; i < 10; i++) {
+      bullets.push_back("bullet" + std::to_string(i));
+   }
+   EXPECT_EQ(bullets.size(), rifle.FireBatch(bullets));
+   std::vector<std::string> wounds;
+   size_t received = 0;
+   while (received < bullets.size() && !zctx_interrupted) {
+      std::vector<std::string> shots;
+      size_t count = vampire.GetShots(shots, 4, kWaitTimeMs);
+      ASSERT_LT(0, count);
+      ASSERT_GE(4, count);
+      ASSERT_EQ(count, shots.size());
+      wounds.insert(wounds.end(), shots.begin(), shots.end());
+      received += count;
+   }
+   EXPECT_EQ(bullets, wounds);
+   std::vector<std::string> shots(3, "stale");
+   EXPECT_EQ(0, vampire.GetShots(shots, 4, 1));
+   EXPECT_TRUE(shots.empty());
+}
+
+TEST_F(RifleVampireTests, FireBatchStopsAtBlank) {
+   std::string location = GetIpcLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::vector<std::string> bullets = {"one", "two", "", "four"};
+   EXPECT_EQ(2, rifle.FireBatch(bullets));
+   std::vector<std::string> wounds;
+   EXPECT_EQ(2, vampire.GetShots(wounds, 10, kWaitTimeMs));
+   ASSERT_EQ(2, wounds.size());
+   EXPECT_EQ("one", wounds[0]);
+   EXPECT_EQ("two", wounds[1]);
+   std::vector<std::string> none;
+   EXPECT_EQ(0, rifle.FireBatch(none));
+}
+
+TEST_F(RifleVampireTests, GetShotViewAndReusedWound) {
+   std::string location = GetIpcLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   const char* view = NULL;
+   size_t size = 0;
+   EXPECT_FALSE(vampire.GetShotView(view, size, 1));
+   EXPECT_EQ(NULL, view);
+   EXPECT_EQ(0, size);
+
+   std::string msg("a longer bullet that does not fit in a small string");
+   ASSERT_TRUE(rifle.Fire(msg));
+   ASSERT_TRUE(vampire.GetShotView(view, size, kWaitTimeMs));
+   EXPECT_EQ(msg, std::string(view, size));
+
+   std::string wound;
+   wound.reserve(msg.size() * 2);
+   const size_t capacity = wound.capacity();
+   ASSERT_TRUE(rifle.Fire(msg));
+   ASSERT_TRUE(vampire.GetShot(wound, kWaitTimeMs));
+   EXPECT_EQ(msg, wound);
+   std::string shorter("short");
+   ASSERT_TRUE(rifle.Fire(shorter));
+   ASSERT_TRUE(vampire.GetShot(wound, kWaitTimeMs));
+   EXPECT_EQ(shorter, wound);
+   EXPECT_EQ(capacity, wound.capacity());
+}
+
+TEST_F(RifleVampireTests, FireZeroCopyOwnedBuffers) {
+   std::string location = GetIpcLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::string bullet;
+
+   std::vector<uint8_t> bytes = {'a', 'b', 'c'};
+   EXPECT_TRUE(rifle.FireZeroCopy(std::move(bytes)));
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("abc", bullet);
+
+   // small enough to live inside the string, the data moves with it
+   std::string small("sso");
+   EXPECT_TRUE(rifle.FireZeroCopy(std::move(small)));
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("sso", bullet);
+
+   std::unique_ptr<uint8_t[]> array(new uint8_t[2]);
+   array[0] = 'h';
+   array[1] = 'i';
+   EXPECT_TRUE(rifle.FireZeroCopy(std::move(array), 2));
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("hi", bullet);
+
+   EXPECT_FALSE(rifle.FireZeroCopy(std::vector<uint8_t>()));
+}
+
+TEST_F(RifleVampireTests, FireZeroCopyReturnsBufferToPool) {
+   std::string location = GetIpcLocation();
+   TestBufferPool pool;
+   {
+      Rifle rifle(location);
+      ASSERT_TRUE(rifle.Aim());
+      //nobody to shoot, the buffer goes straight back
+      EXPECT_FALSE(rifle.FireZeroCopy(std::vector<uint8_t>(10, 'x'), pool, 1));
+      EXPECT_EQ(1, pool.mReleased);
+      EXPECT_EQ(10, pool.mReleasedSize);
+   }
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   EXPECT_TRUE(rifle.FireZeroCopy(std::vector<uint8_t>(20, 'y'), pool));
+   std::string bullet;
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ(std::string(20, 'y'), bullet);
+   for (int i = 0; i < 100 && pool.mReleased < 2; i++) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+   }
+   EXPECT_EQ(2, pool.mReleased);
+   EXPECT_EQ(30, pool.mReleasedSize);
+}
+
+TEST_F(RifleVampireTests, FireZeroCopyFromMagazine) {
+   std::string location = GetIpcLocation();
+   Magazine magazine(16, 1);
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   char* slot = magazine.Load();
+   ASSERT_TRUE(slot != NULL);
+   memcpy(slot, "magazine", 8);
+   EXPECT_TRUE(rifle.FireZeroCopy(magazine, slot, 8));
+   std::string bullet;
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("magazine", bullet);
+   slot = magazine.Load();
+   for (int i = 0; i < 100 && slot == NULL; i++) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+      slot = magazine.Load();
+   }
+   ASSERT_TRUE(slot != NULL);
+   //too big for the slot, it goes straight back
+   EXPECT_FALSE(rifle.FireZeroCopy(magazine, slot, 17));
+   EXPECT_TRUE(magazine.Load() != NULL);
+}
+
+TEST_F(RifleVampireTests, OptimisticFire) {
+   std::string location = GetIpcLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   EXPECT_FALSE(rifle.GetOptimisticFire());
+   rifle.SetOptimisticFire(true);
+   EXPECT_TRUE(rifle.GetOptimisticFire());
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::string msg("woo");
+   std::string bullet;
+   EXPECT_TRUE(rifle.Fire(msg));
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ(msg, bullet);
+   EXPECT_TRUE(rifle.FireStake(&msg));
+   void* stake = NULL;
+   ASSERT_TRUE(vampire.GetStake(stake, kWaitTimeMs));
+   EXPECT_EQ(&msg, stake);
+   std::vector<std::pair<void*, unsigned int> > bundle, gotBundle;
+   bundle.push_back(make_pair(&msg, 5));
+   EXPECT_TRUE(rifle.FireStakes(bundle));
+   ASSERT_TRUE(vampire.GetStakes(gotBundle, kWaitTimeMs));
+   EXPECT_EQ(bundle, gotBundle);
+}
+
+TEST_F(RifleVampireTests, OptimisticFireInTheDark) {
+   Rifle rifle(GetIpcLocation());
+   rifle.SetOptimisticFire(true);
+   rifle.Aim();
+   EXPECT_EQ(0, rifle.GetFireFallbacks());
+   std::string msg("Fire!");
+   //nobody to shoot, every send falls back to the poll and times out
+   EXPECT_FALSE(rifle.Fire(msg, 1));
+   EXPECT_EQ(1, rifle.GetFireFallbacks());
+   EXPECT_FALSE(rifle.FireStake(&msg, 1));
+   EXPECT_EQ(2, rifle.GetFireFallbacks());
+   std::vector<std::string> bullets(2, msg);
+   EXPECT_EQ(0, rifle.FireBatch(bullets, 1));
+   EXPECT_EQ(3, rifle.GetFireFallbacks());
+}
+
+TEST_F(RifleVampireTests, CoalescedBullets) {
+   std::string location = GetIpcLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   rifle.SetCoalescing(1024, 10 * 1000 * 1000);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   EXPECT_TRUE(rifle.Fire("one"));
+   EXPECT_TRUE(rifle.Fire("two"));
+   EXPECT_TRUE(rifle.Fire("three"));
+   std::string bullet;
+   //nothing goes out until the budget or deadline is hit
+   EXPECT_FALSE(vampire.GetShot(bullet, 1));
+   EXPECT_TRUE(rifle.Flush());
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("one", bullet);
+   std::vector<std::string> wounds;
+   EXPECT_EQ(2, vampire.GetShots(wounds, 10, kWaitTimeMs));
+   ASSERT_EQ(2, wounds.size());
+   EXPECT_EQ("two", wounds[0]);
+   EXPECT_EQ("three", wounds[1]);
+
+   // a stake flushes the coalesced bullets first to keep the order
+   EXPECT_TRUE(rifle.Fire("four"));
+   EXPECT_TRUE(rifle.FireStake(&bullet));
+   const char* view = NULL;
+   size_t size = 0;
+   ASSERT_TRUE(vampire.GetShotView(view, size, kWaitTimeMs));
+   EXPECT_EQ("four", std::string(view, size));
+   void* stake = NULL;
+   ASSERT_TRUE(vampire.GetStake(stake, kWaitTimeMs));
+   EXPECT_EQ(&bullet, stake);
+}
+
+TEST_F(RifleVampireTests, CoalescedBulletsFlushOnBudgetAndDeadline) {
+   std::string location = GetIpcLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::string bullet;
+   // two 10 byte bullets and their lengths are over the budget
+   rifle.SetCoalescing(20, 10 * 1000 * 1000);
+   EXPECT_TRUE(rifle.Fire("0123456789"));
+   EXPECT_FALSE(vampire.GetShot(bullet, 1));
+   EXPECT_TRUE(rifle.Fire("9876543210"));
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("0123456789", bullet);
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("9876543210", bullet);
+
+   rifle.SetCoalescing(1024, 1000);
+   EXPECT_TRUE(rifle.Fire("first"));
+   boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+   EXPECT_TRUE(rifle.Fire("late"));
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("first", bullet);
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("late", bullet);
+
+   // turning it off sends what is left
+   EXPECT_TRUE(rifle.Fire("left"));
+   rifle.SetCoalescing(0, 0);
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("left", bullet);
+   EXPECT_TRUE(rifle.Fire("plain"));
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("plain", bullet);
+}
+
+TEST_F(RifleVampireTests, CoalescedBulletsFireOnTheirDeadlineAlone) {
+   std::string location = GetIpcLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   rifle.SetCoalescing(1024, 1000);
+   // no more bullets and no Flush, the deadline still fires it
+   EXPECT_TRUE(rifle.Fire("quiet"));
+   std::string bullet;
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("quiet", bullet);
+}
+
+TEST_F(RifleVampireTests, CoalescedBulletsKeptWhenFlushFails) {
+   std::string location = GetIpcLocation();
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   rifle.SetCoalescing(1024, 10 * 1000 * 1000);
+   EXPECT_TRUE(rifle.Fire("kept"));
+   // nobody to send to yet
+   EXPECT_FALSE(rifle.Flush(1));
+   Vampire vampire(location);
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   EXPECT_TRUE(rifle.Flush(kWaitTimeMs));
+   std::string bullet;
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("kept", bullet);
+}
+
+TEST_F(RifleVampireTests, StakeBundleStraightFromTheFrame) {
+   std::string location = GetIpcLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   std::string msg("woo");
+   std::vector<std::pair<void*, unsigned int> > bundle;
+   for (unsigned int i = 0; i < SIZE_OF_STAKE_BUNDLE; i++) {
+      bundle.push_back(make_pair(&msg, i));
+   }
+   StakeBundle stakes;
+   EXPECT_FALSE(vampire.GetStakes(stakes, 1));
+   EXPECT_TRUE(stakes.empty());
+   EXPECT_TRUE(rifle.FireStakes(bundle));
+   ASSERT_TRUE(vampire.GetStakes(stakes, kWaitTimeMs));
+   ASSERT_EQ(bundle.size(), stakes.size());
+   for (size_t i = 0; i < bundle.size(); i++) {
+      EXPECT_EQ(bundle[i].first, stakes.Pointer(i));
+      EXPECT_EQ(bundle[i].second, stakes.Hash(i));
+   }
+   //a bullet is not a bundle
+   EXPECT_TRUE(rifle.Fire(std::string(StakeBundle::EncodedSize(1), 'x')));
+   EXPECT_FALSE(vampire.GetStakes(stakes, kWaitTimeMs));
+   EXPECT_TRUE(stakes.empty());
+}
+
+TEST_F(RifleVampireTests, ShmRingCarriesEveryKindOfShot) {
+   std::string location = GetShmLocation();
+   Vampire vampire(location);
+   Rifle rifle(location);
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   ASSERT_TRUE(rifle.Aim());
+   std::string bullet;
+   EXPECT_FALSE(vampire.GetShot(bullet, 1));
+   EXPECT_FALSE(rifle.Fire(bullet, 1));
+
+   ASSERT_TRUE(rifle.Fire("bullet"));
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("bullet", bullet);
+
+   std::vector<std::string> bullets = {"one", "two", "three"};
+   EXPECT_EQ(bullets.size(), rifle.FireBatch(bullets));
+   std::vector<std::string> wounds;
+   EXPECT_EQ(bullets.size(), vampire.GetShots(wounds, 10, kWaitTimeMs));
+   EXPECT_EQ(bullets, wounds);
+
+   std::string msg("woo");
+   ASSERT_TRUE(rifle.FireStake(&msg));
+   void* stake = NULL;
+   ASSERT_TRUE(vampire.GetStake(stake, kWaitTimeMs));
+   EXPECT_EQ(&msg, stake);
+
+   std::vector<std::pair<void*, unsigned int> > bundle = {{&msg, 1}, {&bullet, 2}};
+   ASSERT_TRUE(rifle.FireStakes(bundle));
+   std::vector<std::pair<void*, unsigned int> > stakes;
+   ASSERT_TRUE(vampire.GetStakes(stakes, kWaitTimeMs));
+   EXPECT_EQ(bundle, stakes);
+
+   std::unique_ptr<uint8_t[]> zero(new uint8_t[3]{'z', 'e', 'r'});
+   ASSERT_TRUE(rifle.FireZeroCopy(std::move(zero), 3));
+   const char* view = NULL;
+   size_t size = 0;
+   ASSERT_TRUE(vampire.GetShotView(view, size, kWaitTimeMs));
+   EXPECT_EQ("zer", std::string(view, size));
+
+   EXPECT_FALSE(rifle.Fire(std::string(ShmRing::kDefaultSlotSize + 1, 'x'), 1));
+   EXPECT_FALSE(vampire.GetShot(bullet, 1));
+}
+
+TEST_F(RifleVampireTests, ShmRingSlotSizeAndOwnership) {
+   std::string location = GetShmLocation();
+   Vampire vampire(location);
+   EXPECT_EQ(ShmRing::kDefaultSlotSize, vampire.GetShmSlotSize());
+   vampire.SetShmSlotSize(256 * 1024);
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   const std::string big(200 * 1024, 'b');
+   std::string bullet;
+   {
+      Rifle rifle(location);
+      ASSERT_TRUE(rifle.GetOwnSocket());
+      ASSERT_TRUE(rifle.Aim());
+      ASSERT_TRUE(rifle.Fire(big, kWaitTimeMs));
+   }
+   // the Rifle is gone, the ring and what it fired are still there
+   Rifle rifle(location);
+   ASSERT_TRUE(rifle.Aim());
+   ASSERT_TRUE(rifle.Fire("after", kWaitTimeMs));
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ(big, bullet);
+   ASSERT_TRUE(vampire.GetShot(bullet, kWaitTimeMs));
+   EXPECT_EQ("after", bullet);
+}
+
 TEST_F(RifleVampireTests, ShootBlank) {
    std::string location = GetIpcLocation();
    Vampire vampire(location);
@@ -1899,6 +2613,14 @@ TEST_F(RifleVampireTests, ShotInTheDark) {
    EXPECT_FALSE(rifle.Fire(msg, 10));
 }
 
+TEST_F(RifleVampireTests, BatchInTheDark) {
+   Rifle rifle(GetIpcLocation());
+   rifle.Aim();
+   std::vector<std::string> bullets(3, "Fire!");
+   //should fail without someone to shoot.
+   EXPECT_EQ(0, rifle.FireBatch(bullets, 10));
+}
+
 TEST_F(RifleVampireTests, StakeInTheDark) {
    Rifle rifle(GetIpcLocation());
    rifle.Aim();
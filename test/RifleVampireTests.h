@@ -22,6 +22,7 @@ public:
    static std::string GetTcpLocation();
    static std::string GetIpcLocation();
    static std::string GetInprocLocation();
+   static std::string GetShmLocation();
    void RifleThread(int numberOfMessages, std::string& location,
            std::string& exampleData, int hwm, int ioThreads, bool ownSocket);
    void ShootStakeThread(int numberOfMessages,
@@ -49,6 +50,13 @@ public:
    void NRiflesOneVampireBenchmark(int nRifles, int nIOThreads,
            int rifleHWM, int vampireHWM, std::string& location, int dataSize,
            int nShotsPerRifle, int expectedSpeed, int waitTimeMs);
+   void OneRifleOneVampireBatchBenchmark(std::string& location, int dataSize,
+           int nShots, size_t batchSize);
+   void OneRifleOneVampireStakeBundleBenchmark(std::string& location, int nBundles);
+   double OneRifleOneVampireShotsPerSecond(std::string& location, int dataSize,
+           int nShots, size_t byteBudget, int maxDelayUs, zctx_t* context = NULL);
+   double OneRifleOneVampireRoundTripUs(std::string& there, std::string& back,
+           int dataSize, int nRoundTrips);
    void NRiflesOneVampireBenchmarkZeroCopy(int nRifles, int nIOThreads,
            int rifleHWM, int vampireHWM, std::string& location, int dataSize,
            int nShotsPerRifle, int expectedSpeed, int waitTimeMs);
@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <czmq.h>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SharedBoomStick.h"
+#include "MockSkelleton.h"
+#ifdef QN_DEBUG
+namespace {
+   std::string GetIpcLocation(const std::string& name) {
+      return "ipc:///tmp/SharedBoomStickTests" + name + std::to_string(getpid()) + ".ipc";
+   }
+}
+
+TEST(SharedBoomStick, NotInitialized) {
+   SharedBoomStick stick(GetIpcLocation("NotInitialized"));
+   bool called = false;
+   stick.SendAsync("foo", [&called](const bool success, const std::string& reply) {
+      called = true;
+      EXPECT_FALSE(success);
+      EXPECT_FALSE(reply.empty());
+   });
+   EXPECT_TRUE(called);
+   EXPECT_EQ("", stick.Send("foo"));
+   EXPECT_THROW(stick.SendAsync("foo").get(), std::string);
+}
+
+TEST(SharedBoomStick, ManyThreadsOneSocket) {
+   const std::string location = GetIpcLocation("ManyThreads");
+   MockSkelleton target{location};
+   ASSERT_TRUE(target.Initialize());
+   target.BeginListenAndRepeat();
+   SharedBoomStick stick(location);
+   ASSERT_TRUE(stick.Initialize());
+
+   const int kThreads = 8;
+   const int kSends = 1000;
+   std::atomic<int> matched(0);
+   std::vector<std::thread> workers;
+   for (int t = 0; t < kThreads; ++t) {
+      workers.emplace_back([&stick, &matched, t, kSends]() {
+         for (int i = 0; i < kSends; ++i) {
+            const std::string command = std::to_string(t) + ":" + std::to_string(i);
+            if (stick.Send(command) == command + " reply") {
+               matched++;
+            }
+         }
+      });
+   }
+   for (auto& worker : workers) {
+      worker.join();
+   }
+   EXPECT_EQ(kThreads * kSends, matched.load());
+   auto counters = stick.Stats();
+   EXPECT_EQ(kThreads * kSends, counters.messagesSent);
+   EXPECT_EQ(kThreads * kSends, counters.messagesReceived);
+   EXPECT_EQ(0, counters.outstanding);
+   target.EndListendAndRepeat();
+}
+
+TEST(SharedBoomStick, FuturesAndCallbacks) {
+   const std::string location = GetIpcLocation("Futures");
+   MockSkelleton target{location};
+   ASSERT_TRUE(target.Initialize());
+   target.BeginListenAndRepeat();
+   SharedBoomStick stick(location);
+   ASSERT_TRUE(stick.Initialize());
+
+   const int kRequests = 500;
+   std::vector<std::future<std::string>> replies;
+   for (int i = 0; i < kRequests; ++i) {
+      replies.push_back(stick.SendAsync(std::to_string(i)));
+   }
+   std::atomic<int> called(0);
+   std::promise<void> allCalled;
+   for (int i = 0; i < kRequests; ++i) {
+      const std::string expected = std::to_string(i) + " reply";
+      stick.SendAsync(std::to_string(i), [&, expected](const bool success, const std::string& reply) {
+         EXPECT_TRUE(success);
+         EXPECT_EQ(expected, reply);
+         if (++called == kRequests) {
+            allCalled.set_value();
+         }
+      });
+   }
+   for (int i = 0; i < kRequests; ++i) {
+      EXPECT_EQ(std::to_string(i) + " reply", replies[i].get());
+   }
+   ASSERT_EQ(std::future_status::ready, allCalled.get_future().wait_for(std::chrono::seconds(10)));
+   target.EndListendAndRepeat();
+}
+
+TEST(SharedBoomStick, TimesOutWithoutAServer) {
+   SharedBoomStick stick(GetIpcLocation("NoServer"));
+   stick.SetReplyTimeout(1);
+   ASSERT_TRUE(stick.Initialize());
+   std::future<std::string> reply = stick.SendAsync("foo");
+   ASSERT_EQ(std::future_status::ready, reply.wait_for(std::chrono::seconds(5)));
+   EXPECT_THROW(reply.get(), std::string);
+   EXPECT_EQ(1, stick.Stats().receiveTimeouts);
+}
+
+TEST(SharedBoomStick, WindowFullFailsAtOnce) {
+   SharedBoomStick stick(GetIpcLocation("WindowFull"));
+   stick.SetWindow(1);
+   ASSERT_TRUE(stick.Initialize());
+   std::future<std::string> first = stick.SendAsync("foo");
+   std::future<std::string> second = stick.SendAsync("bar");
+   ASSERT_EQ(std::future_status::ready, second.wait_for(std::chrono::seconds(0)));
+   EXPECT_THROW(second.get(), std::string);
+   const auto counters = stick.Stats();
+   EXPECT_EQ(1, counters.windowSize);
+   EXPECT_EQ(1, counters.windowFull);
+   EXPECT_EQ(std::future_status::timeout, first.wait_for(std::chrono::seconds(0)));
+}
+
+TEST(SharedBoomStick, WindowBlocksManyThreads) {
+   const std::string location = GetIpcLocation("WindowBlocks");
+   MockSkelleton target{location};
+   ASSERT_TRUE(target.Initialize());
+   target.BeginListenAndRepeat();
+   SharedBoomStick stick(location);
+   stick.SetWindow(4, 10000);
+   ASSERT_TRUE(stick.Initialize());
+
+   const int kThreads = 8;
+   const int kSends = 250;
+   std::atomic<int> matched(0);
+   std::vector<std::thread> workers;
+   for (int t = 0; t < kThreads; ++t) {
+      workers.emplace_back([&stick, &matched, t, kSends]() {
+         std::vector<std::future<std::string>> replies;
+         for (int i = 0; i < kSends; ++i) {
+            replies.push_back(stick.SendAsync(std::to_string(t) + ":" + std::to_string(i)));
+         }
+         for (int i = 0; i < kSends; ++i) {
+            if (replies[i].get() == std::to_string(t) + ":" + std::to_string(i) + " reply") {
+               matched++;
+            }
+         }
+      });
+   }
+   for (auto& worker : workers) {
+      worker.join();
+   }
+   EXPECT_EQ(kThreads * kSends, matched.load());
+   EXPECT_LT(0, stick.Stats().windowFull);
+   target.EndListendAndRepeat();
+}
+
+TEST(SharedBoomStick, InterruptedSendsNeverHang) {
+   SharedBoomStick stick(GetIpcLocation("Interrupted"));
+   ASSERT_TRUE(stick.Initialize());
+   std::atomic<bool> stop(false);
+   std::vector<std::future<std::vector<std::future<std::string>>>> workers;
+   for (int t = 0; t < 4; ++t) {
+      workers.push_back(std::async(std::launch::async, [&stick, &stop]() {
+         std::vector<std::future<std::string>> replies;
+         while (!stop.load()) {
+            replies.push_back(stick.SendAsync("foo"));
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+         }
+         return replies;
+      }));
+   }
+   std::this_thread::sleep_for(std::chrono::milliseconds(50));
+   // the I/O thread stops while the workers keep sending
+   zctx_interrupted = true;
+   std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+   stop.store(true);
+   for (auto& worker : workers) {
+      for (auto& reply : worker.get()) {
+         ASSERT_EQ(std::future_status::ready, reply.wait_for(std::chrono::seconds(5)));
+         EXPECT_THROW(reply.get(), std::string);
+      }
+   }
+   zctx_interrupted = false;
+}
+
+TEST(SharedBoomStick, ShutDownFailsWhatIsWaiting) {
+   std::future<std::string> reply;
+   {
+      SharedBoomStick stick(GetIpcLocation("ShutDown"));
+      ASSERT_TRUE(stick.Initialize());
+      reply = stick.SendAsync("foo");
+   }
+   ASSERT_EQ(std::future_status::ready, reply.wait_for(std::chrono::seconds(0)));
+   EXPECT_THROW(reply.get(), std::string);
+}
+
+TEST(SharedBoomStick, FailedCallbackCanSendAgain) {
+   SharedBoomStick stick(GetIpcLocation("SendAgain"));
+   ASSERT_TRUE(stick.Initialize());
+   zctx_interrupted = true;
+   std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+   // a callback that retries on failure submits again from inside the drain
+   std::atomic<int> failures(0);
+   auto retried = std::async(std::launch::async, [&stick, &failures]() {
+      stick.SendAsync("foo", [&stick, &failures](const bool success, const std::string&) {
+         EXPECT_FALSE(success);
+         ++failures;
+         stick.SendAsync("foo", [&failures](const bool success, const std::string&) {
+            EXPECT_FALSE(success);
+            ++failures;
+         });
+      });
+   });
+   ASSERT_EQ(std::future_status::ready, retried.wait_for(std::chrono::seconds(5)));
+   EXPECT_EQ(2, failures.load());
+   zctx_interrupted = false;
+}
+#endif
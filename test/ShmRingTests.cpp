@@ -0,0 +1,273 @@
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ShmRing.h"
+
+namespace {
+   const int kWaitTimeMs = 1000;
+
+   std::string GetShmLocation(const std::string& name) {
+      return ShmRing::kShm + "ShmRingTests" + name + std::to_string(getpid());
+   }
+}
+
+TEST(ShmRing, Location) {
+   EXPECT_TRUE(ShmRing::IsShm("shm://name"));
+   EXPECT_FALSE(ShmRing::IsShm("ipc:///tmp/name"));
+   ShmRing ring("shm://name");
+   EXPECT_EQ("/QueueNado.name", ring.GetName());
+}
+
+TEST(ShmRing, PushAndPeek) {
+   ShmRing consumer(GetShmLocation("PushAndPeek"));
+   ASSERT_TRUE(consumer.Attach(3, 128, true));
+   EXPECT_EQ(4, consumer.GetSlotCount());
+   EXPECT_EQ(128, consumer.GetSlotSize());
+   ShmRing producer(GetShmLocation("PushAndPeek"));
+   ASSERT_TRUE(producer.Attach(100, 1, false));
+   EXPECT_EQ(4, producer.GetSlotCount());
+
+   const char* data = NULL;
+   size_t size = 0;
+   EXPECT_FALSE(consumer.Peek(data, size, 0));
+   EXPECT_FALSE(producer.Push(std::string(129, 'a').data(), 129, 0));
+   for (int lap = 0; lap < 3; ++lap) {
+      for (int i = 0; i < 4; ++i) {
+         const std::string message = std::to_string(lap) + ":" + std::to_string(i);
+         ASSERT_TRUE(producer.Push(message.data(), message.size(), 0));
+      }
+      EXPECT_FALSE(producer.Push("full", 4, 1));
+      for (int i = 0; i < 4; ++i) {
+         ASSERT_TRUE(consumer.Peek(data, size, 0));
+         EXPECT_EQ(std::to_string(lap) + ":" + std::to_string(i), std::string(data, size));
+      }
+      consumer.Release();
+      EXPECT_FALSE(consumer.Peek(data, size, 0));
+   }
+}
+
+TEST(ShmRing, ManyProducers) {
+   const std::string location = GetShmLocation("ManyProducers");
+   ShmRing consumer(location);
+   ASSERT_TRUE(consumer.Attach(64, 64, true));
+   const int kProducers = 4;
+   const int kMessages = 50000;
+   std::vector<std::thread> producers;
+   for (int p = 0; p < kProducers; ++p) {
+      producers.emplace_back([&location, p]() {
+         ShmRing producer(location);
+         ASSERT_TRUE(producer.Attach(0, 0, false));
+         for (int i = 0; i < kMessages; ++i) {
+            const int message[2] = {p, i};
+            ASSERT_TRUE(producer.Push(message, sizeof (message), kWaitTimeMs));
+         }
+      });
+   }
+   std::vector<int> next(kProducers, 0);
+   const char* data = NULL;
+   size_t size = 0;
+   for (int count = 0; count < kProducers * kMessages; ++count) {
+      ASSERT_TRUE(consumer.Peek(data, size, kWaitTimeMs));
+      ASSERT_EQ(2 * sizeof (int), size);
+      const int* message = reinterpret_cast<const int*> (data);
+      // each producer's messages stay in order
+      EXPECT_EQ(next[message[0]]++, message[1]);
+   }
+   for (auto& producer : producers) {
+      producer.join();
+   }
+   EXPECT_FALSE(consumer.Peek(data, size, 0));
+}
+
+TEST(ShmRing, WakesSleepingConsumerOnce) {
+   const std::string location = GetShmLocation("Wakeups");
+   ShmRing consumer(location);
+   ASSERT_TRUE(consumer.Attach(1024, 64, true));
+   ShmRing producer(location);
+   ASSERT_TRUE(producer.Attach(0, 0, false));
+   auto received = std::async(std::launch::async, [&consumer]() {
+      const char* data = NULL;
+      size_t size = 0;
+      return consumer.Peek(data, size, 5 * kWaitTimeMs);
+   });
+   std::this_thread::sleep_for(std::chrono::milliseconds(100));
+   for (int i = 0; i < 100; ++i) {
+      ASSERT_TRUE(producer.Push("wake", 4, 0));
+   }
+   EXPECT_TRUE(received.get());
+   // only the push that found the consumer asleep paid for a wake up
+   EXPECT_EQ(1, producer.GetWakeups());
+}
+
+TEST(ShmRing, AcrossProcesses) {
+   const std::string location = GetShmLocation("Processes");
+   ShmRing consumer(location);
+   ASSERT_TRUE(consumer.Attach(256, 64, true));
+   const int kMessages = 100000;
+   pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      ShmRing producer(location);
+      if (!producer.Attach(0, 0, false)) {
+         _exit(1);
+      }
+      for (int i = 0; i < kMessages; ++i) {
+         if (!producer.Push(&i, sizeof (i), kWaitTimeMs)) {
+            _exit(2);
+         }
+      }
+      _exit(0);
+   }
+   const char* data = NULL;
+   size_t size = 0;
+   for (int i = 0; i < kMessages; ++i) {
+      ASSERT_TRUE(consumer.Peek(data, size, kWaitTimeMs));
+      ASSERT_EQ(sizeof (int), size);
+      EXPECT_EQ(i, *reinterpret_cast<const int*> (data));
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   EXPECT_TRUE(WIFEXITED(status));
+   EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST(ShmRing, OwnerRemovesName) {
+   const std::string location = GetShmLocation("Owner");
+   {
+      ShmRing owner(location);
+      ASSERT_TRUE(owner.Attach(4, 64, true));
+      EXPECT_EQ(0, access(("/dev/shm" + owner.GetName()).c_str(), F_OK));
+   }
+   ShmRing ring(location);
+   EXPECT_NE(0, access(("/dev/shm" + ring.GetName()).c_str(), F_OK));
+}
+
+TEST(ShmRing, OnlyTheConsumerRemovesName) {
+   const std::string location = GetShmLocation("OnlyConsumer");
+   ShmRing consumer(location);
+   ASSERT_TRUE(consumer.Attach(4, 64, true));
+   {
+      ShmRing producer(location);
+      ASSERT_TRUE(producer.Attach(0, 0, false));
+      ASSERT_TRUE(producer.Push("left", 4, 0));
+   }
+   EXPECT_EQ(0, access(("/dev/shm" + consumer.GetName()).c_str(), F_OK));
+   const char* data = NULL;
+   size_t size = 0;
+   ASSERT_TRUE(consumer.Peek(data, size, 0));
+   EXPECT_EQ("left", std::string(data, size));
+}
+
+TEST(ShmRing, OneConsumerAtATime) {
+   const std::string location = GetShmLocation("OneConsumer");
+   ShmRing consumer(location);
+   ASSERT_TRUE(consumer.Attach(4, 64, true));
+   ShmRing second(location);
+   EXPECT_FALSE(second.Attach(4, 64, true));
+   EXPECT_EQ(0, access(("/dev/shm" + consumer.GetName()).c_str(), F_OK));
+}
+
+TEST(ShmRing, ProducerFollowsTheConsumerToANewRing) {
+   const std::string location = GetShmLocation("Follows");
+   ShmRing producer(location);
+   {
+      ShmRing consumer(location);
+      ASSERT_TRUE(consumer.Attach(4, 64, true));
+      ASSERT_TRUE(producer.Attach(0, 0, false));
+   }
+   ShmRing consumer(location);
+   ASSERT_TRUE(consumer.Attach(4, 64, true));
+   ASSERT_TRUE(producer.Push("moved", 5, 0));
+   const char* data = NULL;
+   size_t size = 0;
+   ASSERT_TRUE(consumer.Peek(data, size, kWaitTimeMs));
+   EXPECT_EQ("moved", std::string(data, size));
+}
+
+TEST(ShmRing, StartsOverWhenTheConsumerDied) {
+   const std::string location = GetShmLocation("ConsumerDied");
+   ShmRing producer(location);
+   ASSERT_TRUE(producer.Attach(4, 64, false));
+   pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      // dies without closing, the segment keeps its pid
+      ShmRing consumer(location);
+      _exit(consumer.Attach(4, 64, true) ? 0 : 1);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   ASSERT_EQ(0, WEXITSTATUS(status));
+   ASSERT_TRUE(producer.Push("stale", 5, 0));
+
+   ShmRing consumer(location);
+   ASSERT_TRUE(consumer.Attach(4, 64, true));
+   const char* data = NULL;
+   size_t size = 0;
+   EXPECT_FALSE(consumer.Peek(data, size, 0));
+   ASSERT_TRUE(producer.Push("fresh", 5, 0));
+   ASSERT_TRUE(consumer.Peek(data, size, kWaitTimeMs));
+   EXPECT_EQ("fresh", std::string(data, size));
+}
+
+TEST(ShmRing, SkipsAClaimAbandonedByADeadProducer) {
+   const std::string location = GetShmLocation("ProducerDied");
+   ShmRing consumer(location);
+   ASSERT_TRUE(consumer.Attach(4, 64, true));
+   pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0) {
+      // dies copying the message, after claiming its slot
+      ShmRing producer(location);
+      if (!producer.Attach(0, 0, false)) {
+         _exit(3);
+      }
+      void* unreadable = mmap(NULL, 64, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      producer.Push(unreadable, 64, 0);
+      _exit(0);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   ASSERT_FALSE(WIFEXITED(status) && WEXITSTATUS(status) == 3);
+
+   ShmRing producer(location);
+   ASSERT_TRUE(producer.Attach(0, 0, false));
+   ASSERT_TRUE(producer.Push("after", 5, 0));
+   const char* data = NULL;
+   size_t size = 0;
+   ASSERT_TRUE(consumer.Peek(data, size, 3 * ShmRing::kAbandonedMs));
+   EXPECT_EQ("after", std::string(data, size));
+}
+
+TEST(ShmRing, ProducerParksOnAFullRing) {
+   const std::string location = GetShmLocation("Parks");
+   ShmRing consumer(location);
+   ASSERT_TRUE(consumer.Attach(2, 64, true));
+   ShmRing producer(location);
+   ASSERT_TRUE(producer.Attach(0, 0, false));
+   ASSERT_TRUE(producer.Push("one", 3, 0));
+   ASSERT_TRUE(producer.Push("two", 3, 0));
+   auto pushed = std::async(std::launch::async, [&producer]() {
+      return producer.Push("three", 5, 5 * kWaitTimeMs);
+   });
+   std::this_thread::sleep_for(std::chrono::milliseconds(50));
+   const char* data = NULL;
+   size_t size = 0;
+   ASSERT_TRUE(consumer.Peek(data, size, 0));
+   consumer.Release();
+   const auto released = std::chrono::steady_clock::now();
+   // woken by the release, not by its deadline
+   ASSERT_EQ(std::future_status::ready, pushed.wait_for(std::chrono::milliseconds(kWaitTimeMs)));
+   EXPECT_TRUE(pushed.get());
+   EXPECT_LT(std::chrono::steady_clock::now() - released, std::chrono::milliseconds(kWaitTimeMs));
+   ASSERT_TRUE(consumer.Peek(data, size, 0));
+   EXPECT_EQ("two", std::string(data, size));
+   ASSERT_TRUE(consumer.Peek(data, size, 0));
+   EXPECT_EQ("three", std::string(data, size));
+}
@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <chrono>
+#include <future>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <q/spsc.hpp>
+#include "QAPI.h"
+#include "QueuePump.h"
+#include "SocketQueue.h"
+#include "Vampire.h"
+
+namespace {
+   const size_t kQueueSize = 100;
+   const int kWaitTimeMs = 1000;
+
+   std::string GetIpcLocation(const std::string& name) {
+      return "ipc:///tmp/SocketQueueTests" + name + std::to_string(getpid()) + ".ipc";
+   }
+
+   // The same call sites, whatever carries the queue
+   template <typename Queue>
+   void PushAndPop(Queue queue, const size_t howMany) {
+      auto producer = std::get<QAPI::index::sender>(queue);
+      auto consumer = std::get<QAPI::index::receiver>(queue);
+      auto received = std::async(std::launch::async, [&consumer, howMany]() {
+         std::vector<std::string> values;
+         std::string value;
+         while (values.size() < howMany && consumer.wait_and_pop(value, std::chrono::milliseconds(kWaitTimeMs))) {
+            values.push_back(value);
+         }
+         return values;
+      });
+      for (size_t i = 0; i < howMany; ++i) {
+         std::string value = std::to_string(i);
+         while (!producer.push(value)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+         }
+      }
+      auto values = received.get();
+      ASSERT_EQ(howMany, values.size());
+      for (size_t i = 0; i < howMany; ++i) {
+         EXPECT_EQ(std::to_string(i), values[i]);
+      }
+   }
+}
+
+TEST(SocketQueue, IsATypeChangeAwayFromSpsc) {
+   PushAndPop(QAPI::CreateQueue<spsc::flexible::circular_fifo<std::string>>(kQueueSize), 10000);
+   PushAndPop(QAPI::CreateQueue<SocketQueue>(GetIpcLocation("TypeChange"), kQueueSize), 10000);
+}
+
+TEST(SocketQueue, BaseAPI) {
+   auto queue = QAPI::CreateQueue<SocketQueue>(GetIpcLocation("BaseAPI"), kQueueSize);
+   auto producer = std::get<QAPI::index::sender>(queue);
+   auto consumer = std::get<QAPI::index::receiver>(queue);
+   EXPECT_EQ(kQueueSize, producer.capacity());
+   EXPECT_TRUE(producer.empty());
+   std::string received;
+   EXPECT_FALSE(consumer.pop(received));
+   EXPECT_FALSE(consumer.wait_and_pop(received, std::chrono::milliseconds(10)));
+
+   std::string value = "value";
+   while (!producer.push(value)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   EXPECT_EQ("value", value);
+   EXPECT_EQ(1, producer.size());
+   EXPECT_EQ(kQueueSize - 1, producer.capacity_free());
+   ASSERT_TRUE(consumer.wait_and_pop(received, std::chrono::milliseconds(kWaitTimeMs)));
+   EXPECT_EQ("value", received);
+   EXPECT_TRUE(consumer.empty());
+   std::string empty;
+   EXPECT_FALSE(producer.push(empty));
+}
+
+TEST(SocketQueue, BulkTransfer) {
+   auto queue = QAPI::CreateQueue<SocketQueue>(GetIpcLocation("Bulk"), kQueueSize);
+   auto producer = std::get<QAPI::index::sender>(queue);
+   auto consumer = std::get<QAPI::index::receiver>(queue);
+   std::string received;
+   // connect the Vampire first, the Rifle can't send before someone is there
+   EXPECT_FALSE(consumer.pop(received));
+   std::vector<std::string> values;
+   for (size_t i = 0; i < 10; ++i) {
+      values.push_back(std::to_string(i));
+   }
+   size_t pushed = 0;
+   for (int tries = 0; pushed < values.size() && tries < kWaitTimeMs; ++tries) {
+      pushed += producer.push_bulk(values.begin() + pushed, values.end());
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+   }
+   ASSERT_EQ(values.size(), pushed);
+   std::vector<std::string> all;
+   for (int tries = 0; all.size() < values.size() && tries < kWaitTimeMs; ++tries) {
+      if (0 == consumer.pop_bulk(std::back_inserter(all), values.size())) {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+   }
+   EXPECT_EQ(values, all);
+}
+
+TEST(SocketQueue, PumpDrainsLocalQueueIntoRifle) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   const std::string location = GetIpcLocation("Pump");
+   const size_t kMessages = 100000;
+   auto queue = QAPI::CreateQueue<QType>(kQueueSize);
+   auto producer = std::get<QAPI::index::sender>(queue);
+   Rifle rifle(location);
+   Vampire vampire(location);
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   QueuePump<QType> pump(std::get<QAPI::index::receiver>(queue), rifle, 64);
+   ASSERT_TRUE(pump.Start());
+
+   auto received = std::async(std::launch::async, [&vampire, kMessages]() {
+      size_t count = 0;
+      std::string shot;
+      while (count < kMessages && vampire.GetShot(shot, kWaitTimeMs)) {
+         EXPECT_EQ(std::to_string(count), shot);
+         ++count;
+      }
+      return count;
+   });
+   auto t1 = std::chrono::steady_clock::now();
+   for (size_t i = 0; i < kMessages; ++i) {
+      std::string value = std::to_string(i);
+      while (!producer.push(value)) {
+         std::this_thread::yield();
+      }
+   }
+   EXPECT_EQ(kMessages, received.get());
+   auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t1).count();
+   std::cout << "Pumped " << kMessages << " messages in " << us << " us" << std::endl;
+   pump.Stop();
+   EXPECT_EQ(kMessages, pump.GetPumped());
+}
+
+TEST(SocketQueue, PumpSendsWhatIsLeftOnStop) {
+   using QType = spsc::flexible::circular_fifo<std::string>;
+   const std::string location = GetIpcLocation("PumpStop");
+   auto queue = QAPI::CreateQueue<QType>(kQueueSize);
+   auto producer = std::get<QAPI::index::sender>(queue);
+   Rifle rifle(location);
+   Vampire vampire(location);
+   ASSERT_TRUE(vampire.PrepareToBeShot());
+   {
+      QueuePump<QType> pump(std::get<QAPI::index::receiver>(queue), rifle);
+      ASSERT_TRUE(pump.Start());
+      for (size_t i = 0; i < 50; ++i) {
+         std::string value = std::to_string(i);
+         ASSERT_TRUE(producer.push(value));
+      }
+   }
+   EXPECT_TRUE(producer.empty());
+   std::vector<std::string> shots;
+   size_t count = 0;
+   while (count < 50 && vampire.GetShots(shots, 50, kWaitTimeMs) > 0) {
+      for (const auto& shot : shots) {
+         EXPECT_EQ(std::to_string(count++), shot);
+      }
+   }
+   EXPECT_EQ(50, count);
+}
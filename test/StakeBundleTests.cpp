@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "StakeBundle.h"
+
+TEST(StakeBundle, PackedWithoutPadding) {
+   EXPECT_EQ(8, StakeBundle::EncodedSize(0));
+   EXPECT_EQ(8 + 12, StakeBundle::EncodedSize(1));
+   EXPECT_EQ(8 + (12 * 500), StakeBundle::EncodedSize(500));
+   EXPECT_LT(StakeBundle::EncodedSize(500), 500 * sizeof (std::pair<void*, unsigned int>));
+}
+
+TEST(StakeBundle, EncodeDecode) {
+   std::string a("a");
+   std::string b("b");
+   StakeBundle::Stakes stakes = {{&a, 1}, {&b, 0xffffffff}, {NULL, 3}};
+   std::vector<char> frame(StakeBundle::EncodedSize(stakes.size()));
+   StakeBundle::Encode(stakes, frame.data());
+   StakeBundle::Stakes decoded = {{&a, 7}};
+   ASSERT_TRUE(StakeBundle::Decode(frame.data(), frame.size(), decoded));
+   EXPECT_EQ(stakes, decoded);
+}
+
+TEST(StakeBundle, DecodeRejectsOtherFrames) {
+   std::string a("a");
+   StakeBundle::Stakes stakes = {{&a, 1}, {&a, 2}};
+   std::vector<char> frame(StakeBundle::EncodedSize(stakes.size()));
+   StakeBundle::Encode(stakes, frame.data());
+   StakeBundle::Stakes decoded;
+   EXPECT_FALSE(StakeBundle::Decode(frame.data(), frame.size() - 1, decoded));
+   EXPECT_TRUE(decoded.empty());
+   EXPECT_FALSE(StakeBundle::Decode(frame.data(), 4, decoded));
+   frame[0] ^= 0xff;
+   EXPECT_FALSE(StakeBundle::Decode(frame.data(), frame.size(), decoded));
+   std::string bullet(StakeBundle::EncodedSize(1), 'x');
+   EXPECT_FALSE(StakeBundle::Decode(bullet.data(), bullet.size(), decoded));
+}
@@ -0,0 +1,192 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <q/mpmc.hpp>
+#include "WorkStealingQueue.h"
+
+namespace {
+   using Clock = std::chrono::steady_clock;
+   const size_t kLanes = 4;
+
+   struct Job {
+      size_t id;
+      std::chrono::microseconds cost;
+      Clock::time_point queued;
+   };
+
+   void Work(const Job& job) {
+      const auto done = Clock::now() + job.cost;
+      while (Clock::now() < done) {
+      }
+   }
+
+   // Every kLanes-th job is expensive, so round robin puts all of them on one lane
+   std::vector<Job> SkewedJobs(const size_t howMany) {
+      std::vector<Job> jobs;
+      for (size_t i = 0; i < howMany; ++i) {
+         jobs.push_back({i, std::chrono::microseconds((i % kLanes == 0) ? 200 : 5), Clock::time_point()});
+      }
+      return jobs;
+   }
+
+   void Report(const std::string& name, std::vector<int64_t>& latenciesUs) {
+      std::sort(latenciesUs.begin(), latenciesUs.end());
+      auto at = [&latenciesUs](const double percentile) {
+         return latenciesUs[std::min(latenciesUs.size() - 1, size_t(percentile * latenciesUs.size()))];
+      };
+      std::cout << name << " latency us, p50: " << at(0.5) << ", p99: " << at(0.99)
+                << ", max: " << latenciesUs.back() << std::endl;
+   }
+
+   // Queue all jobs at once and let kLanes workers run them,
+   // pop(worker, job) is how a worker gets its next job
+   template <typename Pop, typename Push>
+   std::vector<int64_t> RunSkewed(Push push, Pop pop, const size_t howMany) {
+      std::vector<std::vector<int64_t>> latencies(kLanes);
+      std::atomic<size_t> done{0};
+      std::vector<std::thread> workers;
+      for (size_t worker = 0; worker < kLanes; ++worker) {
+         workers.emplace_back([&, worker]() {
+            Job job;
+            while (done.load() < howMany) {
+               if (pop(worker, job)) {
+                  Work(job);
+                  latencies[worker].push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                          Clock::now() - job.queued).count());
+                  done++;
+               }
+            }
+         });
+      }
+      for (auto& job : SkewedJobs(howMany)) {
+         job.queued = Clock::now();
+         while (!push(job)) {
+            std::this_thread::yield();
+         }
+      }
+      for (auto& worker : workers) {
+         worker.join();
+      }
+      std::vector<int64_t> all;
+      for (auto& worker : latencies) {
+         all.insert(all.end(), worker.begin(), worker.end());
+      }
+      return all;
+   }
+}
+
+TEST(WorkStealingQueue, RoundRobinAndOwnLaneFirst) {
+   QAPI::WorkStealingQueue<int> queue(2, 10);
+   EXPECT_EQ(2, queue.lanes());
+   EXPECT_EQ(20, queue.capacity());
+   EXPECT_TRUE(queue.empty());
+   for (int i = 0; i < 4; ++i) {
+      ASSERT_TRUE(queue.push(i));
+   }
+   EXPECT_EQ(2, queue.size(0));
+   EXPECT_EQ(2, queue.size(1));
+   int value = -1;
+   ASSERT_TRUE(queue.pop(0, value));
+   EXPECT_EQ(0, value);
+   ASSERT_TRUE(queue.pop(0, value));
+   EXPECT_EQ(2, value);
+   ASSERT_TRUE(queue.pop(1, value));
+   EXPECT_EQ(1, value);
+   EXPECT_EQ(0, queue.GetSteals());
+}
+
+TEST(WorkStealingQueue, IdleWorkerStealsHalfFromTheTail) {
+   QAPI::WorkStealingQueue<int> queue(3, 100);
+   for (int i = 0; i < 10; ++i) {
+      ASSERT_TRUE(queue.push(i, 0));
+   }
+   int other = 10;
+   ASSERT_TRUE(queue.push(other, 1));
+   int value = -1;
+   ASSERT_TRUE(queue.pop(2, value));
+   EXPECT_EQ(1, queue.GetSteals());
+   // the newest half of the longest lane, oldest of them first
+   EXPECT_EQ(5, value);
+   EXPECT_EQ(5, queue.size(0));
+   EXPECT_EQ(4, queue.size(2));
+   ASSERT_TRUE(queue.pop(0, value));
+   EXPECT_EQ(0, value);
+}
+
+TEST(WorkStealingQueue, FullLaneSpillsOverAndNoStealingWhenOff) {
+   QAPI::WorkStealingQueue<int> queue(2, 1);
+   int value = 1;
+   ASSERT_TRUE(queue.push(value, 0));
+   EXPECT_FALSE(queue.push(value, 0));
+   EXPECT_TRUE(queue.push(value));
+   EXPECT_FALSE(queue.push(value));
+
+   queue.SetStealing(false);
+   ASSERT_TRUE(queue.pop(1, value));
+   EXPECT_FALSE(queue.pop(1, value));
+   queue.SetStealing(true);
+   EXPECT_TRUE(queue.pop(1, value));
+   EXPECT_EQ(1, queue.GetSteals());
+}
+
+TEST(WorkStealingQueue, WaitAndPopWakesOnPush) {
+   QAPI::WorkStealingQueue<int> queue(2, 10);
+   int value = 0;
+   EXPECT_FALSE(queue.wait_and_pop(0, value, std::chrono::milliseconds(10)));
+   std::thread pusher([&queue]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      int pushed = 42;
+      queue.push(pushed, 1);
+   });
+   // lane 1 gets it, lane 0 steals it
+   EXPECT_TRUE(queue.wait_and_pop(0, value, std::chrono::seconds(5)));
+   EXPECT_EQ(42, value);
+   pusher.join();
+}
+
+TEST(WorkStealingQueue, PinToLane) {
+   QAPI::WorkStealingQueue<int> queue(2, 10);
+   EXPECT_FALSE(queue.PinToLane(0));
+   queue.SetAffinity({0});
+   std::thread worker([&queue]() {
+      EXPECT_TRUE(queue.PinToLane(1));
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      ASSERT_EQ(0, pthread_getaffinity_np(pthread_self(), sizeof (cpus), &cpus));
+      EXPECT_TRUE(CPU_ISSET(0, &cpus));
+      EXPECT_EQ(1, CPU_COUNT(&cpus));
+   });
+   worker.join();
+}
+
+// Round robin leaves every expensive job on one lane. Stealing spreads them
+// over the idle workers, a shared mpmc queue does too but all workers
+// contend on its lock.
+TEST(Performance, WorkStealing_SkewedCostTailLatency) {
+   const size_t kJobs = 20000;
+   {
+      QAPI::WorkStealingQueue<Job> lanes(kLanes, kJobs);
+      lanes.SetStealing(false);
+      auto latencies = RunSkewed([&lanes](Job& job) { return lanes.push(job); },
+              [&lanes](size_t worker, Job& job) { return lanes.wait_and_pop(worker, job, std::chrono::milliseconds(1)); }, kJobs);
+      Report("Round robin lanes", latencies);
+   }
+   {
+      mpmc::flexible_lock_queue<Job> shared(kJobs);
+      auto latencies = RunSkewed([&shared](Job& job) { return shared.push(job); },
+              [&shared](size_t, Job& job) { return shared.wait_and_pop(job, std::chrono::milliseconds(1)); }, kJobs);
+      Report("mpmc::flexible_lock_queue", latencies);
+   }
+   {
+      QAPI::WorkStealingQueue<Job> lanes(kLanes, kJobs);
+      auto latencies = RunSkewed([&lanes](Job& job) { return lanes.push(job); },
+              [&lanes](size_t worker, Job& job) { return lanes.wait_and_pop(worker, job, std::chrono::milliseconds(1)); }, kJobs);
+      Report("Work stealing", latencies);
+      std::cout << "Steals: " << lanes.GetSteals() << std::endl;
+   }
+}